@@ -8,6 +8,7 @@
 //#include "codegenasm.hpp"
 #include "stringutil.hpp"
 #include "jitpage.hpp"
+#include "jitprof.hpp"
 #include <iostream>
 #include <iomanip>
 #include <sstream>
@@ -32,11 +33,13 @@ string fname_bin( string const& fname_S ){
 
 size_t asm2bin( string const& fname_S, int const verbose/*=1*/ ){
     if(verbose>1) cout<<" Running asm2bin from " __FILE__<<endl;
+    JitProfScope prof("asm2bin");
     string const fbin = fname_bin( fname_S );
     string mk_cmd("make -f bin.mk " + fbin);
     if(verbose==0) mk_cmd.insert(0,"VERBOSE=0 ");
     if(verbose>1) cout << "cmd: " << mk_cmd << endl;
     int status = system( mk_cmd.c_str() );
+    prof.procs = 1U;
 
     if( status == 0 ){
         if(verbose) cout << "     asm2bin(" << fname_S << ") DONE" << endl;
@@ -58,6 +61,7 @@ size_t asm2bin( string const& fname_S, int const verbose/*=1*/ ){
     }
     if(verbose) cout<<" ftell says "<<f_bin_bytes<<" bytes in file "<<fbin<<endl;
     fclose(f_bin);
+    prof.bytes = (uint64_t)f_bin_bytes;
     return f_bin_bytes;
 }
 
@@ -71,7 +75,11 @@ ExecutablePage::ExecutablePage( std::string const& fbin )
     string basename{fbin.substr(0,len-4)};
 
     JitPage *p = const_cast<JitPage*>(&this->page);
-    bin2jitpage(basename.c_str(), p, verbosity);
+    {
+        JitProfScope prof("bin2jitpage");
+        bin2jitpage(basename.c_str(), p, verbosity);
+        prof.bytes = p->len;
+    }
     if( p->mem == nullptr ){
         throw runtime_error(" Problems getting code page for " + fbin);
     }
@@ -2,6 +2,11 @@
  * This file is part of ve-jit */
 #include "cblock.hpp"
 #include "stringutil.hpp"
+#include <cctype>       // isalnum (bind uses)
+#include <cstring>      // memchr
+#include <cerrno>
+#include <climits>      // IOV_MAX
+#include <unistd.h>
 
 // cblock.hpp can give large compilation times for nc++ inlining... so
 // make this file non-empty to help speed compilation
@@ -18,7 +23,7 @@ std::string ve_pragma_unroll(int64_t const N){
     return ret;
 }
 
-Cblock& Cblock::append(std::string codeline){
+Cblock& Cblock::append(std::string const& codeline){
     if( !codeline.empty() ){
 #if 0 // trial...
         // to technically allow building up a single statement, we only
@@ -31,10 +36,11 @@ Cblock& Cblock::append(std::string codeline){
         }
 #endif
         _code.append(codeline);
+        touched();
     }
     return *this;
 }
-Cblock& Cblock::operator>>(std::string codeline){
+Cblock& Cblock::operator>>(std::string const& codeline){
     return append("\n").append(codeline);
 }
 
@@ -45,6 +51,8 @@ Cblock& Cblock::append(Cblock &cb){
     CBLOCK_DBG(v,10," this@"<<_parent->_name<<"/"<<_name<<" append");
     CBLOCK_DBG(v,10," (cb@"<<cb._name<<")\n");
     cb._parent = this;
+    _root->edited();
+    touched();
 
     auto last_spot = _sub.end();
     if( !_sub.empty() && _sub.back()->getName()=="last")
@@ -96,7 +104,9 @@ Cblock& Cblock::unlink() {
             if(*s == this){
                 CBLOCK_DBG(v,2," YES!");
                 _parent->_sub.erase(s); // all _sub iters (including s) INVALID
+                _parent->touched();
                 _parent = nullptr;
+                _root->edited();
                 CBLOCK_DBG(v,2," _name unlinked"<<std::endl);
                 break;
             }
@@ -104,6 +114,15 @@ Cblock& Cblock::unlink() {
     }
     return *this;
 }
+Cblock& Cblock::before(Cblock& next){
+    if(&next == &_root->root) THROW("Cblock["<<fullpath()<<"].before(root): root has no siblings");
+    if(&next == this) return *this;
+    CBLOCK_DBG(_root->v,2," Cblock["<<fullpath()<<"].before("<<next.fullpath()<<")\n");
+    unlink();
+    Cblock& p = *next._parent;
+    p.insert_sub(std::find(p._sub.begin(), p._sub.end(), &next) - p._sub.begin(), *this);
+    return *this;
+}
 /** find/create subblock.
  * If p is a component (not a path), then
  *   \return subblock with name \c p (create subblock if nec, no throw)
@@ -126,26 +145,29 @@ Cblock& Cblock::operator[](std::string p){
     if( p.substr(0,1) == "*" ) // '*' should never begin a single component name
         THROW("'*' wildcard needs a '/'?  Avoid sub-blocks names like "<<p<<" beginning with '*'");
     // single-component path, possible valid name,
-    for(auto s: _sub) if(s && s->_name==p) return *s;   // found ?
+    Cname const pn = _root->names.intern(p);            // about to be used anyway
+    for(auto s: _sub) if(s && s->_name==pn) return *s;  // found ?
     //                                                  CREATE if not found in _sub[]
     CBLOCK_DBG(_root->v,2,"// new sub-block "<<_name<<"/"<<p<<" "<<_name<<".sub.size()="<<_sub.size()<<"\n");
     //_sub.push_back(new Cblock(this,p));
     //return *_sub.back();
     //  new: special "last" _sub will stay last.
-    return this->append(*new Cblock(this,p));
+    return this->append(_root->newblock(p,this));
 }
 
 Cblock * Cblock::find_immediate_sub(std::string p) const {
     assert( p.find("/") == std::string::npos );
-    if(p.empty()) return nullptr;
-    for(Cblock const* s: _sub) if(s && s->_name==p) return const_cast<Cblock*>(s);
+    Cname pn;
+    if(p.empty() || !_root->names.lookup(p,pn)) return nullptr; // never a block name
+    for(Cblock const* s: _sub) if(s && s->_name==pn) return const_cast<Cblock*>(s);
     return nullptr;
 }
 Cblock * Cblock::find_recurse_sub(std::string p) const {
     assert( p.find("/") == std::string::npos );
-    if(p.empty()) return nullptr;
+    Cname pn;
+    if(p.empty() || !_root->names.lookup(p,pn)) return nullptr;
     for(Cblock const* s: _sub){                          // s is Cblock const*
-        if(s && s->_name==p) return const_cast<Cblock*>(s);
+        if(s && s->_name==pn) return const_cast<Cblock*>(s);
         Cblock *submatch = s->find_recurse_sub(p);
         if(submatch)                            // find first match?
             return const_cast<Cblock*>(submatch);
@@ -178,7 +200,7 @@ Cblock * Cblock::find_recurse_parent(std::string p) const {
  */
 Cblock& mk_extern_c(Cunit& cunit, std::string name){
 #if 0
-    Cblock& block = *(new Cblock(&cunit,name));
+    Cblock& block = cunit.newblock(name);
     block["beg"]<<"\n"
         "#ifdef __cplusplus\n"
         "extern \"C\" {\n"
@@ -200,7 +222,7 @@ Cblock& mk_extern_c(Cunit& cunit, std::string name){
     // want to append a new root block (even if name is dup)
     // This is not so bad, because client can take ref to "this one",
     // or can immediately '.after' it to another tree position.
-    Cblock& block = cunit.root.append(*(new Cblock(&cunit,name)));
+    Cblock& block = cunit.root.append(cunit.newblock(name));
     block["beg"]<<"\n"
         "#ifdef __cplusplus\n"
         "extern \"C\" {\n"
@@ -219,7 +241,7 @@ Cblock& mk_extern_c(Cunit& cunit, std::string name){
  * (Could special-case this within "write" of the _code lines, I guess)
  */
 Cblock& mk_cpp_if(Cunit& cunit, std::string name, std::string cond){
-    Cblock& block = *(new Cblock(&cunit,name));
+    Cblock& block = cunit.newblock(name);
     block["beg"]<<"\n#if "<<cond;
     block["body"]; // empty
     block["end"]<<"#endif // "<<cond;
@@ -227,7 +249,7 @@ Cblock& mk_cpp_if(Cunit& cunit, std::string name, std::string cond){
 }
 /** [beg]~"\#if cond" + [body] + [else]~"\#else" + [end]~"\#endif". */
 Cblock& mk_cpp_ifelse(Cunit& cunit, std::string name, std::string cond){
-    Cblock& block = *(new Cblock(&cunit,name));
+    Cblock& block = cunit.newblock(name);
     block["beg"]<<"\n#if "<<cond;
     block["body"]; // empty
     block["else"]<<"\n#else // !( "<<cond<<"\n";
@@ -248,7 +270,7 @@ Cblock& mk_cpp_ifelse(Cunit& cunit, std::string name, std::string cond){
  * - in 'C' code , \c beg might be "if(cond)" or "else", etc.
  */
 Cblock& mk_scope(Cunit& cunit, std::string name, std::string beg /*=""*/, std::string end /*=""*/){
-    Cblock& block = *(new Cblock(&cunit,name));
+    Cblock& block = cunit.newblock(name);
     if(cunit.flavor!="asm"){
         if(cunit.flavor!="C"){
             std::cout<<" Warning: unknown Cblock flavor \""<<cunit.flavor
@@ -285,10 +307,10 @@ Cblock& mk_scope(Cunit& cunit, std::string name, std::string beg /*=""*/, std::s
  *    b. up 1, then all sub-paths (repeat until full search is done
  * find NEVER creates a block.
  */
-Cblock* Cblock::find(std::string p) const {
+Cblock* Cblock::find_path(std::string const& p) const {
     assert(_root != nullptr);
     int const __attribute__((unused)) v = _root->v;
-    CBLOCK_DBG(v,3,std::string(8,'=')<<" Cblock "<<fullpath()<<" find(\""<<p<<"\")");
+    CBLOCK_DBG(v,3,std::string(8,'=')<<" Cblock "<<fullpath()<<" find_path(\""<<p<<"\")");
     if(p.empty()){
         CBLOCK_DBG(v,3," empty => not found\n");
         return nullptr;
@@ -320,42 +342,56 @@ Cblock* Cblock::find(std::string p) const {
             CBLOCK_DBG(v,3," matches root name\n");
             return &_root->root;
         }
-        CBLOCK_DBG(v,3," root.find(\""<<remain<<"\")\n");
-        return root.find(remain);
+        CBLOCK_DBG(v,3," root.find_path(\""<<remain<<"\")\n");
+        return root.find_path(remain);
     }
     auto comp1 = p.substr(0,firstslash);
     if(remain.empty()){ // terminal [/]\+ not significant
-        return this->find(comp1);
+        return this->find_path(comp1);
     }
     CBLOCK_DBG(v,3,"find@<"<<comp1<<">/<"<<remain<<">\n");
     if( comp1 == "." ){                               // "./remain"
         CBLOCK_DBG(v,3," ./<remain>\n");
-        return this->find(remain);
+        return this->find_path(remain);
     }else if( comp1 == ".." ){                        // "../remain"
         if(_parent /*&& _parent != this*/){ // "/.." is same as root (like FS)
             CBLOCK_DBG(v,3," ../<remain>\n");
-            return _parent->find(remain);
+            return _parent->find_path(remain);
         }else{
             CBLOCK_DBG(v,3," .. no parent\n");
             return nullptr;
         }
     }else if(comp1 == "*" || comp1 == "**"){          // "*/remain"
+        if( comp1 == "**" && remain.find('/') == std::string::npos
+                && remain != "." && remain != ".." ){
+            // "**/name" with a unique name: ask the index, then check ancestry
+            Cblock* only;
+            std::size_t const nnamed = _root->named(remain, only);
+            if(nnamed == 0U) return nullptr;
+            if(nnamed == 1U){
+                for(Cblock const* b = only; b != nullptr; b = b->_parent){
+                    if(b == this) return only;
+                    if(b->isRoot()) break;
+                }
+                return nullptr;
+            }
+        }
         if( comp1 == "**" ){ // ** is allowed to match with this (no subdirs)
-            Cblock * thismatch = this->find(remain);
+            Cblock * thismatch = this->find_path(remain);
             if( thismatch ){
                 CBLOCK_DBG(v,3," ** no-subdir match\n");
                 return thismatch;
             }
         }
         for(Cblock const* s: _sub){
-            Cblock* subfind = s->find(remain);
+            Cblock* subfind = s->find_path(remain);
             if(subfind){                // found 'remain' in s
                 CBLOCK_DBG(v,3," * subfind \n");
                 return subfind;
             }
             if(comp1 == "**"){
                 CBLOCK_DBG(v,3,"\n** subfind ");
-                Cblock* deeper = s->find(p); // repeat "**/remain" search, depthwise
+                Cblock* deeper = s->find_path(p); // repeat "**/remain" search, depthwise
                 if(deeper){
                     CBLOCK_DBG(v,3," ** deeper match\n");
                     return deeper;
@@ -374,7 +410,7 @@ Cblock* Cblock::find(std::string p) const {
             CBLOCK_DBG(v,1," FOUND exact match of parent "<<_parent->_name<<" with remain\n");
             return _parent;
         }
-        Cblock * parentfind = _parent->find(remain);
+        Cblock * parentfind = _parent->find_path(remain);
         if(parentfind){
             CBLOCK_DBG(v,1," FOUND match of parent "<<_parent->_name<<" with remain at "<<parentfind->fullpath()<<"\n");
             return parentfind;
@@ -383,7 +419,7 @@ Cblock* Cblock::find(std::string p) const {
         for(Cblock const* s: _parent->_sub){
             if( s == this ) continue; // search parent sub-tree EXCEPT for this
             CBLOCK_DBG(v,1,"\nssss sibling-find **/"<<remain<<" under sibling "<<s->fullpath()<<"\n");
-            Cblock* sibfind = s->find("**/"+remain);   // force sub-tree search
+            Cblock* sibfind = s->find_path("**/"+remain);   // force sub-tree search
             if(sibfind){
                 CBLOCK_DBG(v,1,"\nssss found "<<remain<<" at "<<sibfind->fullpath()<<"\n");
                 return sibfind;
@@ -391,12 +427,17 @@ Cblock* Cblock::find(std::string p) const {
             CBLOCK_DBG(v,1,"\nssss did not find "<<remain<<"\n");
         }
         // repeat the SAME p="**/remain" search skipping the parent's sub-tree.
-        return _parent->find(p);
+        return _parent->find_path(p);
     }else{                                            // "comp1/remain"
+        Cname c1;
+        if(!_root->names.lookup(comp1,c1)){
+            CBLOCK_DBG(v,3," comp1=<"<<comp1<<"> is no block name\n");
+            return nullptr;
+        }
         for(Cblock const* s: _sub){
-            if(s->_name == comp1){
+            if(s->_name == c1){
                 CBLOCK_DBG(v,3," sub");
-                return s->find(remain);
+                return s->find_path(remain);
             }
         }
         CBLOCK_DBG(v,3," no match for comp1=<"<<comp1<<">\n");
@@ -412,6 +453,43 @@ Cblock* Cblock::find(std::string p) const {
 #endif
     }
 }
+Cblock* Cblock::find(std::string const& p) const {
+    Cunit& u = *_root;
+    if(u.memoEpoch != u.epoch){
+        u.memo.clear();
+        u.memoEpoch = u.epoch;
+    }
+    CfindKey key(this, p);
+    auto const hit = u.memo.find(key);
+    if(hit != u.memo.end()){
+        ++u.nFindHit;
+        return hit->second;
+    }
+    ++u.nFindMiss;
+    Cblock* const ret = find_path(p);
+    u.memo.emplace(std::move(key), ret);
+    return ret;
+}
+Cblock& Cblock::setName(std::string const& name){
+    auto r = _root->byName.equal_range(_name.id());
+    for(auto i = r.first; i != r.second; ++i){
+        if(i->second == this){ _root->byName.erase(i); break; }
+    }
+    _name = _root->names.intern(name);
+    _root->byName.emplace(_name.id(), this);
+    _root->edited();
+    touched();
+    return *this;
+}
+Cblock* Cunit::find(std::string const& path){
+    return root.find(path.empty() || path[0]=='/'? path: "/"+path);
+}
+Cblock* Cunit::find(std::string const& path, Cblock* from){
+    Cblock* ret = (from? from->find(path): nullptr);
+    if(!ret && from) ret = from->up(path);
+    if(!ret) ret = find(path);
+    return ret;
+}
 /** where '#define' for this->define would appear. */
 Cblock& Cblock::goto_defines() const {
     Cblock *a;
@@ -447,6 +525,160 @@ Cblock& Cblock::define_here(std::string name, std::string subst){
     return *this;
 }
 
+Cblock& Cblock::bind(std::string const& name, std::string const& subst){
+    if(name.empty() || name[0]=='(') THROW(" Cblock["<<fullpath()<<"].bind: no macro name");
+    _root->binds.push_back(Cunit::Cbind{name, subst, this});
+    return *this;
+}
+void Cblock::insert_sub(std::size_t const i, Cblock& cb){
+    assert(i <= _sub.size());
+    cb._parent = this;
+    _sub.insert(_sub.begin()+i, &cb);
+    _root->edited();
+    touched();
+}
+
+/** add identifier tokens of \c code to \c toks (skipping numbers and %regs) */
+static void ident_tokens(std::string const& code, std::unordered_set<std::string>& toks){
+    auto const word = [&code](std::size_t i){
+        while(i<code.size() && (std::isalnum((unsigned char)code[i]) || code[i]=='_')) ++i;
+        return i;
+    };
+    for(std::size_t i=0; i<code.size(); ){
+        unsigned char const c = code[i];
+        if(std::isalpha(c) || c=='_'){
+            std::size_t const j = word(i);
+            if(i==0 || code[i-1]!='%') toks.emplace(code, i, j-i);
+            i = j;
+        }else if(std::isdigit(c)){
+            i = word(i);
+        }else ++i;
+    }
+}
+/** Ranges are preorder intervals [beg,end) of the attached tree.  Since a
+ * DEFINE block goes just before the \c first child and the UNDEF just after
+ * the \c last, disjoint intervals mean disjoint \#define..\#undef text. */
+std::size_t Cunit::scope_binds(){
+    if(binds.empty()) return 0U;
+    std::vector<Cblock*> pre;               // attached blocks, preorder
+    std::vector<std::size_t> up, end;       // parent index, subtree end
+    std::unordered_map<Cblock const*, std::size_t> at;
+    {
+        std::vector<std::pair<Cblock*,std::size_t>> stk{{&root,0U}};
+        while(!stk.empty()){
+            auto const b = stk.back();
+            stk.pop_back();
+            at.emplace(b.first, pre.size());
+            pre.push_back(b.first);
+            up.push_back(b.second);
+            for(auto s=b.first->_sub.rbegin(); s!=b.first->_sub.rend(); ++s)
+                stk.emplace_back(*s, pre.size()-1U);
+        }
+        end.resize(pre.size());
+        for(std::size_t i=pre.size(); i-- > 0U; ) end[i] = std::max(end[i], i+1U);
+        for(std::size_t i=pre.size(); i-- > 1U; ) end[up[i]] = std::max(end[up[i]], end[i]);
+    }
+    std::vector<std::unordered_set<std::string>> toks(pre.size());
+    std::vector<char> tokd(pre.size(), 0);  // toks[i] valid?
+
+    struct Place {
+        Cbind const* bd;
+        std::string key;                    // name up to '('
+        Cblock *p, *first, *last;           // define before first, undef after last (subs of p)
+        std::size_t beg, end;               // preorder range
+        std::string reg;                    // subst, or register picked from a pool
+    };
+    std::vector<Place> places;
+    std::vector<Cbind> pending;
+    std::size_t unused = 0U;
+    for(Cbind const& bd: binds){
+        if(!at.count(bd.origin)){ pending.push_back(bd); continue; }   // maybe attached later
+        std::string const key = bd.name.substr(0, bd.name.find('('));
+        std::size_t const s = at.at(&bd.origin->goto_defines());
+        std::size_t lo = pre.size(), hi = 0U;                       // first, last use
+        for(std::size_t i=s; i<end[s]; ++i){
+            std::string const& t = pre[i]->getType();
+            if(t=="DEFINE" || t=="UNDEF") continue;
+            if(!tokd[i]){ ident_tokens(pre[i]->_code, toks[i]); tokd[i] = 1; }
+            if(toks[i].count(key)){ if(lo==pre.size()) lo = i; hi = i; }
+        }
+        if(lo == pre.size()){
+            if(v>=3) std::cout<<" bind "<<bd.name<<" unused in "<<pre[s]->fullpath()<<std::endl;
+            ++unused;
+            continue;
+        }
+        std::size_t lca = lo;
+        while(hi >= end[lca]) lca = up[lca];
+        Place pl{&bd, key, nullptr, nullptr, nullptr, 0U, 0U, bd.subst};
+        if(tokd[lca] && toks[lca].count(key)){                      // lca code uses key
+            if(lca == 0U) THROW(" Cunit "<<name<<": bind("<<bd.name<<") used in root code");
+            pl.p = pre[up[lca]];
+            pl.first = pl.last = pre[lca];
+            pl.beg = lca;
+            pl.end = end[lca];
+        }else{
+            auto const child = [&](std::size_t i){ while(up[i] != lca) i = up[i]; return i; };
+            std::size_t const f = child(lo), l = child(hi);
+            pl.p = pre[lca];
+            pl.first = pre[f];
+            pl.last = pre[l];
+            pl.beg = f;
+            pl.end = end[l];
+        }
+        places.push_back(pl);
+    }
+
+    typedef std::vector<std::pair<std::size_t,std::size_t>> Ranges;
+    auto const overlaps = [](Ranges const& rs, Place const& pl){
+        for(auto const& r: rs) if(r.first < pl.end && pl.beg < r.second) return true;
+        return false;
+    };
+    std::map<std::string, Ranges> byKey, busy;  // busy: register --> ranges
+    for(Place const& pl: places){
+        if(overlaps(byKey[pl.key], pl))
+            THROW(" Cunit "<<name<<": bind("<<pl.bd->name<<") overlaps another "<<pl.key<<" in "<<pl.p->fullpath());
+        byKey[pl.key].emplace_back(pl.beg, pl.end);
+        if(!pl.reg.empty() && pl.reg[0]=='%' && !regpools.count(pl.reg)){ // fixed register
+            if(overlaps(busy[pl.reg], pl))
+                THROW(" Cunit "<<name<<": bind("<<pl.bd->name<<","<<pl.reg<<") overlaps another use of "<<pl.reg);
+            busy[pl.reg].emplace_back(pl.beg, pl.end);
+        }
+    }
+    std::stable_sort(places.begin(), places.end(),
+            [](Place const& a, Place const& b){ return a.beg < b.beg; });
+    for(Place& pl: places){
+        auto const pool = regpools.find(pl.reg);
+        if(pool == regpools.end()) continue;
+        std::string const* r = nullptr;
+        for(std::string const& reg: pool->second)
+            if(!overlaps(busy[reg], pl)){ r = &reg; break; }
+        if(!r) THROW(" Cunit "<<name<<": bind("<<pl.bd->name<<") register pool "<<pl.reg<<" exhausted");
+        busy[*r].emplace_back(pl.beg, pl.end);
+        pl.reg = *r;
+    }
+
+    auto const index = [](Cblock const* p, Cblock const* c){
+        return (std::size_t)(std::find(p->_sub.begin(), p->_sub.end(), c) - p->_sub.begin());
+    };
+    for(Place const& pl: places){
+        if(v>=3) std::cout<<" bind "<<pl.bd->name<<" "<<pl.reg<<" @ "<<pl.first->fullpath()
+            <<(pl.first==pl.last? std::string(): " .. "+pl.last->getName())<<std::endl;
+        Cblock& d = newblock("def_"+pl.key, pl.p);
+        d.setType("DEFINE").set("#define "+pl.bd->name+" "+pl.reg);
+        pl.p->insert_sub(index(pl.p, pl.first), d);
+        Cblock& u = newblock("undef_"+pl.key, pl.p);
+        u.setType("UNDEF").set("#undef "+pl.key);
+        if(pl.last->getName() == "last")            // keep "last" terminal
+            pl.last->insert_sub(pl.last->_sub.size(), u);
+        else
+            pl.p->insert_sub(index(pl.p, pl.last)+1U, u);
+    }
+    binds.swap(pending);
+    nUnused += unused;
+    nBound += places.size();
+    return places.size();
+}
+
 /** debug printout: see the DAG, not the actual code snippets */
 std::ostream& Cblock::dump(std::ostream& os, int const ind/*=0*/)
 {
@@ -463,37 +695,152 @@ std::ostream& Cblock::dump(std::ostream& os, int const ind/*=0*/)
     for(auto s: _sub) s->dump(os,ind+1); // it's easy to generate **very** deep trees
     return os;
 }
-std::ostream& Cblock::write(std::ostream& os, bool chkWrite)
+/** \c prefix_lines as \c Csink segments: \c code lines are referenced
+ * in place, \c prefix must be stable (interned). */
+static void emit_lines(Csink& out, std::string const& code, std::string const& prefix){
+    if( prefix.empty() ){
+        out.ref(code.data(), code.size());
+        return;
+    }
+    char const* const c = code.data();
+    size_t const sz = code.size();
+    size_t nLoc = 0;
+    while(nLoc < sz){
+        char const* const e = static_cast<char const*>(memchr(c+nLoc, '\n', sz-nLoc));
+        size_t const nLocEnd = (e? (size_t)(e-c): sz);
+        size_t nb = nLoc;                                   // first non blank
+        while(nb < nLocEnd && (c[nb]==' ' || c[nb]=='\t' || c[nb]=='\r')) ++nb;
+        if(nb < nLocEnd){                                   // if not a blank line
+            if(c[nb] != '#') out.ref(prefix.data(), prefix.size()); // never indent cpp
+            out.ref(c+nLoc, nLocEnd-nLoc + (e? 1: 0));      // NO newline at end
+        }
+        nLoc = nLocEnd+1;
+    }
+}
+static void emit_manip(Csink& out, CbmanipBase& manip){
+    std::ostringstream oss;                 // usually empty (indent adjust only)
+    oss << manip;
+    std::string const m = oss.str();
+    if(!m.empty()) out.copy(m.data(), m.size());
+}
+void Cblock::emit(Csink& out, bool const chkWrite)
 {
     if(chkWrite && !canWrite()){
         if(_root->v >= 1){
             std::cout<<" SKIP-WRITE! "; std::cout.flush();
         }
-        return os;
+        return;
     }
     std::string& in = _root->indent;
     // very-verbose mode blocks commented with fullpath
-    if(_root->v >= 2){ // TODO add verbose level to show (empty) blocks?
-        if(_code.size()) os<<in<<"//\n";
-        os<<in<<"// Cblock : "<<this->fullpath()<<" : "<<_type;
+    if(_root->v >= 2 || (_code.empty() && _root->v >= _root->emptyTagV)){
+        std::ostringstream os;
+        if(_root->v >= 2 && _code.size()) os<<in<<"//\n";
+        os<<in<<"// "<<_root->blockTag<<" : "<<this->fullpath()<<" : "<<_type;
         if(_code.empty()) os<<" (empty)";
         os<<"\n";
+        std::string const t = os.str();
+        out.copy(t.data(), t.size());
     }
-    if(_premanip) os << *_premanip;
+    if(_premanip) emit_manip(out, *_premanip);
     if(!_code.empty()){
-        //std::cout<<" prefix_lines with code=<"<<_code<<">\n";
-        prefix_lines(os,_code,in) << "\n";
+        emit_lines(out, _code, _root->indents.intern(in).str());
+        out.ref("\n", 1);
+    }
+    if(_root->v >= 3 ){
+        std::string const t = "// _sub.size() = "+std::to_string(_sub.size())+"\n";
+        out.copy(t.data(), t.size());
     }
-    if(_root->v >= 3 ) os<<"// _sub.size() = "<<_sub.size()<<"\n";
     for(auto s: _sub){
-        if(_root->v >= 3 ) os<<in<<"// ........ sub "<<_parent->_name<<"/"<<_name<<"/"<<s->_name<<std::endl;
-        s->write(os,chkWrite);
+        if(_root->v >= 3 ){
+            std::string const t = in+"// ........ sub "+_parent->getName()+"/"+getName()+"/"+s->getName()+"\n";
+            out.copy(t.data(), t.size());
+        }
+        s->emit(out,chkWrite);
     }
-    if(_postmanip) os << *_postmanip;
+    if(_postmanip) emit_manip(out, *_postmanip);
     // if( _next ) _next->write(os);
     if(chkWrite) ++_nwrites;
+}
+std::ostream& Cblock::write(std::ostream& os, bool chkWrite)
+{
+    JitProfScope prof("cblock.write");
+    if(!_root->binds.empty()) _root->scope_binds();
+    CostreamSink out(os);
+    emit(out, chkWrite);
+    prof.bytes = out.bytes();
     return os;
 }
+std::size_t Cblock::write(int const fd, bool const chkWrite)
+{
+    JitProfScope prof("cblock.write");
+    if(!_root->binds.empty()) _root->scope_binds();
+    CfdSink out(fd);
+    emit(out, chkWrite);
+    out.flush();
+    prof.bytes = out.bytes();
+    return out.bytes();
+}
+
+CfdSink::CfdSink(int const fd, std::size_t const bufBytes)
+    : fd(fd), iov(), buf(), nbytes(0U), nwritev(0U)
+{
+    buf.reserve(bufBytes);
+}
+CfdSink::~CfdSink(){
+    try{ flush(); }catch(...){}
+}
+#ifdef IOV_MAX
+static std::size_t const cfdIovMax = IOV_MAX;
+#else
+static std::size_t const cfdIovMax = 1024U;
+#endif
+void CfdSink::ref(char const* p, std::size_t n){
+    if(n == 0U) return;
+    nbytes += n;
+    if(!iov.empty()){                       // coalesce contiguous segments
+        iovec& b = iov.back();
+        if((char const*)b.iov_base + b.iov_len == p){ b.iov_len += n; return; }
+    }
+    if(iov.size() >= cfdIovMax) flush();
+    iov.push_back(iovec{const_cast<char*>(p), n});
+}
+void CfdSink::copy(char const* p, std::size_t n){
+    // flush *before* appending if buf would move or the iov is full:
+    // a flush inside ref() would clear buf under the new segment
+    if(buf.size() + n > buf.capacity() || iov.size() >= cfdIovMax){
+        flush();
+        if(n > buf.capacity()){             // too big to buffer: write it now
+            ref(p,n);
+            flush();
+            return;
+        }
+    }
+    std::size_t const off = buf.size();
+    buf.append(p, n);
+    ref(buf.data()+off, n);
+}
+void CfdSink::flush(){
+    std::size_t i = 0U;
+    while(i < iov.size()){
+        int const cnt = (int)std::min(iov.size()-i, std::size_t{1024});
+        ssize_t w = ::writev(fd, &iov[i], cnt);
+        ++nwritev;
+        if(w < 0){
+            if(errno == EINTR) continue;
+            iov.clear(); buf.clear();
+            THROW("CfdSink: writev(fd="<<fd<<") failed, errno "<<errno);
+        }
+        for(; i < iov.size() && (std::size_t)w >= iov[i].iov_len; ++i)
+            w -= iov[i].iov_len;
+        if(w > 0){                          // partial segment
+            iov[i].iov_base = (char*)iov[i].iov_base + w;
+            iov[i].iov_len -= w;
+        }
+    }
+    iov.clear();
+    buf.clear();                            // keeps capacity
+}
 std::string Cblock::str(){
     std::ostringstream oss;
     _root->indent.clear();
@@ -502,14 +849,227 @@ std::string Cblock::str(){
 }
 Cblock& Cblock::clear(){
     _code="";
-    for(auto s: _sub) delete(s);
-    _sub.clear();
-    _type="";
+    for(auto s: _sub) s->_parent = nullptr;             // detached (for find index)
+    _sub.clear();       // sub-blocks are owned (and later released) by _root->arena
+    _root->edited();
+    touched();
+    _type=Cname();
     if(_premanip){ delete(_premanip); _premanip=nullptr;}
     if(_postmanip){ delete(_postmanip); _postmanip=nullptr;}
     return *this;
 }
 
+
+/** FNV-1a of a length-prefixed field, so ("ab","c") and ("a","bc") differ. */
+static void fnv1a(uint64_t& h, char const* p, size_t const n){
+    uint64_t const prime = 0x100000001b3ULL;
+    for(int i=0; i<8; ++i){ h ^= (uint64_t{n}>>(8*i)) & 0xff; h *= prime; }
+    for(size_t i=0; i<n; ++i){ h ^= (unsigned char)p[i]; h *= prime; }
+}
+static void fnv1a(uint64_t& h, std::string const& s){ fnv1a(h, s.data(), s.size()); }
+static void fnv1a(uint64_t& h, uint64_t const u){
+    char b[8];
+    for(int i=0; i<8; ++i) b[i] = (char)(u>>(8*i));
+    fnv1a(h, b, 8);
+}
+/** manipulators hash by their indent spec (or their output, if not \c Cbin) */
+static void fnv1a(uint64_t& h, CbmanipBase* const m){
+    if(!m){ fnv1a(h, uint64_t{0}); return; }
+    if(Cbin const* const c = dynamic_cast<Cbin const*>(m)){
+        fnv1a(h, uint64_t{1});
+        fnv1a(h, (uint64_t)(int64_t)c->indent_adjust);
+        fnv1a(h, (uint64_t)(unsigned char)c->fill);
+    }else{
+        std::ostringstream oss;
+        oss << *m;
+        fnv1a(h, uint64_t{2});
+        fnv1a(h, oss.str());
+    }
+}
+uint64_t Cblock::hash_own() const {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    fnv1a(h, _name.str());
+    fnv1a(h, _type.str());
+    fnv1a(h, _code);
+    fnv1a(h, _premanip);
+    fnv1a(h, _postmanip);
+    return h;
+}
+uint64_t Cblock::hash() const {
+    if(!_hashed){
+        uint64_t h = hash_own();
+        fnv1a(h, uint64_t{_sub.size()});
+        for(Cblock const* s: _sub) fnv1a(h, s->hash());
+        _hash = h;
+        _hashed = true;
+    }
+    return _hash;
+}
+void Cblock::touched(){
+    // a hashed block has all-hashed sub-blocks, so stop at the first unhashed one
+    for(Cblock* b = this; b != nullptr && b->_hashed; b = (b->isRoot()? nullptr: b->_parent))
+        b->_hashed = false;
+}
+
+char const* name(CblockDiff::Kind const k){
+    switch(k){
+      case CblockDiff::SAME:    return "same";
+      case CblockDiff::CHANGED: return "changed";
+      case CblockDiff::ADDED:   return "added";
+      case CblockDiff::REMOVED: return "removed";
+    }
+    return "?";
+}
+static void cdiff_rec(Cblock const& a, Cblock const& b, std::vector<CblockDiff>& out){
+    if(a.hash() == b.hash()){
+        out.push_back(CblockDiff{CblockDiff::SAME, b.fullpath(), &a, &b});
+        return;
+    }
+    if(a.hash_own() != b.hash_own())
+        out.push_back(CblockDiff{CblockDiff::CHANGED, b.fullpath(), &a, &b});
+    // pair k'th sub named N of a with k'th sub named N of b
+    std::map<Cblock const*, Cblock const*> a2b;
+    std::map<std::string, std::vector<Cblock const*>> bByName;
+    for(Cblock const* s: b.subs()) bByName[s->getName()].push_back(s);
+    std::map<std::string, size_t> seen;
+    for(Cblock const* s: a.subs()){
+        auto const f = bByName.find(s->getName());
+        size_t const k = seen[s->getName()]++;
+        if(f != bByName.end() && k < f->second.size()) a2b[s] = f->second[k];
+    }
+    std::map<Cblock const*, bool> bMatched;
+    for(auto const& m: a2b) bMatched[m.second] = true;
+    for(Cblock const* s: a.subs()){
+        auto const m = a2b.find(s);
+        if(m == a2b.end()) out.push_back(CblockDiff{CblockDiff::REMOVED, s->fullpath(), s, nullptr});
+        else cdiff_rec(*s, *m->second, out);
+    }
+    for(Cblock const* s: b.subs()){
+        if(!bMatched.count(s)) out.push_back(CblockDiff{CblockDiff::ADDED, s->fullpath(), nullptr, s});
+    }
+}
+std::vector<CblockDiff> cdiff(Cblock const& a, Cblock const& b){
+    std::vector<CblockDiff> out;
+    cdiff_rec(a, b, out);
+    return out;
+}
+
+/** literal pieces interleaved with placeholder indices:
+ * lit[0] par[0] lit[1] ... par[n-1] lit[n] */
+struct Ctemplate::Text {
+    std::vector<std::string> lit;
+    std::vector<int> par;
+    std::string str(std::vector<std::string const*> const& val) const {
+        std::size_t n = 0U;
+        for(auto const& l: lit) n += l.size();
+        for(int const p: par) n += val[p]->size();
+        std::string ret;
+        ret.reserve(n);
+        for(std::size_t i=0; i<par.size(); ++i) ret.append(lit[i]).append(*val[par[i]]);
+        return ret.append(lit.back());
+    }
+};
+struct Ctemplate::Node {
+    struct Manip { bool on; int adj; char fill; };  ///< a PreIndent/PostIndent
+    Text name, type, code;
+    Manip pre, post;
+    std::size_t nsub;           ///< direct sub-blocks (following in preorder)
+};
+Ctemplate::Ctemplate(Cblock const& tmpl) : nodes(), pnames(), idents() {
+    snapshot(tmpl);
+}
+Ctemplate::Ctemplate(Cblock const& tmpl, std::vector<std::string> const& idents)
+    : nodes(), pnames(), idents(idents) {
+    snapshot(tmpl);
+}
+Ctemplate::~Ctemplate() {}     // Node is complete here
+int Ctemplate::param(std::string const& name){
+    auto const f = std::find(pnames.begin(), pnames.end(), name);
+    if(f != pnames.end()) return (int)(f - pnames.begin());
+    pnames.push_back(name);
+    return (int)pnames.size() - 1;
+}
+void Ctemplate::tokenize(std::string const& s, Text& t, bool const code){
+    auto const word = [&s](std::size_t e){
+        while(e < s.size() && (isalnum((unsigned char)s[e]) || s[e]=='_')) ++e;
+        return e;
+    };
+    std::size_t lit0 = 0U, at = 0U;
+    t.lit.clear();
+    t.par.clear();
+    while(at < s.size()){
+        if(s.compare(at, 2, "${") == 0){
+            std::size_t const e = word(at + 2U);
+            if(e == at+2U || e >= s.size() || s[e] != '}' || isdigit((unsigned char)s[at+2])){
+                at += 2U;               // not ${NAME}: keep literally
+                continue;
+            }
+            t.lit.push_back(s.substr(lit0, at-lit0));
+            t.par.push_back(param(s.substr(at+2U, e-at-2U)));
+            lit0 = at = e+1U;
+        }else if(isalnum((unsigned char)s[at]) || s[at]=='_'){
+            std::size_t const e = word(at);
+            if(code && !idents.empty() && !isdigit((unsigned char)s[at])
+                    && (at == 0U || (s[at-1] != '.' && s[at-1] != '%'
+                            && !(s[at-1] == '>' && at >= 2U && s[at-2] == '-')))
+                    && std::find(idents.begin(), idents.end(), s.substr(at, e-at)) != idents.end()){
+                t.lit.push_back(s.substr(lit0, at-lit0));
+                t.par.push_back(param(s.substr(at, e-at)));
+                lit0 = e;
+            }
+            at = e;                     // whole word (so never a suffix match)
+        }else{
+            ++at;
+        }
+    }
+    t.lit.push_back(s.substr(lit0));
+}
+void Ctemplate::snapshot(Cblock const& cb){
+    auto const copyManip = [&cb](CbmanipBase* m) -> Node::Manip {
+        if(!m) return Node::Manip{false, 0, ' '};
+        Cbin const* c = dynamic_cast<Cbin const*>(m);
+        if(!c) THROW("Ctemplate: cannot copy non-Cbin manipulator of "<<cb.fullpath());
+        return Node::Manip{true, c->indent_adjust, c->fill};
+    };
+    nodes.push_back(Node());
+    std::size_t const me = nodes.size() - 1U;
+    tokenize(cb.getName(), nodes[me].name);
+    tokenize(cb.getType(), nodes[me].type);
+    tokenize(cb.code_str(), nodes[me].code, true);
+    nodes[me].pre = copyManip(cb._premanip);
+    nodes[me].post = copyManip(cb._postmanip);
+    nodes[me].nsub = cb.subs().size();
+    for(Cblock const* s: cb.subs()) snapshot(*s);
+}
+/** instantiate node \c n under \c parent.  \return next preorder node */
+std::size_t Ctemplate::build(std::size_t const n, Cblock& parent,
+        std::vector<std::string const*> const& val, Cblock*& made) const {
+    Node const& t = nodes[n];
+    std::string const name = t.name.str(val);
+    if(name.find('/') != std::string::npos)
+        THROW("Ctemplate: instantiated block name "<<name<<" contains '/'");
+    Cblock& cb = parent.append(parent.getRoot().newblock(name, &parent));
+    made = &cb;
+    if(!t.type.par.empty() || !t.type.lit.back().empty()) cb.setType(t.type.str(val));
+    cb.append(t.code.str(val));
+    if(t.pre.on) cb<<PreIndent(t.pre.adj, t.pre.fill);
+    if(t.post.on) cb<<PostIndent(t.post.adj, t.post.fill);
+    std::size_t next = n + 1U;
+    Cblock* sub;
+    for(std::size_t i=0; i<t.nsub; ++i) next = build(next, cb, val, sub);
+    return next;
+}
+Cblock& Ctemplate::instantiate(Cblock& parent, Bindings const& bind) const {
+    std::vector<std::string const*> val(pnames.size());
+    for(std::size_t i=0; i<pnames.size(); ++i){
+        auto const f = bind.find(pnames[i]);
+        if(f == bind.end()) THROW("Ctemplate: placeholder ${"<<pnames[i]<<"} not bound");
+        val[i] = &f->second;
+    }
+    Cblock* top = nullptr;
+    build(0U, parent, val, top);
+    return *top;
+}
 }//cprog::
 
 
@@ -1290,7 +1850,265 @@ void test_cblock_kernel(){
     cout<<string(80,'-')<< pr.str() <<string(80,'-')<<endl;
     cout<<string(80,'-')<< pr.tree() <<string(80,'-')<<endl;
 }
+/** many unrolled scopes: all nodes come from the Cunit arena, and the
+ * repeated names ("beg","body","end",...) are interned once. */
+void test_cblock_arena(){
+    Cunit pr("program");
+    pr.v = 0;
+    std::ostringstream oss;
+    auto& fn = mk_func(pr,"fn","int fn(int i)").after(pr.root);
+    int const nUnroll = 2000;
+    for(int u=0; u<nUnroll; ++u){
+        CBLOCK_SCOPE(blk,OSSFMT("if(i>"<<u<<")"),pr,fn);
+        blk>>OSSFMT("i-="<<u<<";");
+    }
+    fn["last"]>>"return i;";
+    size_t const nblk = pr.arena.size();
+    cout<<" arena: "<<nblk<<" Cblocks in "<<pr.arena.bytes()<<" bytes, "
+        <<pr.names.size()<<" interned names"<<endl;
+    CHECK( nblk >= size_t{4*nUnroll} );
+    CHECK( pr.names.size() < 20 );                     // blk,beg,first,body,end,...
+    CHECK( pr.root.find("/fn/blk/body") != nullptr );
+    CHECK( pr.root.find("/fn/no_such_name") == nullptr );
+    CHECK( &fn["blk"] == fn.find("blk") );             // first of the 2000 'blk's
+    // repeated searches are memo hits until the next tree edit
+    Cblock* const b0 = fn.find("**/blk/body");
+    uint64_t const hits = pr.nFindHit;
+    for(int i=0; i<100; ++i) CHECK( fn.find("**/blk/body") == b0 );
+    CHECK( pr.nFindHit == hits + 100 );
+    fn["tail"]>>"// edit";                              // invalidates the memo
+    CHECK( fn.find("**/blk/body") == b0 && pr.nFindHit == hits + 100 );
+    // "**/name" of a unique name is answered by the name index
+    CHECK( pr.root.find("**/tail") == &fn["tail"] );
+    fn["tail"].setName("tail2");
+    CHECK( pr.root.find("**/tail") == nullptr );
+    CHECK( pr.root.find("**/tail2") == fn.find("tail2") );
+    CHECK( pr.find("fn/tail2") == fn.find("tail2") );
+    CHECK( fn["tail2"].find("**/tail2") == &fn["tail2"] );
+    CHECK( pr.root["other"].find("**/tail2") == nullptr ); // not under "other"
+    size_t const nblk2 = pr.arena.size();
+    fn.clear();                                         // nodes stay in arena ...
+    CHECK( pr.arena.size() == nblk2 );
+    CHECK( fn.find("blk") == nullptr );
+    pr.release();                                       // ... until released
+    CHECK( pr.arena.size() == 0 && pr.arena.bytes() == 0 );
+}
+/** Cunit::write(fd) streams the same text as str(), with few writev calls */
+void test_cblock_fd(){
+    Cunit pr("program");
+    pr.v = 0;
+    auto& fn = mk_func(pr,"fn","int fn(int i)").after(pr.root);
+    for(int u=0; u<3000; ++u){
+        std::ostringstream oss;
+        CBLOCK_SCOPE(blk,OSSFMT("if(i>"<<u<<")"),pr,fn);
+        blk>>OSSFMT("i-="<<u<<";\n\n   \n#if 0\nblank lines and cpp\n#endif");
+    }
+    fn["last"]>>"return i;";
+    FILE* tmp = tmpfile();
+    CHECK( tmp != nullptr );
+    size_t const nbytes = pr.write(fileno(tmp));
+    std::string const ref = pr.str();
+    CHECK( nbytes == ref.size() );
+    std::string got(nbytes, '\0');
+    rewind(tmp);
+    size_t const got_n = fread(&got[0], 1, nbytes, tmp);
+    fclose(tmp);
+    CHECK( got_n == nbytes );
+    CHECK( got == ref );
+    {   // more than IOV_MAX segments, copies interleaved with refs
+        static char const refs[] = "0123456789abcdefghijklmnopqrstuvwxyz";
+        std::string expect;
+        FILE* t2 = tmpfile();
+        CHECK( t2 != nullptr );
+        {
+            CfdSink s(fileno(t2), 4096U);
+            for(int c=0; c<3000; ++c){
+                std::string const cp = "<"+std::to_string(c)+">";
+                s.copy(cp.data(), cp.size());
+                expect += cp;
+                s.ref(&refs[c%36], 1U);             // never contiguous with buf
+                expect += refs[c%36];
+            }
+            s.flush();
+            CHECK( s.bytes() == expect.size() );
+        }
+        std::string got2(expect.size(), '\0');
+        rewind(t2);
+        size_t const got2_n = fread(&got2[0], 1, got2.size(), t2);
+        fclose(t2);
+        CHECK( got2_n == got2.size() );
+        CHECK( got2 == expect );
+    }
+    {   // verbose Cunit (v>=2) writes comment copies through the buffer
+        Cunit pv("verbose");
+        pv.v = 2;
+        auto& fv = mk_func(pv,"fv","int fv(int i)").after(pv.root);
+        for(int u=0; u<1500; ++u){
+            std::ostringstream oss;
+            CBLOCK_SCOPE(blk,OSSFMT("if(i>"<<u<<")"),pv,fv);
+            blk>>OSSFMT("i-="<<u<<";");
+        }
+        FILE* t3 = tmpfile();
+        CHECK( t3 != nullptr );
+        size_t const nv = pv.write(fileno(t3));
+        std::string const refv = pv.str();
+        CHECK( nv == refv.size() );
+        std::string gotv(nv, '\0');
+        rewind(t3);
+        size_t const gotv_n = fread(&gotv[0], 1, nv, t3);
+        fclose(t3);
+        CHECK( gotv_n == nv );
+        CHECK( gotv == refv );
+    }
+    CfdSink sink(-1);                   // bad fd: error surfaces at flush
+    sink.ref("x",1);
+    MUST_THROW(sink.flush());
+    cout<<" write(fd): "<<nbytes<<" bytes OK"<<endl;
+}
+/** parameter sweep: only the kernel body differs between variants */
+static void gen_variant(Cunit& pr, int const unroll, bool const extra){
+    std::ostringstream oss;
+    pr["includes"]>>"#include <stdint.h>";
+    pr["macros"]>>"#define MIN(a,b) ((a)<(b)?(a):(b))";
+    auto& fn = mk_func(pr,"kern","void kern(int64_t* a, int64_t n)").after(pr.root);
+    fn["prologue"]>>"int64_t i=0;";
+    CBLOCK_SCOPE(loop,OSSFMT(UNROLL(unroll)"for(; i<n; ++i)"),pr,fn);
+    loop>>"a[i] += i;";
+    if(extra) fn["epilogue"]>>"a[0] = 0;";
+}
+void test_cblock_diff(){
+    Cunit a("program"), b("program"), c("program");
+    a.v = b.v = c.v = 0;
+    gen_variant(a, 4, false);
+    gen_variant(b, 4, false);
+    gen_variant(c, 8, true);
+    CHECK( a.root.hash() == b.root.hash() );
+    CHECK( a.root.hash() != c.root.hash() );
+    auto const same = cdiff(a,b);
+    CHECK( same.size() == 1 && same[0].kind == CblockDiff::SAME );
+    auto const d = cdiff(a,c);
+    int nsame=0, nchanged=0, nadded=0;
+    for(auto const& e: d){
+        cout<<"   "<<name(e.kind)<<" "<<e.path<<endl;
+        nsame += e.kind==CblockDiff::SAME;
+        nchanged += e.kind==CblockDiff::CHANGED;
+        nadded += e.kind==CblockDiff::ADDED;
+        if(e.kind==CblockDiff::CHANGED && e.path != "/kern/loop/beg") THROW("changed path "<<e.path);
+    }
+    CHECK( nchanged == 1 && nadded == 1 && nsame >= 3 );
+    CHECK( a.find("includes")->hash() == c.find("includes")->hash() );
+    // edits drop cached hashes up to the root
+    uint64_t const h0 = a.root.hash();
+    b.root.at("**/loop/body") << Endl;
+    CHECK( b.root.hash() != h0 );
+    a.root.at("**/loop/body") << Endl;
+    CHECK( a.root.hash() == b.root.hash() );
+    a["macros"].setType("TAG");
+    CHECK( a.root.hash() != b.root.hash() );
+}
+/** Ctemplate instances match the directly generated subtrees */
+void test_cblock_template(){
+    std::ostringstream oss;
+    Cunit scratch("scratch");
+    scratch.v = 0;
+    auto& t = mk_scope(scratch,"blk_${ii}_${jj}","for(int64_t i=0; i<${ii}; i+=${vl})");
+    t["body"]>>"a[i] += ${jj}; // ${not a placeholder} $x ${}";
+    t["body"]["last"]>>"tot += ${ii}*${jj};";
+    t.setType("ii=${ii}");
+    Ctemplate const tmpl(t);
+    CHECK( tmpl.params().size() == 3 );
+    scratch.release();                                  // template is a snapshot
+
+    Cunit direct("program"), templ("program");
+    direct.v = templ.v = 0;
+    auto& fd = mk_func(direct,"fn","void fn(int64_t* a)").after(direct.root);
+    auto& ft = mk_func(templ ,"fn","void fn(int64_t* a)").after(templ.root);
+    int ninst = 0;
+    for(int ii=1; ii<=40; ii+=3) for(int jj=0; jj<3; ++jj, ++ninst){
+        int const vl = (ii%2? 1: 2);
+        auto& d = mk_scope(direct,OSSFMT("blk_"<<ii<<"_"<<jj),
+                OSSFMT("for(int64_t i=0; i<"<<ii<<"; i+="<<vl<<")")).after(fd);
+        d["body"]>>OSSFMT("a[i] += "<<jj<<"; // ${not a placeholder} $x ${}");
+        d["body"]["last"]>>OSSFMT("tot += "<<ii<<"*"<<jj<<";");
+        d.setType(OSSFMT("ii="<<ii));
+        Cblock& b = tmpl.instantiate(ft, {{"ii",jitdec(ii)},{"jj",jitdec(jj)},{"vl",jitdec(vl)}});
+        CHECK( b.getName() == d.getName() );
+    }
+    CHECK( direct.str() == templ.str() );
+    CHECK( direct.root.hash() == templ.root.hash() );
+    MUST_THROW(tmpl.instantiate(ft, {{"ii","1"}}));     // ${jj} unbound
+    cout<<" Ctemplate: "<<ninst<<" instances OK"<<endl;
+}
+/** Cblock::bind places defines/undefs tightly, reusing pool registers */
+void test_cblock_bind(){
+    {   // asm: two kernel phases, 5 values in a 3-register pool
+        Cunit pr("kernel","asm");
+        pr.v = 0;
+        pr.regpools["%v"] = {"%v0","%v1","%v2"};
+        auto& k = pr.root["kernel"];
+        auto& p1 = k["phase1"];
+        p1["lda"]<<"vld VA,8,%s0";
+        p1["ldb"]<<"vld VB,8,%s1";
+        p1["add"]<<"vaddu.l VC,VA,VB";
+        p1["st"]<<"vst VC,8,%s2";
+        p1.bind("VA","%v").bind("VB","%v").bind("VC","%v");
+        auto& p2 = k["phase2"];
+        p2["ld"]<<"vld VD,8,%s2";
+        p2["mul"]<<"vmulu.l VE,VD,VD";
+        p2["st"]<<"vst VE,8,%s3";
+        p2["st"].bind("VD","%v").bind("VE","%v").bind("VZ","%v");
+        k["ret"]<<"b.l (,%lr)";
+        std::string const code = pr.str();
+        //cout<<code<<endl;
+        CHECK( pr.nBound == 5U && pr.nUnused == 1U && pr.binds.empty() );
+        CHECK( code.find("#define VA %v0\nvld VA") != string::npos );
+        CHECK( code.find("#define VC %v2\nvaddu.l") != string::npos );
+        CHECK( code.find("vaddu.l VC,VA,VB\n#undef VB\n#undef VA") != string::npos );
+        CHECK( code.find("#define VD %v0") != string::npos );  // reused after phase1
+        CHECK( code.find("#define VE %v1") != string::npos );
+        CHECK( code.find("#undef VC") < code.find("#define VD") );
+        CHECK( code.find("VZ") == string::npos );
+        CHECK( code.find("#undef VE\nb.l") != string::npos );
+        CHECK( pr.str() == code );                 // placed once
+    }
+    {   // C: nested loops, binds hug their uses (cf. define, which hoists)
+        Cunit pr("program");
+        pr.v = 0;
+        auto& fn = mk_func(pr,"fn","void fn(int64_t* a)").after(pr.root);
+        auto& li = mk_scope(pr,"loop_i","for(int64_t i=0; i<N; ++i)").after(fn["body"]);
+        auto& lj = mk_scope(pr,"loop_j","for(int64_t j=0; j<M; ++j)").after(li["body"]);
+        lj["body"]>>"a[i*M+j] = SCALE(j);";
+        lj["body"].bind("SCALE(x)","((2*i+1)*(x))");
+        fn["body"].bind("M","16").bind("N","4");
+        std::string const code = pr.str();
+        CHECK( pr.nBound == 3U );
+        auto const at = [&code](char const* s){ auto p = code.find(s); if(p==string::npos) THROW("missing "<<s); return p; };
+        CHECK( at("#define SCALE(x) ((2*i+1)*(x))") > at("for(int64_t j=0") );
+        CHECK( at("#undef SCALE") < at("#undef M") );
+        CHECK( at("#define M 16") > at("for(int64_t i=0") );  // M only used by loop_j
+        CHECK( at("#define N 4") < at("for(int64_t i=0") );
+        CHECK( at("#undef N") < at("#define M") );         // N only used by the loop_i header
+    }
+    {   // fixed registers with overlapping ranges
+        Cunit pr("bad","asm");
+        pr.v = 0;
+        auto& b = pr.root["body"];
+        b["x"]<<"or X,0,%s0";
+        b["y"]<<"or Y,X,(1)0";
+        b.bind("X","%s40").bind("Y","%s40");
+        MUST_THROW(pr.str());
+        pr.binds.back().subst = "%s41";
+        pr.str();
+        CHECK( pr.nBound == 2U );
+    }
+    cout<<" Cblock::bind OK"<<endl;
+}
 int main(int,char**){
+    test_cblock_bind();
+    test_cblock_template();
+    test_cblock_diff();
+    test_cblock_fd();
+    test_cblock_arena();
     test_cblock_basic();
     test_cblock_path();
     test_cblock_short();
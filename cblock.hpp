@@ -4,6 +4,7 @@
  * This file is part of ve-jit */
 #include "throw.hpp"
 #include "stringutil.hpp"   // OSSFMT
+#include "jitprof.hpp"      // JitProf (newblock count, write timing)
 /** \file
  * Arange statements (std::string) into blocks.
  *
@@ -40,9 +41,13 @@
 #include <vector>
 #include <map>
 #include <deque>
+#include <unordered_set>
+#include <unordered_map>
+#include <new>          // placement new (CblockArena)
 #include <cassert>
 #include <sstream>
 #include <algorithm>    // std::max
+#include <sys/uio.h>    // iovec (CfdSink)
 
 // CBLOCK_DBG disabled (things running OK now)
 #if 1 || defined(NDEBUG)
@@ -107,22 +112,106 @@ inline std::ostream& operator<<(std::ostream& os, CbmanipBase & cbmanip){
 }
 //@}
 
+/** \group Cblock emission targets
+ * \c Cblock::emit walks the tree once and hands out \e segments:
+ * - \c ref for bytes that stay put until the next \c flush
+ *   (Cblock \c _code, interned indents, literals), and
+ * - \c copy for short-lived text (verbose comments, manipulator output).
+ */
+//@{
+struct Csink {
+    virtual ~Csink() {}
+    virtual void ref(char const* p, std::size_t n) = 0;
+    virtual void copy(char const* p, std::size_t n) { ref(p,n); }
+    virtual void flush() {}
+};
+/** \c Csink onto a \c std::ostream (what \c Cblock::write(ostream&) uses) */
+struct CostreamSink : public Csink {
+    explicit CostreamSink(std::ostream& os) : os(os), nbytes(0U) {}
+    void ref(char const* p, std::size_t n) override { os.write(p, n); nbytes += n; }
+    std::size_t bytes() const {return nbytes;}
+    std::ostream& os;
+    std::size_t nbytes;
+};
+/** \c Csink onto a file descriptor (file, pipe to a compiler, memfd, ...),
+ * using \c writev of up to \c IOV_MAX segments that point straight into the
+ * Cblock tree.  \c copy segments go through a fixed-capacity buffer.
+ * \throw on write errors (from \c flush). */
+class CfdSink : public Csink {
+  public:
+    explicit CfdSink(int const fd, std::size_t const bufBytes=65536U);
+    ~CfdSink();                             ///< best-effort \c flush
+    void ref(char const* p, std::size_t n) override;
+    void copy(char const* p, std::size_t n) override;
+    void flush() override;
+    std::size_t bytes() const {return nbytes;}      ///< total (incl. pending)
+    std::size_t writes() const {return nwritev;}    ///< \c writev calls so far
+  private:
+    int const fd;
+    std::vector<iovec> iov;
+    std::string buf;                        ///< never reallocated between flushes
+    std::size_t nbytes;
+    std::size_t nwritev;
+};
+//@}
+
+/** Interned Cblock name or type string.
+ * Equal strings share one \c std::string in \c Cunit::names, so a \c Cname
+ * is one pointer, and \c Cname==Cname is a pointer compare. */
+class Cname {
+  public:
+    Cname() : p(&none()) {}
+    std::string const& str() const {return *p;}
+    operator std::string const&() const {return *p;}
+    char const* c_str() const {return p->c_str();}
+    std::size_t size() const {return p->size();}
+    bool empty() const {return p->empty();}
+    std::string const* id() const {return p;}      ///< unique per distinct string
+    bool operator==(Cname const& o) const {return p==o.p;}
+    bool operator!=(Cname const& o) const {return p!=o.p;}
+  private:
+    friend class Cnames;
+    explicit Cname(std::string const* p) : p(p) {}
+    static std::string const& none(){ static std::string const e; return e; }
+    std::string const* p;
+};
+inline bool operator==(Cname const& a, std::string const& b){ return a.str()==b; }
+inline bool operator==(std::string const& a, Cname const& b){ return a==b.str(); }
+inline bool operator!=(Cname const& a, std::string const& b){ return a.str()!=b; }
+inline std::ostream& operator<<(std::ostream& os, Cname const& n){ return os<<n.str(); }
+
+/** Cunit-wide intern table for Cblock names and types.
+ * Strings are never removed, so \c Cname pointers stay valid for the
+ * lifetime of the \c Cunit. */
+class Cnames {
+  public:
+    Cname intern(std::string const& s){
+        if(s.empty()) return Cname();
+        return Cname(&*tab.insert(s).first);
+    }
+    /** \c intern without inserting. \return false if \c s was never interned,
+     * so no Cblock can be named \c s (used to short-circuit searches). */
+    bool lookup(std::string const& s, Cname& n) const {
+        if(s.empty()){ n = Cname(); return true; }
+        auto const it = tab.find(s);
+        if(it == tab.end()) return false;
+        n = Cname(&*it);
+        return true;
+    }
+    std::size_t size() const {return tab.size();}
+  private:
+    std::unordered_set<std::string> tab;
+};
+
 //template<class T> struct endl {;}; // Nope. confusion with std::endl
 class Cblock {
   public:
-    /// Empty Cblock constructor (placeholder)
-    Cblock(Cunit *root, std::string name="root")
-        : _root(root), _parent(this), _name(name), _type(""),
-        // _parent==this means we are _root
-        _premanip(nullptr), _code(""), _sub(), _postmanip(nullptr),
-        _nwrites(0), _maxwrites(1)
-        {}
+    /** Empty Cblock constructor (placeholder).
+     * \note Blocks other than \c Cunit::root are normally made by
+     * \c Cunit::newblock, so they live in (and die with) the Cunit arena. */
+    Cblock(Cunit *root, std::string const& name="root");
     /// Sub-block constructor
-    Cblock(Cblock *parent, std::string name="")
-        : _root(parent->_root), _parent(parent), _name(name), _type(""),
-        _premanip(nullptr), _code(""), _sub(), _postmanip(nullptr),
-        _nwrites(0), _maxwrites(1)
-        {}
+    Cblock(Cblock *parent, std::string const& name="");
 
     /** Find \c p in \c sub -Cblocks, or appending a new Cblock to \c _sub
      * when \c p is a single <em>path component</em> \c p;
@@ -140,13 +229,13 @@ class Cblock {
      */
     Cblock& operator[](std::string p);
     /** shift-left operator appends codeline \e as-is. */
-    Cblock& operator<<(std::string codeline) { return append(codeline); }
+    Cblock& operator<<(std::string const& codeline) { return append(codeline); }
     /** prepends a newline, then adds codeline (same precedence as <<). */
-    Cblock& operator>>(std::string codeline); // { return append("\n").append(codeline); }
+    Cblock& operator>>(std::string const& codeline); // { return append("\n").append(codeline); }
     /** \c codeline append to \c _code (\c Cblock appends to \c _sub).
      * Mostly append as-is, \em except if last line of code has a ';' in it,
      * we add a newline (tweak for C-code readability). */
-    Cblock& append(std::string codeline);
+    Cblock& append(std::string const& codeline);
     /** Sub-block \c cb appends to \c _sub, except if the terminal \c sub
      * block is named "last", where \c cb is inserted just-before-last. */
     Cblock& append(Cblock &cb);
@@ -169,12 +258,16 @@ class Cblock {
         assert( abspath[0] == '/' );
         return after(at(abspath));
     }
+    /** unlink \c this and insert it as the sibling just before \c next
+     * (ex. to move a late-created block to the front of root).
+     * \throw if \c next is the root.
+     * \return \c *this */
+    Cblock& before(Cblock& next);
 
-#if 0
     /// \group define/undef scoping
-    /**
-     * WIP: both asm and C need #defines. Reimplement AsmFmtCols 'scope'
-     *      concept within Cblock [more powerfully].
+    /** Deferred \c \#define \c name \c subst, placed by \c Cunit::scope_binds
+     * (just before the tree is written) at the \b tightest scope covering
+     * every use of \c name.
      *
      *   Cblock                         | AsmFmtCols
      *   ======================================================================
@@ -184,57 +277,35 @@ class Cblock {
      *   program is a tree              | AsmFmtCols snippets stitched together
      *                                  | "by hand" to situate undef outputs
      *   ----------------------------------------------------------------------
-     *   lines input as strings         | line input helper functions, that
-     *                                  | encapsulate simple assembly
-     *                                  | optimizations
-     *   ----------------------------------------------------------------------
-     *   verbatim line output,          | columnar asm output
-     *   (apart from indent)            | with scope indent typically zero
-     *   -----------------------------------------------------------------------
+     *
+     * \c bind removes the "by hand" part:
+     * - uses are identifier tokens \c name (text before any '(') in the
+     *   \c _code of blocks under \c goto_defines() (DEFINE/UNDEF blocks ignored),
+     * - with one using block, the \#define goes just before it, the \#undef just after;
+     *   o/w both go among the sub-blocks of the lowest common ancestor of the uses,
+     *   around the children holding the first and last use,
+     * - bindings without uses are dropped (\c Cunit::nUnused).
+     *
+     * If \c subst names a \c Cunit::regpools entry (ex. "%v"), a register
+     * from that pool is picked so that bindings with non-overlapping
+     * \#define..\#undef ranges share registers (for asm kernel phases, or
+     * unrolled loop copies).  Other \c subst beginning with '%' are fixed
+     * registers, and block pool use over their range.
+     *
+     * \c define and \c define_here still emit immediately, at their fixed spots.
+     * \return *this
      */
-  private:
-    /** Each scope could have a vector of macro --> substitution strings.
-     * For cpp+assembler output, this is quite important, as macros are
-     * used (abused) to handle register assignments.  As such, every
-     * macro has a corresponding \#undef.  We can package a bunch of
-     * macro emissions together in \c StringPairs. */
-    struct StringPairs
-        : public std::vector<std::pair<std::string,std::string>>
-    {
-        /// Convenient \c push_back trimmed versions of \c name and \c subst.
-        void push_trimmed(std::string name, std::string subst);
-    };
-    struct Defines : public StringPairs {
-        /** In the final tree, an \c un_path (absolute/relative) must also
-         * be "forward" of \c this Cblock.  Hmmm, a new type of relative
-         * search could enforce this.
-         *
-         * - asm
-         *   - define/undef scoping critical for register tracking
-         *   - default un_path is "." for assembly (too local?) */
-         * - C:
-         *   - defines/macros often non-local convenience items.
-         *   - default un_path is "" (C usually lazy about undefs) */
-         */
-        std::string const un_path;
-        Defines() : {}
-        /** undef bindings are late, to allow one to specify un_path that
-         * has not yet been created.  A final pass to walk the tree, locate
-         * undef Cblocks, and emit the undefs happens as a write() starts
-         * up.  Un-emittable \c un_path is a serious error for root write().
-        */
-        std::string last_un_path;
-    };
-    std::vector<StringPairs> stack_defs;
-    /** Convert \c StringPairs macros into multiline \#undefs string. */
-    std::string defs2undefs( StringPairs const& macs, std::string block_name );
-  public:
-#endif
+    Cblock& bind(std::string const& name, std::string const& subst);
 
     int nWrites() const {return _nwrites;}
     /** Note: write has a strange behaviour of emptying the string.
      * <B>Subject to change</B> \deprecated */
     std::ostream& write(std::ostream& os, bool const chkWrite=true);
+    /** \c write the subtree to file descriptor \c fd in one pass, without
+     * building the program text (see \c CfdSink).  \return bytes written. */
+    std::size_t write(int const fd, bool const chkWrite=true);
+    /** one-pass emission core of \c write (and \c str) */
+    void emit(Csink& out, bool const chkWrite=true);
     /** Maybe for unrolling we have a max number of writes ? \deprecated */
     bool canWrite() { return _nwrites>=0 && _nwrites<_maxwrites; }
     /** depth-first tree dump */
@@ -244,20 +315,29 @@ class Cblock {
     /** return immediate code string, no subblocks, ex for empty check */
     std::string const& code_str() const {return this->_code;}
 
-    /** reset code, subblocks and pre-/post-manipulators */
+    /** reset code, subblocks and pre-/post-manipulators.
+     * Dropped sub-blocks stay in the \c Cunit arena until the Cunit dies. */
     Cblock& clear();
     /** swap all `_code` for something new */
-    Cblock& set(std::string s) {_code=s; return *this;}
-    Cblock& setName(std::string type); ///< `{this->type=type; return *this;}` and update root!
-    Cblock& setType(std::string type) {_type=type; return *this;}
+    Cblock& set(std::string s) {_code=s; touched(); return *this;}
+    Cblock& setName(std::string const& name); ///< rename, updating the \c Cunit name index
+    Cblock& setType(std::string const& type); ///< interned in \c Cunit::names
     std::string const& getName() const;
     std::string const& getType() const;
     Cunit& getRoot() const;
     //Cblock& append(std::string code) {this->code += code; return *this;} // maybe inefficient
     //Cblock* next();
     //Cblock* prev()
-    ~Cblock(){ clear(); }
+    /** sub-blocks are owned by the \c Cunit arena, not by their parent */
+    ~Cblock(){ delete _premanip; delete _postmanip; }
     bool isRoot() const { return _parent == this; }
+    /** content hash of this subtree (name, type, code, manipulators and
+     * sub-block hashes, in order).  Computed lazily and cached; any edit
+     * drops the cached hashes of the block and its ancestors.
+     * Equal hashes mean (up to FNV-1a collisions) identical output text. */
+    uint64_t hash() const;
+    uint64_t hash_own() const;      ///< \c hash() ignoring sub-blocks
+    std::vector<Cblock*> const& subs() const {return _sub;}  ///< sub-blocks, in output order
     /// \group path functions
     //@{
     std::string fullpath() const;
@@ -270,8 +350,10 @@ class Cblock {
      * - '..*' \em strange recursive upward parent+subtree search excluding sub-tree of \c this
      *   - also called \c up since this is not a common path convention.
      * \return nullptr if not found.
+     * \note results are memoized in \c Cunit::memo until the next tree edit
+     *       (append, unlink, clear, setName).
      */
-    Cblock *find(std::string path) const;
+    Cblock *find(std::string const& path) const;
     /** utility for dot-dot-star wildcard, <em>find-in-upwards-subtrees</em>,
      * a Cblock match \em close to \c this, but \b not underneath \c this.
      * Note: could have taken ..* to mean "match anywhere on path to root" to root,
@@ -340,6 +422,7 @@ class Cblock {
   private:
     /** find first \b single-component path \c p for simple search strategy.
      * return nullptr if not found. */
+    Cblock * find_path(std::string const& p) const;   ///< uncached \c find
     Cblock * find_immediate_sub(std::string p) const;
     Cblock * find_recurse_sub(std::string p) const;
     Cblock * find_recurse_parent(std::string p) const;
@@ -351,19 +434,26 @@ class Cblock {
      * \post \c _parent==nullptr
      */
     Cblock& unlink();
+    /** drop cached \c hash() of \c this and its ancestors */
+    void touched();
+    /** link \c cb as \c _sub[i] (no "last" adjustment) */
+    void insert_sub(std::size_t const i, Cblock& cb);
   private:
     friend struct CbmanipBase;
+    friend class Ctemplate;
     struct Cunit * const _root;
     class Cblock * _parent;
   private:
-    std::string _name;              ///< terminal \e path component (from root)
-    std::string _type;              ///< store /e notes (flags,state)
+    Cname _name;                    ///< terminal \e path component (from root)
+    Cname _type;                    ///< store /e notes (flags,state)
     CbmanipBase* _premanip;         ///< TODO support multiple?
     std::string _code;
     std::vector<Cblock*> _sub;      ///< name /e last => \e always-last semantics
     CbmanipBase* _postmanip;        ///< TODO support multiple?
     int _nwrites;   // counter
     int _maxwrites; // limit for _nwrites
+    mutable uint64_t _hash;         ///< \c hash() cache, valid if \c _hashed
+    mutable bool _hashed;           ///< if set, so is \c _hashed of every sub-block
     friend Cblock& operator<<(Cblock& cb, PostIndent const& postIndent);
     friend Cblock& operator<<(Cblock& cb, PreIndent const& preIndent);
     //friend Cblock& operator<<(Cblock& cb, Endl<Cblock> const&);
@@ -371,32 +461,171 @@ class Cblock {
 };
 template<> inline Cblock& Endl<Cblock>(Cblock& cblock){
     cblock._code.append("\n"); // since frequent, cut out some intermediate functions
+    cblock.touched();
     return cblock;
 }
 
+/** Chunked arena owning all non-root Cblocks of a Cunit.
+ * Allocation is a placement-new into the current chunk; \c release() runs
+ * the (shallow) destructors in one linear pass and frees the chunks, instead
+ * of a recursive \c delete of every node. */
+class CblockArena {
+  public:
+    explicit CblockArena(std::size_t const perChunk=256)
+        : chunks(), per(perChunk? perChunk: 1), nlast(perChunk? perChunk: 1), n(0) {}
+    CblockArena(CblockArena const&) = delete;
+    CblockArena& operator=(CblockArena const&) = delete;
+    ~CblockArena() { release(); }
+    template<typename... Args> Cblock* make(Args&&... args){
+        if(nlast == per){
+            chunks.push_back(static_cast<Cblock*>(::operator new(per*sizeof(Cblock))));
+            nlast = 0;
+        }
+        Cblock* const cb = new(chunks.back() + nlast) Cblock(std::forward<Args>(args)...);
+        ++nlast; ++n;       // after construction, in case it throws
+        return cb;
+    }
+    void release(){
+        for(std::size_t c=0; c<chunks.size(); ++c){
+            std::size_t const nc = (c+1==chunks.size()? nlast: per);
+            for(std::size_t i=0; i<nc; ++i) chunks[c][i].~Cblock();
+            ::operator delete(chunks[c]);
+        }
+        chunks.clear();
+        nlast = per;
+        n = 0;
+    }
+    std::size_t size() const {return n;}                    ///< Cblocks allocated
+    std::size_t bytes() const {return chunks.size()*per*sizeof(Cblock);}
+  private:
+    std::vector<Cblock*> chunks;
+    std::size_t per;        ///< Cblocks per chunk
+    std::size_t nlast;      ///< used in chunks.back()
+    std::size_t n;
+};
+
+/** \c Cunit::memo key, {search origin, path} */
+typedef std::pair<Cblock const*, std::string> CfindKey;
+struct CfindKeyHash {
+    std::size_t operator()(CfindKey const& k) const {
+        return std::hash<std::string>()(k.second) ^ (std::hash<void const*>()(k.first) * 31U);
+    }
+};
+
 struct Cunit {
     std::string name;       ///< maybe Cunit subtrees might be copied for unrolling ??
+    Cnames names;           ///< interned Cblock names and types (outlives \c arena)
+    CblockArena arena;      ///< owns every Cblock except \c root
+    /** \group Cblock::find acceleration */
+    //@{
+    /** every Cblock ever made (attached or not), keyed by \c Cname::id() */
+    std::unordered_multimap<std::string const*, Cblock*> byName;
+    std::unordered_map<CfindKey, Cblock*, CfindKeyHash> memo;  ///< valid for \c memoEpoch
+    uint64_t epoch;         ///< bumped by every tree edit
+    uint64_t memoEpoch;     ///< \c epoch when \c memo was last valid
+    uint64_t nFindHit;      ///< memo hits
+    uint64_t nFindMiss;     ///< memo misses (full \c find_path searches)
+    void edited() {++epoch;}                        ///< invalidate \c memo
+    /** number of Cblocks named \c p (attached or not), and \c only if exactly one */
+    std::size_t named(std::string const& p, Cblock*& only) const;
+    //@}
     Cblock root;
     int v; // verbosity
     std::string indent;                             ///< internal Cblock::write context
+    Cnames indents;                                 ///< indents seen by \c Cblock::emit (stable for \c Csink::ref)
     std::string const flavor;                       ///< [WIP] "C" or "asm"
     int shiftwidth;
+    /** \group write header policy (\c asmprog::Asmunit keeps the old Asmblock format) */
+    //@{
+    std::string blockTag;                           ///< header is "// <blockTag> : <fullpath> : <type>"
+    int emptyTagV;                                  ///< verbosity to write headers of empty blocks (others need v>=2)
+    //@}
+    /** \group deferred \#define bindings (see \c Cblock::bind) */
+    //@{
+    struct Cbind {
+        std::string name;                           ///< macro name, maybe "name(args)"
+        std::string subst;                          ///< substitution, or a \c regpools key
+        Cblock* origin;                             ///< \c bind caller
+    };
+    std::vector<Cbind> binds;                       ///< not yet placed
+    /** register pools for \c bind, ex. regpools["%v"] = {"%v0",...,"%v7"} */
+    std::map<std::string, std::vector<std::string>> regpools;
+    std::size_t nBound;                             ///< bindings placed so far
+    std::size_t nUnused;                            ///< bindings dropped for lack of uses
+    /** place pending \c binds whose origin is attached to \c root: choose
+     * registers and insert DEFINE/UNDEF blocks.  Called by \c Cblock::write.
+     * \throw on overlapping ranges of one name or one fixed register,
+     *        on an exhausted pool, or on a use in \c root code.
+     * \return number of bindings placed */
+    std::size_t scope_binds();
+    //@}
     //std::map<std::string, Cblock*> blk;
     Cunit(std::string name, std::string flavor="C", int const verbose=2 )
-        : name(name), root(this,name), v(verbose),
-        indent(), flavor(flavor), shiftwidth(flavor=="C"? 2: 0)
-    {}
+        : name(name), names(), arena(), byName(), memo(), epoch(0U), memoEpoch(0U),
+        nFindHit(0U), nFindMiss(0U), root(this,name), v(verbose),
+        indent(), indents(), flavor(flavor), shiftwidth(flavor=="C"? 2: 0),
+        blockTag("Cblock"), emptyTagV(2), binds(), regpools(), nBound(0U), nUnused(0U)
+    {
+        byName.emplace(root._name.id(), &root);
+    }
     // Should we warn if anything in DAG is un-emitted?
     // Do we make temporary copies that should silently destruct?
-    ~Cunit() { root.clear(); }
+    Cunit(Cunit const&) = delete;
+    /** new (unlinked) Cblock owned by \c arena, \c parent defaults to \c root */
+    Cblock& newblock(std::string const& name, Cblock* parent=nullptr);
+    /** drop the whole tree: clear \c root, the find index and memo, and
+     * release the \c arena. */
+    void release();
     std::ostream& write(std::ostream& os) {return root.write(os);}  ///< write the program unit
-    Cblock *find(std::string path);                 ///< absolute \c path down from \c root
-    Cblock *find(std::string path, Cblock* from);   ///< search up \c from, then down from \c root
+    std::size_t write(int const fd) {return root.write(fd);}        ///< ... or stream it to \c fd
+    Cblock *find(std::string const& path);          ///< absolute \c path down from \c root
+    Cblock *find(std::string const& path, Cblock* from); ///< search up \c from, then down from \c root
     std::string str();                              ///< all code of root
     void dump(std::ostream& os);                    ///< dump the tree
     std::string tree();                             ///< tree structure of root
     Cblock & operator[](std::string name) { return root[name]; }
 };
+inline Cblock::Cblock(Cunit *root, std::string const& name)
+    : _root(root), _parent(this), _name(root->names.intern(name)), _type(),
+    // _parent==this means we are _root
+    _premanip(nullptr), _code(""), _sub(), _postmanip(nullptr),
+    _nwrites(0), _maxwrites(1), _hash(0U), _hashed(false)
+    {}
+inline Cblock::Cblock(Cblock *parent, std::string const& name)
+    : _root(parent->_root), _parent(parent), _name(_root->names.intern(name)), _type(),
+    _premanip(nullptr), _code(""), _sub(), _postmanip(nullptr),
+    _nwrites(0), _maxwrites(1), _hash(0U), _hashed(false)
+    {}
+inline Cblock& Cblock::setType(std::string const& type){
+    _type = _root->names.intern(type);
+    touched();
+    return *this;
+}
+inline Cblock& Cunit::newblock(std::string const& name, Cblock* parent){
+    Cblock* const cb = (parent? arena.make(parent,name): arena.make(this,name));
+    byName.emplace(cb->_name.id(), cb);
+    JitProf::global().block();
+    return *cb;
+}
+inline void Cunit::release(){
+    root.clear();
+    byName.clear();
+    byName.emplace(root._name.id(), &root);
+    memo.clear();
+    binds.clear();
+    nBound = nUnused = 0U;
+    edited();
+    arena.release();
+}
+inline std::size_t Cunit::named(std::string const& p, Cblock*& only) const {
+    Cname n;
+    only = nullptr;
+    if(!names.lookup(p,n)) return 0U;
+    auto const r = byName.equal_range(n.id());
+    std::size_t const cnt = std::distance(r.first, r.second);
+    if(cnt == 1U) only = r.first->second;
+    return cnt;
+}
 inline void Cunit::dump(std::ostream& os){
     root.dump(os);
 }
@@ -446,8 +675,8 @@ struct PreIndent : IndentSpec {
         : IndentSpec(indent_adjust,fill) {}
 };
 
-inline std::string const& Cblock::getName() const {return _name;}
-inline std::string const& Cblock::getType() const {return _type;}
+inline std::string const& Cblock::getName() const {return _name.str();}
+inline std::string const& Cblock::getType() const {return _type.str();}
 
 inline Cblock& Cblock::after(Cblock& prev) {
     // streamlined, with 'append' that returns the argument, instead of 'prev'
@@ -561,6 +790,70 @@ Cblock& mk_scope(Cunit& cunit, std::string name, std::string beg="", std::string
 
 /** Here \c name is for Cblock lookup, \c decl is 'int foo()' [no { or ;]. */
 Cblock& mk_func(Cunit& cunit, std::string name, std::string decl);
+
+/** One entry of \c cdiff(a,b). */
+struct CblockDiff {
+    enum Kind {
+        SAME,       ///< maximal identical subtree (equal \c hash())
+        CHANGED,    ///< own name/type/code/manipulators differ (subs reported separately)
+        ADDED,      ///< only in \c b
+        REMOVED     ///< only in \c a
+    } kind;
+    std::string path;           ///< \c fullpath() in \c b (in \c a for REMOVED)
+    Cblock const* a;            ///< nullptr for ADDED
+    Cblock const* b;            ///< nullptr for REMOVED
+};
+/** Compare two Cblock trees top-down, pruning at equal \c hash().
+ * Sub-blocks are paired by name (the k'th "foo" of \c a with the k'th "foo"
+ * of \c b).  SAME entries are the stable parts that could be split into a
+ * shared header/object; CHANGED/ADDED/REMOVED are what must be rebuilt. */
+std::vector<CblockDiff> cdiff(Cblock const& a, Cblock const& b);
+inline std::vector<CblockDiff> cdiff(Cunit const& a, Cunit const& b){ return cdiff(a.root, b.root); }
+char const* name(CblockDiff::Kind const k);
+
+/** Parametric Cblock subtree.
+ * Build a subtree once, with placeholders <tt>${NAME}</tt> in code, block
+ * names or types, then stamp out copies with \c instantiate(parent,bind).
+ * - The constructor snapshots and pre-tokenizes the subtree, so the
+ *   original may be cleared or reused afterwards.
+ * - Instantiation is token concatenation plus one \c Cunit::newblock per
+ *   node, no C++ formatting or re-parsing.
+ * - Only \c Cbin (PreIndent/PostIndent) manipulators can be copied.
+ *
+ * ```
+ * Cunit scratch("t");
+ * auto& t = mk_scope(scratch,"loop_${ii}","for(int i=0; i<${ii}; ++i)");
+ * t["body"]>>"a[i] += ${jj};";
+ * Ctemplate const loop(t);
+ * for(auto ii: iis) loop.instantiate(fn, {{"ii",jitdec(ii)},{"jj","7"}});
+ * ```
+ */
+class Ctemplate {
+  public:
+    typedef std::map<std::string,std::string> Bindings;
+    /** \throw if \c tmpl has manipulators other than \c Cbin */
+    explicit Ctemplate(Cblock const& tmpl);
+    /** also treat bare identifiers \c idents in code (not after '.', "->"
+     * or '%') as placeholders, so untouched code can be renamed on copy */
+    Ctemplate(Cblock const& tmpl, std::vector<std::string> const& idents);
+    ~Ctemplate();
+    /** placeholder names, in order of first appearance */
+    std::vector<std::string> const& params() const {return pnames;}
+    /** append a substituted copy of the template to \c parent.
+     * \return the new top block.  \throw if a placeholder is unbound. */
+    Cblock& instantiate(Cblock& parent, Bindings const& bind) const;
+  private:
+    struct Text;
+    struct Node;
+    std::vector<Node> nodes;            ///< preorder
+    std::vector<std::string> pnames;
+    std::vector<std::string> idents;    ///< bare-identifier placeholders (code only)
+    int param(std::string const& name); ///< index into \c pnames (adds)
+    void tokenize(std::string const& s, Text& t, bool const code=false);
+    void snapshot(Cblock const& cb);
+    std::size_t build(std::size_t const n, Cblock& parent,
+            std::vector<std::string const*> const& val, Cblock*& made) const;
+};
 /** add \prefix indent to all non-whitespace lines, \c sep is a set of line separators.
  * Exception: cpp '#'-lines begin in first col (historical 'C' requirement) */
 std::ostream& prefix_lines(std::ostream& os, std::string code,
@@ -608,11 +901,13 @@ inline std::ostream& prefix_lines(std::ostream& os, std::string code,
 inline Cblock& operator<<(Cblock& cb, PostIndent const& postIndent){
     //std::cout<<"+PostIndent";
     cb._postmanip = new Cbin(cb, postIndent);
+    cb.touched();
     return cb;
 }
 inline Cblock& operator<<(Cblock& cb, PreIndent const& preIndent){
     //std::cout<<"+PreIndent";
     cb._premanip = new Cbin(cb, preIndent);
+    cb.touched();
     return cb;
 }
 
@@ -0,0 +1,746 @@
+/* Copyright (c) 2019 by NEC Corporation
+ * This file is part of ve-jit */
+/** \file
+ * Cexpr: fold, CSE and DCE a small scalar/vector/mask SSA graph, then
+ * lower it to Cblock code using VE vector intrinsics.
+ */
+#include "cexpr.hpp"
+#include "asmfmt.hpp"     // CexprAsm: AsmFmtVe (inline AsmFmtCols members)
+#include "cblock.hpp"
+#include "stringutil.hpp"
+#include "throw.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+namespace cprog {
+
+using namespace std;
+
+static char const* opname(Cexpr::Op const op){
+    static char const* const n[] = {"const", "var", "add", "sub", "mul", "shl",
+        "shr", "and", "or", "xor", "brd", "seq", "cmplt", "mand", "select"};
+    return n[op];
+}
+static bool commutes(Cexpr::Op const op){
+    return op==Cexpr::ADD || op==Cexpr::MUL || op==Cexpr::AND
+        || op==Cexpr::OR || op==Cexpr::XOR || op==Cexpr::MAND;
+}
+/** scalar semantics of binary ops (shift counts use low 6 bits, like VE) */
+static uint64_t fold(Cexpr::Op const op, uint64_t const a, uint64_t const b){
+    switch(op){
+      case Cexpr::ADD: return a + b;
+      case Cexpr::SUB: return a - b;
+      case Cexpr::MUL: return a * b;
+      case Cexpr::SHL: return a << (b&63);
+      case Cexpr::SHR: return a >> (b&63);
+      case Cexpr::AND: return a & b;
+      case Cexpr::OR:  return a | b;
+      case Cexpr::XOR: return a ^ b;
+      case Cexpr::CMPLT: return a < b;
+      case Cexpr::MAND: return a & b;
+      default: THROW("Cexpr: no scalar fold for "<<opname(op));
+    }
+}
+static int log2exact(uint64_t const c){
+    if(c==0 || (c&(c-1))) return -1;
+    int n=0;
+    while((uint64_t{1}<<n) != c) ++n;
+    return n;
+}
+static string constText(uint64_t const c){
+    return c < 1000000? jitdec(c): jithex(c)+"UL";
+}
+/** 'C' operators for the scalar ops */
+static char const* const sop[] = {"", "", "+", "-", "*", "<<", ">>", "&", "|", "^"};
+
+Cexpr::Cexpr(string const& prefix/*="t"*/, string const& vlExpr/*="vl"*/,
+        int const verbose/*=0*/)
+    : nFold(0), nCse(0), nDead(0), verbose(verbose),
+    nodes(), cse(), outs(), prefix(prefix), curVL()
+{
+    curVL = s(vlExpr);
+}
+
+Cexpr::Val Cexpr::intern(Node const& n){
+    Key key(n.op, n.kind, n.a, n.b, n.c, n.vl, n.k, n.name);
+    auto const found = cse.find(key);
+    if(found != cse.end()){
+        if(n.op != CONST && n.op != VAR){
+            ++nCse;
+            if(verbose>1) cout<<" Cexpr cse "<<opname(n.op)<<" --> "<<prefix<<found->second<<endl;
+        }
+        return Val(found->second);
+    }
+    int const id = (int)nodes.size();
+    nodes.push_back(n);
+    cse.emplace(key, id);
+    return Val(id);
+}
+Cexpr::Val Cexpr::k(uint64_t const c){
+    return intern(Node{CONST, SCALAR, -1, -1, -1, -1, c, string()});
+}
+Cexpr::Val Cexpr::s(string const& cexpr){
+    return intern(Node{VAR, SCALAR, -1, -1, -1, -1, 0, cexpr});
+}
+// vector inputs carry the VL, so a bare input can be an \c out (CexprRef FOR loop)
+Cexpr::Val Cexpr::v(string const& var){
+    return intern(Node{VAR, VECTOR, -1, -1, -1, curVL.id, 0, var});
+}
+Cexpr::Val Cexpr::m(string const& var){
+    return intern(Node{VAR, MASK, -1, -1, -1, curVL.id, 0, var});
+}
+void Cexpr::setVL(Val const vl){
+    if(kind(vl) != SCALAR) THROW("Cexpr::setVL needs a scalar");
+    curVL = vl;
+}
+bool Cexpr::isConst(Val const x, uint64_t* c/*=nullptr*/) const {
+    Node const& n = nodes.at(x.id);
+    if(n.op != CONST) return false;
+    if(c) *c = n.k;
+    return true;
+}
+Cexpr::Val Cexpr::zero(Kind const kind){
+    Val const z = k(0);
+    return kind==SCALAR? z: brd(z);
+}
+Cexpr::Val Cexpr::brd(Val const x){
+    if(kind(x) != SCALAR) THROW("Cexpr::brd needs a scalar");
+    return intern(Node{BRD, VECTOR, x.id, -1, -1, curVL.id, 0, string()});
+}
+Cexpr::Val Cexpr::seq(){
+    return intern(Node{SEQ, VECTOR, -1, -1, -1, curVL.id, 0, string()});
+}
+Cexpr::Val Cexpr::cmplt(Val const a, Val const b){ return mk(CMPLT, a, b); }
+Cexpr::Val Cexpr::mand(Val const a, Val const b){ return mk(MAND, a, b); }
+Cexpr::Val Cexpr::select(Val const m, Val const a, Val const b){ return mk(SELECT, a, b, m); }
+
+/** Build (or find) \c op(a,b[,c]).  Broadcasts of the current VL are
+ * unwrapped, so a vector op between "scalars" is a \c brd of the scalar op.
+ * Scalar operands of vector ops end up first (\c vsvl forms), except
+ * for shift counts, which are second (\c vvsl forms). */
+Cexpr::Val Cexpr::mk(Op const op, Val a, Val b, Val const c/*=Val()*/){
+    if(!a.ok() || !b.ok()) THROW("Cexpr: "<<opname(op)<<" of undefined Val");
+    if(op == MAND){
+        if(kind(a) != MASK || kind(b) != MASK) THROW("Cexpr::mand needs masks");
+        if(a.id == b.id){ ++nFold; return a; }
+        if(a.id > b.id) swap(a, b);
+        return intern(Node{MAND, MASK, a.id, b.id, -1, curVL.id, 0, string()});
+    }
+    if(op == SELECT){
+        if(!c.ok() || kind(c) != MASK) THROW("Cexpr::select needs a mask");
+        if(kind(a) == MASK || kind(b) == MASK) THROW("Cexpr::select of masks");
+        if(a.id == b.id){ ++nFold; return vec(a); }
+        return intern(Node{SELECT, VECTOR, vec(a).id, vec(b).id, c.id, curVL.id, 0, string()});
+    }
+    if(kind(a) == MASK || kind(b) == MASK) THROW("Cexpr: "<<opname(op)<<" of a mask");
+    bool const vector = kind(a)==VECTOR || kind(b)==VECTOR;
+    auto unbrd = [this](Val const x){
+        Node const& n = nodes[x.id];
+        return (n.op==BRD && n.vl==curVL.id)? Val(n.a): x;
+    };
+    a = unbrd(a);
+    b = unbrd(b);
+    if(op == CMPLT){
+        if(kind(a) == SCALAR && kind(b) == SCALAR)
+            THROW("Cexpr::cmplt of scalars (use a 'C' test)");
+        if(kind(b) == SCALAR) b = brd(b);       // vcmpul_vsvl takes the scalar first
+        return intern(Node{CMPLT, MASK, a.id, b.id, -1, curVL.id, 0, string()});
+    }
+    if(vector && kind(a) == SCALAR && kind(b) == SCALAR){
+        ++nFold;                                // brd(x) op brd(y) --> brd(x op y)
+        return brd(mk(op, a, b));
+    }
+    Kind const kr = vector? VECTOR: SCALAR;
+    uint64_t ca=0, cb=0;
+    bool const ka = isConst(a,&ca), kb = isConst(b,&cb);
+    if(ka && kb){ ++nFold; return k(fold(op, ca, cb)); }
+    // identities with a constant operand (moved to b if op commutes)
+    if(commutes(op) && ka){ swap(a, b); swap(ca, cb); }
+    if(isConst(b)){
+        switch(op){
+          case ADD: case SUB: case OR: case XOR: case SHL: case SHR:
+              if(cb == 0){ ++nFold; return a; }
+              break;
+          case MUL:
+              if(cb == 0){ ++nFold; return zero(kr); }
+              if(cb == 1){ ++nFold; return a; }
+              {
+                  int const n = log2exact(cb);
+                  if(n > 0){ ++nFold; return mk(SHL, a, k(n)); }
+              }
+              break;
+          case AND:
+              if(cb == 0){ ++nFold; return zero(kr); }
+              if(cb == ~uint64_t{0}){ ++nFold; return a; }
+              break;
+          default: ;
+        }
+        if(op == SUB && kr == VECTOR){          // v - c --> (-c) + v   (vsvl form)
+            ++nFold;
+            return mk(ADD, k(uint64_t{0}-cb), a);
+        }
+        // reassociate (c1 op x) op c2 --> (c1 op c2) op x
+        Node const na = nodes[a.id];           // copy: k() may grow nodes
+        uint64_t c1;
+        if(commutes(op) && na.op==op && na.kind==kr && na.vl==(kr==SCALAR? -1: curVL.id)
+                && isConst(Val(na.a),&c1)){
+            ++nFold;
+            Val const k12 = k(fold(op, c1, cb));
+            return mk(op, k12, Val(na.b));
+        }
+    }
+    if((op == SHL || op == SHR) && isConst(a,&ca) && ca == 0){ ++nFold; return zero(kr); }
+    if(a.id == b.id){
+        switch(op){
+          case SUB: case XOR: ++nFold; return zero(kr);
+          case AND: case OR:  ++nFold; return a;
+          default: ;
+        }
+    }
+    // canonical operand order: scalars (constants) first, except shift counts
+    if(op == SHL || op == SHR){
+        if(kr == VECTOR && kind(a) == SCALAR) a = brd(a);   // vsll_vvsl: count is scalar
+    }else if(op == SUB){
+        if(kr == VECTOR && kind(b) == SCALAR) b = brd(b);   // vsubul_vsvl is scalar - vector
+    }else if(commutes(op)){
+        bool const swp = kind(a) != kind(b)? kind(b) == SCALAR
+            : isConst(a) != isConst(b)? isConst(b)
+            : a.id > b.id;
+        if(swp) swap(a, b);
+    }
+    return intern(Node{op, kr, a.id, b.id, -1, (kr==SCALAR? -1: curVL.id), 0, string()});
+}
+
+void Cexpr::out(string const& lhs, Val const x){
+    if(!x.ok()) THROW("Cexpr::out("<<lhs<<") of undefined Val");
+    outs.emplace_back(lhs, x.id);
+}
+
+int Cexpr::emit(Cblock& cb){
+    CexprVel vel;
+    return emit(cb, vel);
+}
+int Cexpr::emit(Cblock& cb, CexprEmitter& be){
+    int const nn = (int)nodes.size();
+    vector<int> uses(nn, 0);
+    vector<bool> live(nn, false);
+    for(auto const& o: outs) live[o.second] = true;
+    for(int i=nn-1; i>=0; --i){         // operands always have smaller ids
+        if(!live[i]) continue;
+        Node const& n = nodes[i];
+        for(int const x: {n.a, n.b, n.c, n.vl}){
+            if(x >= 0){ live[x] = true; ++uses[x]; }
+        }
+    }
+    for(auto const& o: outs) ++uses[o.second];
+    vector<int> left(uses);
+    CexprEmitter::Txt txt(nn);
+    auto consume = [&](int const x){
+        if(x >= 0 && --left[x] == 0) be.dead(*this, x, txt);
+    };
+    int nops = 0;
+    nDead = 0;
+    for(int i=0; i<nn; ++i){
+        Node const& n = nodes[i];
+        bool const leaf = n.op==CONST || n.op==VAR;
+        if(!live[i]){
+            if(!leaf) ++nDead;
+            continue;
+        }
+        txt[i] = be.expr(*this, i, txt, cb);
+        if(leaf) continue;
+        nops += (n.op==CMPLT? 2: 1);
+        if(uses[i] > 1 || !be.inlines())
+            txt[i] = be.temp(*this, i, prefix+jitdec(i), txt, cb);
+        for(int const x: {n.a, n.b, n.c, n.vl}) consume(x);
+    }
+    for(auto const& o: outs){
+        be.out(*this, o.second, o.first, txt, cb);
+        consume(o.second);
+    }
+    be.end(*this, cb);
+    if(verbose>0) cout<<"Cexpr::emit "<<nops<<" ops, folds "<<nFold<<", cse "<<nCse
+        <<", dead "<<nDead<<endl;
+    return nops;
+}
+
+// ----------------------------------------------------------- CexprVel
+/** \c _vel_* call for binary vector op \c n, with pass-through vector \c pt
+ * if not empty */
+static std::string vbinop(Cexpr const& e, Cexpr::Node const& n,
+        CexprEmitter::Txt const& txt, std::string const& pt=""){
+    static char const* const vop[] = {"", "", "_vel_vaddul", "_vel_vsubul", "_vel_vmulul",
+        "_vel_vsll", "_vel_vsrl", "_vel_vand", "_vel_vor", "_vel_vxor"};
+    auto scalar = [&e](int const x){ return x>=0 && e.node(Cexpr::Val(x)).kind==Cexpr::SCALAR; };
+    string const form = scalar(n.a)? "_vsv": scalar(n.b)? "_vvs": "_vvv";
+    return vop[n.op]+form+(pt.empty()? "l(": "vl(")+txt[n.a]+","+txt[n.b]+","
+        +(pt.empty()? "": pt+",")+txt[n.vl]+")";
+}
+std::string CexprVel::expr(Cexpr const& e, int const id, Txt const& txt, Cblock&){
+    Cexpr::Node const& n = e.node(Cexpr::Val(id));
+    auto A = [&](){ return txt[n.a]; };
+    auto B = [&](){ return txt[n.b]; };
+    string const VL = (n.vl>=0? txt[n.vl]: string());
+    if(n.kind == Cexpr::SCALAR){
+        switch(n.op){
+          case Cexpr::CONST: return constText(n.k);
+          case Cexpr::VAR:   return n.name;
+          default: ;
+        }
+        if(n.op > Cexpr::XOR) THROW("Cexpr: bad scalar op "<<opname(n.op));
+        return "("+A()+sop[n.op]+B()+")";
+    }
+    auto scalar = [&e](int const x){ return x>=0 && e.node(Cexpr::Val(x)).kind==Cexpr::SCALAR; };
+    string const form = scalar(n.a)? "_vsvl(": scalar(n.b)? "_vvsl(": "_vvvl(";
+    auto args = [&](){ return A()+","+B()+","+VL+")"; };
+    switch(n.op){
+      case Cexpr::VAR:    return n.name;
+      case Cexpr::ADD: case Cexpr::SUB: case Cexpr::MUL: case Cexpr::SHL:
+      case Cexpr::SHR: case Cexpr::AND: case Cexpr::OR: case Cexpr::XOR:
+                          return vbinop(e, n, txt);
+      case Cexpr::BRD:    return "_vel_vbrdl_vsl("+A()+","+VL+")";
+      case Cexpr::SEQ:    return "_vel_vseq_vl("+VL+")";
+      case Cexpr::CMPLT:  return "_vel_vfmkllt_mvl(_vel_vcmpul"+form+args()+","+VL+")";
+      case Cexpr::MAND:   return "_vel_andm_mmm("+A()+","+B()+")";
+      case Cexpr::SELECT: return "_vel_vmrg_vvvml("+B()+","+A()+","+txt[n.c]+","+VL+")";
+      default: THROW("Cexpr: bad vector op "<<opname(n.op));
+    }
+}
+std::string CexprVel::temp(Cexpr const& e, int const id, std::string const& t,
+        Txt const& txt, Cblock& cb){
+    Cexpr::Kind const k = e.node(Cexpr::Val(id)).kind;
+    char const* const decl = (k==Cexpr::SCALAR? "uint64_t const ": k==Cexpr::VECTOR? "__vr ": "__vm256 ");
+    cb>>(decl+t+" = "+txt[id]+";");
+    return t;
+}
+void CexprVel::out(Cexpr const& e, int const id, std::string const& lhs,
+        Txt const& txt, Cblock& cb){
+    Cexpr::Node const& n = e.node(Cexpr::Val(id));
+    if(!passthru || n.kind != Cexpr::VECTOR || n.vl < 0 || n.op == Cexpr::VAR){
+        cb>>(lhs+" = "+txt[id]+";");
+    }else if(n.op >= Cexpr::ADD && n.op <= Cexpr::XOR){
+        cb>>(lhs+" = "+vbinop(e, n, txt, lhs)+";");
+    }else{                                      // 0 | x, lanes >= vl from lhs
+        cb>>(lhs+" = _vel_vor_vsvvl(0UL,"+txt[id]+","+lhs+","+txt[n.vl]+");");
+    }
+}
+std::string CexprVel::decl(Cexpr::Kind const kind, std::string const& name) const {
+    return (kind==Cexpr::SCALAR? "uint64_t ": kind==Cexpr::VECTOR? "__vr ": "__vm256 ")+name+";";
+}
+
+// ----------------------------------------------------------- CexprRef
+std::string CexprRef::expr(Cexpr const& e, int const id, Txt const& txt, Cblock&){
+    Cexpr::Node const& n = e.node(Cexpr::Val(id));
+    switch(n.op){
+      case Cexpr::CONST:  return constText(n.k);
+      case Cexpr::VAR:    return n.kind==Cexpr::SCALAR? n.name: n.name+"["+i+"]";
+      case Cexpr::BRD:    return txt[n.a];
+      case Cexpr::SEQ:    return i;
+      case Cexpr::CMPLT:  return "("+txt[n.a]+"<"+txt[n.b]+")";
+      case Cexpr::MAND:   return "("+txt[n.a]+"&"+txt[n.b]+")";
+      case Cexpr::SELECT: return "("+txt[n.c]+"? "+txt[n.a]+": "+txt[n.b]+")";
+      default: ;
+    }
+    if(n.op > Cexpr::XOR) THROW("Cexpr: bad op "<<opname(n.op));
+    return "("+txt[n.a]+sop[n.op]+txt[n.b]+")";
+}
+std::string CexprRef::temp(Cexpr const& e, int const id, std::string const& t,
+        Txt const& txt, Cblock& cb){
+    Cexpr::Node const& n = e.node(Cexpr::Val(id));
+    if(n.kind == Cexpr::SCALAR){
+        cb>>("uint64_t const "+t+" = "+txt[id]+";");
+        return t;
+    }
+    cb>>("uint64_t "+t+"[256];")
+        >>("FOR("+i+","+txt[n.vl]+") "+t+"["+i+"] = "+txt[id]+";");
+    return t+"["+i+"]";
+}
+void CexprRef::out(Cexpr const& e, int const id, std::string const& lhs,
+        Txt const& txt, Cblock& cb){
+    Cexpr::Node const& n = e.node(Cexpr::Val(id));
+    if(n.kind == Cexpr::SCALAR) cb>>(lhs+" = "+txt[id]+";");
+    else cb>>("FOR("+i+","+txt[n.vl]+") "+lhs+"["+i+"] = "+txt[id]+";");
+}
+std::string CexprRef::decl(Cexpr::Kind const kind, std::string const& name) const {
+    return "uint64_t "+name+(kind==Cexpr::SCALAR? ";": "[256];");
+}
+
+// ----------------------------------------------------------- CexprAsm
+CexprAsm::CexprAsm() : nInsns(0), a(new AsmFmtVe()), sfree(), vfree(), mfree(), mine(), curVL() {
+    // pop from the back: lowest numbers first
+    for(int r=63; r>=40; --r) sfree.push_back("%s"+jitdec(r));
+    for(int r=63; r>=0; --r) vfree.push_back("%v"+jitdec(r));
+    for(int r=15; r>=1; --r) mfree.push_back("%vm"+jitdec(r));
+}
+CexprAsm::~CexprAsm() {}
+void CexprAsm::reserve(std::string const& reg){
+    for(auto* f: {&sfree, &vfree, &mfree})
+        f->erase(std::remove(f->begin(), f->end(), reg), f->end());
+}
+std::string CexprAsm::alloc(char const kind){
+    auto& f = (kind=='s'? sfree: kind=='v'? vfree: mfree);
+    if(f.empty()) THROW("CexprAsm: out of "<<(kind=='s'? "scalar": kind=='v'? "vector": "mask")
+            <<" registers");
+    std::string const r = f.back();
+    f.pop_back();
+    mine.push_back(r);
+    return r;
+}
+void CexprAsm::release(std::string const& reg){
+    auto const m = std::find(mine.begin(), mine.end(), reg);
+    if(m == mine.end()) return;                 // input, immediate, ...
+    mine.erase(m);
+    (reg.compare(0,3,"%vm")==0? mfree: reg.compare(0,2,"%v")==0? vfree: sfree).push_back(reg);
+}
+static bool isImm(std::string const& x){
+    return !x.empty() && (isdigit(x[0]) || x[0]=='-');
+}
+std::string CexprAsm::sreg(std::string const& x, std::vector<std::string>& tmps){
+    if(!isImm(x)) return x;
+    std::string const r = alloc('s');
+    tmps.push_back(r);
+    istringstream iss(x);
+    int64_t c;
+    iss>>c;
+    ins(ve_load64(r, (uint64_t)c));
+    return r;
+}
+void CexprAsm::ins(std::string const& asmcode){
+    a->ins(asmcode);
+    ++nInsns;
+}
+std::string CexprAsm::expr(Cexpr const& e, int const id, Txt const& txt, Cblock&){
+    Cexpr::Node const& n = e.node(Cexpr::Val(id));
+    std::vector<std::string> tmps;              // immediates moved into registers
+    std::string d;
+    if(n.op == Cexpr::CONST){                   // 7-bit immediate, else a register
+        if((int64_t)n.k >= -64 && (int64_t)n.k <= 63) return jitdec((int64_t)n.k);
+        d = alloc('s');
+        ins(ve_load64(d, n.k));
+        return d;
+    }
+    if(n.op == Cexpr::VAR) return n.name;
+    string A = (n.a>=0? txt[n.a]: string());
+    string B = (n.b>=0? txt[n.b]: string());
+    if(n.kind == Cexpr::SCALAR){
+        static char const* const op[] = {"", "", "addu.l", "subu.l", "mulu.l", "sll", "srl",
+            "and", "or", "xor"};
+        if(n.op > Cexpr::XOR) THROW("CexprAsm: bad scalar op "<<opname(n.op));
+        d = alloc('s');
+        if(n.op == Cexpr::SHL || n.op == Cexpr::SHR){       // op sx, sz, sy(count)
+            ins(string(op[n.op])+" "+d+", "+sreg(A,tmps)+", "+B);
+        }else{                                  // op sx, sy(imm ok), sz
+            if(isImm(B) && !isImm(A) && n.op != Cexpr::SUB) swap(A, B);
+            ins(string(op[n.op])+" "+d+", "+A+", "+sreg(B,tmps));
+        }
+    }else{
+        string const& VL = txt[n.vl];
+        if(VL != curVL){
+            if(isImm(VL) && atoll(VL.c_str()) > 63) ins("lvl "+sreg(VL,tmps));
+            else ins("lvl "+VL);
+            curVL = VL;
+        }
+        d = alloc(n.kind==Cexpr::MASK? 'm': 'v');
+        auto vop = [&](char const* op){                 // op vx, sy|vy, vz
+            ins(string(op)+" "+d+", "+A+", "+B);
+        };
+        switch(n.op){
+          case Cexpr::ADD: vop("vaddu.l"); break;
+          case Cexpr::SUB: vop("vsubu.l"); break;
+          case Cexpr::MUL: vop("vmulu.l"); break;
+          case Cexpr::AND: vop("vand"); break;
+          case Cexpr::OR:  vop("vor"); break;
+          case Cexpr::XOR: vop("vxor"); break;
+          case Cexpr::SHL: ins("vsll "+d+", "+A+", "+B); break;     // vsll vx, vz, sy|vy
+          case Cexpr::SHR: ins("vsrl "+d+", "+A+", "+B); break;
+          case Cexpr::BRD: ins("vbrd "+d+", "+A); break;
+          case Cexpr::SEQ: ins("vseq "+d); break;
+          case Cexpr::CMPLT: {
+              string const t = alloc('v');
+              ins("vcmpu.l "+t+", "+A+", "+B);
+              ins("vfmk.l.lt "+d+", "+t);
+              release(t);
+          } break;
+          case Cexpr::MAND: ins("andm "+d+", "+A+", "+B); break;
+          case Cexpr::SELECT: ins("vmrg "+d+", "+B+", "+A+", "+txt[n.c]); break;
+          default: THROW("CexprAsm: bad vector op "<<opname(n.op));
+        }
+    }
+    for(auto const& t: tmps) release(t);
+    return d;
+}
+void CexprAsm::out(Cexpr const& e, int const id, std::string const& lhs,
+        Txt const& txt, Cblock&){
+    Cexpr::Kind const k = e.node(Cexpr::Val(id)).kind;
+    std::string const& x = txt[id];
+    if(x == lhs) return;
+    if(k == Cexpr::SCALAR)      ins(isImm(x)? ve_load64(lhs, (uint64_t)atoll(x.c_str()))
+            : "or "+lhs+", 0, "+x);
+    else if(k == Cexpr::VECTOR) ins("vor "+lhs+", 0, "+x);
+    else                        ins("andm "+lhs+", %vm0, "+x);
+}
+void CexprAsm::dead(Cexpr const&, int const id, Txt const& txt){
+    release(txt[id]);
+}
+void CexprAsm::end(Cexpr const&, Cblock& cb){
+    cb>>a->flush();
+}
+
+map<string, vector<uint64_t>> Cexpr::eval(map<string, vector<uint64_t>> const& in) const {
+    int const nn = (int)nodes.size();
+    vector<vector<uint64_t>> val(nn);
+    auto input = [&in](string const& name) -> vector<uint64_t> const& {
+        auto const found = in.find(name);
+        if(found == in.end()) THROW("Cexpr::eval: no input "<<name);
+        return found->second;
+    };
+    for(int i=0; i<nn; ++i){
+        Node const& n = nodes[i];
+        vector<uint64_t>& r = val[i];
+        if(n.op == CONST){ r.assign(1, n.k); continue; }
+        if(n.op == VAR){
+            r = input(n.name);
+            if(n.kind == SCALAR) r.resize(1);
+            continue;
+        }
+        if(n.kind == SCALAR){ r.assign(1, fold(n.op, val[n.a][0], val[n.b][0])); continue; }
+        size_t const vl = val[n.vl].at(0);
+        if(vl > 256) THROW("Cexpr::eval: vl "<<vl<<" > 256");
+        auto elt = [&val](int const x, size_t const e){
+            vector<uint64_t> const& v = val[x];
+            return v.size()==1? v[0]: v.at(e);
+        };
+        r.resize(vl);
+        for(size_t e=0; e<vl; ++e){
+            switch(n.op){
+              case BRD:    r[e] = val[n.a][0]; break;
+              case SEQ:    r[e] = e; break;
+              case SELECT: r[e] = elt(n.c,e)? elt(n.a,e): elt(n.b,e); break;
+              default:     r[e] = fold(n.op, elt(n.a,e), elt(n.b,e));
+            }
+        }
+    }
+    map<string, vector<uint64_t>> ret;
+    for(auto const& o: outs) ret[o.first] = val[o.second];
+    return ret;
+}
+
+}//cprog::
+
+#ifdef CEXPR_MAIN
+#include "ve_divmod.hpp"
+#include "vesim.hpp"
+#include <cstdlib>
+#include <dlfcn.h>
+#include <fstream>
+using namespace cprog;
+using namespace std;
+
+/** repeated index math of a fused 2-loop kernel: every op is written twice,
+ * as a string-pasting generator would, and constants come from outside. */
+static void test_cse_fold(){
+    cout<<"test_cse_fold"<<endl;
+    Cexpr e("t", "vl", 1);
+    auto const ii = e.s("ii"), jj = e.k(8), one = e.k(1), zero = e.k(0);
+    auto const sq = e.seq();
+    auto const base = e.add(sq, e.s("cnt"));        // a = cnt + seq
+    auto const a1 = e.add(e.s("cnt"), e.seq());     // same, written again
+    CHECK(base.id == a1.id);
+    auto const d = e.shr(base, e.k(3));             // a/8
+    auto const m = e.band(a1, e.sub(jj, one));      // a%8, jj-1 folds to 7
+    auto const d2 = e.add(e.mul(d, one), zero);     // folds to d
+    CHECK(d2.id == d.id);
+    auto const p = e.mul(d2, e.k(16));              // --> shl 4
+    auto const q = e.add(e.add(p, e.k(3)), e.k(5)); // --> 8 + p
+    auto const x = e.bxor(m, m);                    // --> brd 0
+    auto const dead = e.mul(d, ii);  (void)dead;    // never output
+    auto const lt = e.cmplt(m, e.brd(e.k(4)));
+    e.out("vDiv", d);
+    e.out("vMod", m);
+    e.out("vOut", e.select(lt, q, x));
+    Cunit pr("cexpr");
+    auto& body = pr.root["body"];
+    int const nops = e.emit(body);
+    string const code = body.str();
+    cout<<code<<endl;
+    CHECK(e.nCse >= 2);
+    CHECK(e.nFold >= 6);
+    CHECK(e.nDead == 2);  // mul by ii, and (3+p) before reassociation
+    CHECK(nops == 11);
+    CHECK(code.find("__vr t") != string::npos);           // base is shared
+    CHECK(code.find("_vel_vsll_vvsl") != string::npos);   // mul by 16
+    CHECK(code.find("_vel_vmulul") == string::npos);
+    CHECK(code.find("ii") == string::npos);               // dead code dropped
+    // reference semantics
+    map<string, vector<uint64_t>> in{{"vl",{200}}, {"cnt",{1000}}, {"ii",{3}}};
+    auto const r = e.eval(in);
+    for(uint64_t i=0; i<200; ++i){
+        uint64_t const a = 1000+i;
+        CHECK(r.at("vDiv")[i] == a/8);
+        CHECK(r.at("vMod")[i] == a%8);
+        CHECK(r.at("vOut")[i] == (a%8 < 4? (a/8)*16+8: 0));
+    }
+    {   // pass-through outputs keep lanes >= vl of the lhs
+        Cexpr h("h", "rem");
+        h.out("acc", h.bxor(h.v("acc"), h.mul(h.seq(), h.k(3))));
+        h.out("last", h.seq());
+        Cunit pp("passthru");
+        CexprVel pt;
+        pt.passthru = true;
+        h.emit(pp.root, pt);
+        string const ptcode = pp.root.str();
+        cout<<ptcode<<endl;
+        CHECK(ptcode.find("acc = _vel_vxor_vvvvl(") != string::npos);
+        CHECK(ptcode.find(",acc,acc,rem);") != string::npos);
+        CHECK(ptcode.find("last = _vel_vor_vsvvl(0UL,") != string::npos);
+        CHECK(ptcode.find(",last,rem);") != string::npos);
+    }
+}
+/** \c fastdiv/divmod via Cexpr agree with integer division, as evaluated,
+ * as reference 'C' (compiled and dlopen'ed), and as VE asm run on \c VeSim;
+ * then a compare/mask/merge kernel, checked the same three ways */
+static void test_divmod(){
+    cout<<"test_divmod"<<endl;
+    for(uint32_t jj: {1U, 2U, 3U, 7U, 8U, 12U, 100U, 65537U}){
+        for(uint32_t hi: {0U, 1000U}){
+            uint64_t const cnt = hi? hi-256: 123456U;
+            auto check = [&](char const* what, uint64_t const* q, uint64_t const* r){
+                for(uint64_t i=0; i<256; ++i){
+                    if(q[i] != (cnt+i)/jj || r[i] != (cnt+i)%jj)
+                        THROW(what<<" divmod "<<jj<<" hi="<<hi<<" wrong at "<<cnt+i);
+                }
+            };
+            int nops[3];
+            {   // intrinsics text, reference evaluation
+                Cexpr e;
+                auto const dm = divmod(e, e.add(e.seq(), e.s("cnt")), jj, hi);
+                e.out("q", dm.first);
+                e.out("r", dm.second);
+                Cunit pr("divmod");
+                nops[0] = e.emit(pr.root);
+                auto const r = e.eval({{"vl",{256}}, {"cnt",{cnt}}});
+                check("eval", r.at("q").data(), r.at("r").data());
+            }
+            {   // portable 'C'
+                Cexpr e;
+                auto const dm = divmod(e, e.add(e.seq(), e.s("cnt")), jj, hi);
+                e.out("q", dm.first);
+                e.out("r", dm.second);
+                Cunit pr("divmod_ref");
+                CexprRef ref;
+                nops[1] = e.emit(pr.root, ref);
+                {
+                    ofstream ofs("cexpr_ref.c");
+                    ofs<<"#include <stdint.h>\n#define FOR(I,N) for(uint64_t I=0; I<(N); ++I)\n"
+                        "void kern(uint64_t const cnt, uint64_t const vl, uint64_t* q, uint64_t* r){\n"
+                        <<pr.str()<<"\n}\n";
+                }
+                if(system("cc -O1 -shared -fPIC -o cexpr_ref.so cexpr_ref.c"))
+                    THROW("compile of CexprRef output failed");
+                void* dl = dlopen("./cexpr_ref.so", RTLD_NOW|RTLD_LOCAL);
+                if(!dl) THROW("dlopen: "<<dlerror());
+                typedef void (*Kern)(uint64_t, uint64_t, uint64_t*, uint64_t*);
+                Kern const kern = (Kern)dlsym(dl, "kern");
+                vector<uint64_t> q(256), r(256);
+                kern(cnt, 256, q.data(), r.data());
+                dlclose(dl);
+                check("CexprRef", q.data(), r.data());
+            }
+            {   // VE asm, run by VeSim
+                Cexpr e("t", "%s1");
+                auto const dm = divmod(e, e.add(e.seq(), e.s("%s0")), jj, hi);
+                e.out("%v10", dm.first);
+                e.out("%v11", dm.second);
+                Cunit pr("divmod_asm", "asm", 0);
+                CexprAsm as;
+                as.reserve("%v10");
+                as.reserve("%v11");
+                nops[2] = e.emit(pr.root, as);
+                VeSim sim;
+                sim.s[0] = cnt;
+                sim.s[1] = 256;
+                sim.run(VeAsm()(pr.str()));
+                check("CexprAsm", sim.v[10], sim.v[11]);
+                if(jj==7 && hi==0) cout<<pr.str()<<endl;
+            }
+            cout<<" jj="<<jj<<" hi="<<hi<<" "<<nops[0]<<" ops"<<endl;
+            CHECK(nops[1] == nops[0] && nops[2] == nops[0]);
+        }
+    }
+    // compare, mask and merge: the same select kernel on all three backends
+    uint64_t const cnt = 0x7fffff80U, lim = cnt + 200U;
+    auto sel = [](Cexpr& e, string const& c, string const& l){
+        auto const x = e.add(e.seq(), e.s(c));
+        auto const y = e.band(e.mul(x, e.k(5)), e.k(255));
+        auto const lt = e.mand(e.cmplt(y, e.brd(e.k(100))), e.cmplt(x, e.s(l)));
+        return e.select(lt, y, e.bxor(x, e.k(5)));
+    };
+    auto checkSel = [&](char const* what, uint64_t const* o){
+        for(uint64_t i=0; i<256; ++i){
+            uint64_t const x = cnt+i, y = (x*5)&255;
+            if(o[i] != (y<100 && x<lim? y: x^5))
+                THROW(what<<" select wrong at "<<i);
+        }
+    };
+    int nops[3];
+    {   // intrinsics text, reference evaluation
+        Cexpr e;
+        e.out("o", sel(e, "cnt", "lim"));
+        Cunit pr("select");
+        nops[0] = e.emit(pr.root);
+        string const code = pr.str();
+        CHECK(code.find("_vel_vfmkllt_mvl(_vel_vcmpul") != string::npos);
+        CHECK(code.find("_vel_andm_mmm(") != string::npos);
+        CHECK(code.find("_vel_vmrg_vvvml(") != string::npos);
+        checkSel("eval", e.eval({{"vl",{256}}, {"cnt",{cnt}}, {"lim",{lim}}}).at("o").data());
+    }
+    {   // portable 'C'
+        Cexpr e;
+        e.out("o", sel(e, "cnt", "lim"));
+        Cunit pr("select_ref");
+        CexprRef ref;
+        nops[1] = e.emit(pr.root, ref);
+        {
+            ofstream ofs("cexpr_sel.c");
+            ofs<<"#include <stdint.h>\n#define FOR(I,N) for(uint64_t I=0; I<(N); ++I)\n"
+                "void kern(uint64_t const cnt, uint64_t const lim, uint64_t const vl, uint64_t* o){\n"
+                <<pr.str()<<"\n}\n";
+        }
+        if(system("cc -O1 -shared -fPIC -o cexpr_sel.so cexpr_sel.c"))
+            THROW("compile of CexprRef select failed");
+        void* dl = dlopen("./cexpr_sel.so", RTLD_NOW|RTLD_LOCAL);
+        if(!dl) THROW("dlopen: "<<dlerror());
+        typedef void (*Kern)(uint64_t, uint64_t, uint64_t, uint64_t*);
+        Kern const kern = (Kern)dlsym(dl, "kern");
+        vector<uint64_t> o(256);
+        kern(cnt, lim, 256, o.data());
+        dlclose(dl);
+        checkSel("CexprRef", o.data());
+    }
+    {   // VE asm (vcmpu.l, vfmk.l.lt, andm, vmrg), run by VeSim
+        Cexpr e("t", "%s1");
+        e.out("%v10", sel(e, "%s0", "%s2"));
+        Cunit pr("select_asm", "asm", 0);
+        CexprAsm as;
+        as.reserve("%v10");
+        nops[2] = e.emit(pr.root, as);
+        VeSim sim;
+        sim.s[0] = cnt;
+        sim.s[1] = 256;
+        sim.s[2] = lim;
+        sim.run(VeAsm()(pr.str()));
+        cout<<pr.str()<<endl;
+        checkSel("CexprAsm", sim.v[10]);
+    }
+    cout<<" select "<<nops[0]<<" ops"<<endl;
+    CHECK(nops[1] == nops[0] && nops[2] == nops[0]);
+}
+int main(int,char**){
+    test_cse_fold();
+    test_divmod();
+    cout<<"\nGoodbye"<<endl;
+    return 0;
+}
+#endif // CEXPR_MAIN
+// vim: ts=4 sw=4 et cindent cino=^=l0,\:.5s,=-.5s,N-s,g.5s,b1 cinkeys=0{,0},0),\:,0#,!^F,o,O,e,0=break
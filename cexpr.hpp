@@ -0,0 +1,223 @@
+#ifndef CEXPR_HPP
+#define CEXPR_HPP
+/* Copyright (c) 2019 by NEC Corporation
+ * This file is part of ve-jit */
+/** \file
+ * Small typed SSA expression layer that lowers to Cblock text.
+ *
+ * Generators (ex. \c mk_DIVMOD, loops/fl6-kernels) used to emit intrinsic
+ * strings directly and rely on ncc/clang to fold constants and spot repeated
+ * index math.  \c Cexpr instead builds scalar / vector / mask values:
+ *
+ * - constant folding as values are built (scalar consts, \c brd of consts,
+ *   identities like x+0, x*1, x*2^n --> x<<n, x^x --> 0, ...),
+ * - common-subexpression elimination by hash-consing (same op, args, VL),
+ * - dead-code elimination at \c emit (only values reaching an \c out),
+ * - then text, via a \c CexprEmitter backend:
+ *   - \c CexprVel: VE vector intrinsics (\c _vel_*) and plain 'C' scalar code,
+ *   - \c CexprRef: portable reference 'C', \c FOR(i,vl) loops over u64 arrays,
+ *   - \c CexprAsm: VE assembler via \c AsmFmtVe (for an \c "asm" flavor Cunit).
+ *
+ * so one kernel description can be A/B tested as intrinsics, asm, or
+ * host reference code.
+ *
+ * All values are 64-bit unsigned (u64 scalars, u64 vector elements,
+ * masks as 0/1 per element).  Vector ops are VL-aware: they record the
+ * current \c vl() value, so values built under different VL never merge.
+ *
+ * \c eval is a scalar reference interpreter for the same graph (for tests).
+ */
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
+
+struct AsmFmtVe;
+
+namespace cprog {
+class Cblock;
+class CexprEmitter;
+
+class Cexpr {
+  public:
+    enum Kind : uint8_t { SCALAR, VECTOR, MASK };
+    enum Op : uint8_t { CONST, VAR, ADD, SUB, MUL, SHL, SHR, AND, OR, XOR,
+        BRD, SEQ, CMPLT, MAND, SELECT };
+    /** handle to an SSA value of one \c Cexpr */
+    struct Val {
+        int id;
+        Val() : id(-1) {}
+        explicit Val(int const id) : id(id) {}
+        bool ok() const {return id >= 0;}
+    };
+    struct Node {
+        Op op;
+        Kind kind;
+        int a, b, c;            ///< operand ids (or -1)
+        int vl;                 ///< VL value id for VECTOR/MASK ops (or -1)
+        uint64_t k;             ///< CONST value
+        std::string name;       ///< VAR text
+    };
+
+    /** \c prefix names temporaries (prefix0, prefix1, ...), \c vlExpr is the
+     * initial vector length (a scalar 'C' expression). */
+    explicit Cexpr(std::string const& prefix="t", std::string const& vlExpr="vl",
+            int const verbose=0);
+
+    /// \group leaves
+    //@{
+    Val k(uint64_t const c);                    ///< scalar constant
+    /** scalar input.  \c cexpr gets no temporary: its text is pasted at each
+     * use, so keep it a variable or a cheap side-effect-free expression. */
+    Val s(std::string const& cexpr);
+    Val v(std::string const& var);              ///< \c __vr input variable
+    Val m(std::string const& var);              ///< \c __vm256 input variable
+    Val vl() const {return curVL;}              ///< vector length of new vector ops
+    void setVL(Val const vl);                   ///< \c vl must be SCALAR
+    //@}
+    /// \group ops (vector if either operand is, scalars used directly as \c vsvl args)
+    //@{
+    Val add(Val const a, Val const b) {return mk(ADD, a, b);}
+    Val sub(Val const a, Val const b) {return mk(SUB, a, b);}
+    Val mul(Val const a, Val const b) {return mk(MUL, a, b);}
+    Val shl(Val const a, Val const b) {return mk(SHL, a, b);}     ///< a << b (b < 64)
+    Val shr(Val const a, Val const b) {return mk(SHR, a, b);}     ///< a >> b, logical
+    Val band(Val const a, Val const b) {return mk(AND, a, b);}
+    Val bor (Val const a, Val const b) {return mk(OR , a, b);}
+    Val bxor(Val const a, Val const b) {return mk(XOR, a, b);}
+    Val brd(Val const s);                       ///< scalar --> vector
+    Val seq();                                  ///< vector {0,1,2,...}
+    Val cmplt(Val const a, Val const b);        ///< mask a < b (unsigned)
+    Val mand(Val const a, Val const b);         ///< mask and
+    Val select(Val const m, Val const a, Val const b); ///< m? a: b
+    //@}
+
+    /** mark \c x live, emitting <tt>lhs = x;</tt> (in \c out call order) */
+    void out(std::string const& lhs, Val const x);
+    /** lower live values into \c cb (declarations for multi-use values,
+     * single-use values are inlined into their consumer if \c be allows).
+     * \return number of operations (intrinsic calls or scalar ops) emitted */
+    int emit(Cblock& cb, CexprEmitter& be);
+    int emit(Cblock& cb);                       ///< \c emit with \c CexprVel
+
+    /** reference semantics: inputs by name (scalars as 1-element vectors;
+     * the \c vlExpr scalar must be given), outputs by \c out lhs. */
+    std::map<std::string, std::vector<uint64_t>> eval(
+            std::map<std::string, std::vector<uint64_t>> const& in) const;
+
+    Node const& node(Val const x) const {return nodes.at(x.id);}
+    Kind kind(Val const x) const {return nodes.at(x.id).kind;}
+    bool isConst(Val const x, uint64_t* c=nullptr) const;
+
+    /// \group counters
+    //@{
+    int nFold;          ///< ops folded away or simplified
+    int nCse;           ///< ops found already built
+    int nDead;          ///< built values not reaching any \c out (after \c emit)
+    //@}
+    int verbose;
+  private:
+    Val mk(Op const op, Val a, Val b, Val const c=Val());
+    Val intern(Node const& n);
+    Val zero(Kind const kind);
+    Val vec(Val const x) {return kind(x)==SCALAR? brd(x): x;}
+    std::vector<Node> nodes;
+    typedef std::tuple<int,int,int,int,int,int,uint64_t,std::string> Key;
+    std::map<Key,int> cse;
+    std::vector<std::pair<std::string,int>> outs;
+    std::string prefix;
+    Val curVL;
+};
+
+/** Lowering backend for \c Cexpr::emit.  \c Cexpr decides what is live, the
+ * emission order and which values get temporaries; the emitter supplies text.
+ * \c txt[id] holds the text of each value emitted so far (operands first). */
+class CexprEmitter {
+  public:
+    typedef std::vector<std::string> Txt;
+    virtual ~CexprEmitter() {}
+    /** may single-use values be pasted into their consumer? */
+    virtual bool inlines() const {return true;}
+    /** text for value \c id (may also add code to \c cb) */
+    virtual std::string expr(Cexpr const& e, int const id, Txt const& txt, Cblock& cb) = 0;
+    /** bind \c txt[id] to temporary \c t. \return text for later uses */
+    virtual std::string temp(Cexpr const& e, int const id, std::string const& t,
+            Txt const& txt, Cblock& cb) = 0;
+    /** <tt>lhs = txt[id]</tt> */
+    virtual void out(Cexpr const& e, int const id, std::string const& lhs,
+            Txt const& txt, Cblock& cb) = 0;
+    /** all uses of \c id have been emitted (registers may be reused) */
+    virtual void dead(Cexpr const& /*e*/, int const /*id*/, Txt const& /*txt*/) {}
+    /** after the last \c out */
+    virtual void end(Cexpr const& /*e*/, Cblock& /*cb*/) {}
+    /** statement declaring a \c kind variable \c name that \c out may assign
+     * (ex. to hoist values out of a loop), or "" if none is needed */
+    virtual std::string decl(Cexpr::Kind const /*kind*/, std::string const& /*name*/) const {return "";}
+};
+
+/** VE intrinsics: \c __vr / \c __vm256 temporaries, \c _vel_* calls */
+class CexprVel : public CexprEmitter {
+  public:
+    /** \c true: vector \c out uses pass-through forms (ex. \c _vel_vxor_vvvvl),
+     * so lanes >= vl of \c lhs keep their value.  Needed for accumulators
+     * that are also updated under a short remainder vl. */
+    bool passthru = false;
+    std::string expr(Cexpr const& e, int const id, Txt const& txt, Cblock& cb) override;
+    std::string temp(Cexpr const& e, int const id, std::string const& t,
+            Txt const& txt, Cblock& cb) override;
+    void out(Cexpr const& e, int const id, std::string const& lhs,
+            Txt const& txt, Cblock& cb) override;
+    std::string decl(Cexpr::Kind const kind, std::string const& name) const override;
+};
+
+/** Portable reference 'C': vectors and masks are \c uint64_t arrays,
+ * each vector temporary or output is a <tt>FOR(i,vl)</tt> loop
+ * (\c FOR from \ref vfor.h), vector inputs and outputs are indexed as \c v[i]. */
+class CexprRef : public CexprEmitter {
+  public:
+    explicit CexprRef(std::string const& i="i") : i(i) {}
+    std::string expr(Cexpr const& e, int const id, Txt const& txt, Cblock& cb) override;
+    std::string temp(Cexpr const& e, int const id, std::string const& t,
+            Txt const& txt, Cblock& cb) override;
+    void out(Cexpr const& e, int const id, std::string const& lhs,
+            Txt const& txt, Cblock& cb) override;
+    std::string decl(Cexpr::Kind const kind, std::string const& name) const override;
+    std::string const i;        ///< loop index
+};
+
+/** VE assembler via \c AsmFmtVe.  Every op gets a register from the free
+ * lists (scalars %s40-%s63, all vectors, masks %vm1-%vm15), recycled when
+ * \c dead; running out is an error (target small kernels).  Inputs and
+ * \c out lhs are register names (or AsmFmtCols-scoped names for them):
+ * \c reserve them if they overlap the free lists.
+ * \c lvl is emitted whenever the VL value changes. */
+class CexprAsm : public CexprEmitter {
+  public:
+    CexprAsm();
+    ~CexprAsm();
+    void reserve(std::string const& reg);       ///< remove \c reg from the free lists
+    bool inlines() const override {return false;}
+    std::string expr(Cexpr const& e, int const id, Txt const& txt, Cblock& cb) override;
+    std::string temp(Cexpr const&, int const id, std::string const&,
+            Txt const& txt, Cblock&) override { return txt[id]; }
+    void out(Cexpr const& e, int const id, std::string const& lhs,
+            Txt const& txt, Cblock& cb) override;
+    void dead(Cexpr const& e, int const id, Txt const& txt) override;
+    void end(Cexpr const& e, Cblock& cb) override;
+    int nInsns;                                 ///< instructions emitted
+  private:
+    std::string alloc(char const kind);         ///< 's', 'v' or 'm'
+    void release(std::string const& reg);
+    std::string sreg(std::string const& x, std::vector<std::string>& tmps); ///< immediate --> register
+    void ins(std::string const& asmcode);
+    std::unique_ptr<AsmFmtVe> a;
+    std::vector<std::string> sfree, vfree, mfree;
+    std::vector<std::string> mine;              ///< registers allocated by \c expr
+    std::string curVL;
+};
+
+}//cprog::
+// vim: ts=4 sw=4 et cindent cino=^=l0,\:.5s,=-.5s,N-s,g.5s,b1 cinkeys=0{,0},0),\:,0#,!^F,o,O,e,0=break
+#endif // CEXPR_HPP
@@ -0,0 +1,241 @@
+/* Copyright (c) 2019 by NEC Corporation
+ * This file is part of ve-jit */
+/** \file
+ * Cloop: unroll / software-pipeline a counted loop of Cblock stages.
+ */
+#include "cloop.hpp"
+#include "stringutil.hpp"
+#include "throw.hpp"
+
+#include <cctype>
+#include <iostream>
+#include <memory>
+
+namespace cprog {
+
+using namespace std;
+
+static bool isIdent(string const& s){
+    if(s.empty() || isdigit((unsigned char)s[0])) return false;
+    for(char const c: s) if(!isalnum((unsigned char)c) && c!='_') return false;
+    return true;
+}
+static bool isWord(string const& s){            // identifier or number
+    if(s.empty()) return false;
+    for(char const c: s) if(!isalnum((unsigned char)c) && c!='_') return false;
+    return true;
+}
+static bool isNumber(string const& s){
+    if(s.empty() || s.size() > 9U) return false;
+    for(char const c: s) if(!isdigit((unsigned char)c)) return false;
+    return true;
+}
+
+Cloop::Cloop(string const& i, string const& beg, string const& end, string const& step)
+    : i(i), beg(beg), end(end), step(step), v(0), carried(), nUnroll(1), piped(false)
+{
+    if(!isIdent(i)) THROW("Cloop: induction variable \""<<i<<"\" is not an identifier");
+    if(beg.empty() || end.empty() || step.empty()) THROW("Cloop: empty loop bound");
+}
+Cloop& Cloop::carry(string const& type, string const& name){
+    if(!isIdent(name) || name == i) THROW("Cloop: cannot carry \""<<name<<"\"");
+    carried.emplace_back(type, name);
+    return *this;
+}
+Cloop& Cloop::unroll(int const n){
+    if(n < 1) THROW("Cloop: unroll("<<n<<") must be >= 1");
+    nUnroll = n;
+    return *this;
+}
+Cloop& Cloop::pipeline(bool const on){
+    piped = on;
+    return *this;
+}
+string Cloop::times(int const n) const {
+    if(isNumber(step)) return jitdec(n * stoll(step));
+    string const s = (isWord(step)? step: "("+step+")");
+    return (n == 1? s: jitdec(n)+"*"+s);
+}
+string Cloop::offset(int const d) const {
+    if(d == 0) return i;
+    return "("+i+(d>0? "+": "-")+times(d>0? d: -d)+")";
+}
+
+Cblock& Cloop::mk(Cunit& u, string const& name) const {
+    Cblock& loop = mk_scope(u, name, "for(int64_t "+i+"="+beg+"; "+i+"<"+end+"; "+i+"+="+step+")");
+    loop.setType("loop");
+    return loop;
+}
+
+/** Rebuilt \c loop, for S pipeline stages and U copies:
+ * ```
+ * { // loop
+ *   int64_t i = beg;  type x_0, .., x_{U-1};
+ *   [U>1, S==1]  for(; i+(U-1)*step < end; i += U*step){ copy 0 .. copy U-1 }
+ *   [S>1]        if(i+(S-2)*step < end){   // iterations 0..S-2 exist
+ *                  prologue: time T=0..S-2 runs stages T..0 of iterations 0..T
+ *                  i += (S-1)*step;
+ *                  for(; i+(U-1)*step < end; i += U*step){
+ *                    time T+j, j<U: stages S-1..0 of iterations T+j-(S-1)..T+j }
+ *                  epilogue: time T+e, e<S-1: stages S-1..e+1 (started iterations)
+ *                }
+ *   for(; i < end; i += step){ stages 0..S-1 }    // remainder
+ * }
+ * ```
+ * Iteration t uses carried copy t%U, which is static in every section
+ * because kernel trips begin at times S-1+m*U. */
+int Cloop::apply(Cblock& loop) const {
+    if(loop.getType() != "loop")
+        THROW("Cloop::apply("<<loop.fullpath()<<"): not an untransformed Cloop::mk loop");
+    Cblock* const first = loop.find("./first");
+    Cblock* const body = loop.find("./body");
+    if(!body) THROW("Cloop::apply("<<loop.fullpath()<<"): no body");
+    if(first && (!first->code_str().empty() || !first->subs().empty()))
+        THROW("Cloop::apply("<<loop.fullpath()<<"): code in \"first\" (put it in a stage)");
+
+    vector<string> idents{i};
+    for(auto const& c: carried) idents.push_back(c.second);
+    vector<unique_ptr<Ctemplate>> stages;
+    if(body->subs().empty()){
+        stages.emplace_back(new Ctemplate(*body, idents));
+    }else{
+        if(!body->code_str().empty())
+            THROW("Cloop::apply("<<loop.fullpath()<<"): body has both code and stage blocks");
+        for(Cblock const* s: body->subs()) stages.emplace_back(new Ctemplate(*s, idents));
+    }
+    int const S = (piped? (int)stages.size(): 1);
+    int const U = nUnroll;
+    int const R = (U > 1 ? U: 1);               // carried copies
+
+    Cunit& u = loop.getRoot();
+    string const name = loop.getName();
+    int nStamp = 0;
+    // stage s (or all stages if s<0) for the iteration at i+d*step, using carried copy r
+    auto const stamp = [&](Cblock& parent, int const s, int const d, int const r){
+        Ctemplate::Bindings b{{i, offset(d)}};
+        for(auto const& c: carried) b[c.second] = (R > 1? c.second+"_"+jitdec(r): c.second);
+        if(s >= 0){
+            stages[s]->instantiate(parent, b);
+            ++nStamp;
+        }else for(auto const& st: stages){
+            st->instantiate(parent, b);
+            ++nStamp;
+        }
+    };
+
+    std::ostringstream oss;
+    loop.clear();
+    loop.setType(OSSFMT("loop unroll="<<U<<" stages="<<S));
+    loop["beg"]<<"{ // "<<name<<PostIndent(+u.shiftwidth);
+    Cblock& decl = loop["decl"];
+    decl<<"int64_t "<<i<<" = "<<beg<<";";
+    for(auto const& c: carried){
+        decl>>c.first<<" ";
+        for(int r=0; r<R; ++r) decl<<(r? ", ": "")<<(R > 1? c.second+"_"+jitdec(r): c.second);
+        decl<<";";
+    }
+    string const next = "; "+i+" += "+times(U)+")";
+    if(S > 1){
+        Cblock& pipe = mk_scope(u, "pipe", "if("+offset(S-2)+" < "+end+")").after(loop)["body"];
+        Cblock& pro = pipe["prologue"];
+        for(int T=0; T<S-1; ++T){
+            Cblock& t = pro["t"+jitdec(T)];
+            for(int s=T; s>=0; --s) stamp(t, s, T-s, (T-s)%R);
+        }
+        pro["next"]<<i<<" += "<<times(S-1)<<";";
+        Cblock& krn = mk_scope(u, "kernel", "for(; "+offset(U-1)+" < "+end+next).after(pipe)["body"];
+        for(int j=0; j<U; ++j){
+            Cblock& t = krn["u"+jitdec(j)];
+            for(int s=S-1; s>=0; --s) stamp(t, s, j-s, (S-1+j-s)%R);
+        }
+        Cblock& epi = pipe["epilogue"];
+        for(int e=0; e<S-1; ++e){
+            Cblock& t = epi["e"+jitdec(e)];
+            for(int s=S-1; s>e; --s) stamp(t, s, e-s, (S-1+e-s)%R);
+        }
+    }else if(U > 1){
+        Cblock& krn = mk_scope(u, "unrolled", "for(; "+offset(U-1)+" < "+end+next).after(loop)["body"];
+        for(int j=0; j<U; ++j) stamp(krn["u"+jitdec(j)], -1, j, j);
+    }
+    Cblock& rem = mk_scope(u, (S > 1 || U > 1? "remainder": "loop"),
+            "for(; "+i+" < "+end+"; "+i+" += "+step+")").after(loop)["body"];
+    stamp(rem, -1, 0, 0);
+    loop["end"]<<"} //"<<name<<PreIndent(-u.shiftwidth);
+    if(v>0) cout<<" Cloop "<<loop.fullpath()<<" unroll="<<U<<" stages="<<S
+        <<" --> "<<nStamp<<" stage copies"<<endl;
+    return nStamp;
+}
+
+}//cprog::
+
+#ifdef CLOOP_MAIN
+#include <cstdlib>
+#include <dlfcn.h>
+#include <fstream>
+using namespace cprog;
+using namespace std;
+
+/** load/compute/store loop, every (unroll, pipeline, step) variant compiled
+ * and checked against the untransformed loop's semantics */
+static void test_cloop(){
+    cout<<"test_cloop"<<endl;
+    std::ostringstream oss;
+    Cunit pr("cloop");
+    pr.v = 0;
+    pr["includes"]<<"#include <stdint.h>";
+    struct Variant { int u; bool p; bool st; bool xst; std::string fn; };
+    vector<Variant> vs;
+    for(int st=0; st<2; ++st) for(int p=0; p<2; ++p) for(int u=1; u<=4; ++u){
+        bool const xst = !p || u >= 2;          // x lives 2 stages: needs u>=2 if pipelined
+        string const fn = OSSFMT("fn_u"<<u<<"_p"<<p<<"_st"<<st);
+        vs.push_back(Variant{u, p!=0, st!=0, xst, fn});
+        auto& f = mk_func(pr, fn, "void "+fn+"(int64_t const n, int64_t const st,"
+                " int64_t const* a, int64_t* out)").after(pr.root);
+        Cloop lp("i", "0", "n", (st? "st": "1"));
+        lp.carry("int64_t","x").carry("int64_t","y").unroll(u).pipeline(p!=0);
+        auto& loop = lp.mk(pr, "loop").after(f["body"]);
+        loop["body"]["load"]<<"x = a[i];";
+        loop["body"]["compute"]<<"y = x*3 + i;";
+        loop["body"]["store"]<<(xst? "out[i] = y ^ x;": "out[i] = y;");
+        int const n = lp.apply(loop);
+        if(n != (p? (u+1)*3 + 1+2+2+1: (u>1? u*3: 0) + 3))
+            THROW(fn<<": apply emitted "<<n<<" stage copies");
+        bool threw = false;
+        try{ lp.apply(loop); }catch(...){ threw = true; }
+        if(!threw) THROW(fn<<": second apply did not throw"); // already transformed
+        if(u==2 && p && !st) cout<<f.str()<<endl;
+    }
+    {
+        ofstream ofs("cloop_test.c");
+        ofs<<pr.str();
+    }
+    if(system("cc -O1 -shared -fPIC -o cloop_test.so cloop_test.c"))
+        THROW("compile of Cloop output failed");
+    void* dl = dlopen("./cloop_test.so", RTLD_NOW|RTLD_LOCAL);
+    if(!dl) THROW("dlopen: "<<dlerror());
+    typedef void (*Fn)(int64_t, int64_t, int64_t const*, int64_t*);
+    int nchk = 0;
+    for(auto const& vr: vs){
+        Fn const fn = (Fn)dlsym(dl, vr.fn.c_str());
+        if(!fn) THROW("dlsym("<<vr.fn<<"): "<<dlerror());
+        for(int64_t st = 1; st <= (vr.st? 3: 1); ++st){
+            for(int64_t n=0; n<24; ++n){
+                vector<int64_t> a(n+1), out(n+1, -1), ref(n+1, -1);
+                for(int64_t k=0; k<n; ++k) a[k] = 7*k + 1;
+                for(int64_t k=0; k<n; k+=st) ref[k] = (a[k]*3 + k) ^ (vr.xst? a[k]: 0);
+                fn(n, st, a.data(), out.data());
+                if(out != ref) THROW(vr.fn<<"(n="<<n<<",st="<<st<<") mismatch");
+                ++nchk;
+            }
+        }
+    }
+    dlclose(dl);
+    cout<<" "<<vs.size()<<" loop variants, "<<nchk<<" runs OK"<<endl;
+}
+int main(int,char**){
+    test_cloop();
+    cout<<"\nGoodbye"<<endl;
+    return 0;
+}
+#endif // CLOOP_MAIN
+// vim: ts=4 sw=4 et cindent cino=^=l0,\:.5s,=-.5s,N-s,g.5s,b1 cinkeys=0{,0},0),\:,0#,!^F,o,O,e,0=break
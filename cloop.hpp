@@ -0,0 +1,73 @@
+#ifndef CLOOP_HPP
+#define CLOOP_HPP
+/* Copyright (c) 2019 by NEC Corporation
+ * This file is part of ve-jit */
+/** \file
+ * Unroll and software-pipeline transforms for counted 'C' loops in a Cblock tree.
+ *
+ * Hand-unrolled generators (ex. loops/fl6-unroll.cpp) repeat the kernel text
+ * for every copy, prologue and remainder.  Instead, make the loop once with
+ * \c Cloop::mk, let generators append code to \e stage blocks of its "body"
+ * (ex. a \c FusedLoopKernelAbs::emit into a "compute" stage), and then
+ * \c Cloop::apply rewrites the loop:
+ *
+ * - \c unroll(N): a main loop stepping \c N*step with N copies of the body,
+ *   followed by a remainder loop,
+ * - \c pipeline(): a modulo schedule, where one loop trip runs stage \c s of
+ *   iteration \c t-s for every stage (later stages first), with a prologue
+ *   filling the pipe and an epilogue draining it,
+ * - \c carry(type,x): variables passed between stages are declared once per
+ *   copy (x_0, x_1, ...) and renamed (rotated) per iteration, so unrolled
+ *   copies use independent registers.  In asm-style code using
+ *   \c Cblock::bind, each copy's macro gets its own register.
+ *
+ * Stage code names the induction variable and carried variables as plain
+ * identifiers.  Copies are made with \c Ctemplate, which substitutes them
+ * (ex. \c i --> <tt>(i+2*vl)</tt>), so kernels need no changes.
+ *
+ * Rules:
+ * - \c end and \c step are loop-invariant, \c step > 0,
+ * - stage code declares no variables (use \c carry, or declare before the loop),
+ * - when pipelined, a carried value lives at most \c unroll stages
+ *   (\c unroll(1): it is produced and consumed in adjacent stages).
+ */
+#include "cblock.hpp"
+
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace cprog {
+
+class Cloop {
+  public:
+    /** <tt>for(int64_t i=beg; i<end; i+=step)</tt>, all 'C' expressions */
+    Cloop(std::string const& i, std::string const& beg, std::string const& end,
+            std::string const& step="1");
+    /** declare <tt>type name</tt> in the loop scope, once per rotating copy */
+    Cloop& carry(std::string const& type, std::string const& name);
+    Cloop& unroll(int const n);                 ///< body copies per main-loop trip (1)
+    Cloop& pipeline(bool const on=true);        ///< overlap stages of successive iterations
+
+    /** new unlinked loop block \c name/{beg,first,body,end}, of type "loop".
+     * Stages are sub-blocks of "body", in execution order, or else
+     * the "body" block itself is the only stage. */
+    Cblock& mk(Cunit& u, std::string const& name) const;
+    /** rewrite \c loop (from \c mk) in place.
+     * \throw if \c loop is not an untransformed \c mk loop.
+     * \return number of stage copies emitted */
+    int apply(Cblock& loop) const;
+
+    std::string const i, beg, end, step;
+    int v;                                      ///< verbosity
+  private:
+    std::string offset(int const d) const;      ///< \c i + d*step
+    std::string times(int const n) const;       ///< n*step
+    std::vector<std::pair<std::string,std::string>> carried;    ///< type, name
+    int nUnroll;
+    bool piped;
+};
+
+}//cprog::
+// vim: ts=4 sw=4 et cindent cino=^=l0,\:.5s,=-.5s,N-s,g.5s,b1 cinkeys=0{,0},0),\:,0#,!^F,o,O,e,0=break
+#endif // CLOOP_HPP
@@ -1,14 +1,35 @@
 /* Copyright (c) 2019 by NEC Corporation
  * This file is part of ve-jit */
 #include "dllbuild.hpp"
-//#include "cblock.hpp"    // prefix_lines (debug output)
+#include "cblock.hpp"    // DllFile::unit streaming (Csink, CfdSink)
 #include "throw.hpp"
 #include "jitpage.h"    // low level 'C' utilities
+#include "timer.h"      // __clock (build step timing)
+#include "jitprof.hpp"   // JitProfScope (per-stage counters)
 #include <fstream>
 #include <cstring>
 #include <assert.h>
 #include <unistd.h>     // getcwd, sysconf, pathconf, access
 #include <sys/stat.h>   // stat (possibly faster than 'access') and I check size
+#include <sys/file.h>   // flock (library cache eviction)
+#include <sys/mman.h>   // memfd_create (DllBuild::memory)
+#include <fcntl.h>      // open, utimensat
+#include <dirent.h>     // opendir (library cache eviction)
+#include <algorithm>    // std::sort, std::find_if
+#include <cctype>       // isalnum (isFunctionSym)
+#include <cstdlib>      // getenv, strtoull
+#include <iomanip>      // std::setw (cache_key)
+#include <climits>      // PATH_MAX (cache_key compiler paths)
+#include <sstream>
+#include <spawn.h>      // posix_spawnp (DllBuild::make_direct)
+#include <sys/wait.h>   // waitpid
+#include <thread>
+#include <atomic>
+#include <map>
+#include <deque>
+#include <condition_variable>
+
+extern char **environ;
 
 #define PSTREAMS 1
 #if PSTREAMS
@@ -113,9 +134,10 @@ SubDir::SubDir(std::string subdir)
 }
 std::string DllFile::short_descr() const {
     std::ostringstream oss;
-    oss <<basename<<suffix
-        <<" "<<code.size()<<" code bytes, "
-        <<syms.size()<<" symbols";
+    oss <<basename<<suffix<<" ";
+    if(unit) oss<<"Cunit "<<unit->name<<", ";
+    else     oss<<code.size()<<" code bytes, ";
+    oss <<syms.size()<<" symbols";
     return oss.str();
 }
 /** Unfortunately, multiple compilations rely on bin.mk file rule details,
@@ -169,21 +191,58 @@ std::vector<std::string> DllFile::obj(std::string fname, int const v/*=0,quiet*/
             <<") must match %[-vi|-ncc|-clang].{c|cpp} or %.{s|S} (see bin.mk rules)");
     return ret;
 }
+/** \c text() is \c head() + \c code + "\n" */
+std::string DllFile::head() const {
+    std::ostringstream oss;
+    oss <<"//Dllfile: basename = "<<basename
+        <<"\n//Dllfile: suffix   = "<<suffix
+        <<"\n//Dllfile: abspath  = "<<abspath;
+    oss <<"\n"<<comment;
+    oss <<"\n";
+    return oss.str();
+}
+std::string DllFile::text() const {
+    return head() + (unit? unit->str(): code) + "\n";
+}
+namespace {
+/** \c Csink that only counts (\c DllFile::textSize of a \c unit) */
+struct CountSink : public cprog::Csink {
+    CountSink() : nbytes(0U) {}
+    void ref(char const*, std::size_t n) override { nbytes += n; }
+    std::size_t nbytes;
+};
+}//anon::
+void DllFile::emitCode(cprog::Csink& out) const {
+    if(!unit){
+        out.ref(code.data(), code.size());
+        return;
+    }
+    if(!unit->binds.empty()) unit->scope_binds();   // as Cblock::write
+    unit->indent.clear();                           // as Cblock::str
+    unit->root.emit(out, false/*chkWrite*/);
+}
+std::size_t DllFile::textSize() const {
+    if(!unit) return head().size() + code.size() + 1U;
+    CountSink n;
+    emitCode(n);
+    return head().size() + n.nbytes + 1U;
+}
+std::size_t DllFile::write(int const fd, std::string const& pre/*=""*/) const {
+    string const hd = head();
+    cprog::CfdSink out(fd);
+    out.ref(pre.data(), pre.size());
+    out.ref(hd.data(), hd.size());
+    emitCode(out);
+    out.ref("\n", 1U);
+    out.flush();
+    return out.bytes();
+}
 /** \b new: if file exists and "same", don't rewrite it */
 std::string DllFile::write(SubDir const& subdir, int const v/*=0,quiet*/){
-    string myfile; // entire generated source file
-    {
-        std::ostringstream oss;
-        oss <<"//Dllfile: basename = "<<basename
-            <<"\n//Dllfile: suffix   = "<<suffix
-            <<"\n//Dllfile: abspath  = "<<abspath;
-        if(v>1){cout<<" generating comment: "<<comment<<endl; cout.flush();}
-        oss <<"\n"<<comment;
-        if(v>1){cout<<" copying code: "<<code<<endl; cout.flush();}
-        oss <<"\n"<<code
-            <<endl;
-        myfile = oss.str();
-    }
+    if(v>1){cout<<" generating comment: "<<comment<<"\n copying code: "
+        <<(unit? "(streamed from Cunit "+unit->name+")": code)<<endl; cout.flush();}
+    // text() == head + code + "\n", streamed below without joining them
+    size_t const fsize = textSize();
 
     // nitpick: '/' -> os path separator?
     this->abspath = subdir.abspath + "/" + this->basename + this->suffix;
@@ -192,13 +251,13 @@ std::string DllFile::write(SubDir const& subdir, int const v/*=0,quiet*/){
     // check file existence, and whether we can skip the rewrite
     // quick'n'dirty check for file edit via size mismatch
 #if 1 // XXX readable helper fn (perhaps extend with hash of file content?)
-    auto const fcmp = filecmp(abspath, myfile.size());
+    auto const fcmp = filecmp(abspath, fsize);
     bool const writeit = (fcmp != FILECMP_SAMESIZE);
     if (v>1){
         if (fcmp == FILECMP_SAMESIZE) cout<<
             " file samesize as code string, so NOT overwriting";
         else if (fcmp == FILECMP_DIFFSIZE) cout<<
-            " file differs from code string size "<<myfile.size();
+            " file differs from code string size "<<fsize;
         else cout << // FILECMP_ABSENT
             " target file does not exist";
     }
@@ -207,8 +266,8 @@ std::string DllFile::write(SubDir const& subdir, int const v/*=0,quiet*/){
     {
         struct stat st;
         if(stat(abspath.c_str(), &st)){
-            cout<<" my size "<<myfile.size();
-            if((size_t)st.st_size == myfile.size()){ // file size matches => "same" (hack)
+            cout<<" my size "<<fsize;
+            if((size_t)st.st_size == fsize){ // file size matches => "same" (hack)
                 writeit = false;
                 if(v>1)
                     cout<<" matches existing file, so NOT overwriting";
@@ -222,17 +281,16 @@ std::string DllFile::write(SubDir const& subdir, int const v/*=0,quiet*/){
 #endif
 
     if(writeit){
+        int const fd = open(abspath.c_str(), O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0666);
+        if(v>1){cout<<" open("<<abspath<<") fd="<<fd<<endl; cout.flush();}
+        if(fd < 0) THROW(" Trouble writing file "<<abspath<<": "<<strerror(errno));
         try{
-            std::ofstream ofs(abspath);
-            if(v>1){cout<<" ofstream ofs("<<abspath<<") CREATED"<<endl; cout.flush();}
-            ofs<<myfile;
-            if(v>1){cout<<" and an extra ofs.flush() !!!"<<endl; cout.flush();}
-            ofs.flush();
-            ofs.close();
-        }catch(...){
-            cout<<" Trouble writing file "<<abspath<<endl;
-            throw;
+            write(fd);
+        }catch(std::exception const& x){
+            close(fd);
+            THROW(" Trouble writing file "<<abspath<<": "<<x.what());
         }
+        if(close(fd) != 0) THROW(" Trouble writing file "<<abspath<<": "<<strerror(errno));
         if(v>0){cout<<" Wrote file "<<abspath<<endl;}
     }
     return this->abspath;
@@ -301,6 +359,11 @@ std::string const & DllBuild::getLibName() const {
     return this->libname;
 }
 
+static bool hasSym(std::vector<SymbolDecl> const& syms, std::string const& name){
+    for(auto const& sd: syms) if(sd.symbol == name) return true;
+    return false;
+}
+
 /** Generating the Makefile
  *
  * - adds a prefix to canned rules of \e bin.mk Makefile template
@@ -312,11 +375,20 @@ std::string const & DllBuild::getLibName() const {
  * rewritten.
  */
 void DllBuild::prep(string basename, string subdir/*="."*/){
+    prep(basename, subdir, true/*writeFiles*/);
+}
+void DllBuild::prep(string basename, string subdir, bool const writeFiles){
     if(empty()){
         if(verbose) cout<<" Nothing to do for dll "<<basename<<endl;
         return;
     }
-    this->dir      = SubDir(subdir);
+    JitProfScope prof("dllbuild.prep");
+    if(writeFiles){
+        this->dir  = SubDir(subdir);
+    }else{ // names only, do not create subdir
+        this->dir.subdir  = subdir;
+        this->dir.abspath = (subdir[0]=='/'? subdir: getPath()+'/'+subdir);
+    }
     this->basename = basename;
     this->libname  = "lib"+this->basename+".so";
     string archive = "lib"+this->basename+".a";  // NEW
@@ -347,7 +419,8 @@ void DllBuild::prep(string basename, string subdir/*="."*/){
             auto& df_j = (*this)[j];
             if( df_i.basename == df_j.basename ){
                 if( df_i.suffix == df_j.suffix){
-                    if( df_i.code == df_j.code && df_i.syms.size() == df_j.syms.size() ){
+                    if( df_i.code == df_j.code && df_i.unit == df_j.unit
+                            && df_i.syms.size() == df_j.syms.size() ){
                         cout<<" Duplicate DllFile "<<i<<" matches "<<j<<", IGNORED "<<i
                             <<"\n    prev: "<<df_j.short_descr()
                             <<"\n    skip: "<<df_i.short_descr()
@@ -408,6 +481,8 @@ void DllBuild::prep(string basename, string subdir/*="."*/){
             }
         }
     }
+    if(!dispatch.empty())
+        add_dispatch();
     {
         ostringstream sources; sources<<"\nSOURCES:=";
         ostringstream objects; objects<<"\nOBJECTS_FILE:="<<at_filename<<"\nOBJECTS:=";
@@ -469,16 +544,22 @@ void DllBuild::prep(string basename, string subdir/*="."*/){
                 objects<<" \\\n\t"<<object; // add to makefile OBJECTS:=
                 at_file<<object<<"\n";      // also add to @FILE to circumvent command line limits
                 deps<<"\n"<<object<<": "<<dfSourceFile;
+                if(object.rfind("_unroll-ve.o")==object.size()-12)
+                    deps<<" | "<<object<<".rename"; // 'hello' is not ordered under make -j
                 // What object file types do we recognize?
                 if(object.rfind("_unroll-ve.o")==object.size()-12){
                     ostringstream rename;
                     for(auto const& sd: df.syms){ // SymbolDecl
+                        if(sd.symbol.compare(0,7,"unroll_")==0
+                                && hasSym(df.syms, sd.symbol.substr(7)))
+                            continue;   // sd is itself an altsym (prep ran before)
                         string altname = "unroll_"+sd.symbol;
                         string altfwd = sd.fwddecl;
                         size_t fnLoc = altfwd.find(sd.symbol);
                         if(fnLoc != string::npos)
                             altfwd.replace(fnLoc, sd.symbol.length(), altname);
-                        altsyms.emplace_back(altname,"unrolled version",altfwd);
+                        if(!hasSym(df.syms, altname))
+                            altsyms.emplace_back(altname,"unrolled version",altfwd);
                         rename<<"\techo '"<<sd.symbol<<" "<<altname<<"' >> $@\n";
                     }
                     string renames = rename.str();
@@ -501,7 +582,10 @@ void DllBuild::prep(string basename, string subdir/*="."*/){
             }
 
             df.abspath = dir.abspath+'/'+dfSourceFile;
-            df.write(this->dir);            // source file input (throw if err)
+            if(writeFiles){
+                df.write(this->dir);        // source file input (throw if err)
+                prof.bytes += df.textSize();
+            }
         }
         mkfile<<"\n#sources\n"<<sources.str()<<endl;
         mkfile<<"\n#deps   \n"<<deps   .str()<<endl;
@@ -513,6 +597,10 @@ void DllBuild::prep(string basename, string subdir/*="."*/){
     }
     mkfile<<"\n# end of customized prologue.  Follow by standard build recipes from bin.mk\n";
     mkfile << bin_mk_file_to_string() << "\n#";
+    if(!writeFiles){
+        prepped = true;
+        return;
+    }
     { // write mkfile to <dir.abspath>/<mkfname>
         std::string absmkfile;
         try{
@@ -521,6 +609,7 @@ void DllBuild::prep(string basename, string subdir/*="."*/){
             if(ofs){
                 //ofs << mkfile.rdbuf();
                 ofs << mkfile.str();
+                prof.bytes += mkfile.str().size();
                 ofs.flush();
                 ofs.close();
             }else{
@@ -543,6 +632,7 @@ void DllBuild::prep(string basename, string subdir/*="."*/){
             if(ofs){
                 //ofs << mkfile.rdbuf();
                 ofs << at_file.str();
+                prof.bytes += at_file.str().size();
                 ofs.flush();
                 ofs.close();
             }else{
@@ -565,6 +655,70 @@ void DllBuild::prep(string basename, string subdir/*="."*/){
     }
     prepped = true;
 }
+/** Does \c sd name a function?  With no \c fwddecl we assume a kernel, as
+ * before; otherwise the symbol must be followed by a parameter list, so
+ * data such as <tt>extern int const n</tt> or <tt>T (*tbl[])(void)</tt> is not. */
+static bool isFunctionSym( SymbolDecl const& sd ){
+    if(sd.fwddecl.empty()) return true;
+    for(size_t p = sd.fwddecl.find(sd.symbol); p != string::npos;
+            p = sd.fwddecl.find(sd.symbol, p+1)){
+        size_t const e = p + sd.symbol.size();
+        if(p > 0 && (isalnum((unsigned char)sd.fwddecl[p-1]) || sd.fwddecl[p-1]=='_'))
+            continue;
+        size_t const q = sd.fwddecl.find_first_not_of(" \t", e);
+        if(q != string::npos && sd.fwddecl[q] == '(') return true;
+    }
+    return false;
+}
+void DllBuild::add_dispatch(){
+    std::string const dbase = this->basename+"_dispatch";
+    bool x86 = false;
+    for(auto it=begin(); it!=end(); ){
+        if(it->basename == dbase){ it = erase(it); continue; } // from a previous prep
+        if(it->suffix.find("-x86") != string::npos) x86 = true;
+        ++it;
+    }
+    std::map<int,std::string> bytag;
+    for(auto const& df: *this){
+        if(df.syms.empty()) continue;
+        if(df.tag < 0){
+            cout<<" Warning: dispatch table skips "<<df.basename<<df.suffix
+                <<" (tag "<<df.tag<<" < 0)"<<endl;
+            continue;
+        }
+        auto const fn = std::find_if(df.syms.begin(), df.syms.end(), isFunctionSym);
+        if(fn == df.syms.end()){
+            cout<<" Warning: dispatch table skips "<<df.basename<<df.suffix
+                <<" (no function symbol)"<<endl;
+            continue;
+        }
+        if(!bytag.insert(make_pair(df.tag, fn->symbol)).second)
+            THROW(" dispatch table: duplicate DllFile::tag "<<df.tag);
+    }
+    int const n = bytag.empty()? 0: bytag.rbegin()->first + 1;
+    ostringstream code;
+    for(auto const& t: bytag)
+        code<<"extern void "<<t.second<<"(void);\n";
+    code<<"void (*const "<<dispatch<<"[])(void) = {";
+    for(int t=0; t<n; ++t){
+        auto const found = bytag.find(t);
+        code<<(t%4? " ": "\n    ")<<(found==bytag.end()? std::string("0"): found->second)<<",";
+    }
+    if(n==0) code<<"0";
+    code<<"\n};\nint const "<<dispatch<<"_size = "<<n<<";\n";
+
+    DllFile df;
+    df.tag = -1;
+    df.basename = dbase;
+    df.suffix = (x86? "-x86.c": "-ncc.c");
+    df.comment = "// generated dispatch table "+dispatch+"[DllFile::tag]";
+    df.code = code.str();
+    df.syms.push_back(SymbolDecl(dispatch, "DllFile::tag --> first function of that DllFile",
+                "extern void (*const "+dispatch+"[])(void)"));
+    df.syms.push_back(SymbolDecl(dispatch+"_size", "dispatch table size",
+                "extern int const "+dispatch+"_size"));
+    push_back(df);
+}
 void DllBuild::skip_prep(string basename, string subdir/*="."*/){
     if(empty()){
         if(verbose>0) cout<<" Nothing to do for dll "<<basename<<endl;
@@ -660,15 +814,26 @@ void DllBuild::make(std::string env){
     int const v = this->verbose;
     if(!prepped)
         THROW("Please prep(basename,dir) before make()");
+    if(direct || memory){
+        if(make_direct(env)) return;
+        if(memory){ // fall back to a build in files
+            string const b = basename, d = dir.subdir;
+            prep(b, d);
+        }
+    }
+    JitProfScope prof("dllbuild.make");
     std::string mklog = dir.abspath+"/"+mkfname+".log";
-    string mk = env+" make VERBOSE=1 -C "+dir.abspath+" -f "+mkfname;
+    string mk = env+" make VERBOSE=1 -j"+std::to_string(jobs>0? jobs: 1)
+        +" -C "+dir.abspath+" -f "+mkfname;
     if(v>0){cout<<" Make command: "<<mk<<endl; cout.flush();}
     //system(("ls -l "+dir.abspath).c_str()); // <-- unsafe c_str usage
     int bad = try_make(mk,mklog,v);
+    ++prof.procs;
     if(bad){
         mklog.append("2");
         if(v>0) cout<<"Trying make once again... "<<endl;
         bad = try_make(mk, mklog, this->verbose);
+        ++prof.procs;
         if(bad){
             cout<<"BUILD ERROR! see "<<mklog<<endl;
             THROW("Build error");
@@ -694,7 +859,17 @@ void DllBuild::skip_make(std::string env){
     }
     made = true;
 }
-DllOpen::DllOpen() : basename(), libHandle(nullptr), dlsyms(), libname(), files() {
+/** an open memfd, closed when the last DllBuild or DllOpen referring to it goes away */
+struct MemFd {
+    MemFd(int fd) : fd(fd) {}
+    MemFd(MemFd const&) = delete;
+    MemFd& operator=(MemFd const&) = delete;
+    ~MemFd(){ if(fd>=0) close(fd); }
+    int const fd;
+};
+DllOpen::DllOpen() : basename(), libHandle(nullptr), memLib(), dlsyms(),
+    symidx(), symaddr(), symname(), dispatchTable(nullptr), dispatchSize(0U),
+    libname(), files() {
 #if 0
     cout<<" +DllOpen"; cout.flush();
 #endif
@@ -707,6 +882,14 @@ DllOpen::~DllOpen() {
     if(v){cout<<" back from dlclose\n"; cout.flush();}
     //files.clear();
 }
+bool DllOpen::addSym(std::string const& name, void* addr){
+    if(!dlsyms.insert(make_pair(name,addr)).second)
+        return false;
+    symidx.insert(make_pair(name, (uint32_t)symaddr.size()));
+    symaddr.push_back(addr);
+    symname.push_back(name);
+    return true;
+}
 // When inlined from cblock.hpp I got linker errors (std::string::size multiple defn of Cblock::append or so !!!!!)
 static std::ostream& prefix_lines(std::ostream& os, std::string code,
         std::string prefix, std::string sep=std::string("\n")){
@@ -742,6 +925,7 @@ std::unique_ptr<DllOpen> DllBuild::dllopen(){
     int const v = this->verbose;
     //using cprog::prefix_lines;
     if(v)cout<<"*** DllBuild::dllopen() BEGINS"<<endl;
+    JitProfScope prof("dllbuild.dllopen");
     if(!(prepped and made))
         THROW("Please prep(basename,dir) and make() before you dllopen()");
     std::unique_ptr<DllOpen> pRet( new DllOpen );
@@ -790,6 +974,9 @@ std::unique_ptr<DllOpen> DllBuild::dllopen(){
     return pRet;
 #endif
 
+    if(memory) // keep the library memfd (and so its path) for the life of the handle
+        for(auto const& m: memfds)
+            if("/proc/self/fd/"+std::to_string(m->fd) == fullpath) ret.memLib = m;
     if(v>1){cout<<"now dlopen..."<<endl; cout.flush();}
     ret.libHandle = dlopen(fullpath.c_str(), RTLD_LAZY);
     if(v>0){cout<<"DllBuild::dllopen() dlopen(fullpath, RTLD_LAZY) OK"<<endl; cout.flush();}
@@ -800,6 +987,16 @@ std::unique_ptr<DllOpen> DllBuild::dllopen(){
     //
     int nerr=0; // symbol load error count
     if(v>0){cout<<"Library: "<<this->libname<<endl; cout.flush();}
+#if JIT_DLFUNCS
+    if(allsyms){ // every exported symbol, in one pass over the ELF dynamic symbol table
+        size_t const n = dl_symbols(ret.libHandle,
+                [](void* arg, char const* name, void* addr){
+                    static_cast<DllOpen*>(arg)->addSym(name, addr);
+                }, &ret);
+        if(v>0){cout<<"   Loaded "<<n<<" exported symbols"<<endl; cout.flush();}
+    }
+#endif
+    std::unordered_map<std::string,size_t> declared; // symbol --> DllFile index
     ret.dlsyms_num.resize(this->size()); // create 'i'-->vector<symbolName> entries
     for(size_t i=0U; i<this->size(); ++i) // for each source file
     {
@@ -811,9 +1008,18 @@ std::unique_ptr<DllOpen> DllBuild::dllopen(){
         }
         ret.files.push_back(filepath);
         ret.tag.push_back(df.tag);
+        bool const viaTable = dispatchOnly && !dispatch.empty()
+            && df.basename != basename+"_dispatch";
         for(auto const &sym: df.syms){
+            if(viaTable && !allsyms){ // only the table itself needs dlsym
+                ret.dlsyms_num[i].push_back(sym.symbol);
+                continue;
+            }
+            auto const bulk = ret.dlsyms.find(sym.symbol);
+            void* addr = nullptr;
             dlerror(); // clear previous error [if any]
-            void* addr = dlsym(ret.libHandle, sym.symbol.c_str());
+            if(bulk != ret.dlsyms.end()) addr = bulk->second;
+            else addr = dlsym(ret.libHandle, sym.symbol.c_str());
             if(v>0){
                 cout<<"   Symbol: "<<sym.symbol<<" @ "<<addr<<"\n";
                 if(!sym.comment.empty())
@@ -827,19 +1033,509 @@ std::unique_ptr<DllOpen> DllBuild::dllopen(){
                 cout<<"**Error: could not load symbol "<<sym.symbol<<endl;
                 ++nerr;
             }
-            if(ret.dlsyms.find(sym.symbol)!=ret.dlsyms.end()){
+            if(!declared.insert(make_pair(sym.symbol,i)).second){
                 cout<<"**Error: duplicate symbol "<<sym.symbol<<endl;
                 ++nerr;
             }
-            ret.dlsyms.insert(make_pair(sym.symbol,addr));
+            ret.addSym(sym.symbol,addr);
             ret.dlsyms_num[i].push_back(sym.symbol);
         }
     }
+    if(!dispatch.empty() && nerr==0){
+        ret.dispatchTable = reinterpret_cast<void (*const*)(void)>(ret[dispatch]);
+        ret.dispatchSize = (size_t)*static_cast<int const*>(ret[dispatch+"_size"]);
+        if(v>0){cout<<"   Dispatch table "<<dispatch<<"["<<ret.dispatchSize<<"]"<<endl;}
+    }
     if(v){cout<<"*** DllBuild::dllopen() DONE : nerr="<<nerr<<endl; cout.flush();}
     if(nerr) THROW(nerr<<" symbol load errors from "<<libname);
     return pRet;
 }
 
+/** Direct (make-less) builds.
+ *
+ * The recipes below mirror the bin.mk pattern rules, but run each compiler
+ * with \c posix_spawnp, using absolute paths, with merged stdout/stderr read
+ * back through a pipe.  Keep them in sync with bin.mk.
+ */
+std::string DllBuildStep::cmd() const {
+    std::string ret;
+    for(auto const& a: argv){
+        if(!ret.empty()) ret.push_back(' ');
+        if(a.find_first_of(" \t'\"*?$") == std::string::npos) ret.append(a);
+        else ret.append("'").append(a).append("'");
+    }
+    return ret;
+}
+/** split \c s into words, honoring '...', "..." and backslash quoting */
+static std::vector<std::string> shellWords(std::string const& s){
+    std::vector<std::string> ret;
+    std::string w;
+    bool inword = false;
+    for(size_t i=0U; i<s.size(); ++i){
+        char const c = s[i];
+        if(c=='\''){
+            size_t const e = s.find('\'',i+1);
+            if(e==std::string::npos) THROW("unterminated ' in \""<<s<<"\"");
+            w.append(s, i+1, e-i-1);
+            i = e;
+            inword = true;
+        }else if(c=='"'){
+            for(++i; i<s.size() && s[i]!='"'; ++i){
+                if(s[i]=='\\' && i+1<s.size()) ++i;
+                w.push_back(s[i]);
+            }
+            if(i>=s.size()) THROW("unterminated \" in \""<<s<<"\"");
+            inword = true;
+        }else if(c=='\\' && i+1<s.size()){
+            w.push_back(s[++i]);
+            inword = true;
+        }else if(isspace((unsigned char)c)){
+            if(inword) ret.push_back(w);
+            w.clear();
+            inword = false;
+        }else{
+            w.push_back(c);
+            inword = true;
+        }
+    }
+    if(inword) ret.push_back(w);
+    return ret;
+}
+/** bin.mk variables: 'make' command-line style \c env overrides, then environment */
+struct MkVars {
+    MkVars(std::string const& env, int const v){
+        for(auto const& w: shellWords(env)){
+            size_t const eq = w.find('=');
+            if(eq==std::string::npos || eq==0U){
+                if(v>0) cout<<" make_direct: ignoring env word "<<w<<endl;
+                continue;
+            }
+            over[w.substr(0,eq)] = w.substr(eq+1);
+        }
+    }
+    std::string get(std::string const& name, std::string const& dflt="") const {
+        auto const o = over.find(name);
+        if(o != over.end()) return o->second;
+        char const* e = getenv(name.c_str());
+        return e? std::string(e): dflt;
+    }
+    /** environ, with overrides replaced or appended (for child processes) */
+    std::vector<std::string> environment() const {
+        std::vector<std::string> ret;
+        for(char** e = environ; *e; ++e){
+            std::string const kv(*e);
+            if(over.find(kv.substr(0,kv.find('='))) == over.end())
+                ret.push_back(kv);
+        }
+        for(auto const& o: over) ret.push_back(o.first+"="+o.second);
+        return ret;
+    }
+    std::map<std::string,std::string> over;
+};
+static std::vector<std::string> filterOut(std::vector<std::string> words,
+        std::string const& out){
+    words.erase(std::remove(words.begin(), words.end(), out), words.end());
+    return words;
+}
+static std::vector<std::string>& operator+=(std::vector<std::string>& a,
+        std::vector<std::string> const& b){
+    a.insert(a.end(), b.begin(), b.end());
+    return a;
+}
+static bool olderThan(std::string const& target, std::string const& dep){
+    struct stat t, d;
+    if(stat(target.c_str(),&t)) return true;
+    if(stat(dep.c_str(),&d)) return true;
+    return t.st_mtim.tv_sec < d.st_mtim.tv_sec
+        || (t.st_mtim.tv_sec == d.st_mtim.tv_sec && t.st_mtim.tv_nsec < d.st_mtim.tv_nsec);
+}
+/** run \c step.argv with \c envp, collecting output and exit status.
+ * \c stage names the \c JitProf counter ("dllbuild.compile" or "dllbuild.link"). */
+static void runStep(DllBuildStep& step, char* const* envp, char const* stage){
+    JitProfScope prof(stage);
+    std::vector<char*> argv;
+    for(auto& a: step.argv) argv.push_back(&a[0]);
+    argv.push_back(nullptr);
+    int fds[2];
+    if(pipe2(fds, O_CLOEXEC)){
+        step.status = -1;
+        step.output = "pipe2 failed: "+std::string(strerror(errno));
+        return;
+    }
+    posix_spawn_file_actions_t fa;
+    posix_spawn_file_actions_init(&fa);
+    posix_spawn_file_actions_adddup2(&fa, fds[1], 1);
+    posix_spawn_file_actions_adddup2(&fa, fds[1], 2);
+    double const t0 = __clock();
+    pid_t pid;
+    int err = 0;
+    for(int tries=0; tries<3; ++tries){ // only transient spawn failures are retried
+        err = posix_spawnp(&pid, argv[0], &fa, nullptr, argv.data(), envp);
+        if(err != EAGAIN && err != ENOMEM && err != EINTR) break;
+    }
+    posix_spawn_file_actions_destroy(&fa);
+    close(fds[1]);
+    prof.procs = (err? 0U: 1U);
+    if(err){
+        close(fds[0]);
+        step.status = -1;
+        step.output = "posix_spawnp "+step.argv[0]+": "+std::string(strerror(err));
+        return;
+    }
+    char buf[4096];
+    ssize_t n;
+    while((n = read(fds[0], buf, sizeof buf)) != 0){
+        if(n>0) step.output.append(buf, (size_t)n);
+        else if(errno != EINTR) break;
+    }
+    close(fds[0]);
+    int wstatus = 0;
+    while(waitpid(pid, &wstatus, 0) == -1 && errno == EINTR)
+        ;
+    step.status = WIFEXITED(wstatus)? WEXITSTATUS(wstatus): 128+WTERMSIG(wstatus);
+    step.seconds = __clock() - t0;
+    struct stat st;
+    if(step.status == 0 && stat(step.target.c_str(), &st) == 0)
+        prof.bytes = (uint64_t)st.st_size;
+}
+std::string DllBuild::memfile(std::string const& name, std::string const& content){
+#if defined(MFD_CLOEXEC)
+    // no MFD_CLOEXEC: compilers and linkers must inherit it to use the path
+    int const fd = memfd_create(name.c_str(), 0);
+    if(fd == -1) THROW("memfd_create("<<name<<") failed: "<<strerror(errno));
+    memfds.push_back(std::make_shared<MemFd>(fd));
+    for(size_t done=0U; done<content.size(); ){
+        ssize_t const n = write(fd, content.data()+done, content.size()-done);
+        if(n<0 && errno==EINTR) continue;
+        if(n<0) THROW("write to memfd "<<name<<" failed: "<<strerror(errno));
+        done += (size_t)n;
+    }
+    return "/proc/self/fd/"+std::to_string(fd);
+#else
+    THROW("DllBuild::memory needs memfd_create ("<<name<<")");
+#endif
+}
+bool DllBuild::make_direct(std::string env){
+    int const v = this->verbose;
+    if(!prepped)
+        THROW("Please prep(basename,dir) before make_direct()");
+    steps.clear();
+    MkVars const mk(env, v);
+    auto words = [&mk](std::string const& name, std::string const& dflt=""){
+        return shellWords(mk.get(name,dflt));
+    };
+    // tools and flags, as in bin.mk
+    auto const ncc = words("NCC","ncc"), ncxx = words("NCXX","nc++");
+    auto const clang = words("CLANG","clang"), cxxlang = words("CXXLANG","clang++");
+    auto const gcc = words("GCC","gcc"), gcxx = words("GCXX","g++");
+    auto const cflags = shellWords("-O2 -fPIC "+mk.get("CFLAGS"));
+    auto const cxxflags = shellWords("-std=c++11 -O2 -fPIC "+mk.get("CXXFLAGS"));
+    auto const c86flags = shellWords("-O2 "+mk.get("C86FLAGS"));
+    auto const cxx86flags = shellWords("-std=c++11 -O2 "+mk.get("CXX86FLAGS"));
+    std::vector<std::string> clang_flags, cxxlang_flags;
+    {
+        auto clangf = words("CLANG_FLAGS");
+        clangf += cflags;
+        clangf = filterOut(clangf, "-O2");
+        auto const cxxlangf = clangf;     // sic: bin.mk derives this from CLANG_FLAGS
+        auto const prefix = shellWords("-target linux-ve -O3 -mllvm "+mk.get("CLANG_VI_FLAGS",
+                    "-show-spill-message-vec -fno-vectorize -fno-unroll-loops"
+                    " -fno-slp-vectorize -fno-crash-diagnostics"));
+        clang_flags = prefix;   clang_flags += clangf;
+        cxxlang_flags = prefix; cxxlang_flags += cxxlangf;
+        cxxlang_flags = filterOut(cxxlang_flags, "-std=c++11");
+    }
+    auto const clang_unroll = words("CLANG_UNROLL");
+    auto const nobjcopy = words("NOBJCOPY","nobjcopy");
+
+    // one chain of steps per object, plus the final link
+    auto step = [](std::string target, std::vector<std::string> a,
+            std::vector<std::string> const& b, std::vector<std::string> c){
+        DllBuildStep s;
+        s.target = target;
+        s.argv = a; s.argv += b; s.argv += c;
+        return s;
+    };
+    std::vector<std::vector<DllBuildStep>> chains;
+    std::vector<std::string> objs;  // absolute paths, for the link
+    bool x86 = false;
+    auto endsWith = [](std::string const& s, std::string const& suf){
+        return s.size()>=suf.size() && s.compare(s.size()-suf.size(),suf.size(),suf)==0;
+    };
+    // memory: sources, objects, @FILE and library are memfd files (see memfile)
+    memfds.clear();
+    auto out = [this](std::string const& path){
+        return memory? memfile(path.substr(path.rfind('/')+1)): path;
+    };
+    for(auto const& df: *this){
+        string const src = dir.abspath+"/"+df.basename+df.suffix;
+        string const srcp = memory? memfile(df.basename+df.suffix): src;
+        if(memory) df.write(memfds.back()->fd, "#line 1 \""+src+"\"\n");
+        // memfd paths have no suffix, so name the source language
+        auto in = [this,&srcp](char const* lang){
+            return memory? std::vector<std::string>{"-x",lang,srcp}
+            : std::vector<std::string>{srcp};
+        };
+        auto cc = [&in](char const* lang, std::string const& o){
+            std::vector<std::string> ret{"-fPIC","-c"};
+            ret += in(lang);
+            ret += {"-o", o};
+            return ret;
+        };
+        for(auto const& object: df.objects){
+            string const o = out(dir.abspath+"/"+object);
+            objs.push_back(o);
+            if(endsWith(object,"-x86.o")) x86 = true;
+            std::vector<DllBuildStep> chain;
+            if(endsWith(src,"-x86.c")){
+                chain.push_back(step(o, gcc, c86flags, cc("c",o)));
+            }else if(endsWith(src,"-x86.cpp")){
+                chain.push_back(step(o, gcxx, cxx86flags, cc("c++",o)));
+            }else if(endsWith(src,"-ncc.c")){
+                chain.push_back(step(o, ncc, cflags, cc("c",o)));
+            }else if(endsWith(src,"-ncc.cpp")){
+                chain.push_back(step(o, ncxx, cxxflags, cc("c++",o)));
+            }else if(endsWith(src,"-clang.c")){
+                chain.push_back(step(o, clang, clang_flags, cc("c",o)));
+            }else if(endsWith(src,"-clang.cpp") || endsWith(src,"-vi.cpp")){
+                chain.push_back(step(o, cxxlang, cxxlang_flags, cc("c++",o)));
+            }else if(endsWith(src,"-vi.c") && endsWith(object,"_unroll-ve.o") && !memory){
+                string const stem = src.substr(0, src.size()-5);
+                string const base = df.basename+df.suffix.substr(0, df.suffix.size()-5);
+                string const asmf = stem+"_unroll-vi.s", tmp = o+".tmp";
+                auto unroll = clang_flags;
+                unroll += {"-funroll-loops", "-Rpass=loop.*"};
+                unroll += clang_unroll;
+                chain.push_back(step(asmf, clang, unroll, {"-S",src,"-o",asmf}));
+                chain.push_back(step(tmp, ncc, cflags, {"-fPIC","-o",tmp,"-c",asmf}));
+                // the .rename file that bin.mk has 'make' echo, written here directly
+                ostringstream renames;
+                for(auto const& sd: df.syms)
+                    if(hasSym(df.syms, "unroll_"+sd.symbol))
+                        renames<<sd.symbol<<" unroll_"<<sd.symbol<<"\n";
+                if(!renames.str().empty()){
+                    string const renameFile = o+".rename";
+                    ofstream(renameFile)<<renames.str();
+                    chain.push_back(step(o, nobjcopy, {"--redefine-syms", renameFile}, {tmp, o}));
+                }else{
+                    chain.push_back(step(o, nobjcopy, {"--redefine-sym", base+"="+base+"_unroll"}, {tmp, o}));
+                }
+            }else if(endsWith(src,"-vi.c") && !endsWith(object,"_unroll-ve.o")){
+                string const asmf = out(src.substr(0, src.size()-5)+"-vi.s");
+                std::vector<std::string> S{"-fPIC","-S"};
+                S += in("c");
+                S += {"-o", asmf};
+                chain.push_back(step(asmf, clang, clang_flags, S));
+                std::vector<std::string> c{"-o",o,"-c"};
+                if(memory) c += {"-x","assembler"};
+                c.push_back(asmf);
+                chain.push_back(step(o, ncc, cflags, c));
+            }else{
+                // .s/.S, or objcopy renames (objcopy cannot write a memfd path)
+                if(v>0) cout<<" make_direct: no "<<(memory?"in-memory ":"")
+                    <<"direct recipe for "<<object<<endl;
+                memfds.clear();
+                return false;
+            }
+            if(!memory && !olderThan(o, src)){
+                if(v>1) cout<<" make_direct: "<<object<<" is up to date"<<endl;
+                continue;
+            }
+            chains.push_back(chain);
+        }
+    }
+    DllBuildStep linkStep;
+    bool relink = false;
+    { // link, as in bin.mk (gcc for x86, nc++ for VE), object list via @FILE
+        string atfile = dir.abspath+"/"+basename+".OBJECTS_ABS";
+        ostringstream list;
+        for(auto const& o: objs) list<<o<<"\n";
+        if(memory){
+            atfile = memfile(basename+".OBJECTS", list.str());
+            fullpath = memfile(libname);
+        }else{
+            ofstream ofs(atfile);
+            ofs<<list.str();
+            if(!ofs) THROW(" Trouble writing "<<atfile);
+        }
+        auto link = x86? std::vector<std::string>{"gcc"}
+        : std::vector<std::string>{"nc++", "-std=c++11"};
+        link += {"-shared", "-o", fullpath, "-fPIC", "-Wl,-rpath="+dir.abspath, "-L"+dir.abspath};
+        link += words("LDFLAGS");
+        link += words("LIBFLAGS");
+        if(!x86) link.push_back("-Wl,--copy-dt-needed-entries");
+        link.push_back("@"+atfile);
+        linkStep.target = fullpath;
+        linkStep.argv = link;
+        relink = !chains.empty() || memory;
+        for(auto const& o: objs) relink = relink || olderThan(fullpath, o);
+    }
+
+    std::vector<std::string> envs = mk.environment();
+    std::vector<char*> envp;
+    for(auto& e: envs) envp.push_back(&e[0]);
+    envp.push_back(nullptr);
+
+    auto runChain = [&](std::vector<DllBuildStep>& chain, char const* stage){
+        for(auto& s: chain){
+            s.status = -1;
+            s.output.clear();
+            if(v>0){ std::string const c = " "+s.cmd()+"\n"; cout<<c; cout.flush(); }
+            runStep(s, envp.data(), stage);
+            if(s.status) break;
+        }
+    };
+    auto done = [](std::vector<DllBuildStep> const& chain){
+        for(auto const& s: chain) if(s.status) return false;
+        return true;
+    };
+    // compile unfinished object chains concurrently, then link
+    auto pass = [&](){
+        std::vector<size_t> todo;
+        for(size_t c=0U; c<chains.size(); ++c) if(!done(chains[c])) todo.push_back(c);
+        size_t const nthreads = std::min(todo.size(), (size_t)(jobs>0? jobs: 1));
+        std::atomic<size_t> next(0U);
+        auto worker = [&](){
+            for(size_t i; (i = next++) < todo.size(); )
+                runChain(chains[todo[i]], "dllbuild.compile");
+        };
+        std::vector<std::thread> pool;
+        for(size_t t=1U; t<nthreads; ++t) pool.emplace_back(worker);
+        if(nthreads) worker();
+        for(auto& t: pool) t.join();
+        for(auto const& c: chains) if(!done(c)) return false;
+        if(relink && linkStep.status){
+            std::vector<DllBuildStep> l{linkStep};
+            runChain(l, "dllbuild.link");
+            linkStep = l[0];
+        }
+        return !relink || linkStep.status == 0;
+    };
+    double const t0 = __clock();
+    // no second pass: a compiler exit status is not transient (runStep retries spawns)
+    bool const ok = pass();
+    // compilers and linker are done with the memfd paths: stop leaking them to later children
+    for(auto const& m: memfds) fcntl(m->fd, F_SETFD, FD_CLOEXEC);
+    for(auto const& c: chains) steps.insert(steps.end(), c.begin(), c.end());
+    if(relink) steps.push_back(linkStep);
+    if(!ok){
+        if(!memory){ // no partial objects/library that would look up to date next time
+            for(auto const& c: chains) if(!done(c)) for(auto const& s: c) unlink(s.target.c_str());
+            if(relink && linkStep.status) unlink(fullpath.c_str());
+        }
+        std::vector<DllBuildStep> fails;
+        for(auto const& s: steps) // failed, not just skipped after a failure
+            if(s.status && !(s.status==-1 && s.output.empty())) fails.push_back(s);
+        ostringstream oss;
+        oss<<" Build error: "<<fails.size()<<" failed step(s) building "<<libname;
+        for(auto const& f: fails)
+            oss<<"\n  status "<<f.status<<": "<<f.cmd()<<"\n"<<f.output;
+        cout<<oss.str()<<endl;
+        throw DllBuildError(oss.str(), fails);
+    }
+    if(v>1) for(auto const& s: steps) if(!s.output.empty())
+        cout<<" "<<s.target<<":\n"<<s.output<<endl;
+    if(v>0){
+        // per-file compile time: sum over each object's chain of steps
+        std::map<std::string,double> perFile;
+        for(auto const& df: *this)
+            for(auto const& object: df.objects)
+                for(auto const& c: chains)
+                    if(c.back().target == dir.abspath+"/"+object)
+                        for(auto const& s: c) perFile[df.basename+df.suffix] += s.seconds;
+        for(auto const& f: perFile)
+            cout<<"   "<<std::setw(8)<<std::fixed<<std::setprecision(3)<<f.second<<" s  "<<f.first<<"\n";
+        if(relink)
+            cout<<"   "<<std::setw(8)<<linkStep.seconds<<" s  (link) "<<libname<<"\n";
+        cout<<" make_direct built "<<fullpath<<" ("<<steps.size()<<" steps, -j"<<jobs
+            <<", "<<__clock()-t0<<" s)"<<std::defaultfloat<<endl;
+    }
+    made = true;
+    return true;
+}
+
+/** bounded pool of threads running \c create_async builds */
+namespace {
+struct AsyncPool {
+    AsyncPool() : mtx(), cv(), q(), threads(), maxThreads(2), stop(false) {
+        char const* w = getenv("VEJIT_DLLBUILD_WORKERS");
+        if(w && atoi(w)>0) maxThreads = (size_t)atoi(w);
+    }
+    ~AsyncPool(){ shutdown(); } // late fallback: prefer DllBuild::async_shutdown
+    /** run remaining builds (so no future is left broken), join the workers.
+     * Later \c submit calls start new workers. */
+    void shutdown(){
+        std::vector<std::thread> joining;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            for(auto const& t: threads)
+                if(t.get_id() == std::this_thread::get_id())
+                    THROW("DllBuild::async_shutdown from a compile worker (ex. onReady)");
+            stop = true;
+            joining.swap(threads);
+        }
+        cv.notify_all();
+        for(auto& t: joining) t.join();
+        std::lock_guard<std::mutex> lock(mtx);
+        stop = false;
+    }
+    void submit(std::function<void()> job){
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            q.push_back(std::move(job));
+            if(threads.size() < maxThreads)     // start workers lazily
+                threads.emplace_back([this](){ work(); });
+        }
+        cv.notify_one();
+    }
+    void work(){
+        for(;;){
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                cv.wait(lock, [this](){ return stop || !q.empty(); });
+                if(q.empty()) return;           // stop, and nothing left
+                job = std::move(q.front());
+                q.pop_front();
+            }
+            job();
+        }
+    }
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::deque<std::function<void()>> q;
+    std::vector<std::thread> threads;
+    size_t maxThreads;
+    bool stop;
+};
+AsyncPool& asyncPool(){
+    static AsyncPool pool;
+    return pool;
+}
+}//anon::
+void DllBuild::async_workers(int n){
+    AsyncPool& pool = asyncPool();
+    std::lock_guard<std::mutex> lock(pool.mtx);
+    pool.maxThreads = (size_t)(n>0? n: 1);
+}
+void DllBuild::async_shutdown(){
+    asyncPool().shutdown();
+}
+std::shared_future<std::shared_ptr<DllOpen>> DllBuild::create_async(
+        std::string basename, std::string dir, std::string env,
+        std::function<void(std::shared_ptr<DllOpen> const&)> onReady) const {
+    auto build = std::make_shared<DllBuild>(*this);
+    auto task = std::make_shared<std::packaged_task<std::shared_ptr<DllOpen>()>>(
+            [build,basename,dir,env,onReady](){
+                std::shared_ptr<DllOpen> lib(build->create(basename, dir, env));
+                if(onReady) onReady(lib);
+                return lib;
+            });
+    std::shared_future<std::shared_ptr<DllOpen>> ret = task->get_future().share();
+    asyncPool().submit([task](){ (*task)(); });
+    return ret;
+}
+
 std::unique_ptr<DllOpen> DllBuild::safe_create(
         std::string basename,
         std::string dir /*="."*/ ,
@@ -864,6 +1560,231 @@ std::unique_ptr<DllOpen> DllBuild::safe_create(
     return ret;
 }
 
+/** FNV-1a of a length-prefixed field, so ("ab","c") and ("a","bc") differ. */
+static void fnv1a(uint64_t& h, std::string const& s){
+    uint64_t const prime = 0x100000001b3ULL;
+    uint64_t const n = s.size();
+    for(int i=0; i<8; ++i){ h ^= (n>>(8*i)) & 0xff; h *= prime; }
+    for(unsigned char const c: s){ h ^= c; h *= prime; }
+}
+/** bin.mk variables that change what the compile/link recipes produce */
+static char const* const cache_env_vars[] = {
+    "CC", "CXX", "NCC", "NCXX", "CLANG", "CXXLANG", "GCC", "GCXX",
+    "CFLAGS", "CXXFLAGS", "CLANG_FLAGS", "CXXLANG_FLAGS", "C86FLAGS", "CXX86FLAGS",
+    "CLANG_VI_FLAGS", "CLANG_UNROLL", "LDFLAGS", "LIBFLAGS", nullptr };
+
+std::string DllBuild::cache_default_dir(){
+    char const* d = getenv("VEJIT_DLLCACHE");
+    return d? std::string(d): std::string();
+}
+int DllBuild::jobs_default(){
+    char const* j = getenv("VEJIT_DLLBUILD_JOBS");
+    long const n = j? strtol(j,nullptr,0): sysconf(_SC_NPROCESSORS_ONLN);
+    return n>0? (int)n: 1;
+}
+size_t DllBuild::cache_default_max(){
+    char const* m = getenv("VEJIT_DLLCACHE_MAX");
+    return m? (size_t)strtoull(m,nullptr,0): size_t{1}<<30;
+}
+/** bin.mk compiler variables and default commands (\c make_direct tools, linkers) */
+static char const* const cache_compilers[][2] = {
+    {"NCC","ncc"}, {"NCXX","nc++"}, {"CLANG","clang"}, {"CXXLANG","clang++"},
+    {"GCC","gcc"}, {"GCXX","g++"}, {nullptr,nullptr} };
+/** "path\n--version output" of compiler command \c cmd (first word of a bin.mk
+ * variable), \c cmd+": not found" if not on \c PATH.  \c --version is run
+ * once per resolved path, size and mtime (so an upgraded compiler is seen). */
+static std::string compilerIdentity(std::string const& cmd, char* const* envp){
+    std::string path;
+    if(cmd.find('/') != std::string::npos){
+        path = cmd;
+    }else if(!cmd.empty()){
+        char const* p = getenv("PATH");
+        std::istringstream dirs(p? p: "/usr/bin:/bin");
+        for(std::string d; std::getline(dirs, d, ':'); ){
+            std::string const f = (d.empty()? std::string("."): d)+"/"+cmd;
+            if(access(f.c_str(), X_OK) == 0){ path = f; break; }
+        }
+    }
+    struct stat st;
+    if(path.empty() || stat(path.c_str(), &st)) return cmd+": not found";
+    char rp[PATH_MAX];
+    if(realpath(path.c_str(), rp)) path = rp;
+    std::string const memoKey = path+" "+std::to_string((long long)st.st_size)+" "
+        +std::to_string((long long)st.st_mtim.tv_sec)+"."+std::to_string(st.st_mtim.tv_nsec);
+    static std::mutex mtx;
+    static std::map<std::string,std::string> memo;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto const m = memo.find(memoKey);
+        if(m != memo.end()) return m->second;
+    }
+    DllBuildStep step;
+    step.argv = {path, "--version"};
+    runStep(step, envp, "dllbuild.cache");
+    std::string const ret = path+"\n"+step.output
+        +(step.status? " status "+std::to_string(step.status): std::string());
+    std::lock_guard<std::mutex> lock(mtx);
+    memo[memoKey] = ret;
+    return ret;
+}
+std::string DllBuild::cache_key(std::string env) const {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    uint64_t nbytes = 0U;
+    auto add = [&h,&nbytes](std::string const& s){ fnv1a(h,s); nbytes += s.size(); };
+    add("DllBuild cache v2");
+    add(cache_salt);
+    add(dispatch);
+    add(env);
+    add(bin_mk_file_to_string());
+    for(char const* const* e = &cache_env_vars[0]; *e; ++e){
+        char const* val = getenv(*e);
+        add(*e);
+        add(val? val: "");
+    }
+    {   // the compilers themselves: path and --version
+        MkVars const mk(env, 0);
+        std::vector<std::string> envs = mk.environment();
+        std::vector<char*> envp;
+        for(auto& e: envs) envp.push_back(&e[0]);
+        envp.push_back(nullptr);
+        for(auto const* c = &cache_compilers[0]; (*c)[0]; ++c){
+            auto const w = shellWords(mk.get((*c)[0], (*c)[1]));
+            add(compilerIdentity(w.empty()? std::string(): w[0], envp.data()));
+        }
+    }
+    /** \c Cblock::emit segments into \c h (length last: not known up front) */
+    struct FnvSink : public cprog::Csink {
+        FnvSink(uint64_t& h) : h(h), n(0U) {}
+        void ref(char const* p, std::size_t const len) override {
+            for(std::size_t i=0U; i<len; ++i){ h ^= (unsigned char)p[i]; h *= 0x100000001b3ULL; }
+            n += len;
+        }
+        uint64_t& h;
+        std::size_t n;
+    };
+    for(auto const& df: *this){
+        add(df.basename);
+        add(df.suffix);
+        if(df.unit){                        // hash the streamed text, never joined
+            FnvSink fs(h);
+            df.emitCode(fs);
+            add(std::to_string(fs.n));
+            nbytes += fs.n;
+        }else{
+            add(df.code);
+        }
+        add(std::to_string(df.tag));        // add_dispatch: tag --> first function symbol
+        for(auto const& sd: df.syms){
+            add(sd.symbol);
+            add(sd.fwddecl);
+        }
+    }
+    std::ostringstream oss;
+    oss<<std::hex<<std::setfill('0')<<std::setw(16)<<h<<'-'<<nbytes;
+    return oss.str();
+}
+/** cache lookup (hit: in-memory prep + dllopen), else build and insert */
+std::unique_ptr<DllOpen> DllBuild::cache_create(
+        std::string basename, std::string subdir, std::string env){
+    int const v = this->verbose;
+    SubDir cache(cache_dir);                // create-writable, or throw
+    std::string const entry = cache.abspath+"/"+cache_key(env)+".so";
+    cached = false;
+    if(access(entry.c_str(),R_OK)==0){
+        prep(basename, subdir, false/*writeFiles*/);
+        fullpath = entry;
+        made = true;
+        try{
+            std::unique_ptr<DllOpen> ret = dllopen();
+            utimensat(AT_FDCWD, entry.c_str(), nullptr, 0); // LRU: mtime ~ last use
+            cached = true;
+            if(v>0) cout<<" DllBuild cache hit "<<entry<<endl;
+            return ret;
+        }catch(...){
+            // evicted by another process, or a bad entry: rebuild it
+            if(v>0) cout<<" DllBuild cache entry "<<entry<<" unusable, rebuilding"<<endl;
+            unlink(entry.c_str());
+            prepped = made = false;
+        }
+    }
+    if(v>0) cout<<" DllBuild cache miss "<<entry<<endl;
+    prep(basename, subdir);
+    try{
+        make(env);
+    }catch(...){
+        unlink(fullpath.c_str());           // never a partial library in the build dir
+        throw;
+    }
+    try{
+        cache_insert(entry);
+    }catch(std::exception const& e){
+        cout<<" Warning: DllBuild cache insert failed: "<<e.what()<<endl;
+    }
+    return dllopen();
+}
+void DllBuild::cache_insert(std::string const& entry) const {
+    // private tmp name in the cache dir, then atomic rename into place
+    std::string tmp = entry+".tmpXXXXXX";
+    int fd = mkstemp(&tmp[0]);
+    if(fd==-1) THROW("cannot create temporary file "<<tmp);
+    close(fd);
+    unlink(tmp.c_str());
+    if(link(fullpath.c_str(), tmp.c_str())){ // different filesystem? then copy
+        std::ifstream ifs(fullpath, ios::binary);
+        std::ofstream ofs(tmp, ios::binary);
+        ofs<<ifs.rdbuf();
+        ofs.close();
+        if(!ifs || !ofs){
+            unlink(tmp.c_str());
+            THROW("cannot copy "<<fullpath<<" to "<<tmp);
+        }
+    }
+    if(rename(tmp.c_str(), entry.c_str())){
+        unlink(tmp.c_str());
+        THROW("cannot rename "<<tmp<<" to "<<entry);
+    }
+    if(verbose>0) cout<<" DllBuild cache insert "<<entry<<endl;
+    cache_evict();
+}
+void DllBuild::cache_evict() const {
+    if(cache_max_bytes == 0U) return;
+    SubDir cache(cache_dir);
+    std::string const lockfile = cache.abspath+"/.lock";
+    int lk = open(lockfile.c_str(), O_RDWR|O_CREAT, 0666);
+    if(lk==-1) THROW("cannot open "<<lockfile);
+    flock(lk, LOCK_EX);
+    struct Entry { std::string path; time_t mtime; size_t size; };
+    std::vector<Entry> entries;
+    size_t total = 0U;
+    if(DIR* d = opendir(cache.abspath.c_str())){
+        while(struct dirent* de = readdir(d)){
+            std::string const name(de->d_name);
+            if(name.size()<4 || name.compare(name.size()-3,3,".so")!=0)
+                continue;
+            std::string const path = cache.abspath+"/"+name;
+            struct stat st;
+            if(stat(path.c_str(),&st)) continue;
+            entries.push_back(Entry{path, st.st_mtime, (size_t)st.st_size});
+            total += (size_t)st.st_size;
+        }
+        closedir(d);
+    }
+    if(total > cache_max_bytes){
+        std::sort(entries.begin(), entries.end(),
+                [](Entry const& a, Entry const& b){return a.mtime < b.mtime;});
+        // unlink is safe even if another process has the library dlopen-ed
+        for(auto const& e: entries){
+            if(total <= cache_max_bytes) break;
+            if(unlink(e.path.c_str())==0){
+                total -= e.size;
+                if(verbose>0) cout<<" DllBuild cache evict "<<e.path<<endl;
+            }
+        }
+    }
+    flock(lk, LOCK_UN);
+    close(lk);
+}
+
 void DllBuild::dump(std::ostream& os){
     os<<"\nDllBuild::dump"<<endl;
     for(auto const& dllfile: *this){
@@ -879,6 +1800,10 @@ void DllBuild::dump(std::ostream& os){
     os<<"\n  DllBuild::dir      ="<<dir.subdir; // also avail: dir.abspath
     os<<"\n  DllBuild::prepped  ="<<prepped;
     os<<"\n  DllBuild::made     ="<<made;
+    os<<"\n  DllBuild::jobs     ="<<jobs;
+    if(direct||memory) os<<"\n  DllBuild::direct   ="<<direct<<" memory="<<memory
+        <<" ("<<steps.size()<<" steps)";
+    if(!cache_dir.empty()) os<<"\n  DllBuild::cache_dir="<<cache_dir<<(cached? " (hit)": "");
     os.flush();
 }
 
@@ -1171,6 +2096,320 @@ int main(int argc,char**argv){
         cout<<" cjit_fn returned "<<cjit_fn_ret<<endl; cout.flush();
     }
 
+    if(1){ // persistent library cache: second identical build should hit
+        cout<<"\ntest: DllBuild library cache"<<endl;
+        system("rm -rf tmp-dllcache");
+        for(int pass=0; pass<2; ++pass){
+            DllBuild cbuild;
+            cbuild.cache_dir = "tmp-dllcache";
+            cbuild.push_back(tmplucky);
+            unique_ptr<DllOpen> cLib = cbuild.create(libBase, "tmp-dllbuild-cache");
+            LuckyNumberFn fn = (LuckyNumberFn)((*cLib)["myLuckyNumber"]);
+            cout<<" pass "<<pass<<" fromCache="<<cbuild.fromCache()
+                <<" key="<<cbuild.cache_key()<<" returned "<<fn()<<endl;
+            if(cbuild.fromCache() != (pass>0))
+                THROW(" DllBuild cache "<<(pass? "miss": "hit")<<" on pass "<<pass);
+            if(fn() != runtime_lucky_number)
+                THROW(" cached myLuckyNumber returned "<<fn());
+        }
+        {   // another compiler on PATH (same name, other --version) is another key
+            DllBuild kbuild;
+            kbuild.push_back(tmplucky);
+            std::string const k0 = kbuild.cache_key();
+            char cwd[PATH_MAX];
+            if(!getcwd(cwd, sizeof cwd)) THROW(" getcwd failed");
+            std::string const fake = std::string(cwd)+"/tmp-fakecc";
+            mkdir(fake.c_str(), 0755);
+            ofstream(fake+"/gcc")<<"#!/bin/sh\necho fake gcc 0.1\n";
+            chmod((fake+"/gcc").c_str(), 0755);
+            char const* path = getenv("PATH");
+            std::string const oldPath = path? path: "";
+            setenv("PATH", (fake+":"+oldPath).c_str(), 1);
+            std::string const k1 = kbuild.cache_key();
+            setenv("PATH", oldPath.c_str(), 1);
+            system("rm -rf tmp-fakecc");
+            cout<<" compiler change: key "<<k0<<" --> "<<k1<<endl;
+            if(k1 == k0) THROW(" DllBuild cache key ignores the compiler");
+        }
+        for(int pass=0; pass<2; ++pass){   // retagged kernels are another library
+            DllBuild rbuild;
+            rbuild.cache_dir = "tmp-dllcache";
+            rbuild.dispatch = "luckyRetag";
+            for(int f=0; f<2; ++f){
+                DllFile df = tmplucky;
+                string const sym = "myLuckyNumberF"+std::to_string(f);
+                df.tag = (pass? 1-f: f);
+                df.basename = libBase + "_retag" + std::to_string(f);
+                df.code = multiReplace("myLuckyNumber", sym,
+                        program_myLuckyNumber(runtime_lucky_number + 10*f));
+                df.syms.clear();
+                df.syms.push_back(SymbolDecl(sym));
+                rbuild.push_back(df);
+            }
+            unique_ptr<DllOpen> rLib = rbuild.create(libBase+"_retag", "tmp-dllbuild-cache");
+            LuckyNumberFn fn0 = rLib->byTag<LuckyNumberFn>(0);
+            int const want0 = runtime_lucky_number + (pass? 10: 0);
+            cout<<" retag pass "<<pass<<" fromCache="<<rbuild.fromCache()
+                <<" tag 0 --> "<<(fn0? fn0(): -1)<<endl;
+            if(rbuild.fromCache() || !fn0 || fn0() != want0)
+                THROW(" swapped DllFile::tag served a stale cached dispatch table");
+        }
+        system("rm -rf tmp-dllcache");
+    }
+
+    if(strstr(codefile_suffix,"-x86")){ // direct build (no make), x86 recipes only
+        cout<<"\ntest: DllBuild direct build"<<endl;
+        system("rm -rf tmp-dllbuild-direct");
+        DllBuild dbuild;
+        dbuild.direct = true;
+        dbuild.jobs = 3;
+        dbuild.verbose = 1;
+        dbuild.cache_dir.clear();
+        dbuild.push_back(tmplucky);
+        for(int i=1; i<3; ++i){ // a few more files to compile concurrently
+            DllFile more = tmplucky;
+            more.basename = libBase + "_file" + std::to_string(i);
+            more.code = multiReplace("myLuckyNumber", "myLuckyNumber"+std::to_string(i), ccode);
+            more.syms.clear();
+            more.syms.push_back(SymbolDecl("myLuckyNumber"+std::to_string(i)));
+            dbuild.push_back(more);
+        }
+        unique_ptr<DllOpen> dLib = dbuild.create(libBase, "tmp-dllbuild-direct");
+        for(auto const& st: dbuild.getSteps())
+            cout<<" status "<<st.status<<" "<<st.seconds<<" s: "<<st.cmd()<<endl;
+        if(dbuild.getSteps().size() != 4U)
+            THROW(" expected 3 compile + 1 link steps");
+        for(auto const& st: dbuild.getSteps())
+            if(st.status || !(st.seconds > 0.0)) THROW(" bad step "<<st.cmd());
+        LuckyNumberFn fn = (LuckyNumberFn)((*dLib)["myLuckyNumber"]);
+        if(fn() != runtime_lucky_number)
+            THROW(" direct-built myLuckyNumber returned "<<fn());
+
+        DllFile bad = tmplucky;
+        bad.basename = libBase + "_bad";
+        bad.code = "int myUnluckyNumber() { return oops; }\n";
+        bad.syms.clear();
+        DllBuild ebuild;
+        ebuild.direct = true;
+        ebuild.cache_dir.clear();
+        ebuild.push_back(bad);
+        try{
+            ebuild.create(libBase+"_bad", "tmp-dllbuild-direct");
+            THROW(" direct build of bad code should fail");
+        }catch(DllBuildError const& e){
+            if(e.failed.size() != 1U || e.failed[0].output.find("oops")==string::npos)
+                THROW(" unexpected DllBuildError diagnostics");
+            cout<<" GOOD. DllBuildError with "<<e.failed.size()<<" failed step"<<endl;
+        }
+        {   // a failing compiler that leaves a partial object: it must be removed
+            char cwd[PATH_MAX];
+            if(!getcwd(cwd, sizeof cwd)) THROW(" getcwd failed");
+            std::string const cc = std::string(cwd)+"/tmp-partialcc.sh";
+            ofstream(cc)<<"#!/bin/sh\nwhile [ $# -gt 1 ]; do\n"
+                " if [ \"$1\" = -o ]; then echo partial > \"$2\"; fi; shift\ndone\n"
+                "echo oops; exit 1\n";
+            chmod(cc.c_str(), 0755);
+            DllBuild pbuild;
+            pbuild.direct = true;
+            pbuild.cache_dir.clear();
+            pbuild.push_back(tmplucky);
+            try{
+                pbuild.create(libBase+"_partial", "tmp-dllbuild-direct", "GCC="+cc);
+                THROW(" direct build with a failing compiler should fail");
+            }catch(DllBuildError const& e){
+                if(e.failed.empty() || access(e.failed[0].target.c_str(), F_OK) == 0)
+                    THROW(" partial object "<<(e.failed.empty()? "?": e.failed[0].target)
+                            <<" left behind after a failed compile");
+                cout<<" GOOD. failed compile left no partial "<<e.failed[0].target<<endl;
+            }
+            unlink(cc.c_str());
+        }
+        system("rm -rf tmp-dllbuild-direct");
+
+        cout<<"\ntest: DllBuild memory build"<<endl;
+        system("rm -rf tmp-dllbuild-mem");
+        DllBuild mbuild;
+        mbuild.memory = true;
+        mbuild.push_back(tmplucky);
+        unique_ptr<DllOpen> mLib = mbuild.create(libBase, "tmp-dllbuild-mem");
+        for(auto const& st: mbuild.getSteps())
+            cout<<" status "<<st.status<<": "<<st.cmd()<<endl;
+        if(access("tmp-dllbuild-mem",F_OK)==0)
+            THROW(" memory build should not create its build directory");
+        fn = (LuckyNumberFn)((*mLib)["myLuckyNumber"]);
+        if(fn() != runtime_lucky_number)
+            THROW(" memory-built myLuckyNumber returned "<<fn());
+        cout<<" GOOD. memory build returned "<<fn()<<endl;
+        {   // builders gone, both libraries still loaded: no stale /proc/self/fd path
+            auto memBuild = [&libBase,&tmplucky](int const x){
+                DllFile df;
+                df.basename = libBase+"_mem"+std::to_string(x);
+                df.suffix = tmplucky.suffix;
+                df.code = "int memNumber() { return "+std::to_string(x)+"; }\n";
+                df.syms.push_back(SymbolDecl("memNumber"));
+                DllBuild b;
+                b.memory = true;
+                b.cache_dir.clear();
+                b.push_back(df);
+                return b.create(df.basename, "tmp-dllbuild-mem");
+            };
+            unique_ptr<DllOpen> const a = memBuild(1);
+            unique_ptr<DllOpen> const b = memBuild(2);
+            int const na = a->get<LuckyNumberFn>("memNumber")();
+            int const nb = b->get<LuckyNumberFn>("memNumber")();
+            if(na != 1 || nb != 2)
+                THROW(" two memory builds returned a="<<na<<" b="<<nb);
+            cout<<" GOOD. two memory builds returned a="<<na<<" b="<<nb<<endl;
+        }
+
+        cout<<"\ntest: DllFile::unit streamed to a source file and a memfd"<<endl;
+        cprog::Cunit pr("unitLucky", "C", 0);
+        pr.root["fn"]<<"int unitNumber() {";
+        pr.root["fn"]["body"]<<"return "<<std::to_string(runtime_lucky_number+100)<<";";
+        pr.root["fn"]["end"]<<"}";
+        for(bool const mem: {false, true}){
+            DllFile df;
+            df.basename = libBase+"_unit";
+            df.suffix = tmplucky.suffix;
+            df.unit = &pr;
+            df.syms.push_back(SymbolDecl("unitNumber"));
+            DllBuild ub;
+            ub.direct = true;
+            ub.memory = mem;
+            ub.cache_dir.clear();
+            ub.push_back(df);
+            system("rm -rf tmp-dllbuild-unit");
+            unique_ptr<DllOpen> const uLib = ub.create(libBase+"_unit", "tmp-dllbuild-unit");
+            int const n = uLib->get<LuckyNumberFn>("unitNumber")();
+            if(n != runtime_lucky_number+100)
+                THROW(" DllFile::unit build returned "<<n);
+            if(!mem){   // the streamed file is exactly text()
+                ifstream ifs(ub.front().getFilePath());
+                std::stringstream got;
+                got<<ifs.rdbuf();
+                if(got.str() != ub.front().text() || got.str().size() != ub.front().textSize())
+                    THROW(" DllFile::unit source differs from text()");
+            }
+            cout<<" GOOD. "<<(mem? "memfd": "file")<<" from Cunit returned "<<n<<endl;
+        }
+        system("rm -rf tmp-dllbuild-unit");
+    }
+
+    if(1){ // asynchronous build, generic fallback until the JIT symbol is ready
+        cout<<"\ntest: DllBuild create_async + JitFunction"<<endl;
+        DllBuild abuild;
+        abuild.cache_dir.clear();
+        abuild.push_back(tmplucky);
+        struct Generic { static int lucky() { return -1; } };
+        JitFunction<LuckyNumberFn> lucky(&Generic::lucky);
+        auto fut = abuild.create_async(libBase, "tmp-dllbuild-async", "",
+                [&lucky](std::shared_ptr<DllOpen> const& lib){
+                    lucky.install(lib, "myLuckyNumber");
+                });
+        int calls = 0;
+        while(fut.wait_for(std::chrono::milliseconds(1)) != std::future_status::ready){
+            if(lucky() != -1 && lucky() != runtime_lucky_number)
+                THROW(" JitFunction returned "<<lucky());
+            ++calls;
+        }
+        fut.get(); // rethrows any build error
+        cout<<" "<<calls<<" calls while building, then lucky() = "<<lucky()<<endl;
+        if(!lucky.specialized() || lucky() != runtime_lucky_number)
+            THROW(" JitFunction was not swapped to the JIT symbol");
+        // explicit shutdown finishes queued builds; later builds restart the pool
+        auto queued = abuild.create_async(libBase, "tmp-dllbuild-async");
+        DllBuild::async_shutdown();
+        if(queued.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+            THROW(" async_shutdown returned before a queued build finished");
+        queued.get();
+        auto again = abuild.create_async(libBase, "tmp-dllbuild-async");
+        if(again.get()->nSyms() == 0U) THROW(" create_async after async_shutdown failed");
+        DllBuild::async_shutdown();
+        cout<<" GOOD. async_shutdown ran the queued build, and the pool restarts"<<endl;
+        system("rm -rf tmp-dllbuild-async");
+    }
+
+    if(1){ // bulk symbol load, SymbolId and typed access
+        cout<<"\ntest: DllBuild allsyms + SymbolId"<<endl;
+        DllBuild sbuild;
+        sbuild.allsyms = true;
+        sbuild.cache_dir.clear();
+        DllFile more = tmplucky;
+        more.code += "\nint undeclaredNumber() { return 13; }\n"
+            "int const luckyTable[4] = {1,2,3,4};\n";
+        sbuild.push_back(more);
+        unique_ptr<DllOpen> sLib = sbuild.create(libBase+"_allsyms", "tmp-dllbuild-allsyms");
+        DllOpen const& lib = *sLib;
+        cout<<" "<<lib.nSyms()<<" symbols:";
+        for(auto const& name: lib.getSymbolNames()) cout<<" "<<name;
+        cout<<endl;
+        SymbolId const lucky = lib.id("myLuckyNumber");
+        SymbolId const undeclared = lib.id("undeclaredNumber");
+        if(lib.get<LuckyNumberFn>(lucky)() != runtime_lucky_number
+                || lib.get<LuckyNumberFn>(undeclared)() != 13
+                || lib.get<int const*>("luckyTable")[3] != 4
+                || lib[lucky] != lib["myLuckyNumber"])
+            THROW(" allsyms / SymbolId lookup mismatch");
+        cout<<" GOOD. undeclaredNumber() = "<<lib.get<LuckyNumberFn>(undeclared)()<<endl;
+        system("rm -rf tmp-dllbuild-allsyms");
+    }
+
+    if(1){ // generated dispatch table, kernels by DllFile::tag
+        cout<<"\ntest: DllBuild dispatch table"<<endl;
+        DllBuild tbuild;
+        tbuild.dispatch = "luckyByTag";
+        tbuild.cache_dir.clear();
+        for(int t: {3,0,5}){
+            DllFile df = tmplucky;
+            string const sym = "myLuckyNumber"+std::to_string(t);
+            df.tag = t;
+            df.basename = libBase + "_tag" + std::to_string(t);
+            df.code = multiReplace("myLuckyNumber", sym,
+                    program_myLuckyNumber(runtime_lucky_number + t));
+            df.syms.clear();
+            if(t==5){   // a data symbol first: the table must skip to the function
+                df.code += "int const luckyData5 = 5;\n";
+                df.syms.push_back(SymbolDecl("luckyData5", "", "extern int const luckyData5"));
+            }
+            df.syms.push_back(SymbolDecl(sym));
+            tbuild.push_back(df);
+        }
+        unique_ptr<DllOpen> tLib = tbuild.create(libBase+"_dispatch", "tmp-dllbuild-dispatch");
+        for(int t=0; t<7; ++t){
+            LuckyNumberFn fn = tLib->byTag<LuckyNumberFn>(t);
+            bool const expect = (t==0 || t==3 || t==5);
+            cout<<" tag "<<t<<" --> "<<(fn? std::to_string(fn()): string("null"))<<endl;
+            if((fn!=nullptr) != expect || (fn && fn() != runtime_lucky_number + t))
+                THROW(" dispatch table mismatch at tag "<<t);
+        }
+        // declared symbols are still found by name
+        if(!tLib->contains("myLuckyNumber3")
+                || tLib->get<LuckyNumberFn>("myLuckyNumber3")() != runtime_lucky_number + 3)
+            THROW(" dispatch build lost name lookup of a declared symbol");
+        tbuild.dispatchOnly = true;     // opt-in: resolve only the table
+        unique_ptr<DllOpen> oLib = tbuild.create(libBase+"_dispatch", "tmp-dllbuild-dispatch");
+        if(oLib->contains("myLuckyNumber3") || !oLib->byTag<LuckyNumberFn>(3))
+            THROW(" dispatchOnly should resolve the table only");
+        cout<<" GOOD. declared symbols by name, or table only with dispatchOnly"<<endl;
+        system("rm -rf tmp-dllbuild-dispatch");
+    }
+
+    if(1){ // generator profile of everything above
+        cout<<"\ntest: JitProf stage counters"<<endl;
+        JitProf::Stats const s = JitProf::global().snapshot();
+        for(char const* stage: {"dllbuild.prep", "dllbuild.dllopen"})
+            if(s.find(stage) == s.end() || s.at(stage).calls == 0U)
+                THROW(" JitProf missing stage "<<stage);
+        uint64_t procs = 0U;
+        for(auto const& st: s) procs += st.second.procs;
+        if(procs == 0U || s.at("dllbuild.prep").bytes == 0U)
+            THROW(" JitProf counted no build processes or prep bytes");
+        string const js = JitProf::global().json();
+        if(js.find("\"dllbuild.prep\":{\"calls\":") == string::npos)
+            THROW(" JitProf json: "<<js);
+        cout<<js;
+    }
+
 #if 0 // later ...
     typedef int (*JitFunc)();
 #if 0
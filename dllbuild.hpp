@@ -11,12 +11,28 @@
 #include <vector>
 #include <unordered_map>
 #include <memory>           // std::unique_ptr
+#include <stdexcept>        // DllBuildError
+#include <future>           // DllBuild::create_async
+#include <functional>
+#include <atomic>           // JitFunction
+#include <mutex>
 #ifndef NDEBUG
 #include <iostream>
 #include "throw.hpp"
 #endif
 
 #include <dlfcn.h>
+#include <cstdint>
+/** compact handle of a DllOpen symbol, for hot-path lookup without hashing.
+ * Valid only for the DllOpen whose \c id() returned it. */
+struct SymbolId {
+    uint32_t i;
+};
+struct MemFd;
+namespace cprog {
+struct Cunit;
+struct Csink;
+}
 /** DllOpen loads void* symbols from a [jit] library.
  *
  * Path to JIT library:
@@ -28,9 +44,12 @@
  *    - Ex. int (*foo)(int const i) = (int(*)(int const)) (dllopen["foo"]);
  *    - Ex. bar_t bar = (bar) (dllopen["bar"];)
  *    - Ex. uint64_t *maskData = dllopen("maskData"); // uint64_t maskData[4]
+ *    - Ex. SymbolId const foo_id = dllopen.id("foo");  // once
+ *          dllopen.get<int(*)(int const)>(foo_id)(42); // array load, no hashing
  *
- * Q: might it eventually be better to support loading a libary and
- *    reading **all** its public symbols?
+ * With \c DllBuild::allsyms, \b all exported symbols of the library are
+ * loaded in one pass over its ELF dynamic symbol table, not just the
+ * SymbolDecl of each DllFile.
  */
 class DllOpen{
   public:
@@ -70,6 +89,39 @@ class DllOpen{
         return dlsyms.at(s);
     }
     bool contains(std::string const& s) const{return dlsyms.find(s)!=dlsyms.end();}
+
+    /** handle for symbol \c s. \throw if not present. */
+    SymbolId id(std::string const& s) const {
+        auto const found = symidx.find(s);
+        if(found == symidx.end())
+            throw std::out_of_range("DllOpen::id("+s+") not present");
+        return SymbolId{found->second};
+    }
+    /** symbol address by handle (no hashing) */
+    void* operator[](SymbolId const id) const {
+#ifndef NDEBUG
+        if(id.i >= symaddr.size()) THROW("DllOpen[SymbolId "<<id.i<<"] out of range");
+#endif
+        return symaddr[id.i];
+    }
+    /** typed symbol (ex. function pointer type \c T) by handle */
+    template<typename T> T get(SymbolId const id) const {
+        return reinterpret_cast<T>((*this)[id]);
+    }
+    /** typed symbol by name */
+    template<typename T> T get(std::string const& s) const {
+        return reinterpret_cast<T>((*this)[s]);
+    }
+    size_t nSyms() const {return symaddr.size();}
+
+    /** O(1) kernel for DllFile::tag \c tag from a \c DllBuild::dispatch table,
+     * or nullptr if no such tag (or no dispatch table). */
+    template<typename T> T byTag(int const tag) const {
+        return (tag>=0 && (size_t)tag < dispatchSize)
+            ? reinterpret_cast<T>(dispatchTable[tag]): nullptr;
+    }
+    /** symbol names, in \c SymbolId order */
+    std::vector<std::string> const& getSymbolNames() const {return symname;}
     std::unordered_map< std::string, void* > const& getDlsyms() const {return dlsyms;}
     std::vector<std::vector<std::string>> const& getDlsrcs() const {return dlsyms_num;}
     std::vector<std::string> const& getDlfiles() const {return files;}
@@ -78,8 +130,21 @@ class DllOpen{
     friend struct DllBuild;
     std::string basename;
     void *libHandle;
+    /** \c DllBuild::memory library file: open while loaded, so its
+     * /proc/self/fd/N path cannot be reused by another library */
+    std::shared_ptr<MemFd> memLib;
     /** \b always have a map symbol-->address of the \e known JIT symbols. */
     std::unordered_map< std::string, void* > dlsyms; // all, no particular order
+    /// \group SymbolId table
+    //@{
+    std::unordered_map< std::string, uint32_t > symidx; ///< name --> SymbolId::i
+    std::vector<void*>       symaddr;   ///< SymbolId::i --> address
+    std::vector<std::string> symname;   ///< SymbolId::i --> name
+    void (*const *dispatchTable)(void); ///< \c DllBuild::dispatch table, if any
+    size_t dispatchSize;
+    /** add symbol (if new) to \c dlsyms and the SymbolId table. \return false if duplicate */
+    bool addSym(std::string const& name, void* addr);
+    //@}
     /// \group library and source-file data
     /// Typically one set of test params creates one JIT source file.
     /// Multiple JIT source files can be combined into library \c libname
@@ -112,33 +177,63 @@ struct SubDir{
 };
 /** basename*.{c|cpp|s|S} compilable code file */
 struct DllFile {
-    DllFile() : basename(), suffix(), code(), syms(), comment(), objects(), abspath() {}
+    DllFile() : tag(0), basename(), suffix(), code(), unit(nullptr), syms(), comment(), objects(), abspath() {}
     int tag;                        ///< up to user (test number? parameter set?)
     std::string basename;
     std::string suffix;             ///< *.{c|cpp|s|S}
     std::string code;
+    /** optional generated program: if set, \c code is ignored and the source
+     * file (or memfd) is streamed from \c unit->root by \c Cblock::emit, so
+     * large sources are never joined into one string.  Not owned; it must
+     * outlive \c DllBuild::prep/make (or \c create). */
+    cprog::Cunit* unit;
     std::vector<SymbolDecl> syms;   ///< just the public API symbols
     // optional...
 	std::string comment;
     /** write comment+code to <subdir.abspath>/<basename><suffix>.
      * \return \c abspath */
     std::string  write(SubDir const& subdir, int v=0);
+    /** stream \c pre + \c text() to \c fd (writev segments, no joined copy).
+     * \return bytes written.  \throw on write error */
+    std::size_t write(int const fd, std::string const& pre="") const;
+    /** file content that \c write writes (comment+code) */
+    std::string text() const;
+    std::size_t textSize() const;           ///< \c text().size(), without building it
+    void emitCode(cprog::Csink& out) const; ///< \c code, or \c unit text, into \c out
     static std::vector<std::string> obj(std::string fname, int const v=0);   ///< %.{c,cpp,s,S} --> %.o \throw on err
     std::string const& getFilePath() const {return this->abspath;}
     std::string short_descr() const;
   private:
+    std::string head() const;               ///< \c text() before \c code
     std::vector<std::string> objects;        ///< set by \c DllBuild.prep
     friend struct DllBuild;
     std::string abspath;
 };
+/** one compiler, assembler or linker invocation of a \c DllBuild::direct build */
+struct DllBuildStep {
+    DllBuildStep() : target(), argv(), status(-1), output(), seconds(0.0) {}
+    std::string target;             ///< file produced (object or library)
+    std::vector<std::string> argv;  ///< command words (no shell involved)
+    int status;                     ///< exit status, or -1 if not run / spawn failed
+    std::string output;             ///< merged stdout and stderr of the command
+    double seconds;                 ///< wall time of the command
+    std::string cmd() const;        ///< \c argv as one printable line
+};
+/** \c DllBuild::direct build failure, carrying every failed step. */
+struct DllBuildError : public std::runtime_error {
+    DllBuildError(std::string const& what, std::vector<DllBuildStep> const& failed)
+        : std::runtime_error(what), failed(failed) {}
+    std::vector<DllBuildStep> failed;
+};
 /** create empty, append various DllFile, then \c create() the DllOpen.
  *
  * \note This is intended for 'C' jit programs, but can handle assembler
  * until you get a real JIT assembler to bypass all filesystem operations.
  */
 struct DllBuild : std::vector<DllFile> {
-    DllBuild() : std::vector<DllFile>(), prepped(false), made(false),
-    dir(), basename(), libname(), mkfname(), fullpath(), verbose(0)
+    DllBuild() : std::vector<DllFile>(), prepped(false), made(false), cached(false),
+    dir(), basename(), libname(), mkfname(), fullpath(), steps(), memfds(), verbose(0), direct(false), memory(false), allsyms(false), dispatch(), dispatchOnly(false), jobs(jobs_default()),
+    cache_dir(cache_default_dir()), cache_max_bytes(cache_default_max()), cache_salt()
     {
 #ifndef NDEBUG
         if(verbose) std::cout<<" +DllBuild"<<std::endl;
@@ -186,13 +281,34 @@ struct DllBuild : std::vector<DllFile> {
     /** If possible, re-use existing Makefile of a previous \c prep. */
     void skip_prep(std::string basename, std::string dir=".");
 
-    /** Run 'make'.
+    /** Run 'make -j<jobs>'.
      * \c env is prefixed to the 'make' command, and could include things like
      * CFLAGS='...' LDFLAGS='...'
      * \pre \c this->prepped and you have all the [cross-]compiling tools.
      * \post \c libname exists as file at \c fullpath
+     *
+     * If \c direct, run \c make_direct instead.
+     * \note only \c make_direct records per-file compile times (\c getSteps);
+     *       'make' runs the bin.mk recipes itself, so a 'make' build leaves
+     *       \c getSteps() empty and reports no per-file timing.
      */
     void make(std::string env="");
+    /** Build without 'make' or a shell: \c posix_spawn the bin.mk compile and
+     * link recipes for the objects listed by \c prep, compiling up to \c jobs
+     * independent objects concurrently.  \c env VAR=value words override the environment
+     * as they would for 'make'.  Show-only outputs (\c -S listings, the
+     * archive and MEGA_ARCHIVE) are not produced.
+     * With \c memory, sources, objects and library are \c memfd_create files
+     * named /proc/self/fd/N, so nothing is written to the build directory.
+     * \return false, having built nothing, if some source has no direct
+     *         recipe (\c .s, \c .S, or with \c memory, \c _unroll objects that
+     *         need objcopy); \c make then uses 'make' instead.
+     * \throw DllBuildError listing the failed steps.  A compiler that exits
+     *        nonzero is not rerun; only a spawn failing with EAGAIN, ENOMEM
+     *        or EINTR is retried.
+     * \post \c getSteps() has every command that ran, with its output and
+     *       wall time (per-file compile times are printed if \c verbose). */
+    bool make_direct(std::string env="");
     /** If \c fullpath jit library exists, skip the 'make'. */
     void skip_make(std::string env="");
     /** open and load symbols, \throw if not \c prepped and \c made */
@@ -204,11 +320,81 @@ struct DllBuild : std::vector<DllFile> {
             std::string basename,
             std::string dir=".",
             std::string env=""){
+        if(!prepped && !made && memory){
+            prep(basename,dir,false/*writeFiles*/);
+            make(env);
+            return dllopen();
+        }
+        if(!prepped && !made && !cache_dir.empty())
+            return cache_create(basename,dir,env);
         if(!prepped){prep(basename,dir); prepped=true;}
         if(!made){make(env); made=true;}
         return dllopen();
     }
     //@}
+
+    /// @group Asynchronous builds
+    /// \c create_async builds a \e copy of this DllBuild on a bounded pool of
+    /// compile workers (\c async_workers, default $VEJIT_DLLBUILD_WORKERS or 2),
+    /// so the caller can keep running generic code meanwhile.  Concurrent
+    /// builds should use distinct \c basename or \c dir.
+    //@{
+    /** \c create on a compile worker.  If given, \c onReady runs on the worker
+     * with the new library (ex. to \c JitFunction::install symbols) before the
+     * future becomes ready.  Build errors are rethrown by the future's \c get. */
+    std::shared_future<std::shared_ptr<DllOpen>> create_async(
+            std::string basename,
+            std::string dir=".",
+            std::string env="",
+            std::function<void(std::shared_ptr<DllOpen> const&)> onReady=nullptr) const;
+    /** set the maximum number of concurrent \c create_async builds (>=1). */
+    static void async_workers(int n);
+    /** finish every queued \c create_async build, then join the workers.
+     * Call before leaving \c main (otherwise workers are joined only at static
+     * destruction, possibly after objects an \c onReady uses are gone).
+     * A later \c create_async starts new workers.
+     * \throw if called from a compile worker (ex. inside \c onReady). */
+    static void async_shutdown();
+    //@}
+
+    /// @group Persistent library cache
+    /// When \c cache_dir is non-empty, \c create(basename,dir,env) and
+    /// \c safe_create first look for a library built from identical inputs
+    /// (see \c cache_key).  A hit skips writing sources, the Makefile and
+    /// running 'make'.  A miss builds as usual and then inserts the library
+    /// into the cache, evicting least-recently-used entries beyond
+    /// \c cache_max_bytes.  Entries are \c rename()d into place and eviction
+    /// holds an \c flock on cache_dir/.lock, so several processes may share
+    /// one cache directory.
+    //@{
+    /** hex digest of DllFile basename/suffix/code/tag/symbols, \c env, bin.mk rules,
+     * compiler/flag environment variables, each bin.mk compiler's resolved
+     * path and \c --version output, and \c cache_salt. */
+    std::string cache_key(std::string env="") const;
+    /** did the last \c create come from the cache? */
+    bool fromCache() const {return cached;}
+    //@}
+
+    /** commands run by the last \c make_direct, with per-step wall time
+     * (empty after a 'make' build: no per-file times there, see \c make) */
+    std::vector<DllBuildStep> const& getSteps() const {return steps;}
+  private:
+    /** \c prep with optional writing of sources and Makefile (\c writeFiles=false
+     * only fills in DllFile names, objects and symbols for a cached library). */
+    void prep(std::string basename, std::string dir, bool const writeFiles);
+    std::unique_ptr<DllOpen> cache_create(std::string basename, std::string dir,
+            std::string env);
+    /** link or copy \c fullpath into the cache as \c entry, then evict. */
+    void cache_insert(std::string const& entry) const;
+    /** (re)generate the \c dispatch DllFile (called by \c prep) */
+    void add_dispatch();
+    /** remove least-recently-used cache entries beyond \c cache_max_bytes. */
+    void cache_evict() const;
+    static std::string cache_default_dir();     ///< $VEJIT_DLLCACHE, or ""
+    static size_t cache_default_max();          ///< $VEJIT_DLLCACHE_MAX, or 1 GiB
+    static int jobs_default();                  ///< $VEJIT_DLLBUILD_JOBS, or online CPUs
+    /** new memfd holding \c content. \return its /proc/self/fd/N path */
+    std::string memfile(std::string const& name, std::string const& content="");
   private:
     /** during \c prep weed out tests that might create duplicate symbols? */
     //void remove_duplicate_files();
@@ -216,13 +402,74 @@ struct DllBuild : std::vector<DllFile> {
     std::unique_ptr<DllOpen> dllopen();
     bool prepped;
     bool made;
+    bool cached;                ///< library was found in \c cache_dir
     SubDir dir;                 ///< build dir (set via \c prep or skip_prep)
     std::string basename;
     std::string libname;        ///< libbasename.so
     std::string mkfname;        ///< basename.mk
     std::string fullpath;       ///< absolute path to libname {dir.abspath}/{libname}
+    std::vector<DllBuildStep> steps; ///< \c make_direct commands and output
+    std::vector<std::shared_ptr<MemFd>> memfds; ///< \c memory build files
   public:
     int verbose;
+    bool direct;                ///< \c make via \c make_direct (no Makefile run, no shell)
+    bool memory;                ///< \c make_direct in memfd files (no build dir writes; overrides \c cache_dir)
+    bool allsyms;               ///< \c dllopen loads all exported symbols (one ELF pass)
+    /** If non-empty, \c prep adds a generated source defining function-pointer
+     * array \c dispatch[tag] (and \c int \c dispatch_size) holding the first
+     * function SymbolDecl of each DllFile by \c DllFile::tag (tags >= 0, unique;
+     * a SymbolDecl is data if its \c fwddecl gives no parameter list),
+     * which callers reach with \c DllOpen::byTag.  Declared symbols are
+     * still resolved by name, unless \c dispatchOnly. */
+    std::string dispatch;
+    /** with \c dispatch: \c dllopen resolves only the table (one \c dlsym
+     * instead of one per symbol), so declared symbols are \b not found by
+     * name (unless \c allsyms). */
+    bool dispatchOnly;
+    int jobs;                   ///< max concurrent compiles (make -j, or \c make_direct)
+    std::string cache_dir;      ///< persistent library cache directory ("" ~ off)
+    size_t cache_max_bytes;     ///< LRU eviction threshold for \c cache_dir (0 ~ unbounded)
+    std::string cache_salt;     ///< extra cache key material (ex. compiler version string)
+};
+/** Function pointer that starts as a generic \c fallback and is atomically
+ * swapped to a JIT symbol once its library is ready.
+ *
+ * \c install is typically called from a \c DllBuild::create_async \c onReady
+ * callback.  Calls never block: they use whichever function is current.
+ * Installed libraries stay loaded as long as the JitFunction lives.
+ *
+ * Ex. JitFunction<int(*)(int)> f(generic_f);
+ *     build.create_async("foo", "tmp", "",
+ *         [&f](std::shared_ptr<DllOpen> const& lib){ f.install(lib,"foo_jit"); });
+ *     for(...) y = f(x); // generic_f until foo_jit is ready
+ */
+template<typename FnPtr>
+class JitFunction {
+  public:
+    explicit JitFunction(FnPtr fallback) : fn(fallback), fallback(fallback), libs(), mtx() {}
+    JitFunction(JitFunction const&) = delete;
+    JitFunction& operator=(JitFunction const&) = delete;
+    /** current function: \c fallback, or the last installed JIT symbol */
+    FnPtr get() const noexcept { return fn.load(std::memory_order_acquire); }
+    bool specialized() const noexcept { return get() != fallback; }
+    template<typename... Args>
+    auto operator()(Args&&... args) const -> decltype((*(FnPtr)nullptr)(std::forward<Args>(args)...)) {
+        return (*get())(std::forward<Args>(args)...);
+    }
+    /** swap in \c symbol of \c lib (kept alive). \throw if absent. */
+    void install(std::shared_ptr<DllOpen> const& lib, std::string const& symbol){
+        FnPtr const jit = reinterpret_cast<FnPtr>((*lib)[symbol]);
+        if(jit == nullptr)
+            throw std::runtime_error("JitFunction::install: null symbol "+symbol);
+        std::lock_guard<std::mutex> lock(mtx);
+        libs.push_back(lib);    // earlier libraries may still be executing
+        fn.store(jit, std::memory_order_release);
+    }
+  private:
+    std::atomic<FnPtr> fn;
+    FnPtr const fallback;
+    std::vector<std::shared_ptr<DllOpen>> libs;
+    std::mutex mtx;
 };
 // vim: ts=4 sw=4 et cindent cino=^=l0,\:.5s,=-.5s,N-s,g.5s,b1 cinkeys=0{,0},0),\:,0#,!^F,o,O,e,0=break
 #endif // DLLBUILD_HPP
@@ -1,6 +1,9 @@
 #include "fuseloop.hpp"
 #include "vechash.hpp"    // VecHash2 (hash trace of reference loop execution for ref_vloop2)
 #include "stringutil.hpp" // vecprt, lcm[from intutil.hpp]
+#include "ve_divmod.hpp"  // fastdiv, divmod (fused_index)
+#include "cblock.hpp"
+#include "throw.hpp"
 #include <iomanip>
 
 #ifndef MVL
@@ -167,6 +170,9 @@ int64_t ve_vlen_suggest(int64_t const nitems){
     }
     return ret;
 }
+uint64_t ve_vlen_suggest(uint64_t const nitems){ // the api declared in fuseloop.hpp
+    return (uint64_t)ve_vlen_suggest((int64_t)nitems);
+}
 
 std::string str(UnrollSuggest const& u, std::string const& pfx /*=""*/){
     std::ostringstream oss;
@@ -718,6 +724,35 @@ UnrollSuggest unroll_suggest( UnrollSuggest& u, int vl_min/*=0*/, int const v/*=
     return ret;
 }
 
+/** \c unroll_suggest plus its precalculated a[],b[] vectors (see fuseloop.hpp) */
+UnrollData mk_unroll_data( int const vl, int const ii, int const jj,
+        int const b_period_max/*=8*/, int const vl_min/*=0*/ ){
+    UnrollSuggest u = unroll_suggest(vl, ii, jj, b_period_max, 0/*verbose*/);
+    UnrollSuggest const alt = unroll_suggest(u, vl_min);
+    UnrollData d;
+    static_cast<UnrollSuggest&>(d) = (alt.suggested != UNR_UNSET? alt: u);
+    d.vll = u.vll;
+    uint64_t const iijj = (uint64_t)d.ii * d.jj;
+    int npre = 0;
+    switch(d.suggested){
+      case UNR_NLOOP1: case UNR_NLOOP: case UNR_JJPOW2_NLOOP: npre = d.nloop; break;
+      case UNR_CYC: case UNR_JJPOW2_CYC: npre = d.cycle; break;
+      default: npre = (1 < d.jj && d.jj < d.vl? 1: 0);
+    }
+    npre = std::min(npre, d.nloop);
+    for(int l=0; l<npre; ++l){
+        VVlpi a(d.vl, 0U), b(d.vl, 0U);
+        uint64_t const cnt = (uint64_t)l * d.vl;
+        int const vl_l = (int)std::min<uint64_t>(d.vl, iijj - cnt);
+        for(int i=0; i<vl_l; ++i){
+            a[i] = (cnt + i) / d.jj;
+            b[i] = (cnt + i) % d.jj;
+        }
+        d.pre.emplace_back(a, b, vl_l);
+    }
+    return d;
+}
+
 /** Generate reference vectors of vectorized 2-loop indices */
 std::vector<Vab> ref_vloop2(Lpi const vlen, Lpi const ii, Lpi const jj,
         int const verbose/*=1*/ )
@@ -764,6 +799,527 @@ std::vector<Vab> ref_vloop2(Lpi const vlen, Lpi const ii, Lpi const jj,
     }
     return vabs;
 }
+// ------------------------------------------------------------- N-loop fusion
+static char const* fuseDimNames[] = {
+    "FD_UNSET", "FD_ONE", "FD_SCALAR", "FD_CONST", "FD_POW2", "FD_DIVMOD" };
+char const* name( enum FuseDim const fd ){
+    assert( (int)fd >= 0 && (size_t)fd < sizeof(fuseDimNames)/sizeof(char const*) );
+    return fuseDimNames[fd];
+}
+std::ostream& operator<<(std::ostream& os, enum FuseDim const fd){
+    return os<<name(fd);
+}
+std::vector<Lpi> FusedPlan::limits() const {
+    std::vector<Lpi> ret;
+    for(auto const& d: dim) ret.push_back(d.n);
+    return ret;
+}
+
+/** \c vIn_hi argument for \c cprog::fastdiv (0 if out of u32 range) */
+static uint32_t u32hi(uint64_t const hi){
+    return hi < 0xffffffffULL? (uint32_t)hi: 0U;
+}
+/** outermost dimension with n>1 (its index needs no modulus), or -1 */
+static int outermost(FusedPlan const& p){
+    for(size_t k=0U; k<p.dim.size(); ++k) if(p.dim[k].n > 1) return (int)k;
+    return -1;
+}
+/** set \c idx[k] for dims \c ks (inner to outer, consecutive strides) of \c x < hi
+ * by one fastdiv and a chain of divmods */
+static void peel(cprog::Cexpr& e, FusedPlan const& p, cprog::Cexpr::Val const x,
+        uint64_t hi, std::vector<int> const& ks, std::vector<cprog::Cexpr::Val>& idx){
+    if(ks.empty()) return;
+    int const kout = outermost(p);
+    Lpi const s = p.dim[ks[0]].stride;
+    cprog::Cexpr::Val q = cprog::fastdiv(e, x, (uint32_t)s, u32hi(hi));
+    hi = hi/s + 1U;
+    for(int const k: ks){
+        if(k == kout){ idx[k] = q; break; }
+        auto const dm = cprog::divmod(e, q, (uint32_t)p.dim[k].n, u32hi(hi));
+        idx[k] = dm.second;
+        q = dm.first;
+        hi = hi/p.dim[k].n + 1U;
+    }
+}
+static std::vector<int> dimsOf(FusedPlan const& p, enum FuseDim const a,
+        enum FuseDim const b=FD_UNSET){
+    std::vector<int> ks;                        // inner to outer
+    for(int k=(int)p.dim.size()-1; k>=0; --k)
+        if(p.dim[k].how == a || p.dim[k].how == b) ks.push_back(k);
+    return ks;
+}
+std::vector<cprog::Cexpr::Val> fused_index( cprog::Cexpr& e, FusedPlan const& p,
+        cprog::Cexpr::Val const f0, std::vector<std::string> const& hoisted ){
+    std::vector<cprog::Cexpr::Val> idx(p.dim.size());
+    for(size_t k=0U; k<p.dim.size(); ++k){
+        if(p.dim[k].how == FD_ONE) idx[k] = e.k(0);
+        else if(p.dim[k].how == FD_CONST) idx[k] = e.v(hoisted.at(k));
+    }
+    uint64_t const hi = (uint64_t)p.total + (uint64_t)p.vl;
+    peel(e, p, f0, hi, dimsOf(p, FD_SCALAR), idx);
+    peel(e, p, e.add(e.seq(), f0), hi, dimsOf(p, FD_POW2, FD_DIVMOD), idx);
+    return idx;
+}
+void fused_const( cprog::Cexpr& e, FusedPlan const& p,
+        std::vector<std::string> const& hoisted ){
+    std::vector<cprog::Cexpr::Val> idx(p.dim.size());
+    std::vector<int> const ks = dimsOf(p, FD_CONST);
+    peel(e, p, e.seq(), (uint64_t)p.vl, ks, idx);
+    for(auto k = ks.rbegin(); k != ks.rend(); ++k) e.out(hoisted.at(*k), idx[*k]);
+}
+/** index ops per vector iteration, counted from the emitted intrinsics */
+static int fused_iops(FusedPlan const& p){
+    cprog::Cexpr e;
+    std::vector<std::string> hoisted;
+    for(size_t k=0U; k<p.dim.size(); ++k) hoisted.push_back("c"+jitdec(k));
+    auto const idx = fused_index(e, p, e.s("f0"), hoisted);
+    for(size_t k=0U; k<p.dim.size(); ++k) e.out("i"+jitdec(k), idx[k]);
+    cprog::Cunit scratch("fused_iops", "C", 0);
+    cprog::CexprVel vel;
+    return e.emit(scratch.root, vel);
+}
+
+// -------------------------------------------------- ranked 2-loop plans
+/** vector ops for <tt>sq += vl; a = sq/jj; b = sq%jj</tt> */
+static int divmodOps(int const vl, int const ii, int const jj){
+    cprog::Cexpr e;
+    uint64_t const hi = (uint64_t)ii*jj + vl;
+    auto const dm = cprog::divmod(e, e.add(e.v("sq"), e.s("vl")), (uint32_t)jj,
+            u32hi(hi));
+    e.out("a", dm.first);
+    e.out("b", dm.second);
+    cprog::Cunit scratch("divmodOps", "C", 0);
+    cprog::CexprVel vel;
+    return e.emit(scratch.root, vel);
+}
+std::vector<UnrollPlan> unroll_plans( int const vl_max, int const ii, int const jj,
+        int const maxun/*=8*/, int vl_min/*=0*/, UnrollCost const& c/*=UnrollCost()*/ ){
+    if(vl_max < 1 || vl_max > MVL || ii < 1 || jj < 1)
+        THROW("unroll_plans: bad vl_max,ii,jj = "<<vl_max<<","<<ii<<","<<jj);
+    uint64_t const iijj = (uint64_t)ii * jj;
+    if(iijj + 2*MVL > 0xffffffffULL) THROW("unroll_plans: ii*jj too large for u32 index math");
+    uint64_t const nloop0 = (iijj + vl_max - 1) / vl_max;
+    if(vl_min < 1 || vl_min > vl_max){
+        uint64_t const nl = (105*nloop0 + 99) / 100;
+        vl_min = std::max(1, (int)((iijj + nl - 1) / nl));
+    }
+    int const vl_hi = (int)std::min<uint64_t>(vl_max, iijj);
+    if(vl_min > vl_hi) vl_min = vl_hi;
+    bool const jj_pow2 = positivePow2(jj);
+    std::vector<UnrollPlan> ret;
+    for(int vl = vl_hi; vl >= vl_min; --vl){
+        int const nloop = (int)((iijj + vl - 1) / vl);
+        int const period = lcm(vl, jj) / vl;    // b[] cycle
+        int const dm = divmodOps(vl, ii, jj);   // formula induction (incl. sq+=vl)
+        int const init = dm;                    // first a[], b[]
+        auto add = [&](enum Unroll const how, int const unroll, int const cycle,
+                int const pregs, int const initOps, double const indOps){
+            if(pregs > c.vregs) return;
+            UnrollPlan p;
+            p.vl = vl; p.ii = ii; p.jj = jj;
+            p.how = how; p.unroll = unroll; p.cycle = cycle; p.pregs = pregs;
+            p.nloop = nloop; p.initOps = initOps; p.indOps = indOps;
+            int const trips = (nloop + unroll - 1) / unroll;
+            p.cost = c.vop * initOps + c.preg * pregs
+                + nloop * c.vop * (indOps + c.kernel)
+                + trips * c.sop * 2.0
+                + (iijj % vl? trips * c.sop * c.lastvl: 0.0)
+                + c.code * unroll * (indOps + c.kernel);
+            ret.push_back(p);
+        };
+        // formula inductions may use any small unroll
+        auto addAnyUnroll = [&](enum Unroll const how, int const pregs, double const indOps){
+            for(int u=1; u <= std::max(1, std::min(maxun, nloop)); u *= 2)
+                add(how, u, 0, pregs, init, indOps);
+        };
+        if(nloop == 1){
+            add(UNR_NLOOP1, 1, 1, 2, init, 0.0);
+            continue;
+        }
+        if(vl % jj == 0) addAnyUnroll(UNR_VLMODJJ, 0, 1.0);            // a += vl/jj
+        if(jj % vl == 0){
+            int const p = jj / vl;
+            if(nloop <= p) addAnyUnroll(UNR_JJMODVL_NORESET, 0, 1.0);  // b += vl
+            else addAnyUnroll(UNR_JJMODVL_RESET, 0, 1.0 + 2.0/p);      // ... reset every p
+        }
+        if(nloop <= maxun)                                              // full precalc
+            add(jj_pow2? UNR_JJPOW2_NLOOP: UNR_NLOOP, nloop, nloop, 2*nloop, nloop*dm, 0.0);
+        if(period > 1 && period <= maxun && nloop > period)             // cyclic precalc
+            for(int u = period; u <= maxun; u += period)
+                add(jj_pow2? UNR_JJPOW2_CYC: UNR_CYC, u, period, 2*period,
+                        period*dm, 1.0);                                // a += aDelta[cyc]
+        addAnyUnroll(jj_pow2? UNR_JJPOW2_BIG: UNR_DIVMOD, 0, (double)dm);
+    }
+    std::stable_sort(ret.begin(), ret.end(), [](UnrollPlan const& a, UnrollPlan const& b){
+            return a.cost < b.cost; });
+    return ret;
+}
+UnrollSuggest suggestion( UnrollPlan const& p ){
+    UnrollSuggest u(p.vl, p.ii, p.jj, std::max(p.unroll, p.cycle));
+    u.suggested = p.how;
+    u.unroll = p.unroll;
+    u.cycle = p.cycle;
+    return u;
+}
+std::string str(UnrollPlan const& p){
+    std::ostringstream oss;
+    oss<<"vl,ii,jj="<<p.vl<<","<<p.ii<<","<<p.jj<<" "<<name(p.how)
+        <<" unroll="<<p.unroll;
+    if(p.cycle) oss<<" cycle="<<p.cycle;
+    if(p.pregs) oss<<" pregs="<<p.pregs;
+    oss<<" nloop="<<p.nloop<<" init="<<p.initOps<<" ind="<<p.indOps<<" cost~"<<p.cost;
+    return oss.str();
+}
+std::ostream& operator<<(std::ostream& os, UnrollPlan const& p){
+    return os<<str(p);
+}
+
+FusedPlan fused_plan( std::vector<Lpi> const& n, int const vl, int const maxun/*=8*/ ){
+    if(n.empty()) THROW("fused_plan: no loops");
+    if(vl < 1 || vl > MVL) THROW("fused_plan: vl="<<vl<<" not in [1,"<<MVL<<"]");
+    FusedPlan p;
+    p.total = 1;
+    for(Lpi const nk: n){
+        if(nk < 1) THROW("fused_plan: loop limit "<<nk<<" < 1");
+        p.total *= nk;
+        if(p.total + 2*MVL > (Lpi)0xffffffffLL)
+            THROW("fused_plan: too many iterations for u32 index math");
+    }
+    p.vl = (int)(p.total < vl? p.total: vl);   // 1 vector: vl = total (like UNR_NLOOP1)
+    p.dim.resize(n.size());
+    Lpi stride = 1;
+    for(int k=(int)n.size()-1; k>=0; --k){
+        FusedDim& d = p.dim[k];
+        d.n = n[k];
+        d.stride = stride;
+        stride *= d.n;
+        d.how = (d.n == 1? FD_ONE
+                : d.stride % p.vl == 0? FD_SCALAR
+                : p.vl % (d.n*d.stride) == 0? FD_CONST
+                : positivePow2(d.n) && positivePow2(d.stride)? FD_POW2
+                : FD_DIVMOD);
+    }
+    p.nloop = (int)((p.total + p.vl - 1) / p.vl);
+    int const full = (int)(p.total / p.vl);
+    p.unroll = (maxun > 1? std::max(1, std::min(maxun, full)): 1);
+    p.iops = fused_iops(p);
+    // Cost, as unroll_suggest's OpEst: index ops + a nominal 10-op kernel
+    // per vector, 2 loop ops per trip, 3 more to set a short final vl.
+    int const Kops = 10;
+    int const mainTrips = (p.unroll > 1? full / p.unroll: 0);
+    int const rem = p.nloop - mainTrips * p.unroll;
+    p.cost = (double)p.nloop * (p.iops + Kops) + 2.0*mainTrips + 2.0*rem
+        + (p.total % p.vl? 3.0*rem: 0.0);
+    return p;
+}
+FusedPlan fused_plan_suggest( std::vector<Lpi> const& n, int const vl_max/*=256*/,
+        int const maxun/*=8*/, int vl_min/*=0*/, int const v/*=0*/ ){
+    FusedPlan best = fused_plan(n, vl_max, maxun);
+    if(best.vl < vl_max){
+        if(v>0) cout<<" fused_plan_suggest: one vector, "<<str(best)<<endl;
+        return best;
+    }
+    uint64_t const total = best.total;
+    if(vl_min < 1 || vl_min > vl_max){         // allow up to 5% more vector iterations
+        uint64_t const nl = (105*(uint64_t)best.nloop + 99) / 100;
+        vl_min = std::max(1, (int)((total + nl - 1) / nl));
+    }
+    if(v>0) cout<<" fused_plan_suggest: checking vl "<<vl_max<<" to "<<vl_min<<endl;
+    for(int vl = vl_max-1; vl >= vl_min; --vl){
+        FusedPlan const p = fused_plan(n, vl, maxun);
+        if(v>1) cout<<"   "<<str(p)<<endl;
+        if(p.cost < best.cost) best = p;
+    }
+    if(v>0) cout<<" best "<<str(best)<<endl;
+    return best;
+}
+std::string str(FusedPlan const& p, std::string const& pfx/*=""*/){
+    std::ostringstream oss;
+    if(!pfx.empty()) oss<<" "<<pfx<<" ";
+    oss<<"fused";
+    char const* sep = " ";
+    for(auto const& d: p.dim){ oss<<sep<<d.n; sep = "x"; }
+    oss<<" vl="<<p.vl<<" nloop="<<p.nloop<<" unroll="<<p.unroll
+        <<" iops="<<p.iops<<" cost~"<<p.cost<<" {";
+    sep = "";
+    for(auto const& d: p.dim){ oss<<sep<<name(d.how); sep = ","; }
+    oss<<"}";
+    return oss.str();
+}
+std::ostream& operator<<(std::ostream& os, FusedPlan const& p){
+    return os<<str(p);
+}
+
+cprog::Cblock& fused_loop( cprog::Cunit& u, std::string const& name, FusedPlan const& p,
+        FusedKernel const& kern, cprog::CexprEmitter& be ){
+    using cprog::Cblock;
+    using cprog::Cexpr;
+    if(p.dim.empty() || p.vl < 1) THROW("fused_loop("<<name<<"): empty plan");
+    Cblock& scope = cprog::mk_scope(u, name);
+    scope["first"]<<"// "<<str(p);
+    Cblock& body = scope["body"];
+    std::vector<std::string> hoisted(p.dim.size());
+    Cblock& pre = body["pre"];
+    if(!dimsOf(p, FD_CONST).empty()){
+        Cexpr ec(name+"_h", jitdec(p.vl));
+        for(size_t k=0U; k<p.dim.size(); ++k){
+            if(p.dim[k].how != FD_CONST) continue;
+            hoisted[k] = name+"_c"+jitdec(k);
+            pre>>be.decl(Cexpr::VECTOR, hoisted[k]);
+        }
+        fused_const(ec, p, hoisted);
+        ec.emit(pre, be);
+    }
+    pre>>"uint64_t f0 = 0;";
+    int nCopy = 0;
+    auto const copy = [&](Cblock& parent, int const c, std::string const& f0txt,
+            std::string const& vltxt){
+        Cblock& cb = cprog::mk_scope(u, (c<0? "k": "u"+jitdec(c))).after(parent);
+        Cexpr e("t", vltxt);
+        Cexpr::Val const f0 = e.s(f0txt);
+        Cblock& idxBlock = cb["body"]["idx"];
+        FusedAt at{e, fused_index(e, p, f0, hoisted), f0, f0txt, vltxt, cb["body"]["kern"], c};
+        kern(at);
+        e.emit(idxBlock, be);
+        ++nCopy;
+    };
+    std::string const total = jitdec(p.total);
+    if(p.unroll > 1){
+        std::string const step = jitdec((Lpi)p.unroll * p.vl);
+        Cblock& loop = cprog::mk_scope(u, "unrolled",
+                "for(; f0+"+step+" <= "+total+"; f0 += "+step+")").after(body)["body"];
+        for(int c=0; c<p.unroll; ++c)
+            copy(loop, c, (c? "(f0+"+jitdec((Lpi)c*p.vl)+")": "f0"), jitdec(p.vl));
+    }
+    std::string const vl = jitdec(p.vl);
+    Cblock& loop = cprog::mk_scope(u, "loop",
+            "for(; f0 < "+total+"; f0 += "+vl+")").after(body)["body"];
+    if(p.total % p.vl == 0){
+        copy(loop, -1, "f0", vl);
+    }else{
+        loop["vl"]>>("uint64_t const vl = ("+total+"-f0 < "+vl+"? "+total+"-f0: "+vl+");");
+        copy(loop, -1, "f0", "vl");
+    }
+    return scope;
+}
+
+/** 'C' copy of intutil.c \c fastdiv_make, for runtime divisors in jit code */
+static char const* fusedRtFastdiv =
+"#include <stdint.h>\n"
+"#ifndef INT_UTIL_H /* else use (and link) intutil.h fastdiv_make */\n"
+"struct fastdiv { uint32_t mul; uint32_t add; int32_t shift; uint32_t _odiv; };\n"
+"static void fastdiv_make(struct fastdiv *d, uint32_t divisor){\n"
+"    uint32_t const l = (divisor > 1U? 31U - (uint32_t)__builtin_clz(divisor): 0U);\n"
+"    d->_odiv = divisor;\n"
+"    if(divisor & (divisor - 1U)){\n"
+"        uint64_t const m = 1ULL << (l + 32U);\n"
+"        d->mul = (uint32_t)(m / divisor);\n"
+"        uint32_t const r = (uint32_t)m - d->mul * divisor;\n"
+"        if(divisor - r < (1UL << l)){ ++d->mul; d->add = 0; }\n"
+"        else d->add = d->mul;\n"
+"        d->shift = 32 + l;\n"
+"    }else{ d->mul = 1; d->add = 0; d->shift = l; }\n"
+"}\n"
+"#endif\n"
+"#ifndef FUSED_RT_U32MAX /* flat indices up to this use u32 fastdiv (tests may lower it) */\n"
+"#define FUSED_RT_U32MAX 0xffffffffULL\n"
+"#endif";
+/** \c x as an unsigned integer literal? */
+static bool literal(std::string const& x, uint64_t* val){
+    if(x.empty() || x.find_first_not_of("0123456789") != std::string::npos) return false;
+    *val = std::stoull(x);
+    return true;
+}
+cprog::Cblock& fused_loop_rt( cprog::Cunit& u, std::string const& name,
+        std::vector<std::string> const& n, FusedKernel const& kern, cprog::CexprEmitter& be,
+        std::vector<FusedPlan> const& fast/*=std::vector<FusedPlan>()*/,
+        int const vl_max/*=256*/, int const unroll/*=1*/ ){
+    using cprog::Cblock;
+    using cprog::Cexpr;
+    size_t const N = n.size();
+    if(N == 0U) THROW("fused_loop_rt("<<name<<"): no loops");
+    if(vl_max < 1 || vl_max > MVL) THROW("fused_loop_rt("<<name<<"): vl_max="<<vl_max);
+    for(auto const& p: fast)
+        if(p.dim.size() != N || p.vl < 1)
+            THROW("fused_loop_rt("<<name<<"): fast path "<<str(p)<<" is not a "<<N<<"-loop plan");
+    std::vector<uint64_t> lit(N, 0U);           // 0: runtime limit
+    for(size_t k=0U; k<N; ++k)
+        if(literal(n[k], &lit[k]) && lit[k] == 0U)
+            THROW("fused_loop_rt("<<name<<"): loop limit 0");
+    Cblock* inc = u.find("includes");
+    if(!inc){                                   // fastdiv_make must precede its uses
+        inc = &u["includes"];
+        if(u.root.subs().front() != inc) inc->before(*u.root.subs().front());
+    }
+    if(!inc->find("fused_rt_fastdiv")) (*inc)["fused_rt_fastdiv"]>>fusedRtFastdiv;
+
+    std::vector<std::string> nv(N);             // limit variables
+    std::string total;
+    Cblock& scope = cprog::mk_scope(u, name);
+    {
+        std::ostringstream oss;
+        oss<<"// "<<name<<": fused runtime ";
+        for(size_t k=0U; k<N; ++k) oss<<(k? " x ": "")<<n[k];
+        oss<<" vl<="<<vl_max<<" unroll="<<unroll<<", "<<fast.size()<<" fast paths";
+        scope["first"]<<oss.str();
+    }
+    Cblock& body = scope["body"];
+    Cblock& lim = body["limits"];
+    for(size_t k=0U; k<N; ++k){
+        nv[k] = name+"_n"+jitdec(k);
+        lim>>("uint64_t const "+nv[k]+" = ("+n[k]+");");
+        total += (k? "*": "")+nv[k];
+    }
+    std::string const tot = name+"_total";
+    lim>>("uint64_t const "+tot+" = "+total+";");
+
+    // specialized shapes: compile-time plans
+    for(size_t s=0U; s<fast.size(); ++s){
+        std::string cond;
+        for(size_t k=0U; k<N; ++k)
+            cond += (k? " && ": "")+nv[k]+"=="+jitdec(fast[s].dim[k].n);
+        Cblock& fb = cprog::mk_scope(u, name+"_fast"+jitdec(s),
+                (s? "else if(": "if(")+cond+")").after(body)["body"];
+        fused_loop(u, name+"_f"+jitdec(s), fast[s], kern, be).after(fb);
+    }
+    Cblock& gen = cprog::mk_scope(u, name+"_rt", (fast.empty()? "": "else")).after(body)["body"];
+    // fastdiv magic for runtime divisors, computed once at entry
+    Cblock& pre = gen["pre"];
+    std::vector<std::string> dv(N);
+    for(size_t k=1U; k<N; ++k){                 // dim 0 (outermost) is never a divisor
+        if(lit[k]) continue;
+        dv[k] = name+"_d"+jitdec(k);
+        pre>>("struct fastdiv "+dv[k]+"; fastdiv_make(&"+dv[k]+", (uint32_t)"+nv[k]+");");
+    }
+    // equitable vector length: fewest vectors at vl_max, then shortest vl for that many
+    std::string const vlv = name+"_vl";
+    std::string const VL = jitdec(vl_max);
+    pre>>("uint64_t const "+name+"_nv = ("+tot+"+"+jitdec(vl_max-1)+")/"+VL+";")
+        >>("uint64_t const "+vlv+" = ("+name+"_nv? ("+tot+"+"+name+"_nv-1)/"+name+"_nv: 1);")
+        >>"uint64_t f0 = 0;";
+    // u32 path: flat index f0+lane < 2^32, fastdiv of the flat index
+    auto const index = [&](Cexpr& e, Cexpr::Val const f0){
+        std::vector<Cexpr::Val> idx(N);
+        Cexpr::Val q = e.add(e.seq(), f0);
+        for(size_t k=N; k-- > 1U; ){            // inner to outer
+            if(lit[k] == 1U){ idx[k] = e.k(0); continue; }
+            if(lit[k]){
+                auto const dm = cprog::divmod(e, q, (uint32_t)lit[k]);
+                idx[k] = dm.second;
+                q = dm.first;
+                continue;
+            }
+            Cexpr::Val const d = e.shr(e.add(e.mul(q, e.s(dv[k]+".mul")), e.s(dv[k]+".add")),
+                    e.s(dv[k]+".shift"));
+            idx[k] = e.sub(q, e.mul(e.s(nv[k]), d));
+            q = d;
+        }
+        idx[0] = (lit[0] == 1U? e.k(0): q);
+        return idx;
+    };
+    // u64 path: exact scalar digits of f0 (pasted, dead ones vanish), then
+    // digit + carry per lane, so fastdiv numerators stay below n[k]+vl
+    std::vector<std::string> pv(N);             // product of the limits inside dim k
+    for(size_t k=0U; k+1U<N; ++k){
+        for(size_t j=k+1U; j<N; ++j) pv[k] += (j>k+1U? "*": "")+nv[j];
+        if(k+2U < N) pv[k] = "("+pv[k]+")";
+    }
+    auto const indexBig = [&](Cexpr& e, std::string const& f0txt){
+        auto digit = [&](size_t const k){
+            std::string const q = (pv[k].empty()? f0txt: f0txt+"/"+pv[k]);
+            return e.s("("+(k? "("+q+")%"+nv[k]: q)+")");
+        };
+        std::vector<Cexpr::Val> idx(N);
+        Cexpr::Val c = e.seq();                 // carry into dim k
+        for(size_t k=N; k-- > 1U; ){
+            if(lit[k] == 1U){ idx[k] = e.k(0); continue; }
+            Cexpr::Val const x = e.add(c, digit(k));
+            if(lit[k]){
+                auto const dm = cprog::divmod(e, x, (uint32_t)lit[k]);
+                idx[k] = dm.second;
+                c = dm.first;
+                continue;
+            }
+            Cexpr::Val const d = e.shr(e.add(e.mul(x, e.s(dv[k]+".mul")), e.s(dv[k]+".add")),
+                    e.s(dv[k]+".shift"));
+            idx[k] = e.sub(x, e.mul(e.s(nv[k]), d));
+            c = d;
+        }
+        idx[0] = (lit[0] == 1U? e.k(0): e.add(c, digit(0)));
+        return idx;
+    };
+    auto const copy = [&](Cblock& parent, int const c, std::string const& f0txt,
+            std::string const& vltxt, bool const big){
+        Cblock& cb = cprog::mk_scope(u, (c<0? "k": "u"+jitdec(c))).after(parent);
+        Cexpr e("t", vltxt);
+        Cexpr::Val const f0 = e.s(f0txt);
+        Cblock& idxBlock = cb["body"]["idx"];
+        FusedAt at{e, (big? indexBig(e, f0txt): index(e, f0)), f0, f0txt, vltxt,
+            cb["body"]["kern"], c};
+        kern(at);
+        e.emit(idxBlock, be);
+    };
+    Cblock& small = cprog::mk_scope(u, name+"_u32",
+            "if("+tot+"+"+jitdec(vl_max-1)+" <= FUSED_RT_U32MAX)").after(gen)["body"];
+    int const U = std::max(1, unroll);
+    std::string const step = (U > 1? jitdec(U)+"*"+vlv: vlv);
+    Cblock& full = cprog::mk_scope(u, "unrolled",
+            "for(; f0+"+step+" <= "+tot+"; f0 += "+step+")").after(small)["body"];
+    for(int c=0; c<U; ++c)
+        copy(full, c, (c? "(f0+"+(c>1? jitdec(c)+"*": std::string())+vlv+")": "f0"), vlv, false);
+    Cblock& rem = cprog::mk_scope(u, "loop",
+            "for(; f0 < "+tot+"; f0 += "+vlv+")").after(small)["body"];
+    rem["vl"]>>("uint64_t const vl = ("+tot+"-f0 < "+vlv+"? "+tot+"-f0: "+vlv+");");
+    copy(rem, -1, "f0", "vl", false);
+    Cblock& large = cprog::mk_scope(u, name+"_u64", "else").after(gen)["body"];
+    Cblock& remBig = cprog::mk_scope(u, "loop",
+            "for(; f0 < "+tot+"; f0 += "+vlv+")").after(large)["body"];
+    remBig["vl"]>>("uint64_t const vl = ("+tot+"-f0 < "+vlv+"? "+tot+"-f0: "+vlv+");");
+    copy(remBig, -1, "f0", "vl", true);
+    return scope;
+}
+
+/** Generate reference vectors of vectorized N-loop indices */
+std::vector<VabN> ref_vloopN(Lpi const vlen, std::vector<Lpi> const& n,
+        int const verbose/*=1*/ )
+{
+    std::vector<VabN> vabs;
+    size_t const N = n.size();
+    Lpi total = 1;
+    for(Lpi const nk: n) total *= nk;
+    VabN cur;
+    cur.idx.assign(N, VVlpi(vlen, 0));
+    cur.vl = 0;
+    std::vector<Lpi> i(N, 0);                   // odometer, innermost last
+    for(Lpi f=0; f<total; ++f){
+        for(size_t k=0U; k<N; ++k) cur.idx[k][cur.vl] = i[k];
+        if(++cur.vl >= vlen){
+            vabs.push_back(cur);
+            cur.vl = 0;
+        }
+        for(size_t k=N; k-- > 0U; ){
+            if(++i[k] < n[k]) break;
+            i[k] = 0;
+        }
+    }
+    if(cur.vl > 0){ // partial final vector
+        for(size_t k=0U; k<N; ++k)
+            for(Lpi l=cur.vl; l<vlen; ++l) cur.idx[k][l] = 0;
+        vabs.push_back(cur);
+    }
+    if(verbose>0){
+        cout<<vabs.size()<<" vectors of "<<vlen<<" for "<<N<<" fused loops"<<endl;
+        int const w = 8; // output up-to-w [ ... [up-to-w]] ints
+        for(size_t l=0; l<vabs.size(); ++l){
+            cout<<"__"<<l<<endl;
+            for(size_t k=0U; k<N; ++k)
+                cout<<"i"<<k<<"_"<<l<<"["<<vabs[l].vl<<"]="
+                    <<vecprt(w, 1+(n[k]<10? 1: n[k]<100? 2: n[k]<1000? 3: 4), vabs[l].idx[k], vabs[l].vl)<<endl;
+        }
+    }
+    return vabs;
+}
+
 /** \fn unroll_suggest
  *
  * What about vector barrel rotate (Aurora VMV instruction)...
@@ -845,4 +1401,323 @@ std::vector<Vab> ref_vloop2(Lpi const vlen, Lpi const ii, Lpi const jj,
 
 
 }//loop::
+
+#ifdef FUSELOOP_MAIN
+#include <cstdlib>
+#include <dlfcn.h>
+#include <fstream>
+using namespace loop;
+using namespace std;
+
+static void test_fused_plan(){
+    cout<<"test_fused_plan"<<endl;
+    FusedPlan p = fused_plan({4,64}, 256);      // one vector, all precalc
+    CHECK( p.vl == 256 && p.nloop == 1 && p.iops == 0 );
+    CHECK( p.dim[0].how == FD_CONST && p.dim[1].how == FD_CONST );
+    p = fused_plan({100,512}, 256);             // jj%vl==0, jj=2^k
+    CHECK( p.dim[0].how == FD_SCALAR && p.dim[1].how == FD_POW2 );
+    p = fused_plan({5,3,16}, 48);               // vl%(3*16)==0, stride%vl==0
+    CHECK( p.dim[0].how == FD_SCALAR && p.dim[1].how == FD_CONST && p.dim[2].how == FD_CONST );
+    p = fused_plan({5,3,16}, 40);
+    CHECK( p.dim[0].how == FD_DIVMOD && p.dim[1].how == FD_DIVMOD && p.dim[2].how == FD_POW2 );
+    p = fused_plan({7,1,9,11}, 256, 1);
+    CHECK( p.dim[1].how == FD_ONE && p.dim[3].how == FD_DIVMOD && p.unroll == 1 );
+    FusedPlan const q = fused_plan_suggest({7,1,9,11}, 256, 1);
+    CHECK( q.cost <= p.cost && q.nloop <= p.nloop*105/100 + 1 );
+    cout<<" "<<p<<"\n "<<q<<endl;
+    bool threw = false;
+    try{ fused_plan({3,0,2}, 256); }catch(...){ threw = true; }
+    if(!threw) THROW("fused_plan of a zero extent did not throw");
+}
+/** vector ops emitted (\c CexprVel) for the outputs of \c e */
+static int emitted_ops(cprog::Cexpr& e){
+    cprog::Cunit scratch("emitted_ops", "C", 0);
+    cprog::CexprVel vel;
+    return e.emit(scratch.root, vel);
+}
+/** \c UnrollCost of a 2-loop plan, with op counts measured from the Cexpr of
+ * its precalc and induction step (not from \c unroll_plans bookkeeping). */
+static double measured_cost( int const vl, int const ii, int const jj, enum Unroll const how,
+        int const unroll, int const cycle, UnrollCost const& c=UnrollCost() ){
+    uint64_t const iijj = (uint64_t)ii * jj;
+    int const nloop = (int)((iijj + vl - 1) / vl);
+    uint32_t const hi = u32hi(iijj + vl);
+    bool const precalc = (how==UNR_NLOOP1 || how==UNR_NLOOP || how==UNR_JJPOW2_NLOOP
+            || how==UNR_CYC || how==UNR_JJPOW2_CYC);
+    int const nvec = (how==UNR_NLOOP1? 1: how==UNR_NLOOP || how==UNR_JJPOW2_NLOOP? nloop
+            : precalc? cycle: 1);
+    cprog::Cexpr ei;                            // a[k],b[k] = divmod(sq+k*vl)
+    for(int k=0; k<nvec; ++k){
+        auto const dm = cprog::divmod(ei, ei.add(ei.v("sq"), ei.s(jitdec(k)+"*vl")), (uint32_t)jj, hi);
+        ei.out("a"+jitdec(k), dm.first);
+        ei.out("b"+jitdec(k), dm.second);
+    }
+    int const initOps = emitted_ops(ei);
+    double indOps = 0.0;
+    cprog::Cexpr es;                            // induction step
+    switch(how){
+      case UNR_VLMODJJ: es.out("a", es.add(es.v("a"), es.s("vl/jj"))); break;
+      case UNR_JJMODVL_NORESET: es.out("b", es.add(es.v("b"), es.s("vl"))); break;
+      case UNR_JJMODVL_RESET: {
+          es.out("b", es.add(es.v("b"), es.s("vl")));
+          cprog::Cexpr er;                      // every jj/vl steps
+          er.out("a", er.add(er.v("a"), er.k(1)));
+          er.out("b", er.sub(er.v("b"), er.s("jj")));
+          indOps = (double)emitted_ops(er) / (jj/vl);
+      } break;
+      case UNR_CYC: case UNR_JJPOW2_CYC: es.out("a", es.add(es.v("a"), es.v("aDelta"))); break;
+      case UNR_DIVMOD: case UNR_JJPOW2_BIG: {
+          auto const dm = cprog::divmod(es, es.add(es.v("sq"), es.s("vl")), (uint32_t)jj, hi);
+          es.out("a", dm.first);
+          es.out("b", dm.second);
+      } break;
+      default: break;                           // full precalc: no induction
+    }
+    if(!precalc || how==UNR_CYC || how==UNR_JJPOW2_CYC) indOps += emitted_ops(es);
+    int const pregs = (precalc? 2*nvec: 0);
+    int const un = std::max(1, unroll);
+    int const trips = (nloop + un - 1) / un;
+    return c.vop * initOps + c.preg * pregs
+        + nloop * c.vop * (indOps + c.kernel)
+        + trips * c.sop * 2.0
+        + (iijj % vl? trips * c.sop * c.lastvl: 0.0)
+        + c.code * un * (indOps + c.kernel);
+}
+/** ranked 2-loop plans: sorted, consistent with each method's preconditions,
+ * and the best is never worse than the \c unroll_suggest choice at \c vl_max
+ * (both costed by \c measured_cost) */
+static void test_unroll_plans(){
+    cout<<"test_unroll_plans"<<endl;
+    struct Shape { int vl, ii, jj; };
+    vector<Shape> const shapes{ {256,4,64}, {256,100,512}, {256,1000,25}, {256,200,50},
+        {256,7,9}, {128,13,16}, {64,3,100}, {256,20,384} };
+    size_t nplans = 0U;
+    for(auto const& sh: shapes){
+        vector<UnrollPlan> const ps = unroll_plans(sh.vl, sh.ii, sh.jj, 8);
+        if(ps.empty()) THROW("no plans for "<<sh.ii<<"x"<<sh.jj);
+        nplans += ps.size();
+        for(size_t k=0; k<ps.size(); ++k){
+            UnrollPlan const& p = ps[k];
+            if(k && ps[k-1].cost > p.cost) THROW("plans not sorted by cost at "<<k);
+            CHECK( p.vl <= sh.vl && p.ii == sh.ii && p.jj == sh.jj && p.unroll >= 1 );
+            CHECK( p.nloop == (sh.ii*sh.jj + p.vl - 1) / p.vl );
+            CHECK( p.pregs <= UnrollCost().vregs );
+            switch(p.how){
+              case UNR_NLOOP1: CHECK( p.nloop == 1 ); break;
+              case UNR_VLMODJJ: CHECK( p.vl % p.jj == 0 ); break;
+              case UNR_JJMODVL_NORESET: // fall-through
+              case UNR_JJMODVL_RESET: CHECK( p.jj % p.vl == 0 ); break;
+              case UNR_NLOOP: case UNR_JJPOW2_NLOOP: CHECK( p.unroll == p.nloop ); break;
+              case UNR_CYC: case UNR_JJPOW2_CYC: CHECK( p.unroll % p.cycle == 0 ); break;
+              default: break;
+            }
+            UnrollSuggest const u = suggestion(p);
+            CHECK( u.suggested == p.how && u.unroll == p.unroll && u.vl == p.vl );
+        }
+        UnrollSuggest const h = unroll_suggest(sh.vl, sh.ii, sh.jj, 8, 0);
+        int const hvl = (int)std::min<int64_t>(h.vl, (int64_t)sh.ii*sh.jj);
+        double const hcost = measured_cost(hvl, sh.ii, sh.jj, h.suggested,
+                (h.suggested==UNR_NLOOP1? 1: h.unroll), h.cycle);
+        UnrollPlan const& f = ps.front();
+        double const fcost = measured_cost(f.vl, f.ii, f.jj, f.how, f.unroll, f.cycle);
+        cout<<" best of "<<ps.size()<<": "<<f<<" measured "<<fcost
+            <<" vs unroll_suggest "<<name(h.suggested)<<" unroll="<<h.unroll
+            <<" measured "<<hcost<<endl;
+        CHECK( fcost <= hcost );
+    }
+    CHECK( unroll_plans(256,4,64).front().how == UNR_NLOOP1 );
+    vector<UnrollPlan> const few = unroll_plans(256,100,512,8,256);    // vl fixed
+    for(auto const& p: few) CHECK( p.vl == 256 && p.how != UNR_DIVMOD );
+    UnrollCost heavy;                           // free registers: full precalc wins
+    heavy.kernel = 1.0; heavy.preg = 0.0;
+    UnrollPlan const b = unroll_plans(256,100,9,8,256,heavy).front();
+    CHECK( b.vl == 256 && b.how == UNR_NLOOP && b.indOps == 0.0 );
+    bool threw = false;
+    try{ unroll_plans(257,2,2); }catch(...){ threw = true; }
+    if(!threw) THROW("unroll_plans with vl>256 did not throw");
+    cout<<" "<<shapes.size()<<" shapes, "<<nplans<<" ranked plans OK"<<endl;
+}
+/** emit fused loops for various shapes as portable 'C', run them, and compare
+ * every index of every vector with \c ref_vloopN */
+static void test_fused_loop(){
+    cout<<"test_fused_loop"<<endl;
+    vector<vector<Lpi>> const shapes = {
+        {13}, {3,5}, {7,1,9}, {2,3,4,5}, {4,64}, {100,512}, {3,3,16,7,5},
+        {6,5,4,3,2,1}, {13,17,19}, {1,1}, {2,128,3} };
+    vector<FusedPlan> plans;
+    for(auto const& n: shapes){
+        plans.push_back(fused_plan_suggest(n, 256, 4));
+        plans.push_back(fused_plan(n, 60, 3));  // short vl: remainders, unrolled copies
+        plans.push_back(fused_plan(n, 8, 1));
+    }
+    cprog::Cunit pr("fused");
+    pr.v = 0;
+    pr["includes"]<<"#include <stdint.h>\n#define FOR(I,N) for(uint64_t I=0; I<(N); ++I)";
+    cprog::CexprRef ref;
+    for(size_t t=0U; t<plans.size(); ++t){
+        string const fn = "fn"+jitdec(t);
+        auto& f = cprog::mk_func(pr, fn, "void "+fn+"(uint64_t** o)").after(pr.root);
+        auto kern = [&](FusedAt& at){
+            for(size_t k=0U; k<at.idx.size(); ++k){
+                auto const x = at.idx[k];
+                at.e.out("(o["+jitdec(k)+"]+"+at.f0txt+")",
+                        at.e.kind(x)==cprog::Cexpr::SCALAR? at.e.brd(x): x);
+            }
+        };
+        fused_loop(pr, "fused", plans[t], kern, ref).after(f["body"]);
+    }
+    {
+        cprog::Cunit vel("fused_vel");          // intrinsics text: hoists, scalars, unroll
+        vel.v = 0;
+        cprog::CexprVel be;
+        fused_loop(vel, "fused", fused_plan({5,3,16}, 48, 2),
+                [](FusedAt& at){ at.e.out("y", at.idx[0]); }, be).after(vel.root);
+        string const txt = vel.str();
+        cout<<txt<<endl;
+        CHECK( txt.find("__vr fused_c2;") != string::npos );
+        CHECK( txt.find("_vel_vseq_vl(48)") != string::npos );
+    }
+    {
+        ofstream ofs("fuseloop_test.c");
+        ofs<<pr.str();
+    }
+    if(system("cc -O1 -shared -fPIC -o fuseloop_test.so fuseloop_test.c"))
+        THROW("compile of fused_loop output failed");
+    void* dl = dlopen("./fuseloop_test.so", RTLD_NOW|RTLD_LOCAL);
+    if(!dl) THROW("dlopen: "<<dlerror());
+    typedef void (*Fn)(uint64_t**);
+    size_t nchk = 0U;
+    for(size_t t=0U; t<plans.size(); ++t){
+        FusedPlan const& p = plans[t];
+        Fn const fn = (Fn)dlsym(dl, ("fn"+jitdec(t)).c_str());
+        if(!fn) THROW("dlsym: "<<dlerror());
+        size_t const N = p.dim.size();
+        vector<vector<uint64_t>> out(N, vector<uint64_t>(p.total + p.vl, ~0ULL));
+        vector<uint64_t*> o;
+        for(auto& v: out) o.push_back(v.data());
+        fn(o.data());
+        auto const vabs = ref_vloopN(p.vl, p.limits(), 0);
+        CHECK( vabs.size() == (size_t)p.nloop );
+        for(size_t l=0U; l<vabs.size(); ++l)
+            for(size_t k=0U; k<N; ++k)
+                for(int i=0; i<vabs[l].vl; ++i){
+                    if(out[k][l*p.vl+i] != vabs[l].idx[k][i])
+                        THROW(str(p)<<": dim "<<k<<" vector "<<l<<" lane "<<i<<" is "
+                                <<out[k][l*p.vl+i]<<", expected "<<vabs[l].idx[k][i]);
+                    ++nchk;
+                }
+    }
+    dlclose(dl);
+    cout<<" "<<plans.size()<<" fused loops, "<<nchk<<" indices OK"<<endl;
+}
+/** one runtime-shape kernel per rank, run on many shapes (fast paths and
+ * generic), compared with \c ref_vloopN */
+static void test_fused_loop_rt(){
+    cout<<"test_fused_loop_rt"<<endl;
+    cprog::Cunit pr("fused_rt");
+    pr.v = 0;
+    pr["includes"]<<"#include <stdint.h>\n#define FOR(I,N) for(uint64_t I=0; I<(N); ++I)";
+    cprog::CexprRef ref;
+    auto kern = [&](FusedAt& at){
+        for(size_t k=0U; k<at.idx.size(); ++k){
+            auto const x = at.idx[k];
+            at.e.out("(o["+jitdec(k)+"]+"+at.f0txt+")",
+                    at.e.kind(x)==cprog::Cexpr::SCALAR? at.e.brd(x): x);
+        }
+    };
+    {
+        auto& f = cprog::mk_func(pr, "rt3",
+                "void rt3(uint64_t** o, uint64_t n0, uint64_t n1, uint64_t n2)").after(pr.root);
+        vector<FusedPlan> const fast = { fused_plan_suggest({4,8,8}), fused_plan({2,3,5}, 8, 2) };
+        fused_loop_rt(pr, "fz", {"n0","n1","n2"}, kern, ref, fast, 60, 3).after(f["body"]);
+    }
+    {
+        auto& f = cprog::mk_func(pr, "rt2", "void rt2(uint64_t** o, uint64_t n0)").after(pr.root);
+        fused_loop_rt(pr, "fy", {"n0","7"}, kern, ref).after(f["body"]);
+    }
+    string const txt = pr.str();
+    CHECK( txt.find("fastdiv_make(&fz_d1, (uint32_t)fz_n1);") != string::npos );
+    CHECK( txt.find("fastdiv_make(&fz_d2, (uint32_t)fz_n2);") != string::npos );
+    CHECK( txt.find("fy_d1") == string::npos );            // literal 7: constants
+    CHECK( txt.find("if(fz_n0==4 && fz_n1==8 && fz_n2==8)") != string::npos );
+    {
+        cprog::Cunit vel("fused_rt_vel");       // intrinsics text: scalar magic operands
+        vel.v = 0;
+        vel["includes"]<<"#include \"velintrin.h\"";
+        cprog::CexprVel be;
+        fused_loop_rt(vel, "fv", {"ii","jj"}, [](FusedAt& at){ at.e.out("y", at.idx[1]); },
+                be).after(vel.root);
+        string const t = vel.str();
+        CHECK( t.find("fv_d1.mul") != string::npos && t.find("_vel_vseq_vl(") != string::npos );
+    }
+    {   // no "includes" block: fastdiv_make (and <stdint.h>) go first
+        cprog::Cunit bare("fused_rt_bare");
+        bare.v = 0;
+        bare["macros"]<<"#define FOR(I,N) for(uint64_t I=0; I<(N); ++I)";
+        auto& f = cprog::mk_func(bare, "rt1",
+                "void rt1(uint64_t** o, uint64_t n0, uint64_t n1)").after(bare.root);
+        fused_loop_rt(bare, "fb", {"n0","n1"}, kern, ref).after(f["body"]);
+        if(bare.root.subs().front()->getName() != "includes")
+            THROW("fused_loop_rt did not put \"includes\" first:\n"<<bare.tree());
+        {
+            ofstream ofs("fuseloop_rt_bare.c");
+            ofs<<bare.str();
+        }
+        if(system("cc -O1 -Wall -Werror -c -o fuseloop_rt_bare.o fuseloop_rt_bare.c"))
+            THROW("compile of fused_loop_rt output without \"includes\" failed");
+    }
+    {
+        ofstream ofs("fuseloop_rt_test.c");
+        ofs<<txt;
+    }
+    CHECK( txt.find("if(fz_total+59 <= FUSED_RT_U32MAX)") != string::npos );
+    // FUSED_RT_U32MAX=0 runs every runtime shape through the u64 path
+    if(system("cc -O1 -Wall -Werror -shared -fPIC -o fuseloop_rt_test.so fuseloop_rt_test.c")
+            || system("cc -O1 -Wall -Werror -shared -fPIC -DFUSED_RT_U32MAX=0"
+                " -o fuseloop_rt_u64.so fuseloop_rt_test.c"))
+        THROW("compile of fused_loop_rt output failed");
+    vector<vector<Lpi>> const shapes = {
+        {4,8,8}, {2,3,5}, {1,1,1}, {13,17,19}, {3,1,100}, {1,300,1}, {5,5,5}, {2,128,3},
+        {1,7}, {37,7}, {100,7} };
+    size_t nchk = 0U;
+    for(char const* so: {"./fuseloop_rt_test.so", "./fuseloop_rt_u64.so"}){
+        void* dl = dlopen(so, RTLD_NOW|RTLD_LOCAL);
+        if(!dl) THROW("dlopen: "<<dlerror());
+        typedef void (*Fn3)(uint64_t**, uint64_t, uint64_t, uint64_t);
+        typedef void (*Fn2)(uint64_t**, uint64_t);
+        Fn3 const rt3 = (Fn3)dlsym(dl, "rt3");
+        Fn2 const rt2 = (Fn2)dlsym(dl, "rt2");
+        if(!rt3 || !rt2) THROW("dlsym: "<<dlerror());
+        for(auto const& n: shapes){
+            Lpi total = 1;
+            string shape;
+            for(Lpi const x: n){ total *= x; shape += (shape.empty()? "": "x")+jitdec(x); }
+            vector<vector<uint64_t>> out(n.size(), vector<uint64_t>(total + MVL, ~0ULL));
+            vector<uint64_t*> o;
+            for(auto& v: out) o.push_back(v.data());
+            if(n.size() == 3U) rt3(o.data(), n[0], n[1], n[2]);
+            else rt2(o.data(), n[0]);
+            auto const vabs = ref_vloopN(1, n, 0);   // one flat index per "vector"
+            for(Lpi f=0; f<total; ++f)
+                for(size_t k=0U; k<n.size(); ++k){
+                    if(out[k][f] != vabs[f].idx[k][0])
+                        THROW("fused_loop_rt "<<so<<" "<<shape<<": dim "<<k<<" index "<<f<<" is "
+                                <<out[k][f]<<", expected "<<vabs[f].idx[k][0]);
+                    ++nchk;
+                }
+            CHECK( out[0][total] == ~0ULL );       // nothing past the end
+        }
+        dlclose(dl);
+    }
+    cout<<" "<<shapes.size()<<" runtime shapes, u32 and u64 paths, "<<nchk<<" indices OK"<<endl;
+}
+int main(int,char**){
+    test_fused_plan();
+    test_unroll_plans();
+    test_fused_loop();
+    test_fused_loop_rt();
+    cout<<"\nGoodbye"<<endl;
+    return 0;
+}
+#endif // FUSELOOP_MAIN
 // vim: ts=4 sw=4 et cindent cino=^=l0,\:.5s,=-.5s,N-s,g.5s,b1 cinkeys=0{,0},0),\:,0#,!^F,o,O,e,0=break
@@ -2,12 +2,18 @@
 #define FUSELOOP_HPP
 /* Copyright (c) 2019 by NEC Corporation
  * This file is part of ve-jit */
+#include "cexpr.hpp"    // FusedPlan index math
 #include <sstream>
 #include <vector>
+#include <string>
+#include <functional>
 #include <type_traits>
 #include <cstdint>
 #include <cassert>
 
+namespace cprog {
+class Cunit;
+}
 namespace loop {
 
 typedef int64_t Lpi; // Loop-index type
@@ -83,6 +89,7 @@ struct UnrollSuggest {
  * Outputs a descriptive suggestion to \c cout.
  *
  * \return enum value describing the type of unrolling that could be done.
+ * \sa unroll_plans for a ranked, cost-model alternative.
  *
  * \todo a separate function returning a struct describing precalc,
  * complete with precalculated data vectors
@@ -112,6 +119,43 @@ UnrollSuggest unroll_suggest( int const vl, int const ii, int const jj, int cons
  */
 UnrollSuggest unroll_suggest( UnrollSuggest & u, int vl_min=0, int v=0/*verbosity*/ );
 
+/** Explicit per-op cost model for \c unroll_plans, in units of one vector op */
+struct UnrollCost {
+    UnrollCost() : vop(1.0), sop(0.25), preg(0.5), lastvl(3.0), kernel(10.0),
+        code(0.02), vregs(16) {}
+    double vop;         ///< vector op (induction or kernel)
+    double sop;         ///< scalar op (loop counter, branch)
+    double preg;        ///< precalc vector register (one-time, register pressure)
+    double lastvl;      ///< scalar ops per loop trip to check/set a short final VL
+    double kernel;      ///< nominal kernel vector ops per vector iteration
+    double code;        ///< per vector op of unrolled loop body (code size)
+    int vregs;          ///< precalc register budget (plans needing more are dropped)
+};
+/** One candidate (VL, unroll, precalc, induction method) for \c for(0..ii)for(0..jj). */
+struct UnrollPlan {
+    int vl, ii, jj;
+    enum Unroll how;    ///< induction method
+    int unroll;         ///< vector iterations per loop trip
+    int cycle;          ///< precalc period (0: formula induction)
+    int pregs;          ///< precalc vector registers
+    int nloop;          ///< vector iterations
+    int initOps;        ///< one-time vector ops (first a[],b[], precalc)
+    double indOps;      ///< induction vector ops per vector iteration
+    double cost;        ///< \c UnrollCost total for the whole loop
+};
+/** Enumerate every applicable plan for \c vl in [vl_min,vl_max], score each with
+ * \c c, and return them cheapest first (no output).  Unlike \c unroll_suggest,
+ * which returns the first matching \c enum \c Unroll case, all cases that apply
+ * to a VL compete.  Divmod op counts come from \c cprog::divmod (same method
+ * selection as \c mk_DIVMOD).  \c maxun bounds unroll and precalc periods;
+ * \c vl_min out of range [default] allows at most 5% more vector iterations. */
+std::vector<UnrollPlan> unroll_plans( int const vl_max, int const ii, int const jj,
+        int const maxun=8, int vl_min=0, UnrollCost const& c=UnrollCost() );
+/** \c UnrollSuggest view of a plan, for existing \c UnrollSuggest consumers */
+UnrollSuggest suggestion( UnrollPlan const& p );
+std::string str(UnrollPlan const& p);
+std::ostream& operator<<(std::ostream& os, UnrollPlan const& p);
+
 /** If nothing turned up with unroll_suggest, we can always try for equitable
  * loop vector length...
  *
@@ -205,11 +249,157 @@ struct UnrollData : public UnrollSuggest {
      */
     std::vector<Vab> pre;
 };
+/** \c unroll_suggest at \c vl, then its lower-vl alternative (\c vl_min as
+ * in \c unroll_suggest(UnrollSuggest&,...)), with \c pre filled for the
+ * chosen strategy: all \c nloop vectors for UNR_NLOOP1 / UNR_NLOOP /
+ * UNR_JJPOW2_NLOOP, \c cycle vectors for UNR_CYC / UNR_JJPOW2_CYC, else
+ * one init-phase vector when 1<jj<vl.
+ * \post \c vll is the alternative vl (0: none); if nonzero, \c vl==vll. */
+UnrollData mk_unroll_data( int const vl, int const ii, int const jj,
+        int const b_period_max=8, int const vl_min=0 );
 
 /** Generate reference vectors of vectorized 2-loop indices */
 std::vector<Vab> ref_vloop2(Lpi const vlen, Lpi const ii, Lpi const jj,
         int const verbose=1);
 
+/** \group N-loop fusion
+ * Vectorize the flattened iteration space of N nested loops
+ * <tt>for(i0<n[0]) for(i1<n[1]) ... for(i_{N-1}<n[N-1])</tt>, (outermost first).
+ * Flat index \c f = sum of i_k*stride_k, so <tt>i_k = (f/stride_k) % n[k]</tt>,
+ * and a vector holds flat indices <tt>f0 .. f0+vl-1</tt> (\c f0 a multiple of \c vl).
+ *
+ * Each dimension gets the cheapest index strategy its shape allows at that \c vl,
+ * generalizing the 2-loop \c UNR_VLMODJJ / \c UNR_JJMODVL / \c UNR_JJPOW2 / \c UNR_DIVMOD
+ * cases of \c unroll_suggest.  Vector dimensions are peeled off by a chain of
+ * \c cprog::divmod (so N loops cost at most N-1 divmods, never N divisions of \c f).
+ */
+//@{
+enum FuseDim {
+    FD_UNSET=0,     ///< uninitialized
+    FD_ONE,         ///< n==1: index always 0
+    FD_SCALAR,      ///< stride%vl==0: one index per vector (scalar divmod of f0)
+    FD_CONST,       ///< vl%(n*stride)==0: same index vector every time (precalc once)
+    FD_POW2,        ///< n, stride 2^k: shift/mask of f
+    FD_DIVMOD       ///< generic: fastdiv + mul-sub of f (slowest)
+};
+char const* name( enum FuseDim const fd );
+std::ostream& operator<<(std::ostream& os, enum FuseDim const fd);
+
+struct FusedDim {
+    Lpi n;              ///< loop limit
+    Lpi stride;         ///< product of inner loop limits
+    enum FuseDim how;
+};
+/** N-loop fusion plan: vector length, per-dimension strategy, unroll.
+ * Like \c UnrollSuggest::unroll, \c unroll is a suggestion (copies of
+ * full-vector iterations per main-loop trip), which \c fused_loop honors. */
+struct FusedPlan {
+    FusedPlan() : dim(), total(0), vl(0), nloop(0), unroll(0), iops(0), cost(0.0) {}
+    std::vector<FusedDim> dim;  ///< outermost first
+    Lpi total;          ///< product of all n
+    int vl;             ///< vector length
+    int nloop;          ///< vector iterations
+    int unroll;         ///< suggested unroll (1: none)
+    int iops;           ///< index ops per vector (from the emitted \c Cexpr)
+    double cost;        ///< estimated total ops, including a nominal kernel
+    std::vector<Lpi> limits() const;
+};
+/** plan for loop limits \c n at exactly vector length \c vl (\c vl<=256).
+ * \c maxun limits the unroll (<=1: never unroll).
+ * \throw if some n<1, or the iteration count does not fit u32 index math. */
+FusedPlan fused_plan( std::vector<Lpi> const& n, int const vl, int const maxun=8 );
+/** Scan vector lengths \c vl_max down to \c vl_min for the lowest-cost plan
+ * (fewer index ops, fewer loops, equitable last vector), as
+ * \c unroll_suggest(UnrollSuggest&) does for 2 loops.  \c vl_min out of
+ * range [default] means allow at most 5% more vector iterations. */
+FusedPlan fused_plan_suggest( std::vector<Lpi> const& n, int const vl_max=256,
+        int const maxun=8, int vl_min=0, int const v=0/*verbose*/ );
+std::string str(FusedPlan const& p, std::string const& pfx="");
+std::ostream& operator<<(std::ostream& os, FusedPlan const& p);
+
+/** per-dimension index values for the vector at flat index \c f0 (a scalar):
+ * \c k(0) for FD_ONE, scalars for FD_SCALAR, \c v(hoisted[k]) for FD_CONST
+ * (values of \c fused_const), vectors otherwise.  Uses \c e.vl(). */
+std::vector<cprog::Cexpr::Val> fused_index( cprog::Cexpr& e, FusedPlan const& p,
+        cprog::Cexpr::Val const f0, std::vector<std::string> const& hoisted );
+/** FD_CONST index vectors (at VL \c p.vl): <tt>out(hoisted[k], ...)</tt> */
+void fused_const( cprog::Cexpr& e, FusedPlan const& p,
+        std::vector<std::string> const& hoisted );
+
+/** one vector-iteration copy of a \c fused_loop kernel */
+struct FusedAt {
+    cprog::Cexpr& e;            ///< index math, emitted (after the kernel adds \c out s) before \c cb
+    std::vector<cprog::Cexpr::Val> idx;     ///< per-dimension index values
+    cprog::Cexpr::Val f0;       ///< flat index of lane 0 (scalar)
+    std::string f0txt;          ///< 'C' text of \c f0
+    std::string vltxt;          ///< 'C' text of the vector length
+    cprog::Cblock& cb;          ///< kernel code (in its own { } scope)
+    int copy;                   ///< unrolled copy, or -1 in the remainder loop
+};
+typedef std::function<void(FusedAt& at)> FusedKernel;
+
+/** Emit plan \c p as the unlinked scope \c name (link it with \c after):
+ * ```
+ * { // name: fused 4x3x5 vl=60 ...
+ *   hoisted FD_CONST index vectors;  uint64_t f0 = 0;
+ *   [unroll>1] for(; f0+U*vl <= total; f0 += U*vl){ {copy 0} .. {copy U-1} }
+ *   for(; f0 < total; f0 += vl){ uint64_t const vl = ..; {copy -1} }
+ * }
+ * ```
+ * \c kern is called once per copy.  \c be lowers the index math
+ * (\c CexprVel for VE intrinsics, \c CexprRef for portable 'C'). */
+cprog::Cblock& fused_loop( cprog::Cunit& u, std::string const& name, FusedPlan const& p,
+        FusedKernel const& kern, cprog::CexprEmitter& be );
+
+/** Runtime-shape \c fused_loop: loop limits \c n are 'C' expressions (ex.
+ * function arguments), so one compiled kernel covers a family of shapes.
+ * ```
+ * { // name: fused runtime n0 x n1 ...
+ *   uint64_t const name_n0 = (n[0]); ...  name_total = name_n0*name_n1*...;
+ *   if(name_n0==4 && name_n1==64){ fused_loop of fast[0] }  // compile-time plans
+ *   else if(...){ fused_loop of fast[1] } ...
+ *   else{ // name_rt
+ *     struct fastdiv name_d1; fastdiv_make(&name_d1, (uint32_t)name_n1); ...
+ *     name_vl = equitable split of name_total at vl_max;  uint64_t f0 = 0;
+ *     if(name_total+vl_max-1 <= FUSED_RT_U32MAX){ // name_u32
+ *       for(; f0+U*name_vl <= name_total; ...){ {copy 0} .. {copy U-1} }
+ *       for(; f0 < name_total; f0 += name_vl){ uint64_t const vl = ..; {copy -1} }
+ *     }else{ // name_u64
+ *       for(; f0 < name_total; f0 += name_vl){ uint64_t const vl = ..; {copy -1} }
+ *     }
+ *   }
+ * }
+ * ```
+ * Runtime dims use \c FD_DIVMOD-style index math with the magic constants
+ * as scalar inputs: <tt>q=(x*mul+add)>>shift, r=x-n*q</tt>, valid for
+ * x < 2^32.  The u32 path divides the flat index f0+lane.  Above
+ * \c FUSED_RT_U32MAX (default 2^32-1; a test may \#define it lower), the
+ * u64 path takes the exact digits of f0 with scalar 64-bit / and %, and
+ * divides only digit+carry per lane, which stays below limit+vl.  Limits that
+ * are integer literals keep compile-time \c cprog::divmod constants.  The
+ * first call for \c u adds a 'C' \c fastdiv_make to \c u["includes"]
+ * (skipped if \ref intutil.h was included first), creating "includes" as
+ * the first block of \c u.root if it is missing.
+ *
+ * \c fast plans (ex. \c fused_plan_suggest of common shapes) must have
+ * \c n.size() dims.  \c unroll is the number of copies in the full-vector loop.
+ * \pre at run time, all limits >= 1 and each limit + vl_max < 2^32.
+ * \throw on a literal limit of 0, or a \c fast plan of another rank. */
+cprog::Cblock& fused_loop_rt( cprog::Cunit& u, std::string const& name,
+        std::vector<std::string> const& n, FusedKernel const& kern, cprog::CexprEmitter& be,
+        std::vector<FusedPlan> const& fast=std::vector<FusedPlan>(),
+        int const vl_max=256, int const unroll=1 );
+
+/** Reference values for correct N-loop index outputs */
+struct VabN {
+    std::vector<VVlpi> idx;     ///< idx[k][0..vl) for each loop, outermost first
+    int vl;
+};
+/** Generate reference vectors of vectorized N-loop indices */
+std::vector<VabN> ref_vloopN(Lpi const vlen, std::vector<Lpi> const& n,
+        int const verbose=1);
+//@}
+
 }//loop::
 
 // vim: ts=4 sw=4 et cindent cino=^=l0,\:.5s,=-.5s,N-s,g.5s,b1 cinkeys=0{,0},0),\:,0#,!^F,o,O,e,0=break
@@ -0,0 +1,312 @@
+/* Copyright (c) 2019 by NEC Corporation
+ * This file is part of ve-jit */
+/** \file
+ * FuseTune: build, time and remember the fastest fused-loop plans.
+ */
+#include "fusetune.hpp"
+#include "dllbuild.hpp"
+#include "cblock.hpp"
+#include "stringutil.hpp"
+#include "throw.hpp"
+#include "timer.h"
+
+#include <algorithm>
+#include <cstdio>       // std::rename
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#ifndef MVL
+#define MVL 256
+#endif
+
+namespace loop {
+
+using namespace std;
+
+#if defined(__ve)
+static bool const tuneVel = true;
+#else
+static bool const tuneVel = false;
+#endif
+
+void fused_kernel_hash(FusedAt& at){
+    static uint64_t const odd[] = {1000003U, 8191U, 131071U, 524287U, 65537U, 257U, 17U, 3U};
+    cprog::Cexpr& e = at.e;
+    cprog::Cexpr::Val sum;
+    for(size_t k=0U; k<at.idx.size(); ++k){
+        auto const t = e.mul(at.idx[k], e.k(odd[k%8U]));
+        sum = (k? e.add(sum, t): t);
+    }
+    if(e.kind(sum) == cprog::Cexpr::SCALAR) sum = e.brd(sum);
+    e.out("h", e.bxor(e.v("h"), sum));
+}
+
+std::string fuse_tune_key( std::vector<Lpi> const& n, std::string const& kname,
+        bool const vel ){
+    std::ostringstream oss;
+    for(size_t k=0U; k<n.size(); ++k) oss<<(k? "x": "")<<n[k];
+    oss<<"/"<<kname<<"/"<<(vel? "ve": "x86");
+    return oss.str();
+}
+std::map<std::string,FuseTuneEntry> fuse_tune_load( std::string const& file ){
+    std::map<std::string,FuseTuneEntry> ret;
+    ifstream ifs(file);
+    string line;
+    for(int ln=1; getline(ifs, line); ++ln){
+        size_t const b = line.find_first_not_of(" \t");
+        if(b == string::npos || line[b] == '#') continue;
+        istringstream iss(line);
+        FuseTuneEntry e;
+        if(!(iss>>e.key>>e.vl>>e.unroll>>e.cycles) || e.vl < 1 || e.vl > MVL || e.unroll < 1)
+            THROW("fuse_tune_load: "<<file<<":"<<ln<<": bad line \""<<line<<"\"");
+        ret[e.key] = e;
+    }
+    return ret;
+}
+void fuse_tune_save( std::string const& file, FuseTuneEntry const& e ){
+    if(e.key.empty() || e.key.find_first_of(" \t\n#") != string::npos)
+        THROW("fuse_tune_save: bad key \""<<e.key<<"\"");
+    auto m = fuse_tune_load(file);
+    m[e.key] = e;
+    string const tmp = file + ".tmp";
+    {
+        ofstream ofs(tmp);
+        ofs<<"# FuseTune lookup: shape/kernel/target vl unroll cycles_per_call\n";
+        for(auto const& x: m)
+            ofs<<x.first<<" "<<x.second.vl<<" "<<x.second.unroll<<" "<<x.second.cycles<<"\n";
+        if(!ofs) THROW("fuse_tune_save: cannot write "<<tmp);
+    }
+    if(std::rename(tmp.c_str(), file.c_str()))
+        THROW("fuse_tune_save: cannot rename "<<tmp<<" to "<<file);
+}
+/** lookup under \c fuse_tune_key(n,kname,vel) */
+static FusedPlan fused_plan_tuned( std::vector<Lpi> const& n, std::string const& file,
+        std::string const& kname, bool const vel, int const vl_max, int const maxun ){
+    auto const m = fuse_tune_load(file);
+    auto const found = m.find(fuse_tune_key(n, kname, vel));
+    if(found != m.end()) return fused_plan(n, found->second.vl, found->second.unroll);
+    return fused_plan_suggest(n, vl_max, maxun);
+}
+FusedPlan fused_plan_tuned( std::vector<Lpi> const& n, std::string const& file,
+        std::string const& kname/*="HASH"*/, int const vl_max/*=256*/, int const maxun/*=8*/ ){
+    return fused_plan_tuned(n, file, kname, tuneVel, vl_max, maxun);
+}
+FusedPlan fused_plan_tuned( std::vector<Lpi> const& n, std::string const& file,
+        FuseTune const& ft, std::string const& kname/*="HASH"*/ ){
+    return fused_plan_tuned(n, file, kname, ft.vel, ft.vl_max, ft.maxun);
+}
+
+FuseTune::FuseTune()
+    : K(4), vl_max(MVL), maxun(8), trials(5), reps(0U), minCycles(200000U),
+    vel(tuneVel), dir("tmp-fusetune"), v(0), nLib(0)
+{}
+
+std::vector<FusedPlan> FuseTune::candidates( std::vector<Lpi> const& n ) const {
+    std::vector<FusedPlan> all;
+    if(n.size() == 2U){
+        // u.how is dropped: fused_plan picks its own index method for u.vl
+        for(auto const& u: unroll_plans(vl_max, (int)n[0], (int)n[1], maxun))
+            all.push_back(fused_plan(n, u.vl, std::min(u.unroll, maxun)));
+    }else{
+        FusedPlan const p0 = fused_plan(n, vl_max, 1);
+        Lpi const nl = (105*(Lpi)p0.nloop + 99) / 100;
+        int const vl_min = std::max<Lpi>(1, (p0.total + nl - 1) / nl);
+        for(int vl = p0.vl; vl >= vl_min; --vl)
+            for(int u=1; u <= std::max(1, maxun); u *= 2)
+                all.push_back(fused_plan(n, vl, u));
+        std::stable_sort(all.begin(), all.end(), [](FusedPlan const& a, FusedPlan const& b){
+                return a.cost < b.cost; });
+    }
+    std::vector<FusedPlan> ret;
+    for(auto const& p: all){
+        if((int)ret.size() >= K) break;
+        bool dup = false;
+        for(auto const& q: ret) dup = dup || (q.vl == p.vl && q.unroll == p.unroll);
+        if(!dup) ret.push_back(p);
+    }
+    return ret;
+}
+
+std::vector<FuseTuneResult> FuseTune::run( std::vector<Lpi> const& n,
+        FusedKernel const& kern/*=fused_kernel_hash*/ ){
+    std::vector<FusedPlan> const plans = candidates(n);
+    if(plans.empty()) THROW("FuseTune: no candidate plans");
+    cprog::CexprRef ref;
+    cprog::CexprVel vi;
+    vi.passthru = true;         // remainder vl must not clobber h lanes >= vl
+    cprog::CexprEmitter& be = (vel? static_cast<cprog::CexprEmitter&>(vi): ref);
+    DllBuild build;
+    for(size_t t=0U; t<plans.size(); ++t){
+        string const fn = "fusetune"+jitdec(t);
+        cprog::Cunit pr(fn, "C", 0);
+        pr.v = 0;
+        pr["includes"]<<"#include <stdint.h>";
+        if(vel) pr["includes"]>>"#include \"velintrin.h\"";
+        else pr["includes"]>>"#define FOR(I,N) for(uint64_t I=0; I<(N); ++I)";
+        auto& f = cprog::mk_func(pr, fn, "void "+fn+"(uint64_t* sink)").after(pr.root);
+        auto& body = f["body"];
+        auto& h = body["h"];
+        h>>be.decl(cprog::Cexpr::VECTOR, "h");
+        {
+            cprog::Cexpr z("z", jitdec(MVL));
+            z.out("h", z.brd(z.k(0U)));
+            cprog::CexprVel zi;                 // all MVL lanes, no pass-through
+            z.emit(h, (vel? static_cast<cprog::CexprEmitter&>(zi): ref));
+        }
+        fused_loop(pr, "fused", plans[t], kern, be).after(body);
+        if(vel){
+            body["store"]>>("_vel_vst_vssl(h, 8, sink, "+jitdec(MVL)+");");
+        }else{
+            cprog::Cexpr s("s", jitdec(MVL));
+            s.out("sink", s.v("h"));
+            s.emit(body["store"], be);
+        }
+        DllFile df;
+        df.basename = fn;
+        df.suffix = (vel? "-vi.c": "-x86.c");
+        df.code = pr.str();
+        df.syms.push_back(SymbolDecl(fn, str(plans[t])));
+        df.comment = "// "+str(plans[t])+"\n";
+        build.push_back(df);
+    }
+    string libBase = "fusetune_"+jitdec(nLib++)+"_";
+    for(char const c: fuse_tune_key(n, "", vel)) libBase += (isalnum((unsigned char)c)? c: '_');
+    build.direct = true;
+    std::unique_ptr<DllOpen> lib = build.safe_create(libBase, dir);
+
+    typedef void (*TuneFn)(uint64_t*);
+    std::vector<uint64_t> sink(MVL);
+    std::vector<FuseTuneResult> ret;
+    for(size_t t=0U; t<plans.size(); ++t){
+        TuneFn const fn = lib->get<TuneFn>("fusetune"+jitdec(t));
+        std::fill(sink.begin(), sink.end(), 0U);
+        fn(sink.data());                        // warm-up and check
+        uint64_t check = 0U;
+        for(uint64_t const x: sink) check ^= x;
+        if(t && check != ret[0].check)
+            THROW("FuseTune: "<<str(plans[t])<<" hash "<<check<<" != "<<ret[0].check
+                    <<" of "<<str(ret[0].plan));
+        uint64_t r = reps;
+        if(r == 0U){
+            for(r = 1U; r < (1U<<20); r *= 2U){
+                unsigned long long const t0 = __cycle();
+                for(uint64_t i=0U; i<r; ++i) fn(sink.data());
+                if(__cycle() - t0 >= minCycles) break;
+            }
+        }
+        unsigned long long best = ~0ULL;
+        for(int tr=0; tr<std::max(1,trials); ++tr){
+            unsigned long long const t0 = __cycle();
+            for(uint64_t i=0U; i<r; ++i) fn(sink.data());
+            best = std::min(best, __cycle() - t0);
+        }
+        FuseTuneResult res;
+        res.plan = plans[t];
+        res.cycles = (double)best / r;
+        res.perIter = res.cycles / plans[t].total;
+        res.check = check;
+        if(v>0) cout<<" FuseTune "<<str(res.plan)<<" : "<<res.cycles<<" cycles/call, "
+            <<res.perIter<<" per iteration (reps="<<r<<")"<<endl;
+        ret.push_back(res);
+    }
+    std::stable_sort(ret.begin(), ret.end(), [](FuseTuneResult const& a, FuseTuneResult const& b){
+            return a.cycles < b.cycles; });
+    return ret;
+}
+
+std::vector<FuseTuneResult> FuseTune::tune( std::vector<Lpi> const& n, std::string const& file,
+        FusedKernel const& kern/*=fused_kernel_hash*/, std::string const& kname/*="HASH"*/ ){
+    std::vector<FuseTuneResult> const ret = run(n, kern);
+    FuseTuneEntry e;
+    e.key = fuse_tune_key(n, kname, vel);
+    e.vl = ret[0].plan.vl;
+    e.unroll = ret[0].plan.unroll;
+    e.cycles = ret[0].cycles;
+    fuse_tune_save(file, e);
+    if(v>0) cout<<" FuseTune "<<e.key<<" --> vl="<<e.vl<<" unroll="<<e.unroll
+        <<" saved to "<<file<<endl;
+    return ret;
+}
+
+}//loop::
+
+#ifdef FUSETUNE_MAIN
+using namespace loop;
+using namespace std;
+
+/** host value of the \c fused_kernel_hash lane hash */
+static uint64_t hash_ref(vector<Lpi> const& n){
+    static uint64_t const odd[] = {1000003U, 8191U, 131071U, 524287U, 65537U, 257U, 17U, 3U};
+    Lpi total = 1;
+    for(Lpi const x: n) total *= x;
+    uint64_t ret = 0U;
+    for(Lpi f=0; f<total; ++f){
+        uint64_t sum = 0U;
+        Lpi stride = total;
+        for(size_t k=0U; k<n.size(); ++k){
+            stride /= n[k];
+            sum += (uint64_t)((f/stride) % n[k]) * odd[k%8U];
+        }
+        ret ^= sum;
+    }
+    return ret;
+}
+static void test_fuse_tune(){
+    cout<<"test_fuse_tune"<<endl;
+    string const file = "fusetune_test.txt";
+    std::remove(file.c_str());
+    FuseTune ft;
+    ft.K = 3;
+    ft.trials = 3;
+    ft.v = 1;
+    vector<vector<Lpi>> const shapes = { {100,9}, {4,64}, {7,3,11} };
+    for(auto const& n: shapes){
+        auto const cands = ft.candidates(n);
+        CHECK( !cands.empty() && (int)cands.size() <= ft.K );
+        auto const res = ft.tune(n, file);
+        CHECK( res.size() == cands.size() );
+        for(size_t t=0U; t<res.size(); ++t){
+            if(res[t].check != hash_ref(n)) THROW("candidate "<<t<<" hash "<<res[t].check<<" != "<<hash_ref(n));
+            CHECK( res[t].cycles > 0.0 );
+            if(t && res[t-1].cycles > res[t].cycles) THROW("results not sorted by cycles at "<<t);
+        }
+        FusedPlan const p = fused_plan_tuned(n, file, ft);
+        CHECK( p.vl == res[0].plan.vl && p.unroll == res[0].plan.unroll );
+    }
+    auto const m = fuse_tune_load(file);
+    CHECK( m.size() == shapes.size() );
+    CHECK( m.count(fuse_tune_key({4,64}, "HASH", ft.vel)) );
+    {   // lookup follows FuseTune::vel, the key tune() saved under
+        FuseTune other;
+        other.vel = !ft.vel;
+        FuseTuneEntry x;
+        x.key = fuse_tune_key({4,64}, "HASH", other.vel);
+        x.vl = 64; x.unroll = 2; x.cycles = 1.0;
+        fuse_tune_save(file, x);
+        FusedPlan const o = fused_plan_tuned({4,64}, file, other);
+        if(o.vl != 64 || o.unroll != 2) THROW("vel="<<other.vel<<" lookup got "<<o);
+        FuseTuneEntry const& mine = m.at(fuse_tune_key({4,64}, "HASH", ft.vel));
+        FusedPlan const p = fused_plan_tuned({4,64}, file, ft);
+        if(p.vl != mine.vl || p.unroll != mine.unroll) THROW("vel="<<ft.vel<<" lookup got "<<p);
+    }
+    // unknown shape: cost model
+    FusedPlan const q = fused_plan_tuned({5,5}, file);
+    CHECK( q.vl == fused_plan_suggest({5,5}).vl );
+    {
+        ofstream ofs(file, ios::app);
+        ofs<<"3x3/HASH/x86 not-a-number 1 2\n";
+    }
+    bool threw = false;
+    try{ fuse_tune_load(file); }catch(...){ threw = true; }
+    if(!threw) THROW("fuse_tune_load of a bad line did not throw");
+    std::remove(file.c_str());
+    cout<<" "<<shapes.size()<<" shapes tuned, lookup file OK"<<endl;
+}
+int main(int,char**){
+    test_fuse_tune();
+    cout<<"\nGoodbye"<<endl;
+    return 0;
+}
+#endif // FUSETUNE_MAIN
+// vim: ts=4 sw=4 et cindent cino=^=l0,\:.5s,=-.5s,N-s,g.5s,b1 cinkeys=0{,0},0),\:,0#,!^F,o,O,e,0=break
@@ -0,0 +1,107 @@
+#ifndef FUSETUNE_HPP
+#define FUSETUNE_HPP
+/* Copyright (c) 2019 by NEC Corporation
+ * This file is part of ve-jit */
+/** \file
+ * Empirical autotuning of fused-loop plans.
+ *
+ * \c unroll_plans and \c fused_plan_suggest rank plans by a cost model;
+ * \c FuseTune measures the top few for one loop shape:
+ *
+ * - the \c K best distinct (vl,unroll) plans are emitted with \c fused_loop
+ *   and a kernel, one <tt>void fusetuneN(uint64_t* sink)</tt> per plan,
+ * - all are built into one \c DllBuild library: gcc "-x86.c" with
+ *   \c CexprRef on the host, clang "-vi.c" with \c CexprVel on VE,
+ * - each is checked (all plans must leave the same \c h[] lane hash)
+ *   and timed with \c __cycle() (\ref timer.h): one warm-up call, then
+ *   the minimum over \c trials runs of \c reps calls,
+ * - \c tune saves the winner to a plain-text lookup file, which
+ *   \c fused_plan_tuned consults before falling back to the cost model.
+ *
+ * Tuning kernels update a function-scope vector \c h (declared, zeroed
+ * and stored to \c sink by the harness), so work cannot be optimized
+ * away.  Combine lanes with an order-independent op (ex. xor) if the
+ * hash check is to hold across vector lengths.
+ */
+#include "fuseloop.hpp"
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace loop {
+
+/** \c h ^= sum_k idx[k]*odd_k (the default tuning kernel, "HASH").
+ * \c FuseTune::run emits it with \c CexprVel::passthru, so a short remainder
+ * vl leaves lanes >= vl of \c h alone and the xor of all lanes is the same
+ * for every plan. */
+void fused_kernel_hash(FusedAt& at);
+
+/** one timed candidate */
+struct FuseTuneResult {
+    FusedPlan plan;
+    double cycles;      ///< \c __cycle() ticks per call (min over trials)
+    double perIter;     ///< \c cycles per loop iteration
+    uint64_t check;     ///< xor of the final \c h[] lanes
+};
+/** one lookup-file line: <tt>key vl unroll cycles</tt> */
+struct FuseTuneEntry {
+    std::string key;    ///< \c fuse_tune_key
+    int vl;
+    int unroll;
+    double cycles;
+};
+/** "4x64/HASH/x86" (or ".../ve") */
+std::string fuse_tune_key( std::vector<Lpi> const& n, std::string const& kname,
+        bool const vel );
+/** read a lookup file ('#' comments; missing file: empty map).
+ * \throw on a malformed line */
+std::map<std::string,FuseTuneEntry> fuse_tune_load( std::string const& file );
+/** replace or add the entry for \c e.key (rewrites via a temporary + rename) */
+void fuse_tune_save( std::string const& file, FuseTuneEntry const& e );
+/** plan stored for \c n in \c file, else \c fused_plan_suggest(n,vl_max,maxun).
+ * Looks up the compile target's key (\c vel on VE); see also the
+ * \c FuseTune overload. */
+FusedPlan fused_plan_tuned( std::vector<Lpi> const& n, std::string const& file,
+        std::string const& kname="HASH", int const vl_max=256, int const maxun=8 );
+class FuseTune;
+/** plan that \c ft.tune stored for \c n in \c file (same \c ft.vel key),
+ * else \c fused_plan_suggest(n,ft.vl_max,ft.maxun) */
+FusedPlan fused_plan_tuned( std::vector<Lpi> const& n, std::string const& file,
+        FuseTune const& ft, std::string const& kname="HASH" );
+
+class FuseTune {
+  public:
+    FuseTune();
+    /** \c K best distinct (vl,unroll) plans, cost-model order.  Two loops
+     * follow \c unroll_plans; others scan \c fused_plan over vl and unroll.
+     * Only <tt>(vl,unroll)</tt> is tuned: candidates are \c fused_plan
+     * plans, whose per-dimension index method (\c FusedDim::how) is chosen
+     * by \c fused_plan.  The induction method \c unroll_plans ranked
+     * (precalc, cyclic, ...) only orders the pairs; it is not timed. */
+    std::vector<FusedPlan> candidates( std::vector<Lpi> const& n ) const;
+    /** build, check and time \c candidates(n) with kernel \c kern.
+     * \return results, fastest first.
+     * \throw on build failure or if candidates disagree on the hash. */
+    std::vector<FuseTuneResult> run( std::vector<Lpi> const& n,
+            FusedKernel const& kern=fused_kernel_hash );
+    /** \c run, then save the winner for key <tt>(n,kname,vel)</tt> to \c file */
+    std::vector<FuseTuneResult> tune( std::vector<Lpi> const& n, std::string const& file,
+            FusedKernel const& kern=fused_kernel_hash, std::string const& kname="HASH" );
+
+    int K;              ///< candidates to time (4)
+    int vl_max;         ///< (256)
+    int maxun;          ///< unroll limit (8)
+    int trials;         ///< timed runs per candidate, min kept (5)
+    uint64_t reps;      ///< calls per timed run (0: double until \c minCycles)
+    uint64_t minCycles; ///< auto \c reps target per run (200000)
+    bool vel;           ///< VE intrinsics (default on VE) else portable 'C'
+    std::string dir;    ///< \c DllBuild directory ("tmp-fusetune")
+    int v;              ///< verbosity
+  private:
+    int nLib;           ///< libraries built (unique basenames)
+};
+
+}//loop::
+// vim: ts=4 sw=4 et cindent cino=^=l0,\:.5s,=-.5s,N-s,g.5s,b1 cinkeys=0{,0},0),\:,0#,!^F,o,O,e,0=break
+#endif // FUSETUNE_HPP
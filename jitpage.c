@@ -118,16 +118,7 @@ char* bin2jitpage(char const* basename, JitPage *jitpage, int const v){
             // VE note: page_size seems to be 64M (cf. 4k typical of x86),
             //          so there is a big penalty to having lots of jit pages
             //          around without supporting jitpage merging.
-            // TODO: support JitPage merging:
-            //  - 1 JitPage stores multiple blobs, each with start addr, len,
-            //  - and 'head' and 'next' JitPage* (forming a fwd list).
-            //  - and 'state' state.
-            //  - 'head' and 'next' entries modified ONLY by bin2jitpage
-            //  - free just marks as freed, checks if all blobs are free before dealloc.
-            //  - readexec works on all contained blobs
-            //    - oh well, don't have mixed code/data jit blobs?
-            //  - bin2jitpage tries "merge-after-existing" first, and if no space creates a
-            //    new mmap region (with a new 'head' entry);
+            //  - bin2jitpool merges many blobs into a JitPagePool instead.
             ssize_t const page_size = sysconf(_SC_PAGE_SIZE);
             size_t const min_bytes = (fsize<page_size? page_size: fsize);
             page_len = (min_bytes + page_size-1)/page_size*page_size;
@@ -161,6 +152,7 @@ char* bin2jitpage(char const* basename, JitPage *jitpage, int const v){
     jitpage->len = page_len;
     //jitpage->pos = 0;
     jitpage->verbosity = v;
+    jitpage->pool = NULL;
     if(v>=2){
         printf(" Return JitPage{mem=%lX, len=%ld, verbosity=%d)\n",
                 (long unsigned)jitpage->mem, (long signed)jitpage->len, jitpage->verbosity);
@@ -176,6 +168,8 @@ void jitpage_readexec(JitPage *jitpage){
         int const v = jitpage->verbosity;
         if( jitpage->mem==NULL ){
             if(v>=1){ printf(" jitpage_readexec bad/missing jitpage/mem\n"); fflush(stdout); }
+        }else if( jitpage->pool ){
+            jitpool_exec(jitpage->pool);
         }else{
             int status = mprotect(jitpage->mem, jitpage->len, PROT_READ|PROT_EXEC);
             if(status && v>=1){ printf(" jitpage_readexec status=%d\n",status); fflush(stdout); }
@@ -185,7 +179,9 @@ void jitpage_readexec(JitPage *jitpage){
 
 int jitpage_free(JitPage* page){
     int status = 0;
-    if( page && page->mem ){ // don't warn about NULLs
+    if( page && page->mem && page->pool ){
+        status = jitpool_free(page);
+    }else if( page && page->mem ){ // don't warn about NULLs
         status = munmap(page->mem, page->len);
         if(status){
             if(page->verbosity>=0){
@@ -204,6 +200,338 @@ int jitpage_free(JitPage* page){
     return status;
 }
 
+/** one pool mmap region.  Free space is a singly-linked list of extents,
+ * sorted by offset, with no two extents adjacent. */
+typedef struct JitPoolFree_s {
+    size_t off;
+    size_t len;
+    struct JitPoolFree_s* next;
+} JitPoolFree;
+typedef struct JitPoolChunk_s {
+    char* mem;
+    size_t len;
+    size_t used;        ///< bytes in live blobs
+    size_t blobs;       ///< number of live blobs
+    int prot;           ///< current PROT_* of whole chunk
+    int dirty;          ///< written since last jitpool_exec?
+    JitPoolFree* free;
+    struct JitPoolChunk_s* next;
+} JitPoolChunk;
+struct JitPagePool_s {
+    JitPoolChunk* chunks;
+    size_t chunk_bytes;
+    size_t page_size;
+    size_t nmmap, nmunmap, nmprotect;
+    int verbosity;
+};
+/** allocation granularity: every extent is a multiple of this. */
+#define JITPOOL_GRAIN 16
+
+static size_t jitpool_roundup(size_t const n, size_t const m){
+    return (n + m-1) / m * m;
+}
+static JitPoolChunk* jitpool_newchunk(JitPagePool* pool, size_t const min_bytes){
+    int const v = pool->verbosity;
+    size_t const len = jitpool_roundup(min_bytes>pool->chunk_bytes? min_bytes: pool->chunk_bytes,
+            pool->page_size);
+    JitPoolChunk* c = (JitPoolChunk*)malloc(sizeof(JitPoolChunk));
+    JitPoolFree* f = (JitPoolFree*)malloc(sizeof(JitPoolFree));
+    char* mem = (c && f? (char*)mmap(NULL, len, PROT_READ|PROT_WRITE,
+                MAP_PRIVATE|MAP_ANONYMOUS, -1, 0): (char*)MAP_FAILED);
+    if(mem == (char*)MAP_FAILED){
+        if(v>=0){ printf(" jitpool: mmap chunk len=%lu FAILED\n",(unsigned long)len); fflush(stdout); }
+        free(c); free(f);
+        return NULL;
+    }
+    ++pool->nmmap;
+    f->off = 0; f->len = len; f->next = NULL;
+    c->mem = mem; c->len = len; c->used = 0; c->blobs = 0;
+    c->prot = PROT_READ|PROT_WRITE; c->dirty = 0;
+    c->free = f;
+    c->next = NULL;
+    { // append, so the first chunk stays first
+        JitPoolChunk** pp = &pool->chunks;
+        while(*pp) pp = &(*pp)->next;
+        *pp = c;
+    }
+    if(v>=2){ printf(" jitpool: new chunk %p len=%lu\n",(void*)mem,(unsigned long)len); fflush(stdout); }
+    return c;
+}
+static void jitpool_unmap(JitPagePool* pool, JitPoolChunk* c){
+    if(munmap(c->mem, c->len) && pool->verbosity>=0){
+        printf(" jitpool: munmap(%p,%lu) problem\n",(void*)c->mem,(unsigned long)c->len); fflush(stdout);
+    }
+    ++pool->nmunmap;
+    while(c->free){ JitPoolFree* n = c->free->next; free(c->free); c->free = n; }
+    free(c);
+}
+
+JitPagePool* jitpool_create(size_t const chunk_bytes, int const verbosity){
+    JitPagePool* pool = (JitPagePool*)malloc(sizeof(JitPagePool));
+    if(pool==NULL){
+        if(verbosity>=0){ printf(" jitpool_create: out of memory\n"); fflush(stdout); }
+        return NULL;
+    }
+    pool->chunks = NULL;
+    pool->page_size = (size_t)sysconf(_SC_PAGE_SIZE);
+    pool->chunk_bytes = jitpool_roundup(chunk_bytes? chunk_bytes: 1, pool->page_size);
+    pool->nmmap = pool->nmunmap = pool->nmprotect = 0;
+    pool->verbosity = verbosity;
+    if(verbosity>=2){ printf(" jitpool_create: chunk_bytes=%lu (page_size %lu)\n",
+            (unsigned long)pool->chunk_bytes, (unsigned long)pool->page_size); fflush(stdout); }
+    return pool;
+}
+void jitpool_destroy(JitPagePool* pool){
+    if(pool==NULL) return;
+    if(pool->verbosity>=2) jitpool_print(pool);
+    while(pool->chunks){
+        JitPoolChunk* n = pool->chunks->next;
+        jitpool_unmap(pool, pool->chunks);
+        pool->chunks = n;
+    }
+    free(pool);
+}
+
+/** first fit of \c need bytes at \c align within chunk \c c.
+ * \return offset, or (size_t)-1 if no fit. */
+static size_t jitpool_carve(JitPoolChunk* c, size_t const need, size_t const align){
+    for(JitPoolFree **pp = &c->free; *pp; pp = &(*pp)->next){
+        JitPoolFree* f = *pp;
+        size_t const off = jitpool_roundup(f->off, align);
+        size_t const end = f->off + f->len;
+        if(off + need > end) continue;
+        // [f->off,off) stays free; [off+need,end) is the new tail extent
+        if(off + need < end){
+            if(off == f->off){
+                f->off = off + need;
+                f->len = end - f->off;
+                return off;
+            }
+            JitPoolFree* t = (JitPoolFree*)malloc(sizeof(JitPoolFree));
+            if(t==NULL) return (size_t)-1;
+            t->off = off + need; t->len = end - t->off; t->next = f->next;
+            f->next = t;
+        }
+        if(off == f->off){ // extent fully consumed
+            *pp = f->next;
+            free(f);
+        }else{
+            f->len = off - f->off;
+        }
+        return off;
+    }
+    return (size_t)-1;
+}
+/** return [off,off+need) to the sorted free list of \c c, coalescing neighbours.
+ * \return 0, 1 if it overlaps a free extent (double free?), 2 if out of memory
+ *         (the extent is leaked, the chunk stays consistent). */
+static int jitpool_release(JitPoolChunk* c, size_t const off, size_t const need){
+    JitPoolFree* prev = NULL;
+    JitPoolFree* next = c->free;
+    while(next && next->off < off){ prev = next; next = next->next; }
+    if((prev && prev->off + prev->len > off) || (next && off + need > next->off))
+        return 1;
+    if(prev && prev->off + prev->len == off){
+        prev->len += need;
+        if(next && prev->off + prev->len == next->off){
+            prev->len += next->len;
+            prev->next = next->next;
+            free(next);
+        }
+    }else if(next && off + need == next->off){
+        next->off = off;
+        next->len += need;
+    }else{
+        JitPoolFree* f = (JitPoolFree*)malloc(sizeof(JitPoolFree));
+        if(f==NULL) return 2;
+        f->off = off; f->len = need; f->next = next;
+        if(prev) prev->next = f; else c->free = f;
+    }
+    return 0;
+}
+
+char* jitpool_alloc(JitPagePool* pool, void const* blob, size_t const len,
+        size_t const align, JitPage* jitpage){
+    int const v = (pool? pool->verbosity: 0);  // no pool: print errors
+    if(pool==NULL || jitpage==NULL || len==0){
+        if(v>=0){ printf(" jitpool_alloc: NULL pool/jitpage or zero len\n"); fflush(stdout); }
+        return NULL;
+    }
+    size_t const a = (align? align: JITPOOL_GRAIN);
+    if((a & (a-1)) != 0 || a > pool->page_size){
+        if(v>=0){ printf(" jitpool_alloc: bad align %lu\n",(unsigned long)a); fflush(stdout); }
+        return NULL;
+    }
+    size_t const need = jitpool_roundup(len, JITPOOL_GRAIN);
+    JitPoolChunk* c = pool->chunks;
+    size_t off = (size_t)-1;
+    for( ; c; c = c->next){
+        if(c->len - c->used < need) continue;
+        if(c->prot != (PROT_READ|PROT_WRITE) && c->blobs) continue; // sealed, in use: keep RX
+        if((off = jitpool_carve(c, need, a)) != (size_t)-1) break;
+    }
+    if(c==NULL){
+        // chunk mem is page-aligned, so offset 0 satisfies any a <= page_size
+        if((c = jitpool_newchunk(pool, need)) == NULL) return NULL;
+        off = jitpool_carve(c, need, a);
+        assert(off == 0);
+    }
+    if(c->prot != (PROT_READ|PROT_WRITE)){ // an empty sealed chunk: no live kernel to break
+        assert(c->blobs == 0);
+        ++pool->nmprotect;
+        if(mprotect(c->mem, c->len, PROT_READ|PROT_WRITE)){
+            if(v>=0){ printf(" jitpool_alloc: mprotect RW failed\n"); fflush(stdout); }
+            jitpool_release(c, off, need);  // nothing committed: give the range back
+            return NULL;
+        }
+        c->prot = PROT_READ|PROT_WRITE;
+    }
+    c->dirty = 1;
+    c->used += need;
+    ++c->blobs;
+    char* mem = c->mem + off;
+    if(blob) memcpy(mem, blob, len);
+    jitpage->mem = (void*)mem;
+    jitpage->len = len;
+    jitpage->verbosity = v;
+    jitpage->pool = pool;
+    if(v>=2){ printf(" jitpool_alloc: %lu bytes align %lu at %p (chunk %p + %lu)\n",
+            (unsigned long)len, (unsigned long)a, (void*)mem, (void*)c->mem,
+            (unsigned long)off); fflush(stdout); }
+    return mem;
+}
+
+char* bin2jitpool(char const* basename, JitPagePool* pool, JitPage* jitpage){
+    int const v = (pool? pool->verbosity: 0);
+    char file_bin[100];
+    if(basename==NULL || pool==NULL || jitpage==NULL
+            || snprintf(&file_bin[0],100,"%s.bin",basename) >= 100){
+        if(v>=-1){ printf("bin2jitpool: bad basename/pool/jitpage\n"); fflush(stdout); }
+        return NULL;
+    }
+    char* ret = NULL;
+    char* buf = NULL;
+    FILE* f_bin = fopen(file_bin,"rb");
+    if( f_bin==NULL ){
+        if(v>=0){ printf(" bin2jitpool(\"%s\",...): Missing file %s\n",basename,file_bin); }
+        return NULL;
+    }
+    fseek(f_bin,0,SEEK_END);
+    long const fsize = ftell(f_bin);
+    fseek(f_bin,0,SEEK_SET);
+    if( fsize<=0 ){
+        if(v>=0){ printf(" bin2jitpool(\"%s\",...): %s bad file size %ld\n",basename,file_bin,fsize); }
+    }else if((buf = (char*)malloc((size_t)fsize)) != NULL
+            && fread(buf, 1, (size_t)fsize, f_bin) == (size_t)fsize){
+        ret = jitpool_alloc(pool, buf, (size_t)fsize, 0, jitpage);
+    }else if(v>=0){
+        printf(" bin2jitpool(\"%s\",...): read error\n",basename); fflush(stdout);
+    }
+    free(buf);
+    fclose(f_bin);
+    return ret;
+}
+
+int jitpool_exec(JitPagePool* pool){
+    int status = 0;
+    if(pool==NULL) return 1;
+    // I-cache: x86 is coherent; VE blobs only ever run after this flip.
+    for(JitPoolChunk* c = pool->chunks; c; c = c->next){
+        if(!c->dirty) continue;
+        ++pool->nmprotect;     // per chunk call, as in jitpool_alloc (failures too)
+        if(mprotect(c->mem, c->len, PROT_READ|PROT_EXEC)){
+            if(pool->verbosity>=0){ printf(" jitpool_exec: mprotect(%p,%lu) failed\n",
+                    (void*)c->mem,(unsigned long)c->len); fflush(stdout); }
+            status = 1;
+            continue;
+        }
+        c->prot = PROT_READ|PROT_EXEC;
+        c->dirty = 0;
+    }
+    return status;
+}
+
+int jitpool_free(JitPage* jitpage){
+    if(jitpage==NULL || jitpage->mem==NULL) return 0;
+    JitPagePool* pool = jitpage->pool;
+    if(pool==NULL){
+        if(jitpage->verbosity>=0){ printf(" jitpool_free: not a pooled JitPage\n"); fflush(stdout); }
+        return 1;
+    }
+    char* const mem = (char*)jitpage->mem;
+    JitPoolChunk** cp = &pool->chunks;
+    while(*cp && !(mem >= (*cp)->mem && mem < (*cp)->mem + (*cp)->len))
+        cp = &(*cp)->next;
+    if(*cp==NULL){
+        if(pool->verbosity>=0){ printf(" jitpool_free(%p): not in pool\n",(void*)mem); fflush(stdout); }
+        return 1;
+    }
+    JitPoolChunk* c = *cp;
+    size_t const off = (size_t)(mem - c->mem);
+    size_t const need = jitpool_roundup(jitpage->len, JITPOOL_GRAIN);
+    int const rel = jitpool_release(c, off, need);
+    if(rel==1){
+        if(pool->verbosity>=0){ printf(" jitpool_free(%p): double free?\n",(void*)mem); fflush(stdout); }
+        return 1;
+    }
+    if(rel) return 1; // leak the extent, pool stays consistent
+    c->used -= need;
+    --c->blobs;
+    if(pool->verbosity>=2){ printf(" jitpool_free mem=%p len=%lu\n",(void*)mem,(unsigned long)jitpage->len); fflush(stdout); }
+    if(c->blobs==0 && c != pool->chunks){ // keep the first chunk for reuse
+        *cp = c->next;
+        jitpool_unmap(pool, c);
+    }
+    jitpage->mem = NULL;
+    jitpage->len = 0;
+    jitpage->verbosity = 0;
+    jitpage->pool = NULL;
+    return 0;
+}
+
+void jitpool_stats(JitPagePool const* pool, JitPagePoolStats* s){
+    if(s==NULL) return;
+    memset(s, 0, sizeof(*s));
+    if(pool==NULL) return;
+    for(JitPoolChunk const* c = pool->chunks; c; c = c->next){
+        ++s->chunks;
+        s->mapped += c->len;
+        s->used += c->used;
+        s->blobs += c->blobs;
+        for(JitPoolFree const* f = c->free; f; f = f->next){
+            ++s->free_extents;
+            if(f->len > s->largest_free) s->largest_free = f->len;
+        }
+    }
+    size_t const nfree = s->mapped - s->used;
+    s->fragmentation = (nfree? 1.0 - (double)s->largest_free / (double)nfree: 0.0);
+    s->nmmap = pool->nmmap;
+    s->nmunmap = pool->nmunmap;
+    s->nmprotect = pool->nmprotect;
+}
+
+void jitpool_print(JitPagePool const* pool){
+    JitPagePoolStats s;
+    jitpool_stats(pool, &s);
+    printf(" JitPagePool{chunks=%lu mapped=%lu used=%lu blobs=%lu free_extents=%lu"
+            " largest_free=%lu fragmentation=%.3f mmap/munmap/mprotect=%lu/%lu/%lu}\n",
+            (unsigned long)s.chunks, (unsigned long)s.mapped, (unsigned long)s.used,
+            (unsigned long)s.blobs, (unsigned long)s.free_extents,
+            (unsigned long)s.largest_free, s.fragmentation,
+            (unsigned long)s.nmmap, (unsigned long)s.nmunmap, (unsigned long)s.nmprotect);
+    if(pool && pool->verbosity>=2){
+        for(JitPoolChunk const* c = pool->chunks; c; c = c->next){
+            printf("   chunk %p len=%lu blobs=%lu %s%s free:", (void*)c->mem,
+                    (unsigned long)c->len, (unsigned long)c->blobs,
+                    (c->prot & PROT_EXEC? "RX": "RW"), (c->dirty? " dirty": ""));
+            for(JitPoolFree const* f = c->free; f; f = f->next)
+                printf(" [%lu,+%lu)", (unsigned long)f->off, (unsigned long)f->len);
+            printf("\n");
+        }
+    }
+    fflush(stdout);
+}
+
 void hexdump(char const* page, size_t sz){
     // reproduce hexdump -C "canonical hex+ASCII" output format
     for(size_t b=0; b<sz; b+=16){
@@ -607,9 +935,179 @@ void dl_dump(void * const handle){
 #endif // CYGWIN
 }
 
+#if !defined(__CYGWIN__)
+/** dynamic symbol count from DT_HASH, or else from the DT_GNU_HASH chains */
+static size_t dl_symcount(const ElfW(Addr) load_addr, const ElfW(Dyn) * const dyn_start){
+    if(FindTag(dyn_start, DT_HASH)){
+        const uint32_t * const hash = (const uint32_t *)FindPtr(load_addr, dyn_start, DT_HASH);
+        return hash[1];                         // nchain == number of symbols
+    }
+    if(FindTag(dyn_start, DT_GNU_HASH)){
+        const uint32_t * const gnu = (const uint32_t *)FindPtr(load_addr, dyn_start, DT_GNU_HASH);
+        const uint32_t nbuckets  = gnu[0];
+        const uint32_t symoffset = gnu[1];
+        const uint32_t bloomsz   = gnu[2];      // in ElfW(Addr) words
+        const uint32_t * const buckets = gnu + 4 + bloomsz * (sizeof(ElfW(Addr))/4);
+        const uint32_t * const chain   = buckets + nbuckets;
+        uint32_t last = 0U, b;
+        for(b=0U; b<nbuckets; ++b)
+            if(buckets[b] > last) last = buckets[b];
+        if(last < symoffset) return symoffset;
+        while(!(chain[last - symoffset] & 1U)) ++last; // low bit ends a chain
+        return last + 1U;
+    }
+    return 0U;
+}
+#endif
+
+size_t dl_symbols(void * const handle,
+        void (*const sym)(void * arg, char const* name, void * addr), void * arg){
+#if defined(__CYGWIN__)
+    printf("Cygwin uses COFF format (dl_symbols requires ELF)\n");
+    return 0U;
+#else
+    const struct link_map * link_map = 0;
+    if(dlinfo(handle, RTLD_DI_LINKMAP, &link_map) || !link_map)
+        return 0U;
+    const ElfW(Dyn) * const dyn_start = link_map->l_ld;
+    const ElfW(Addr) load_addr = link_map->l_addr;
+    if(!FindTag(dyn_start, DT_SYMTAB) || !FindTag(dyn_start, DT_STRTAB))
+        return 0U;
+    const ElfW(Sym) * const symtab = (const ElfW(Sym) *)FindPtr(load_addr, dyn_start, DT_SYMTAB);
+    const char * const strtab = (const char *)FindPtr(load_addr, dyn_start, DT_STRTAB);
+    const size_t nsyms = dl_symcount(load_addr, dyn_start);
+    size_t i, n = 0U;
+    for(i=1U; i<nsyms; ++i){                    // [0] is always STN_UNDEF
+        const ElfW(Sym) * const s = &symtab[i];
+        const int bind = ELF64_ST_BIND(s->st_info); // same as ELF32_ST_BIND
+        const int type = ELF64_ST_TYPE(s->st_info);
+        if(s->st_shndx == SHN_UNDEF || s->st_name == 0U) continue;
+        if(bind != STB_GLOBAL && bind != STB_WEAK) continue;
+        if(type != STT_FUNC && type != STT_OBJECT && type != STT_NOTYPE) continue;
+        if(sym) sym(arg, &strtab[s->st_name], (void*)(load_addr + s->st_value));
+        ++n;
+    }
+    return n;
+#endif // CYGWIN
+}
+
 #endif // JIT_DLFUNCS
 
 #ifdef __cplusplus
 } // extern "C"
 #endif
+#ifdef JITPAGE_MAIN
+/** JitPagePool self-test.  On x86, also runs the pooled blobs. */
+int main(int argc, char** argv){
+    int const v = (argc>1? atoi(argv[1]): 1);
+    int nerr = 0;
+#define JITPOOL_CHECK(COND) do{ if(!(COND)){ ++nerr; \
+    printf(" FAILED line %d: %s\n",__LINE__,#COND); fflush(stdout); } }while(0)
+    enum { N = 300 };                           // > 1 chunk of 4k
+    JitPage pages[N];
+    JitPagePoolStats s;
+    JitPagePool* pool = jitpool_create(4096, v);
+    JITPOOL_CHECK(pool != NULL);
+    for(int i=0; i<N; ++i){
+        unsigned char code[16] = {0};
+#if defined(__x86_64__)
+        code[0] = 0xb8;                         // mov $i, %eax
+        memcpy(&code[1], &i, 4);
+        code[5] = 0xc3;                         // ret
+#endif
+        char* mem = jitpool_alloc(pool, code, 6+i%7, (i%4==0? 64: 0), &pages[i]);
+        JITPOOL_CHECK(mem != NULL);
+        JITPOOL_CHECK(i%4!=0 || ((uintptr_t)mem & 63) == 0);
+    }
+    JITPOOL_CHECK(jitpool_exec(pool) == 0);
+    jitpool_stats(pool, &s);
+    if(v>=1) jitpool_print(pool);
+    JITPOOL_CHECK(s.blobs == N);
+    JITPOOL_CHECK(s.chunks > 1 && s.nmmap == s.chunks);
+    JITPOOL_CHECK(s.nmprotect == s.chunks);     // one batched flip per chunk
+    JITPOOL_CHECK(s.mapped < N * (size_t)sysconf(_SC_PAGE_SIZE));
+#if defined(__x86_64__)
+    for(int i=0; i<N; ++i){
+        int (*fn)(void) = (int(*)(void))pages[i].mem;
+        JITPOOL_CHECK(fn() == i);
+    }
+#endif
+    // free every other blob: fragmented; then the rest: coalesced
+    for(int i=0; i<N; i+=2) JITPOOL_CHECK(jitpage_free(&pages[i]) == 0);
+    JITPOOL_CHECK(jitpool_free(&pages[0]) == 0);   // dup free (mem==NULL) is ok
+    jitpool_stats(pool, &s);
+    if(v>=1) jitpool_print(pool);
+    JITPOOL_CHECK(s.blobs == N/2);
+    JITPOOL_CHECK(s.fragmentation > 0.0);
+    size_t const nprot = s.nmprotect, nmap = s.nmmap;
+    {   // sealed chunks with live blobs stay RX: a new blob goes to a new chunk
+        unsigned char code[16] = {0};
+#if defined(__x86_64__)
+        int const k = N;
+        code[0] = 0xb8; memcpy(&code[1], &k, 4); code[5] = 0xc3;
+#endif
+        JITPOOL_CHECK(jitpool_alloc(pool, code, 6, 0, &pages[0]) != NULL);
+        jitpool_stats(pool, &s);
+        JITPOOL_CHECK(s.nmprotect == nprot && s.nmmap == nmap + 1);
+#if defined(__x86_64__)
+        for(int i=1; i<N; i+=2){                // still callable before jitpool_exec
+            int (*fn)(void) = (int(*)(void))pages[i].mem;
+            JITPOOL_CHECK(fn() == i);
+        }
+#endif
+        jitpage_readexec(&pages[0]);
+        jitpool_stats(pool, &s);
+        JITPOOL_CHECK(s.nmprotect == nprot + 1);    // only the new chunk flips
+#if defined(__x86_64__)
+        JITPOOL_CHECK(((int(*)(void))pages[0].mem)() == N);
+#endif
+    }
+    for(int i=0; i<N; i+=1) jitpage_free(&pages[i]);
+    jitpool_stats(pool, &s);
+    if(v>=1) jitpool_print(pool);
+    JITPOOL_CHECK(s.blobs == 0 && s.used == 0);
+    JITPOOL_CHECK(s.chunks == 1 && s.free_extents == 1);
+    JITPOOL_CHECK(s.fragmentation == 0.0);
+    JITPOOL_CHECK(s.nmunmap + 1 == s.nmmap);
+    // oversize blob gets its own chunk
+    JITPOOL_CHECK(jitpool_alloc(pool, NULL, 3*4096, 0, &pages[0]) != NULL);
+    jitpool_stats(pool, &s);
+    JITPOOL_CHECK(s.chunks == 2 && s.mapped >= 4*4096);
+    jitpool_destroy(pool);
+    {   // a verbosity -1 pool prints nothing, even for bad requests
+        JitPagePool* quiet = jitpool_create(4096, -1);
+        FILE* tmp = tmpfile();
+        int const out = dup(1);
+        fflush(stdout);
+        JITPOOL_CHECK(quiet != NULL && tmp != NULL && out >= 0);
+        dup2(fileno(tmp), 1);
+        JITPOOL_CHECK(jitpool_alloc(quiet, NULL, 0, 0, &pages[0]) == NULL);
+        JITPOOL_CHECK(jitpool_alloc(quiet, NULL, 8, 3, &pages[0]) == NULL);
+        fflush(stdout);
+        dup2(out, 1);
+        close(out);
+        JITPOOL_CHECK(lseek(fileno(tmp), 0, SEEK_END) == 0);
+        fclose(tmp);
+        jitpool_destroy(quiet);
+    }
+    {   // RW flip of an empty sealed chunk fails (unmapped behind the pool's back):
+        // NULL, nothing committed
+        JitPagePool* p2 = jitpool_create(4096, -1);
+        char* const mem = jitpool_alloc(p2, NULL, 64, 0, &pages[0]);
+        JITPOOL_CHECK(mem != NULL);
+        JITPOOL_CHECK(jitpool_exec(p2) == 0);
+        JITPOOL_CHECK(jitpool_free(&pages[0]) == 0);  // first chunk kept, still RX
+        JitPagePoolStats s0, s1;
+        jitpool_stats(p2, &s0);
+        JITPOOL_CHECK(munmap(mem, 4096) == 0);
+        JITPOOL_CHECK(jitpool_alloc(p2, NULL, 64, 0, &pages[1]) == NULL);
+        jitpool_stats(p2, &s1);
+        JITPOOL_CHECK(s1.used == s0.used && s1.blobs == s0.blobs);
+        JITPOOL_CHECK(s1.free_extents == s0.free_extents && s1.largest_free == s0.largest_free);
+        jitpool_destroy(p2);
+    }
+    printf("\nJitPagePool tests %s (%d errors)\n", (nerr? "FAILED": "OK"), nerr);
+    return nerr? 1: 0;
+}
+#endif // JITPAGE_MAIN
 // vim: ts=4 sw=4 et cindent cino=^=l0,\:.5s,=-.5s,N-s,g.5s,b1 cinkeys=0{,0},0),\:,0#,!^F,o,O,e,0=break
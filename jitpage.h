@@ -34,6 +34,10 @@ extern "C" {
         /** \c v verbosity: never(-1), print errors(0), warnings(1), debug(>=2).
          * Remember this setting, from \c bin2jitpage, for convenience. */
         int verbosity;
+        /** non-NULL if \c mem is a sub-allocation of a \ref JitPagePool
+         * (see \c bin2jitpool).  \c jitpage_readexec and \c jitpage_free
+         * then act on the pool rather than \c mmap'ing per blob. */
+        struct JitPagePool_s* pool;
     };
     typedef struct JitPage_s JitPage;
 
@@ -61,11 +65,12 @@ extern "C" {
     char* bin2jitpage(char const* basename, JitPage *jitpage, int const verbosity);
 
     /** attempt to PROT_READ|PROT_EXEC the page.
+     * For a pooled page, this is \c jitpool_exec(jitpage->pool).
      * (executable self-modifying code would require I-Cache flushing on Aurora).
      */
     void jitpage_readexec(JitPage *jitpage);
 
-    /** munmap the exectuable code page.
+    /** munmap the exectuable code page (or \c jitpool_free a pooled page).
      * - \c verbosity as per \c jitpage->verbosity:
      *   -  never(-1), print errors(0), warnings(1), debug(>=2).
      * \return status nonzero on error
@@ -73,6 +78,78 @@ extern "C" {
      */
     int jitpage_free(JitPage* jitpage);
 
+    /// @group JitPagePool: many code blobs per mmap
+    //@{
+    /** A pool of large \c mmap chunks, sub-allocated into many JIT blobs.
+     * Chunks are PROT_READ|PROT_WRITE while blobs are copied in, and get
+     * flipped to PROT_READ|PROT_EXEC in one batch by \c jitpool_exec (W^X:
+     * never both).  Freed blobs return their extent to a per-chunk free list
+     * (sorted, coalesced) for reuse; wholly empty chunks (except the first)
+     * are unmapped.
+     *
+     * Why: VE page size is large (64M?), so one \c mmap per .bin blob is
+     * expensive, and one \c mprotect per blob costs a syscall each.
+     *
+     * Once flipped, a chunk holding live blobs is never made writable
+     * again, so loaded kernels stay callable: new blobs go to chunks that are
+     * still writable (or to a new chunk), and a sealed chunk is reused only
+     * after all of its blobs are freed.
+     * \note not thread-safe.
+     */
+    typedef struct JitPagePool_s JitPagePool;
+
+    /** \c jitpool_stats snapshot. */
+    struct JitPagePoolStats_s {
+        size_t chunks;          ///< number of live mmap regions
+        size_t mapped;          ///< total bytes mapped
+        size_t used;            ///< bytes held by live blobs (incl. alignment rounding)
+        size_t blobs;           ///< number of live blobs
+        size_t free_extents;    ///< number of free extents, over all chunks
+        size_t largest_free;    ///< largest free extent (bytes)
+        /** 1 - largest_free/(mapped-used), or 0.0 if nothing is free.
+         * 0.0 means all free space is contiguous. */
+        double fragmentation;
+        size_t nmmap;           ///< lifetime mmap calls
+        size_t nmunmap;         ///< lifetime munmap calls
+        size_t nmprotect;       ///< lifetime mprotect calls (one per chunk flip)
+    };
+    typedef struct JitPagePoolStats_s JitPagePoolStats;
+
+    /** create an empty pool whose chunks are at least \c chunk_bytes
+     * (rounded up to page size; 0 means one page).
+     * \c verbosity : never(-1), print errors(0), warnings(1), debug(>=2).
+     * \return NULL on error. */
+    JitPagePool* jitpool_create(size_t const chunk_bytes, int const verbosity);
+
+    /** munmap all chunks and free \c pool.  Every \c JitPage still
+     * pointing into \c pool becomes invalid. */
+    void jitpool_destroy(JitPagePool* pool);
+
+    /** sub-allocate \c len bytes aligned to \c align (a power of two,
+     * 0 for 16), copy \c blob into it (if non-NULL), and describe it in
+     * \c jitpage.  The containing chunk is writable until \c jitpool_exec;
+     * chunks already flipped by \c jitpool_exec with live blobs are skipped.
+     * \return blob address (or NULL). */
+    char* jitpool_alloc(JitPagePool* pool, void const* blob, size_t const len,
+            size_t const align, JitPage* jitpage);
+
+    /** like \c bin2jitpage, but read basename.bin into \c pool. */
+    char* bin2jitpool(char const* basename, JitPagePool* pool, JitPage* jitpage);
+
+    /** flip every chunk written since the last call to PROT_READ|PROT_EXEC,
+     * one \c mprotect per chunk.  \return nonzero on error. */
+    int jitpool_exec(JitPagePool* pool);
+
+    /** return the blob to its pool (also done by \c jitpage_free).
+     * \return nonzero on error (\c jitpage not from \c pool, ...) */
+    int jitpool_free(JitPage* jitpage);
+
+    void jitpool_stats(JitPagePool const* pool, JitPagePoolStats* stats);
+
+    /** print \c jitpool_stats (and chunk layout if \c verbosity>=2). */
+    void jitpool_print(JitPagePool const* pool);
+    //@}
+
     /** reproduce hexdump -C "canonical hex+ASCII" output format */
     void hexdump(char const* page, size_t sz);
 
@@ -105,6 +182,13 @@ extern "C" {
     /** walk symbol table of dlopen handle \p handle, dumping to \c stdout. */
     void dl_dump(void * const handle);
 
+    /** one pass over the dynamic symbol table of dlopen handle \p handle,
+     * calling \p sym(arg,name,address) for each defined global or weak
+     * function/object symbol (\p sym may be NULL to just count them).
+     * \return number of such symbols (0 if no ELF dynamic symbol table). */
+    size_t dl_symbols(void * const handle,
+            void (*const sym)(void * arg, char const* name, void * addr), void * arg);
+
 #endif
 
 #ifdef __cplusplus
@@ -8,6 +8,7 @@
 
 #include "pstreams-1.0.1/pstream.h"
 #include "throw.hpp"
+#include "jitprof.hpp"
 #include <iostream>
 #include <string>
 #include <fstream>
@@ -220,7 +221,11 @@ inline DllPipe::DllPipe(std::string basename, std::string ccode,
 
 	// instead of passing a string to some script, we'll
 	// create a temp file here (and remove it while libXX.so is made).
-	mkTmpfile( ccode );
+	{
+		JitProfScope prof("dllpipe.write");
+		mkTmpfile( ccode );
+		prof.bytes = ccode.size();
+	}
 	assert( !ccode_tmpfile.empty() ); // if not, we should have thrown an error
 
 	if(v>=2)std::cout<<" DllPipe selected compiler "<<this->cc<<std::endl;
@@ -228,6 +233,7 @@ inline DllPipe::DllPipe(std::string basename, std::string ccode,
 	// Oh. sometimes that target is not a function of the first word ..
 	// NOT a function of the compiler name (ex. clang --target ve-linux...
 	// A nicer generic way might be '--version' ...
+	JitProfScope prof("dllpipe.compile");
 	std::string libhow("unknown"); // how was the library generated?
 	{
 		// set libhow to {unknown, gcc, ncc, clang or nclang}.
@@ -235,6 +241,7 @@ inline DllPipe::DllPipe(std::string basename, std::string ccode,
 			std::string versionCmd(this->cc+" --version");
 			PstreamPipe pVersion(versionCmd);
 			pVersion.run("");
+			++prof.procs;
 			if( pVersion.error ){
 				std::cout<<"stdout:\n"<<pVersion.out<<std::endl;
 				std::cout<<"stderr:\n"<<pVersion.err<<std::endl;
@@ -271,6 +278,7 @@ inline DllPipe::DllPipe(std::string basename, std::string ccode,
 	PstreamPipe doit(cmd);
 	// hmm. pipe error handling could be common code.
 	auto const status = doit.run(std::string("")); // this "pipe" doesn't read from stdin
+	++prof.procs;
 
 	if( status ){
 		if(v>=-1) std::cout<<" Warning: "<<cmd
@@ -284,6 +292,7 @@ inline DllPipe::DllPipe(std::string basename, std::string ccode,
 	if(v>=2){if( doit.out.size() ) std::cout<<">>> stdout:\n"<<doit.out<<std::endl;}
 	if(v>=2){if( doit.err.size() ) std::cout<<">>> stderr:\n"<<doit.err<<std::endl;}
 	auto ok = system(("ls -l "+libname+" "+ccode_tmpfile).c_str());
+	++prof.procs;
 	if( doit.status == 0 && ok == 0 ){
 		if(v>=2)std::cout<<" (removing the tmp file)"<<std::endl;
 		//system(("rm -f "+ccode_tmpfile).c_str());
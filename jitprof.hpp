@@ -0,0 +1,137 @@
+#ifndef JITPROF_HPP
+#define JITPROF_HPP
+/* Copyright (c) 2019 by NEC Corporation
+ * This file is part of ve-jit */
+/** \file
+ * Lightweight per-stage counters for the JIT code-generation pipeline.
+ *
+ * Each stage (ex. "cblock.write", "dllbuild.prep", "dllbuild.make",
+ * "dllbuild.compile", "dllbuild.dllopen", "dllpipe.compile", "asm2bin",
+ * "bin2jitpage") accumulates calls, \c __cycle() ticks (\ref timer.h),
+ * bytes produced and child processes run.  Cblocks made by
+ * \c Cunit::newblock are counted as stage "cunit.newblock".
+ *
+ * - \c JitProfScope times one call of a stage (RAII, also on throw),
+ * - \c JitProf::json exports a snapshot; ticks are converted to seconds
+ *   with a tick rate measured over the life of the process so far,
+ * - env \c VEJIT_PROF=file (or "-" for stderr) dumps the JSON at exit,
+ * - \c JitProf::global().enabled=false stops recording.
+ *
+ * Header-only, so every libjit1 object (and self-test) shares one
+ * \c JitProf::global() without link-order concerns.
+ */
+#include "timer.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>      // getenv
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+
+struct JitProfStat {
+    uint64_t calls;
+    uint64_t cycles;    ///< \c __cycle() ticks
+    uint64_t bytes;     ///< text or binary produced
+    uint64_t procs;     ///< compiler, make, ... processes run
+};
+
+class JitProf {
+  public:
+    typedef std::map<std::string, JitProfStat> Stats;
+    static JitProf& global(){ static JitProf p; return p; }
+    void add(char const* stage, uint64_t const cycles, uint64_t const bytes=0U,
+            uint64_t const procs=0U){
+        if(!enabled) return;
+        std::lock_guard<std::mutex> lock(mtx);
+        JitProfStat& s = stats[stage];
+        ++s.calls;
+        s.cycles += cycles;
+        s.bytes += bytes;
+        s.procs += procs;
+    }
+    /** one \c Cunit::newblock (atomic, no lock) */
+    void block(){ if(enabled) nBlocks.fetch_add(1U, std::memory_order_relaxed); }
+    Stats snapshot() const {
+        Stats ret;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            ret = stats;
+        }
+        uint64_t const nb = nBlocks.load(std::memory_order_relaxed);
+        if(nb) ret["cunit.newblock"] = JitProfStat{nb, 0U, 0U, 0U};
+        return ret;
+    }
+    void reset(){
+        std::lock_guard<std::mutex> lock(mtx);
+        stats.clear();
+        nBlocks = 0U;
+    }
+    /** \c __cycle() ticks per second (0 if not yet measurable) */
+    double hz() const {
+        double const dt = __clock() - clk0;
+        return dt > 1.e-3? (double)(__cycle() - cyc0) / dt: 0.0;
+    }
+    std::ostream& json(std::ostream& os) const {
+        Stats const s = snapshot();
+        double const f = hz();
+        std::ostringstream oss;         // keep caller's stream flags
+        oss<<"{\"hz\":"<<f<<",\"stages\":{";
+        char const* sep = "\n";
+        for(auto const& st: s){
+            oss<<sep<<"  \"";
+            for(char const c: st.first){
+                if(c=='"' || c=='\\') oss<<'\\';
+                oss<<c;
+            }
+            oss<<"\":{\"calls\":"<<st.second.calls<<",\"cycles\":"<<st.second.cycles;
+            if(f > 0.0) oss<<",\"seconds\":"<<st.second.cycles / f;
+            oss<<",\"bytes\":"<<st.second.bytes<<",\"procs\":"<<st.second.procs<<"}";
+            sep = ",\n";
+        }
+        oss<<"\n}}\n";
+        return os<<oss.str();
+    }
+    std::string json() const {
+        std::ostringstream oss;
+        json(oss);
+        return oss.str();
+    }
+    std::atomic<bool> enabled;
+  private:
+    JitProf() : enabled(true), mtx(), stats(), nBlocks(0U), cyc0(__cycle()), clk0(__clock()) {}
+    ~JitProf(){
+        char const* const f = getenv("VEJIT_PROF");
+        if(!f || !*f) return;
+        if(f[0]=='-' && f[1]=='\0'){ json(std::cerr); return; }
+        std::ofstream ofs(f);
+        if(ofs) json(ofs);
+    }
+    JitProf(JitProf const&) = delete;
+    JitProf& operator=(JitProf const&) = delete;
+    mutable std::mutex mtx;
+    Stats stats;
+    std::atomic<uint64_t> nBlocks;
+    unsigned long long const cyc0;
+    double const clk0;
+};
+
+/** time one call of \c stage; set \c bytes / \c procs before scope exit */
+class JitProfScope {
+  public:
+    explicit JitProfScope(char const* stage)
+        : bytes(0U), procs(0U), stage(stage), t0(__cycle()) {}
+    ~JitProfScope(){ JitProf::global().add(stage, __cycle() - t0, bytes, procs); }
+    JitProfScope(JitProfScope const&) = delete;
+    JitProfScope& operator=(JitProfScope const&) = delete;
+    uint64_t bytes;
+    uint64_t procs;
+  private:
+    char const* const stage;
+    unsigned long long const t0;
+};
+// vim: ts=4 sw=4 et cindent cino=^=l0,\:.5s,=-.5s,N-s,g.5s,b1 cinkeys=0{,0},0),\:,0#,!^F,o,O,e,0=break
+#endif // JITPROF_HPP
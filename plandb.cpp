@@ -0,0 +1,420 @@
+/* Copyright (c) 2019 by NEC Corporation
+ * This file is part of ve-jit */
+/** \file
+ * PlanDb: fused-loop decisions cached in a shared memory-mapped file.
+ */
+#include "plandb.hpp"
+#include "throw.hpp"
+
+#include <cerrno>
+#include <cstring>      // strerror, memcpy
+#include <iostream>
+#include <sstream>
+
+#include <fcntl.h>
+#include <sys/file.h>   // flock
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifndef MVL
+#define MVL 256
+#endif
+
+namespace loop {
+
+using namespace std;
+
+static_assert(sizeof(PlanRec) == 64U, "PlanRec is a 64-byte file record");
+
+struct PlanDb::Header {
+    char magic[8];          ///< "VEJITPDB"
+    uint32_t version;
+    uint32_t nslot;         ///< power of 2
+    uint32_t nrec;
+    uint32_t recSize;       ///< sizeof(PlanRec)
+    uint64_t dataEnd;       ///< file offset of the end of the data area
+    uint8_t pad[32];
+};
+static char const pdbMagic[8] = {'V','E','J','I','T','P','D','B'};
+static uint32_t const pdbVersion = 2U;  // 2: b_period_max in the key
+
+/** flock for the life of a scope */
+struct PlanDbLock {
+    PlanDbLock(int const fd, int const op) : fd(fd) {
+        while(flock(fd, op) != 0)
+            if(errno != EINTR) THROW("PlanDb: flock: "<<strerror(errno));
+    }
+    ~PlanDbLock(){ flock(fd, LOCK_UN); }
+    int const fd;
+};
+
+static uint64_t keyHash(PlanRec const& k){
+    uint64_t h = (((uint64_t)k.ii<<32) | k.jj) * 0x9E3779B97F4A7C15ULL;
+    h ^= (((uint64_t)k.vl<<32) | k.needs) * 0xC2B2AE3D27D4EB4FULL;
+    h ^= (uint64_t)k.b_period_max * 0x165667B19E3779F9ULL;
+    return h ^ (h>>29);
+}
+static PlanRec mkKey(int const vl, int const ii, int const jj, uint32_t const needs,
+        int const b_period_max){
+    if(ii < 1 || jj < 1 || vl < 1 || vl > MVL || b_period_max < 1 || b_period_max > 0xffff)
+        THROW("PlanDb: bad key vl,ii,jj,b_period_max = "<<vl<<","<<ii<<","<<jj
+                <<","<<b_period_max);
+    PlanRec k;
+    memset(&k, 0, sizeof k);
+    k.ii = ii; k.jj = jj; k.vl = vl; k.needs = needs;
+    k.b_period_max = (uint16_t)b_period_max;
+    return k;
+}
+
+PlanDb::PlanDb( std::string const& file, uint32_t const nslot/*=4096U*/,
+        bool const readonly/*=false*/, int const verbose/*=0*/ )
+    : file(file), hits(0U), misses(0U), v(verbose),
+    fd(-1), ro(readonly), nslot(0U), base(nullptr), mapped(0U)
+{
+    static_assert(sizeof(Header) == 64U, "PlanDb header is 64 bytes");
+    fd = open(file.c_str(), (ro? O_RDONLY: O_RDWR|O_CREAT) | O_CLOEXEC, 0644);
+    if(fd < 0) THROW("PlanDb: open "<<file<<": "<<strerror(errno));
+    try{
+        PlanDbLock lk(fd, ro? LOCK_SH: LOCK_EX);
+        struct stat st;
+        if(fstat(fd, &st)) THROW("PlanDb: fstat "<<file<<": "<<strerror(errno));
+        if(st.st_size == 0){
+            if(ro) THROW("PlanDb: "<<file<<" is empty");
+            uint32_t n = 4U;
+            while(n < nslot && n < (1U<<24)) n *= 2U;
+            uint64_t const sz = sizeof(Header) + (uint64_t)n * sizeof(PlanRec);
+            if(ftruncate(fd, sz)) THROW("PlanDb: ftruncate "<<file<<": "<<strerror(errno));
+            remap();
+            Header* const h = hdr();
+            memcpy(h->magic, pdbMagic, sizeof pdbMagic);
+            h->version = pdbVersion;
+            h->nslot = n;
+            h->nrec = 0U;
+            h->recSize = sizeof(PlanRec);
+            h->dataEnd = sz;
+        }else{
+            remap();
+        }
+        Header const* const h = hdr();
+        if(mapped < sizeof(Header) || memcmp(h->magic, pdbMagic, sizeof pdbMagic)
+                || h->version != pdbVersion || h->recSize != sizeof(PlanRec)
+                || (h->nslot & (h->nslot-1U)) || mapped < h->dataEnd
+                || mapped < sizeof(Header) + (uint64_t)h->nslot * sizeof(PlanRec))
+            THROW("PlanDb: "<<file<<" is not a version "<<pdbVersion<<" plan database");
+        this->nslot = h->nslot;
+    }catch(...){
+        if(base) munmap(base, mapped);
+        close(fd);
+        throw;
+    }
+    if(v>0) cout<<" PlanDb "<<file<<" "<<this->nslot<<" slots"<<endl;
+}
+PlanDb::~PlanDb(){
+    if(base) munmap(base, mapped);
+    if(fd >= 0) close(fd);
+}
+PlanDb::Header* PlanDb::hdr() const { return static_cast<Header*>(base); }
+PlanRec* PlanDb::slots() const {
+    return reinterpret_cast<PlanRec*>(static_cast<char*>(base) + sizeof(Header));
+}
+void PlanDb::remap(){
+    struct stat st;
+    if(fstat(fd, &st)) THROW("PlanDb: fstat "<<file<<": "<<strerror(errno));
+    size_t const sz = (size_t)st.st_size;
+    if(sz == mapped) return;
+    if(base) munmap(base, mapped);
+    base = nullptr;
+    mapped = 0U;
+    void* const p = mmap(nullptr, sz, PROT_READ | (ro? 0: PROT_WRITE), MAP_SHARED, fd, 0);
+    if(p == MAP_FAILED) THROW("PlanDb: mmap "<<file<<": "<<strerror(errno));
+    base = p;
+    mapped = sz;
+}
+PlanRec* PlanDb::probe( PlanRec const& k ) const {
+    uint32_t const mask = nslot - 1U;
+    PlanRec* const s = slots();
+    uint32_t i = (uint32_t)keyHash(k) & mask;
+    for(uint32_t n=0U; n<nslot; ++n, i = (i+1U) & mask){
+        PlanRec* const r = &s[i];
+        if(r->ii == 0U) return r;
+        if(r->ii == k.ii && r->jj == k.jj && r->vl == k.vl && r->needs == k.needs
+                && r->b_period_max == k.b_period_max) return r;
+    }
+    return nullptr;
+}
+UnrollData PlanDb::unpack( PlanRec const& r ) const {
+    UnrollData d;
+    d.vl = r.dvl; d.ii = r.ii; d.jj = r.jj; d.b_period_max = r.b_period_max;
+    d.suggested = (enum Unroll)r.suggested;
+    d.vll = r.vll; d.nloop = r.nloop; d.unroll = r.unroll; d.cycle = r.cycle;
+    if(r.npre){
+        uint64_t const nlane = (uint64_t)r.npre * r.dvl;
+        if(r.preOff + 2U*4U*nlane > mapped) THROW("PlanDb: "<<file<<" truncated");
+        uint32_t const* const a = reinterpret_cast<uint32_t const*>(
+                static_cast<char const*>(base) + r.preOff);
+        uint32_t const* const b = a + nlane;
+        uint64_t const iijj = (uint64_t)r.ii * r.jj;
+        for(uint32_t l=0U; l<r.npre; ++l){
+            VVlpi va(a + l*r.dvl, a + (l+1U)*r.dvl), vb(b + l*r.dvl, b + (l+1U)*r.dvl);
+            int const vl_l = (int)std::min<uint64_t>(r.dvl, iijj - (uint64_t)l*r.dvl);
+            d.pre.emplace_back(va, vb, vl_l);
+        }
+    }
+    return d;
+}
+
+bool PlanDb::find( int const vl, int const ii, int const jj, uint32_t const needs,
+        int const b_period_max, UnrollData* d/*=nullptr*/, PlanRec* rec/*=nullptr*/ ){
+    PlanRec const k = mkKey(vl, ii, jj, needs, b_period_max);
+    PlanDbLock lk(fd, LOCK_SH);
+    remap();
+    PlanRec const* const r = probe(k);
+    if(!r || r->ii == 0U) return false;
+    if(rec) *rec = *r;
+    if(d) *d = unpack(*r);
+    return true;
+}
+bool PlanDb::put( int const vl, int const ii, int const jj, uint32_t const needs,
+        UnrollData const& d ){
+    if(ro) THROW("PlanDb: "<<file<<" opened read-only");
+    PlanRec r = mkKey(vl, ii, jj, needs, d.b_period_max);
+    if(d.vl < 1 || d.vl > MVL || d.ii != ii || d.jj != jj)
+        THROW("PlanDb::put: decision "<<str(d)<<" does not match key");
+    uint64_t const nlane = (uint64_t)d.pre.size() * d.vl;
+    uint64_t const bytes = 2U*4U*nlane;
+    PlanDbLock lk(fd, LOCK_EX);
+    remap();
+    PlanRec* s = probe(r);
+    if(s && s->ii != 0U) return false;
+    if(!s || (hdr()->nrec + 1U) * 4U > nslot * 3U)
+        THROW("PlanDb: "<<file<<" full ("<<hdr()->nrec<<" of "<<nslot<<" slots)");
+    uint64_t const off = hdr()->dataEnd;
+    if(off + bytes > 0xffffffffULL) THROW("PlanDb: "<<file<<" data area over 4 GiB");
+    if(bytes){
+        if(ftruncate(fd, off + bytes)) THROW("PlanDb: ftruncate "<<file<<": "<<strerror(errno));
+        remap();
+        s = probe(r);
+        uint32_t* const a = reinterpret_cast<uint32_t*>(static_cast<char*>(base) + off);
+        uint32_t* const b = a + nlane;
+        for(size_t l=0U; l<d.pre.size(); ++l)
+            for(int i=0; i<d.vl; ++i){
+                a[l*d.vl + i] = (uint32_t)d.pre[l].a[i];
+                b[l*d.vl + i] = (uint32_t)d.pre[l].b[i];
+            }
+    }
+    r.suggested = (uint8_t)d.suggested;
+    r.vll = (uint16_t)d.vll;
+    r.vlen = (uint16_t)ve_vlen_suggest((uint64_t)ii * jj);
+    r.dvl = d.vl;
+    r.nloop = d.nloop; r.unroll = d.unroll; r.cycle = d.cycle;
+    fastdiv_make(&r.fd, (uint32_t)jj);
+    r.npre = (uint32_t)d.pre.size();
+    r.preOff = (uint32_t)(bytes? off: 0U);
+    uint32_t const key_ii = r.ii;
+    r.ii = 0U;
+    *s = r;                         // body first, key last
+    s->ii = key_ii;
+    hdr()->dataEnd = off + bytes;
+    ++hdr()->nrec;
+    if(v>0) cout<<" PlanDb put "<<ii<<"x"<<jj<<" vl="<<vl<<" needs="<<needs
+        <<" b_period_max="<<d.b_period_max
+        <<" --> "<<name(d.suggested)<<" vl="<<d.vl<<" pre="<<d.pre.size()<<endl;
+    return true;
+}
+UnrollData PlanDb::get( int const vl, int const ii, int const jj, uint32_t const needs/*=0U*/,
+        int const b_period_max/*=8*/ ){
+    UnrollData d;
+    if(find(vl, ii, jj, needs, b_period_max, &d)){
+        ++hits;
+        return d;
+    }
+    ++misses;
+    d = mk_unroll_data(vl, ii, jj, b_period_max);
+    if(!ro && !put(vl, ii, jj, needs, d))
+        find(vl, ii, jj, needs, b_period_max, &d);  // another process stored it first
+    return d;
+}
+uint32_t PlanDb::size(){
+    PlanDbLock lk(fd, LOCK_SH);
+    remap();
+    return hdr()->nrec;
+}
+
+int plan_db_precompute( PlanDb& db, std::istream& shapes, int const v/*=0*/ ){
+    int added = 0;
+    string line;
+    for(int ln=1; getline(shapes, line); ++ln){
+        size_t const b = line.find_first_not_of(" \t");
+        if(b == string::npos || line[b] == '#') continue;
+        istringstream iss(line);
+        int ii = 0, jj = 0, vl = MVL, bpm = 8;
+        uint32_t needs = 0U;
+        string rest;
+        // optional columns keep their default only when absent, never when garbled
+        if(!(iss>>ii>>jj)
+                || (!(iss>>std::ws).eof() && !(iss>>vl))
+                || (!(iss>>std::ws).eof() && !(iss>>needs))
+                || (!(iss>>std::ws).eof() && !(iss>>bpm))
+                || (iss>>rest))
+            THROW("plan_db_precompute: line "<<ln<<": bad shape \""<<line<<"\"");
+        uint64_t const m0 = db.misses;
+        UnrollData const d = db.get(vl, ii, jj, needs, bpm);
+        if(db.misses != m0) ++added;
+        if(v>0) cout<<" "<<ii<<"x"<<jj<<" vl="<<vl<<" needs="<<needs<<" : "
+            <<name(d.suggested)<<" vl="<<d.vl<<" nloop="<<d.nloop
+            <<(db.misses != m0? " (new)": "")<<endl;
+    }
+    return added;
+}
+
+}//loop::
+
+#ifdef PLANDB_MAIN
+#include "timer.h"
+#include <cstdio>
+#include <fstream>
+#include <sys/wait.h>
+using namespace loop;
+using namespace std;
+
+static void test_plan_db(){
+    cout<<"test_plan_db"<<endl;
+    string const file = "plandb_test.pdb";
+    std::remove(file.c_str());
+    vector<int> const ii_jj = {100,9, 4,64, 13,16, 1000,25, 7,3, 20,384};
+    {
+        PlanDb db(file, 64U);
+        CHECK( db.capacity() == 64U && db.size() == 0U );
+        for(size_t s=0U; s<ii_jj.size(); s+=2U){
+            int const ii = ii_jj[s], jj = ii_jj[s+1];
+            UnrollData const d = db.get(256, ii, jj);
+            UnrollData const ref = mk_unroll_data(256, ii, jj);
+            CHECK( d.vl == ref.vl && d.suggested == ref.suggested && d.vll == ref.vll
+                    && d.nloop == ref.nloop && d.unroll == ref.unroll && d.cycle == ref.cycle );
+            CHECK( d.pre.size() == ref.pre.size() );
+            for(size_t l=0U; l<d.pre.size(); ++l){
+                CHECK( d.pre[l].vl == ref.pre[l].vl );
+                for(int i=0; i<d.pre[l].vl; ++i){
+                    uint64_t const f = (uint64_t)l*d.vl + i;
+                    CHECK( d.pre[l].a[i] == f/jj && d.pre[l].b[i] == f%jj );
+                }
+            }
+            UnrollData const again = db.get(256, ii, jj);
+            CHECK( again.suggested == d.suggested && again.pre.size() == d.pre.size() );
+        }
+        CHECK( db.misses == ii_jj.size()/2U && db.hits == ii_jj.size()/2U );
+        CHECK( db.size() == ii_jj.size()/2U );
+        db.get(256, 100, 9, 0x5U);              // same shape, other kernel needs
+        CHECK( db.size() == ii_jj.size()/2U + 1U );
+        PlanRec r;
+        CHECK( db.find(256, 100, 9, 0U, 8, nullptr, &r) );
+        CHECK( r.fd._odiv == 9U && r.vlen == ve_vlen_suggest(900) );
+        CHECK( !db.find(256, 100, 9, 0x7U, 8) );
+        CHECK( !db.find(256, 100, 9, 0U, 4) );
+        UnrollData const b4 = db.get(256, 100, 9, 0U, 4);   // other b_period_max: own plan
+        UnrollData const ref4 = mk_unroll_data(256, 100, 9, 4);
+        CHECK( b4.b_period_max == 4 && b4.suggested == ref4.suggested
+                && b4.unroll == ref4.unroll && b4.cycle == ref4.cycle
+                && b4.pre.size() == ref4.pre.size() );
+        CHECK( db.size() == ii_jj.size()/2U + 2U );
+        CHECK( db.find(256, 100, 9, 0U, 4, nullptr, &r) && r.b_period_max == 4U );
+        // only put makes needs matter: a tuned plan for needs=1 ...
+        UnrollData const tuned = mk_unroll_data(128, 20, 20);
+        UnrollData const ref = mk_unroll_data(256, 20, 20);
+        CHECK( tuned.vl != ref.vl );
+        CHECK( db.put(256, 20, 20, 1U, tuned) );
+        uint64_t const hits0 = db.hits, misses0 = db.misses;
+        UnrollData const d0 = db.get(256, 20, 20, 0U);     // ... leaves needs=0 computed
+        CHECK( db.misses == misses0 + 1U );
+        CHECK( d0.vl == ref.vl && d0.suggested == ref.suggested
+                && d0.pre.size() == ref.pre.size() );
+        UnrollData const d1 = db.get(256, 20, 20, 1U);     // ... and is what needs=1 gets
+        CHECK( db.hits == hits0 + 1U );
+        CHECK( d1.vl == tuned.vl && d1.suggested == tuned.suggested
+                && d1.cycle == tuned.cycle && d1.pre.size() == tuned.pre.size() );
+        CHECK( db.size() == ii_jj.size()/2U + 4U );
+    }
+    {   // another process adds a shape, and we see it
+        pid_t const pid = fork();
+        if(pid == 0){
+            PlanDb db(file);
+            db.get(200, 33, 17);
+            _exit(db.misses == 1U? 0: 1);
+        }
+        int status = -1;
+        waitpid(pid, &status, 0);
+        CHECK( WIFEXITED(status) && WEXITSTATUS(status) == 0 );
+        PlanDb db(file);
+        UnrollData d;
+        CHECK( db.find(200, 33, 17, 0U, 8, &d) && d.ii == 33 );
+        CHECK( db.size() == ii_jj.size()/2U + 5U );
+    }
+    {   // read-only: computes misses, stores nothing
+        PlanDb ro(file, 0U, true);
+        uint32_t const n = ro.size();
+        ro.get(256, 11, 11);
+        CHECK( ro.misses == 1U && ro.size() == n );
+        bool threw = false;
+        try{ ro.put(256, 11, 11, 0U, mk_unroll_data(256, 11, 11)); }catch(...){ threw = true; }
+        if(!threw) THROW("read-only put did not throw");
+    }
+    {   // bulk precompute, then a full table
+        istringstream shapes("# ii jj [vl [needs]]\n100 9\n5 5 128\n5 5 128 3\n\n8 8\n");
+        PlanDb db(file);
+        uint32_t const n = db.size();
+        CHECK( plan_db_precompute(db, shapes, 1) == 3 );   // 100x9 already present
+        CHECK( db.size() == n + 3U );
+        string const small = "plandb_small.pdb";
+        std::remove(small.c_str());
+        PlanDb tiny(small, 4U);
+        tiny.get(256, 2, 3); tiny.get(256, 3, 3); tiny.get(256, 4, 3);
+        bool threw = false;
+        try{ tiny.get(256, 5, 3); }catch(...){ threw = true; }
+        if(!threw) THROW("get into a full table did not throw");
+        for(char const* bad: {"5\n", "5 5 x\n", "5 5 128 y\n", "5 5 128 0 z\n", "5 5 128 0 8 9\n"}){
+            istringstream badShapes(bad);
+            threw = false;
+            try{ plan_db_precompute(db, badShapes); }catch(...){ threw = true; }
+            if(!threw) THROW("shape line \""<<bad<<"\" did not throw");
+        }
+        {   // header claims more slots than the file holds
+            fstream fs(small.c_str(), ios::in|ios::out|ios::binary);
+            uint32_t const big = 1024U;
+            fs.seekp(12);   // Header::nslot
+            fs.write((char const*)&big, sizeof big);
+        }
+        threw = false;
+        try{ PlanDb lying(small); }catch(...){ threw = true; }
+        if(!threw) THROW("opening a file with too few slots did not throw");
+        std::remove(small.c_str());
+    }
+    {
+        ofstream ofs("plandb_bad.pdb");
+        ofs<<"not a plan database, not at all, no";
+    }
+    bool threw = false;
+    try{ PlanDb bad("plandb_bad.pdb"); }catch(...){ threw = true; }
+    if(!threw) THROW("opening a bad file did not throw");
+    std::remove("plandb_bad.pdb");
+    std::remove(file.c_str());
+    cout<<" plan database OK"<<endl;
+}
+/** no args: self-test.  <tt>DBFILE SHAPES [NSLOT]</tt>: bulk precompute */
+int main(int argc,char**argv){
+    if(argc >= 3){
+        PlanDb db(argv[1], (argc > 3? (uint32_t)atol(argv[3]): 4096U));
+        ifstream ifs(argv[2]);
+        if(!ifs) THROW("cannot read shapes file "<<argv[2]);
+        double const t0 = __clock();
+        int const n = plan_db_precompute(db, ifs, 1);
+        cout<<n<<" new plans, "<<db.size()<<" of "<<db.capacity()<<" slots used in "
+            <<argv[1]<<" ("<<__clock()-t0<<" s)"<<endl;
+        return 0;
+    }
+    test_plan_db();
+    cout<<"\nGoodbye"<<endl;
+    return 0;
+}
+#endif // PLANDB_MAIN
+// vim: ts=4 sw=4 et cindent cino=^=l0,\:.5s,=-.5s,N-s,g.5s,b1 cinkeys=0{,0},0),\:,0#,!^F,o,O,e,0=break
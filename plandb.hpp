@@ -0,0 +1,104 @@
+#ifndef PLANDB_HPP
+#define PLANDB_HPP
+/* Copyright (c) 2019 by NEC Corporation
+ * This file is part of ve-jit */
+/** \file
+ * Persistent, memory-mapped store of fused-loop decisions.
+ *
+ * \c ve_vlen_suggest, \c unroll_suggest (which may rescan every VL from
+ * 256 down to ~224) and \c fastdiv_make are re-run for every generated
+ * kernel.  \c PlanDb caches their results per key
+ * <tt>(ii,jj,vl,needs,b_period_max)</tt> in one file shared by all processes:
+ *
+ * - 64-byte header, then a fixed power-of-2 table of 64-byte \c PlanRec
+ *   slots (open addressing, linear probing), then a data area holding the
+ *   \c UnrollData::pre index vectors as u32,
+ * - the file is \c mmap'ed \c MAP_SHARED; \c flock serializes writers
+ *   (readers take a shared lock), and a process remaps when another one
+ *   has grown the data area,
+ * - \c needs is an opaque kernel-requirements word (ex. \c KernelNeeds
+ *   flags packed as bits).  \c mk_unroll_data does not look at it, so
+ *   \c get computes the same plan for every \c needs; only \c put (ex. a
+ *   \c FuseTune winner for one kernel) makes the plans of a shape differ.
+ *
+ * A network's layer shapes can be precomputed in bulk with
+ * \c plan_db_precompute (<tt>plandb-x86 DBFILE SHAPES</tt>), after which
+ * generator startup is one table lookup per layer.
+ */
+#include "fuseloop.hpp"
+#include "intutil.h"    // struct fastdiv
+
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+
+namespace loop {
+
+/** file layout of one \c PlanDb slot (host byte order) */
+struct PlanRec {
+    uint32_t ii, jj, vl, needs;     ///< key (ii==0: empty slot)
+    uint8_t  suggested;             ///< enum Unroll of the decision
+    uint8_t  reserved;
+    uint16_t b_period_max;          ///< key, \c unroll_suggest precalc limit
+    uint16_t vll;                   ///< alternative (lower) vl, or 0
+    uint16_t vlen;                  ///< \c ve_vlen_suggest(ii*jj)
+    uint32_t dvl;                   ///< vector length of the decision (\c vl or \c vll)
+    uint32_t nloop, unroll, cycle;  ///< of the decision
+    struct fastdiv fd;              ///< \c fastdiv_make(jj)
+    uint32_t npre;                  ///< \c UnrollData::pre vectors
+    uint32_t preOff;                ///< data offset of a[npre*dvl] then b[npre*dvl] (u32)
+};
+
+class PlanDb {
+  public:
+    /** open (or create, with \c nslot slots rounded up to a power of 2) \c file.
+     * \c verbose>0 reports the slot count on open.
+     * \throw on I/O error or if \c file is not a PlanDb. */
+    explicit PlanDb( std::string const& file, uint32_t const nslot=4096U,
+            bool const readonly=false, int const verbose=0 );
+    ~PlanDb();
+    PlanDb(PlanDb const&) = delete;
+    PlanDb& operator=(PlanDb const&) = delete;
+
+    /** stored decision, or \c mk_unroll_data (then stored unless read-only).
+     * A computed plan ignores \c needs, which only selects a \c put one.
+     * \throw if the table is 3/4 full. */
+    UnrollData get( int const vl, int const ii, int const jj, uint32_t const needs=0U,
+            int const b_period_max=8 );
+    /** lookup only. \return false if absent (\c d, \c rec untouched) */
+    bool find( int const vl, int const ii, int const jj, uint32_t const needs,
+            int const b_period_max, UnrollData* d=nullptr, PlanRec* rec=nullptr );
+    /** store \c d (ex. a \c FuseTune winner) for the key, with
+     * \c d.b_period_max completing it.
+     * \return false if the key was already present (kept). */
+    bool put( int const vl, int const ii, int const jj, uint32_t const needs,
+            UnrollData const& d );
+
+    uint32_t size();                ///< stored records
+    uint32_t capacity() const { return nslot; }
+    std::string const file;
+    uint64_t hits;                  ///< \c get served from the table
+    uint64_t misses;                ///< \c get computed
+    int v;                          ///< verbosity
+  private:
+    struct Header;
+    Header* hdr() const;
+    PlanRec* slots() const;
+    void remap();                   ///< follow file growth (call with lock held)
+    PlanRec* probe( PlanRec const& key ) const;     ///< match or empty slot, or nullptr
+    UnrollData unpack( PlanRec const& r ) const;
+    int fd;
+    bool const ro;
+    uint32_t nslot;
+    void* base;
+    size_t mapped;
+};
+
+/** \c db.get for each <tt>ii jj [vl=256 [needs=0 [b_period_max=8]]]</tt> line of \c shapes
+ * ('#' comments).  \return number of shapes newly computed.
+ * \throw on bad lines: no \c ii \c jj, an unparsable column, or trailing text. */
+int plan_db_precompute( PlanDb& db, std::istream& shapes, int const v=0 );
+
+}//loop::
+// vim: ts=4 sw=4 et cindent cino=^=l0,\:.5s,=-.5s,N-s,g.5s,b1 cinkeys=0{,0},0),\:,0#,!^F,o,O,e,0=break
+#endif // PLANDB_HPP
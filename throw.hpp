@@ -25,6 +25,7 @@
 #define THROW_UNLESS( COND, MSG ) do{}while(0)
 #define TODO(MSG) do{}while(0)
 #define THROW(MSG) do{}while(0)
+#define CHECK(COND) do{}while(0)
 #else
 //static std::runtime_error throwmsg(char const* file, int line, char const* msg){
 //    ostringstream oss;
@@ -49,6 +50,11 @@
 #define THROW_UNLESS( COND, MSG ) THROW_PRETTY_IF(__FILE__, __LINE__, COND, MSG)
 #define TODO(MSG) THROW_PRETTY( __PRETTY_FUNCTION__, __LINE__, "TODO: "<<MSG)
 #define THROW(MSG) THROW_PRETTY( __PRETTY_FUNCTION__, __LINE__, MSG)
+/** Self-test check that, unlike \c assert, stays active under NDEBUG.
+ * Throws with the failing condition text, \c __FILE__ and \c __LINE__. */
+#define CHECK( COND ) do{ \
+    if(!(COND)) THROW_PRETTY( __FILE__, __LINE__, "check failed: "<<#COND); \
+}while(0)
 
 #endif
 // vim: ts=4 sw=4 et cindent cino=^=l0,\:.5s,=-.5s,N-s,g.5s,h.5s,b1 cinkeys=0{,0},0),\:,0#,!^F,o,O,e,0=break
@@ -2,6 +2,7 @@
 #include "ve_divmod.hpp"
 #include "cblock.hpp"
 #include "stringutil.hpp"
+#include "throw.hpp"
 
 namespace cprog {
 
@@ -154,7 +155,7 @@ int mk_DIVMOD(Cblock& cb, uint32_t const jj, uint32_t const vIn_hi/*=0*/,
     }else{
         scope[tag].setType("TAG"); // create the tag block "we were here before"
         if(v>0) cout<<"DIVMOD_"<<jj<<" new macro"<<endl;
-        int nops = mk_FASTDIV(cb,jj,vIn_hi,v);
+        nops = mk_FASTDIV(cb,jj,vIn_hi,v);
         string mac = OSSFMT(" \\\n          VDIV = FASTDIV_"<<jj<<"(V,VL); \\\n");
         if(nops==1){
             assert(positivePow2(jj));
@@ -175,5 +176,33 @@ int mk_DIVMOD(Cblock& cb, uint32_t const jj, uint32_t const vIn_hi/*=0*/,
     return nops;
 }
 
+Cexpr::Val fastdiv(Cexpr& e, Cexpr::Val const x, uint32_t const jj,
+        uint32_t const vIn_hi/*=0*/){
+    if(jj==0) THROW("fastdiv by zero");
+    struct fastdiv jj_fastdiv;
+    fastdiv_make( &jj_fastdiv, (uint32_t)jj );
+    uint32_t fastdiv_ops = 0U;
+    if(jj_fastdiv.mul != 1) ++fastdiv_ops;
+    if(jj_fastdiv.add != 0) ++fastdiv_ops;
+    if(1) /*shift*/ ++fastdiv_ops;
+    if(fastdiv_ops==3 && (vIn_hi>0 && vIn_hi <= FASTDIV_SAFEMAX)){
+        // 2-op mul-shift, valid for "small" inputs
+        uint64_t const jj_M = computeM_uB(jj);
+        return e.shr(e.mul(x, e.k(jj_M)), e.k(FASTDIV_C));
+    }
+    // 'struct fastdiv' (mul,add,shr); Cexpr folds away mul-by-1, add-0, shr-0
+    return e.shr(e.add(e.mul(x, e.k(jj_fastdiv.mul)), e.k(jj_fastdiv.add)),
+            e.k(jj_fastdiv.shift));
+}
+
+std::pair<Cexpr::Val,Cexpr::Val> divmod(Cexpr& e, Cexpr::Val const x,
+        uint32_t const jj, uint32_t const vIn_hi/*=0*/){
+    Cexpr::Val const q = fastdiv(e, x, jj, vIn_hi);
+    Cexpr::Val const r = (positivePow2(jj)
+            ? e.band(x, e.k(jj-1))
+            : e.sub(x, e.mul(e.k(jj), q)));
+    return std::make_pair(q, r);
+}
+
 }//cprog::
 // vim: ts=4 sw=4 et cindent cino=^=l0,\:.5s,=-.5s,N-s,g.5s,b1 cinkeys=0{,0},0),\:,0#,!^F,o,O,e,0=break
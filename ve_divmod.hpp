@@ -1,6 +1,8 @@
 #ifndef __VE_DIVMOD_HPP
 #define __VE_DIVMOD_HPP
+#include "cexpr.hpp"
 #include <cstdint>
+#include <utility>
 
 namespace cprog
 {
@@ -63,6 +65,18 @@ int mk_FASTDIV(Cblock& cb, uint32_t const jj, uint32_t const vIn_hi=0,
 int mk_DIVMOD(Cblock& cb, uint32_t const jj, uint32_t const vIn_hi=0,
         int const v=0/*verbose*/);
 
+/** \c Cexpr version of \c mk_FASTDIV: build \c x/jj inline, using the same
+ * method selection (shift, mul-shift for small \c vIn_hi, else struct fastdiv).
+ * Constants become \c Cexpr constants, so they fold and CSE with the caller's
+ * index math instead of living in \c FASTDIV_jj macros.
+ * \pre \c x holds u32 values (scalar or vector), jj>0 */
+Cexpr::Val fastdiv(Cexpr& e, Cexpr::Val const x, uint32_t const jj,
+        uint32_t const vIn_hi=0);
+/** \c Cexpr version of \c mk_DIVMOD: return {x/jj, x%jj} (mask if jj is 2^N,
+ * else mul-sub). */
+std::pair<Cexpr::Val,Cexpr::Val> divmod(Cexpr& e, Cexpr::Val const x,
+        uint32_t const jj, uint32_t const vIn_hi=0);
+
 }//cprog::
 // vim: ts=4 sw=4 et cindent cino=^=l0,\:.5s,=-.5s,N-s,g.5s,b1 cinkeys=0{,0},0),\:,0#,!^F,o,O,e,0=break
 #endif // __VE_DIVMOD_HPP
@@ -0,0 +1,640 @@
+/* Copyright (c) 2019 by NEC Corporation
+ * This file is part of ve-jit */
+/** \file
+ * In-process VE assembler, see \ref veasm.hpp.
+ *
+ * Every VE instruction is one 64-bit word (little-endian in memory):
+ * ```
+ *  63    56 55 54    48 47 46    40 39 38    32 31                 0
+ * [  op    |cx|  sx    |cy|  sy    |cz|  sz    | D (RM) or vector fields]
+ * ```
+ * - \c cy=1: \c sy is a scalar register; \c cy=0: \c sy is a 7-bit signed I.
+ * - \c cz=1: \c sz is a scalar register; \c cz=0: RR formats read \c sz as
+ *   an M value, \c (m)1 encoded as m and \c (m)0 as m+64; RM formats read 0.
+ * - RV (vector) formats reuse \c cx..sz, with \c cs (bit 53) meaning "the
+ *   scalar \c sy replaces \c vy", \c m (bits 51..48) the mask register, and
+ *   vx|vy|vz|vw in bits 31..0.
+ */
+#include "veasm.hpp"
+#include "throw.hpp"
+#include "stringutil.hpp"
+#include <sys/mman.h>
+#include <unistd.h>
+#include <cstring>
+#include <cstdlib>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+
+using namespace std;
+
+namespace {
+
+/** VE instruction formats as needed by our subset.
+ * Suffix tells operand order, ex. \c RRzy is "op sx, sz, sy" (shifts). */
+enum Fmt { RM, RMbc, RRyz, RRzy, RRlvl, RRnop,
+    RVyz, RVzy, RVld, RVbrd, RVseq, RVmv, RVfmk, RVlsv, RVlvs,
+    RVm3, RVm2, RVlvm, RVsvm, RVpcvm, BRCF };
+struct OpInfo {
+    uint8_t op;
+    Fmt fmt;
+    bool cx;
+    uint8_t cf;     ///< BRCF/RVfmk condition: af=0 gt lt ne eq ge le, at=15
+};
+
+map<string,OpInfo> const& opTable(){
+    static map<string,OpInfo> const tab = []{ map<string,OpInfo> t = {
+        {"lea",     {0x06, RM, false}},   {"lea.sl",    {0x06, RM, true}},
+        {"ld",      {0x01, RM, false}},   {"ldu",       {0x02, RM, false}},
+        {"ldl.sx",  {0x03, RM, false}},   {"ldl.zx",    {0x03, RM, true}},
+        {"ld2b.sx", {0x04, RM, false}},   {"ld2b.zx",   {0x04, RM, true}},
+        {"ld1b.sx", {0x05, RM, false}},   {"ld1b.zx",   {0x05, RM, true}},
+        {"st",      {0x11, RM, false}},   {"stu",       {0x12, RM, false}},
+        {"stl",     {0x13, RM, false}},   {"st2b",      {0x14, RM, false}},
+        {"st1b",    {0x15, RM, false}},
+        {"b.l",     {0x19, RMbc, false}},
+        {"and",     {0x44, RRyz, false}}, {"or",        {0x45, RRyz, false}},
+        {"xor",     {0x46, RRyz, false}}, {"eqv",       {0x47, RRyz, false}},
+        {"nnd",     {0x54, RRyz, false}},
+        {"addu.l",  {0x48, RRyz, false}}, {"addu.w",    {0x48, RRyz, true}},
+        {"adds.w.sx",{0x4a, RRyz, false}},{"adds.w.zx", {0x4a, RRyz, true}},
+        {"adds.l",  {0x59, RRyz, false}},
+        {"subu.l",  {0x58, RRyz, false}}, {"subu.w",    {0x58, RRyz, true}},
+        {"subs.w.sx",{0x5a, RRyz, false}},{"subs.w.zx", {0x5a, RRyz, true}},
+        {"subs.l",  {0x5b, RRyz, false}},
+        {"mulu.l",  {0x49, RRyz, false}}, {"mulu.w",    {0x49, RRyz, true}},
+        {"muls.w.sx",{0x4b, RRyz, false}},{"muls.w.zx", {0x4b, RRyz, true}},
+        {"muls.l",  {0x6e, RRyz, false}},
+        {"cmpu.l",  {0x55, RRyz, false}}, {"cmpu.w",    {0x55, RRyz, true}},
+        {"cmps.w.sx",{0x7a, RRyz, false}},{"cmps.w.zx", {0x7a, RRyz, true}},
+        {"cmps.l",  {0x6a, RRyz, false}},
+        {"sll",     {0x65, RRzy, false}}, {"srl",       {0x75, RRzy, false}},
+        {"sla.w.sx",{0x66, RRzy, false}}, {"sla.w.zx",  {0x66, RRzy, true}},
+        {"sla.l",   {0x57, RRzy, false}},
+        {"sra.w.sx",{0x76, RRzy, false}}, {"sra.w.zx",  {0x76, RRzy, true}},
+        {"sra.l",   {0x77, RRzy, false}},
+        {"lvl",     {0xbf, RRlvl, false}},
+        {"nop",     {0x79, RRnop, false}},
+        {"vld",     {0x81, RVld, false}}, {"vldu",      {0x82, RVld, false}},
+        {"vldl.sx", {0x83, RVld, false}}, {"vldl.zx",   {0x83, RVld, true}},
+        {"vst",     {0x91, RVld, false}}, {"vstu",      {0x92, RVld, false}},
+        {"vstl",    {0x93, RVld, false}},
+        {"vaddu.l", {0xc8, RVyz, false}}, {"vaddu.w",   {0xc8, RVyz, true}},
+        {"vadds.w.sx",{0xca, RVyz, false}},{"vadds.w.zx",{0xca, RVyz, true}},
+        {"vadds.l", {0x8b, RVyz, false}},
+        {"vsubu.l", {0xd8, RVyz, false}}, {"vsubu.w",   {0xd8, RVyz, true}},
+        {"vsubs.w.sx",{0xda, RVyz, false}},{"vsubs.w.zx",{0xda, RVyz, true}},
+        {"vsubs.l", {0x9b, RVyz, false}},
+        {"vmulu.l", {0xc9, RVyz, false}}, {"vmulu.w",   {0xc9, RVyz, true}},
+        {"vmuls.w.sx",{0xcb, RVyz, false}},{"vmuls.w.zx",{0xcb, RVyz, true}},
+        {"vmuls.l", {0xdb, RVyz, false}},
+        {"vand",    {0xc4, RVyz, false}}, {"vor",       {0xc5, RVyz, false}},
+        {"vxor",    {0xc6, RVyz, false}}, {"veqv",      {0xc7, RVyz, false}},
+        {"vsll",    {0xe5, RVzy, false}}, {"vsrl",      {0xf5, RVzy, false}},
+        {"vsla.l",  {0xd4, RVzy, false}}, {"vsra.l",    {0xd5, RVzy, false}},
+        {"vbrd",    {0x8c, RVbrd, false}},
+        {"vseq",    {0x99, RVseq, false}},
+        {"vcmpu.l", {0xb9, RVyz, false}}, {"vcmpu.w",   {0xb9, RVyz, true}},
+        {"vmrg",    {0xd6, RVyz, false}},   // vmrg vx, sy|vy, vz, vm: vm? vz: vy
+        {"vmv",     {0x9c, RVmv, false}},
+        {"lsv",     {0x8e, RVlsv, false}},
+        {"lvs",     {0x9e, RVlvs, false}},
+        {"andm",    {0x84, RVm3, false}}, {"orm",       {0x85, RVm3, false}},
+        {"xorm",    {0x86, RVm3, false}}, {"eqvm",      {0x87, RVm3, false}},
+        {"nndm",    {0x94, RVm3, false}}, {"negm",      {0x95, RVm2, false}},
+        {"pcvm",    {0xa4, RVpcvm, false}},
+        {"lvm",     {0xb7, RVlvm, false}}, {"svm",      {0xa7, RVsvm, false}},
+        {"br.l",    {0x18, BRCF, false, 15}},
+    };
+    // relative conditional branches br<cc>.{l,w} sy, sz, label
+    static char const* const cc[] = {"gt","lt","ne","eq","ge","le"};
+    for(int c=0; c<6; ++c){
+        t[string("br")+cc[c]+".l"] = OpInfo{0x18, BRCF, false, uint8_t(c+1)};
+        t[string("br")+cc[c]+".w"] = OpInfo{0x18, BRCF, true, uint8_t(c+1)};
+        // vfmk.l.<cc> vmx, vz: mask of signed vz <cc> 0 (after vcmp)
+        t[string("vfmk.l.")+cc[c]] = OpInfo{0xb4, RVfmk, false, uint8_t(c+1)};
+    }
+    return t; }();
+    return tab;
+}
+
+struct Opnd {
+    enum Kind { NONE, SREG, VREG, VMREG, INT, MVAL } k;
+    uint64_t v;     ///< register number, integer, or encoded M
+};
+
+/** M-value encoding of \c x, or -1 if \c x is not of form (m)B. */
+int mEncode(uint64_t const x){
+    if(x==0) return 0;                                  // (0)1
+    if(x==~uint64_t{0}) return 0x40;                    // (0)0
+    for(int m=1; m<64; ++m){
+        if(x == ~uint64_t{0} << (64-m)) return m;       // (m)1
+        if(x == ~uint64_t{0} >> m) return m | 0x40;     // (m)0
+    }
+    return -1;
+}
+
+Opnd opnd(string const& s0){
+    string const s = trim(s0);
+    Opnd o{Opnd::NONE, 0};
+    if(s.empty()) return o;
+    static map<string,unsigned> const alias = {{"%sl",8},{"%fp",9},{"%lr",10},
+        {"%sp",11},{"%tp",14},{"%got",15},{"%plt",16}};
+    auto a = alias.find(s);
+    if(a != alias.end()){ o.k = Opnd::SREG; o.v = a->second; return o; }
+    char const* const c = s.c_str();
+    char* end = nullptr;
+    if(s.compare(0,3,"%vm")==0){
+        o.k = Opnd::VMREG; o.v = strtoul(c+3, &end, 10);
+        if(*end || end==c+3 || o.v>15) THROW("bad mask register "<<s);
+    }else if(s.compare(0,2,"%s")==0 || s.compare(0,2,"%v")==0){
+        o.k = (s[1]=='s'? Opnd::SREG: Opnd::VREG); o.v = strtoul(c+2, &end, 10);
+        if(*end || end==c+2 || o.v>63) THROW("bad register "<<s);
+    }else if(s[0]=='('){                                // (m)0 or (m)1
+        unsigned long m = strtoul(c+1, &end, 10);
+        if(end==c+1 || *end!=')' || m>63 || (end[1]!='0' && end[1]!='1') || end[2])
+            THROW("bad M operand "<<s);
+        o.k = Opnd::MVAL; o.v = m | (end[1]=='0'? 0x40: 0);
+    }else{
+        bool const neg = (s[0]=='-');
+        uint64_t const u = strtoull(c+(neg||s[0]=='+'? 1: 0), &end, 0);
+        if(*end || end==c+(neg? 1: 0)) THROW("unsupported operand "<<s
+                <<" (labels and expressions need nas, use asm2bin)");
+        o.k = Opnd::INT; o.v = (neg? uint64_t(0)-u: u);
+    }
+    return o;
+}
+
+/** split args at top-level commas (not inside parentheses) */
+vector<string> splitArgs(string const& args){
+    vector<string> ret;
+    if(trim(args).empty()) return ret;
+    int depth = 0;
+    string cur;
+    for(char const ch: args){
+        if(ch=='(') ++depth;
+        if(ch==')') --depth;
+        if(ch==',' && depth==0){ ret.push_back(trim(cur)); cur.clear(); }
+        else cur.push_back(ch);
+    }
+    ret.push_back(trim(cur));
+    return ret;
+}
+
+uint64_t yField(Opnd const& o, string const& what){
+    if(o.k==Opnd::SREG) return 0x80 | o.v;
+    if(o.k==Opnd::NONE) return 0;
+    if(o.k==Opnd::INT && isIval((int64_t)o.v)) return o.v & 0x7f;
+    THROW(what<<" needs %s register or I in [-64,63]");
+}
+uint64_t zField(Opnd const& o, string const& what){
+    if(o.k==Opnd::SREG) return 0x80 | o.v;
+    if(o.k==Opnd::MVAL) return o.v;
+    if(o.k==Opnd::INT){
+        int const m = mEncode(o.v);
+        if(m >= 0) return (uint64_t)m;
+    }
+    THROW(what<<" needs %s register or M value (m)0|(m)1");
+}
+uint64_t need(Opnd const& o, Opnd::Kind const k, string const& what){
+    if(o.k != k) THROW(what<<" has wrong operand type");
+    return o.v;
+}
+/** RM/RR scalar word */
+uint64_t word(uint8_t op, bool cx, uint64_t sx, uint64_t y, uint64_t z, uint32_t lo){
+    return (uint64_t)op<<56 | (uint64_t)cx<<55 | sx<<48 | y<<40 | z<<32 | lo;
+}
+/** RV vector fields, bits 31..0 */
+uint32_t vfields(uint64_t vx, uint64_t vy, uint64_t vz){
+    return uint32_t(vx<<24 | vy<<16 | vz<<8);
+}
+
+/** parse "D(sy,sz)", "D(,sz)", "(,sz)" or "D" for RM formats */
+void address(string const& a, string const& what, uint64_t& y, uint64_t& z, uint32_t& d){
+    auto const lp = a.find('(');
+    string const disp = trim(a.substr(0,lp));
+    y = z = 0; d = 0;
+    if(!disp.empty()){
+        Opnd const o = opnd(disp);
+        int64_t const sd = (int64_t)need(o, Opnd::INT, what+" displacement");
+        if(sd < INT32_MIN || sd > (int64_t)UINT32_MAX) THROW(what<<" displacement "<<disp<<" out of 32-bit range");
+        d = (uint32_t)sd;
+    }
+    if(lp == string::npos) return;
+    auto const rp = a.find(')', lp);
+    auto const comma = a.find(',', lp);
+    if(rp == string::npos || rp+1 != a.size() || comma == string::npos || comma > rp)
+        THROW(what<<" address "<<a<<" should look like D(sy,sz) or D(,sz)");
+    y = yField(opnd(a.substr(lp+1, comma-lp-1)), what);
+    Opnd const oz = opnd(a.substr(comma+1, rp-comma-1));
+    if(oz.k != Opnd::NONE) z = 0x80 | need(oz, Opnd::SREG, what+" base");
+}
+/** parse "%vx(sy)" for lsv/lvs */
+uint64_t velement(string const& a, string const& what, uint64_t& y){
+    auto const lp = a.find('(');
+    if(lp == string::npos || a.back() != ')') THROW(what<<" element "<<a<<" should look like %vN(sy)");
+    y = yField(opnd(a.substr(lp+1, a.size()-lp-2)), what);
+    return need(opnd(a.substr(0,lp)), Opnd::VREG, what);
+}
+
+}//anon::
+
+uint64_t VeAsm::encode(string const& op, string const& args){
+    auto const found = opTable().find(op);
+    if(found == opTable().end()) THROW("VeAsm: unsupported instruction "<<op<<" "<<args);
+    OpInfo const& i = found->second;
+    vector<string> a = splitArgs(args);
+    // optional trailing vector mask for RV formats
+    uint64_t m = 0;
+    if(i.fmt >= RVyz && i.fmt <= RVfmk && !a.empty() && a.back().compare(0,3,"%vm")==0){
+        m = opnd(a.back()).v;
+        a.pop_back();
+    }
+    static size_t const nargs[] = {2,1,3,3,1,0, 3,3,3,2,1,3,2,2,2, 3,2,3,3,2,3};
+    if(a.size() != nargs[i.fmt] && !(i.fmt==BRCF && i.cf==15 && a.size()==1))
+        THROW("VeAsm: "<<op<<" expects "<<nargs[i.fmt]<<" operands, got \""<<args<<"\"");
+    string const& what = op;
+    uint64_t y=0, z=0;
+    uint32_t d=0;
+    switch(i.fmt){
+      case RM:
+          address(a[1], what, y, z, d);
+          return word(i.op, i.cx, need(opnd(a[0]),Opnd::SREG,what), y, z, d);
+      case RMbc:    // unconditional only: cf=AT(15), no compare operand
+          address(a[0], what, y, z, d);
+          if(y) THROW("VeAsm: b.l supports only D(,sz) addressing");
+          return word(i.op, false, 0x0f, 0, z, d);
+      case RRyz:
+          return word(i.op, i.cx, need(opnd(a[0]),Opnd::SREG,what),
+                  yField(opnd(a[1]),what), zField(opnd(a[2]),what), 0);
+      case RRzy:
+          return word(i.op, i.cx, need(opnd(a[0]),Opnd::SREG,what),
+                  yField(opnd(a[2]),what), zField(opnd(a[1]),what), 0);
+      case RRlvl: {   // AsmFmtVe::set_vector_length emits "lvl N" for N<=127
+          Opnd const o = opnd(a[0]);
+          if(o.k==Opnd::INT && o.v<=127) return word(i.op, false, 0, o.v, 0, 0);
+          return word(i.op, false, 0, yField(o,what), 0, 0);
+      }
+      case RRnop:
+          return word(i.op, false, 0, 0, 0, 0);
+      case RVyz:
+      case RVzy: {
+          Opnd const oy = opnd(a[i.fmt==RVyz? 1: 2]);
+          uint64_t const vx = need(opnd(a[0]), Opnd::VREG, what);
+          uint64_t const vz = need(opnd(a[i.fmt==RVyz? 2: 1]), Opnd::VREG, what);
+          uint64_t const cs_m = (oy.k==Opnd::VREG? 0: 0x20) | m;
+          if(oy.k==Opnd::VREG)
+              return word(i.op, i.cx, cs_m, 0, 0, vfields(vx, oy.v, vz));
+          return word(i.op, i.cx, cs_m, yField(oy,what), 0, vfields(vx, 0, vz));
+      }
+      case RVld:
+          return word(i.op, i.cx, m, yField(opnd(a[1]),what), zField(opnd(a[2]),what),
+                  vfields(need(opnd(a[0]),Opnd::VREG,what), 0, 0));
+      case RVbrd:
+          return word(i.op, i.cx, m, yField(opnd(a[1]),what), 0,
+                  vfields(need(opnd(a[0]),Opnd::VREG,what), 0, 0));
+      case RVseq:
+          return word(i.op, i.cx, m, 0, 0, vfields(need(opnd(a[0]),Opnd::VREG,what), 0, 0));
+      case RVmv:
+          return word(i.op, i.cx, m, yField(opnd(a[1]),what), 0,
+                  vfields(need(opnd(a[0]),Opnd::VREG,what), 0,
+                      need(opnd(a[2]),Opnd::VREG,what)));
+      case RVfmk:   // condition in sy (cy=0), mask register in the vx field
+          return word(i.op, i.cx, m, i.cf, 0, vfields(need(opnd(a[0]),Opnd::VMREG,what), 0,
+                      need(opnd(a[1]),Opnd::VREG,what)));
+      case RVlsv: {
+          uint64_t const vx = velement(a[0], what, y);
+          return word(i.op, i.cx, 0, y, zField(opnd(a[1]),what), vfields(vx, 0, 0));
+      }
+      case RVlvs: {
+          uint64_t const vx = velement(a[1], what, y);
+          return word(i.op, i.cx, need(opnd(a[0]),Opnd::SREG,what), y, 0, vfields(vx, 0, 0));
+      }
+      case RVm3:
+          return word(i.op, i.cx, 0, 0, 0, vfields(need(opnd(a[0]),Opnd::VMREG,what),
+                      need(opnd(a[1]),Opnd::VMREG,what), need(opnd(a[2]),Opnd::VMREG,what)));
+      case RVm2:
+          return word(i.op, i.cx, 0, 0, 0, vfields(need(opnd(a[0]),Opnd::VMREG,what),
+                      need(opnd(a[1]),Opnd::VMREG,what), 0));
+      case RVlvm:   // lvm %vmx, sy(word index 0..3), sz
+          return word(i.op, i.cx, 0, yField(opnd(a[1]),what), zField(opnd(a[2]),what),
+                  vfields(need(opnd(a[0]),Opnd::VMREG,what), 0, 0));
+      case RVsvm:   // svm %sx, %vmz, sy(word index 0..3)
+          return word(i.op, i.cx, need(opnd(a[0]),Opnd::SREG,what), yField(opnd(a[2]),what), 0,
+                  vfields(0, 0, need(opnd(a[1]),Opnd::VMREG,what)));
+      case RVpcvm:
+          return word(i.op, i.cx, need(opnd(a[0]),Opnd::SREG,what), 0, 0,
+                  vfields(0, need(opnd(a[1]),Opnd::VMREG,what), 0));
+      case BRCF: {  // IC-relative; \c VeAsm::operator() resolves label operands
+          Opnd const od = opnd(a.back());
+          int64_t const disp = (int64_t)need(od, Opnd::INT, what+" displacement");
+          if(disp < INT32_MIN || disp > INT32_MAX) THROW(what<<" branch too far");
+          if(a.size()==1) return word(i.op, i.cx, i.cf, 0, 0, (uint32_t)disp);
+          return word(i.op, i.cx, i.cf, yField(opnd(a[0]),what),
+                  0x80 | need(opnd(a[1]),Opnd::SREG,what), (uint32_t)disp);
+      }
+    }
+    THROW("VeAsm: unhandled format for "<<op);
+}
+
+string VeAsm::expand(string line) const {
+    if(macros.empty()) return line;
+    auto const isword = [](char const c){ return isalnum((unsigned char)c) || c=='_'; };
+    for(int pass=0; pass<16; ++pass){   // allow macros of macros
+        bool changed = false;
+        string out;
+        for(size_t p=0; p<line.size(); ){
+            if(!isword(line[p]) || (p>0 && (isword(line[p-1]) || line[p-1]=='%'))){
+                out.push_back(line[p++]);
+                continue;
+            }
+            size_t e = p;
+            while(e<line.size() && isword(line[e])) ++e;
+            auto const mac = macros.find(line.substr(p, e-p));
+            if(mac != macros.end()){ out.append(mac->second); changed = true; }
+            else out.append(line, p, e-p);
+            p = e;
+        }
+        line = out;
+        if(!changed) return line;
+    }
+    THROW("VeAsm: recursive macro expansion in "<<line);
+}
+
+/** remove C and C++ comments (cpp does this before nas sees anything) */
+static string uncomment_c(string const& s){
+    string out;
+    for(size_t p=0; p<s.size(); ++p){
+        if(s.compare(p,2,"/*")==0){
+            auto e = s.find("*/", p+2);
+            if(e==string::npos) THROW("VeAsm: unterminated /* comment");
+            out.push_back(' ');
+            p = e+1;
+        }else if(s.compare(p,2,"//")==0){
+            while(p<s.size() && s[p]!='\n') ++p;
+            if(p<s.size()) out.push_back('\n');
+        }else{
+            out.push_back(s[p]);
+        }
+    }
+    return out;
+}
+
+VeAsm& VeAsm::operator()(string const& asmcode){
+    istringstream iss(uncomment_c(asmcode));
+    string line;
+    while(getline(iss, line)){
+        string const t = trim(line);
+        if(t.compare(0,7,"#define")==0 || t.compare(0,6,"#undef")==0){
+            istringstream ls(t);
+            string directive, sym, subst;
+            ls >> directive >> sym;
+            getline(ls, subst);
+            if(sym.find('(') != string::npos)
+                THROW("VeAsm: function-like macro "<<sym<<" needs cpp, use asm2bin");
+            if(directive=="#define") macros[sym] = trim(subst);
+            else macros.erase(sym);
+            continue;
+        }
+        // '#' starts an asm comment; ';' separates statements
+        string stmts = expand(t.substr(0, t.find('#')));
+        istringstream ss(stmts);
+        string stmt;
+        while(getline(ss, stmt, ';')){
+            stmt = trim(stmt);
+            auto const colon = stmt.find(':');
+            if(colon != string::npos && stmt.find_first_of(" \t,(") > colon){
+                string const lab = stmt.substr(0,colon);
+                if(labs.count(lab)) THROW("VeAsm: duplicate label "<<lab);
+                labs[lab] = bytes();
+                for(auto f=fixups.begin(); f!=fixups.end(); ){   // backpatch
+                    if(f->second != lab){ ++f; continue; }
+                    int64_t const disp = int64_t(bytes()) - int64_t(f->first*8);
+                    code[f->first] = (code[f->first] & ~uint64_t{0xffffffff}) | (uint32_t)disp;
+                    f = fixups.erase(f);
+                }
+                stmt = trim(stmt.substr(colon+1));
+            }
+            if(stmt.empty()) continue;
+            auto const sp = stmt.find_first_of(" \t");
+            string const op = stmt.substr(0, sp);
+            string const args = (sp==string::npos? string(): stmt.substr(sp+1));
+            if(op==".text" || op==".globl" || op==".type" || op==".size" || op==".section")
+                continue;
+            if(op.compare(0,2,"br")==0 && opTable().count(op)){ // label operand?
+                auto const comma = args.rfind(',');
+                string const target = trim(comma==string::npos? args: args.substr(comma+1));
+                if(!target.empty() && (isalpha((unsigned char)target[0]) || target[0]=='_')){
+                    string const pre = (comma==string::npos? string(): args.substr(0,comma+1));
+                    auto const l = labs.find(target);
+                    int64_t const disp = (l==labs.end()? 0: int64_t(l->second) - int64_t(bytes()));
+                    if(l==labs.end()) fixups.emplace_back(code.size(), target);
+                    code.push_back(encode(op, pre+jitdec(disp)));
+                    continue;
+                }
+            }
+            code.push_back(encode(op, args));
+            if(verbose>1) cout<<" VeAsm "<<setw(4)<<bytes()-8<<": "
+                <<hex<<setfill('0')<<setw(16)<<code.back()<<dec<<setfill(' ')
+                <<"  "<<op<<" "<<args<<endl;
+        }
+    }
+    return *this;
+}
+
+string VeAsm::mnemonic(uint64_t const w){
+    static map<uint32_t,string> const rev = []{
+        map<uint32_t,string> r;
+        for(auto const& t: opTable()){
+            uint32_t const key = t.second.op<<8 | t.second.cx<<4 | t.second.cf;
+            if(!r.count(key)) r[key] = t.first;
+        }
+        return r; }();
+    uint8_t const op = w>>56;
+    bool const cx = (w>>55)&1;
+    uint8_t const cf = (op==0x18? (w>>48)&0xf: op==0xb4? (w>>40)&0xf: 0);
+    auto const found = rev.find(op<<8 | cx<<4 | cf);
+    return found==rev.end()? string(): found->second;
+}
+
+char* VeAsm::jitpage(JitPage* page, JitPagePool* pool) const {
+    if(page==nullptr || code.empty()) return nullptr;
+    if(!fixups.empty()) THROW("VeAsm: undefined label "<<fixups.front().second);
+    if(pool){
+        char* mem = jitpool_alloc(pool, code.data(), bytes(), sizeof(uint64_t), page);
+        if(mem) jitpool_exec(pool);
+        return mem;
+    }
+    size_t const page_size = sysconf(_SC_PAGE_SIZE);
+    size_t const len = (bytes() + page_size-1) / page_size * page_size;
+    void* mem = mmap(nullptr, len, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if(mem == MAP_FAILED){
+        if(verbose>=0) cout<<" VeAsm::jitpage mmap of "<<len<<" bytes FAILED"<<endl;
+        return nullptr;
+    }
+    memcpy(mem, code.data(), bytes());
+    *page = JitPage{mem, len, verbose, nullptr};
+    jitpage_readexec(page);
+    return (char*)mem;
+}
+
+std::vector<uint64_t> ve_assemble(std::string const& asmcode){
+    return VeAsm()(asmcode).words();
+}
+
+#ifdef VEASM_MAIN
+#include "asmfmt.hpp"
+#include <random>
+/** reference encodings, as nobjdump prints them (memory byte order). */
+static struct { char const* ins; char const* bytes; } const refs[] = {
+    {"lea %s0, 77",                 "4d 00 00 00 00 00 00 06"},
+    {"lea %s63, 324(,%s11)",        "44 01 00 00 8b 00 3f 06"},
+    {"lea %s11, -1(%s10,%s11)",     "ff ff ff ff 8b 8a 0b 06"},
+    {"lea %s3, 0xffffffff",         "ff ff ff ff 00 00 03 06"},
+    {"lea.sl %s3, 0x12345678(,%s3)","78 56 34 12 83 00 83 06"},
+    {"or %s3, 5, (0)1",             "00 00 00 00 00 05 03 45"},
+    {"or %s3, -1, (0)1",            "00 00 00 00 00 7f 03 45"},
+    {"or %s3, 0, (8)0",             "00 00 00 00 48 00 03 45"},
+    {"xor %s3, 0x3f, (58)1",        "00 00 00 00 3a 3f 03 46"},
+    {"and %s0, %s0, (32)0",         "00 00 00 00 60 80 00 44"},
+    {"sll %s3, (63)0, 12",          "00 00 00 00 7f 0c 03 65"},
+    {"addu.l %s3, 1, (1)1",         "00 00 00 00 01 01 03 48"},
+    {"addu.w %s1, %s2, %s3",        "00 00 00 00 83 82 81 48"},
+    {"subu.l %s3, -2, (0)0",        "00 00 00 00 40 7e 03 58"},
+    {"sra.l %s1, %s2, 63",          "00 00 00 00 82 3f 01 77"},
+    {"lvl %s5",                     "00 00 00 00 00 85 00 bf"},
+    {"lvl 32",                      "00 00 00 00 00 20 00 bf"},
+    {"b.l (,%lr)",                  "00 00 00 00 8a 00 0f 19"},
+    {"nop",                         "00 00 00 00 00 00 00 79"},
+    {"ld %s1, 8(,%sp)",             "08 00 00 00 8b 00 01 01"},
+    {"st %s1, -8(,%fp)",            "f8 ff ff ff 89 00 01 11"},
+    {"vaddu.l %v1, %v2, %v3",       "00 03 02 01 00 00 00 c8"},
+    {"vaddu.l %v1, %s2, %v3",       "00 03 00 01 00 82 20 c8"},
+    {"vor %v0, 1, %v4, %vm2",       "00 04 00 00 00 01 22 c5"},
+    {"vld %v5, 8, %s1",             "00 00 00 05 81 08 00 81"},
+    {"vst %v5, 8, %s1",             "00 00 00 05 81 08 00 91"},
+    {"vbrd %v7, %s3",               "00 00 00 07 00 83 00 8c"},
+    {"vseq %v2",                    "00 00 00 02 00 00 00 99"},
+    {"vsll %v1, %v2, 3",            "00 02 00 01 00 03 20 e5"},
+    {"lsv %v1(%s2), %s3",           "00 00 00 01 83 82 00 8e"},
+    {"lvs %s4, %v1(%s2)",           "00 00 00 01 00 82 04 9e"},
+    {"andm %vm1, %vm2, %vm3",       "00 03 02 01 00 00 00 84"},
+    {"lvm %vm1, 3, %s2",            "00 00 00 01 82 03 00 b7"},
+    {"svm %s4, %vm1, 0",            "00 01 00 00 00 00 04 a7"},
+    {"pcvm %s4, %vm1",              "00 00 01 00 00 00 04 a4"},
+    {"vcmpu.l %v1, %v2, %v3",       "00 03 02 01 00 00 00 b9"},
+    {"vcmpu.l %v1, %s2, %v3",       "00 03 00 01 00 82 20 b9"},
+    {"vfmk.l.lt %vm1, %v2",         "00 02 00 01 00 02 00 b4"},
+    {"vfmk.l.ge %vm1, %v2, %vm3",   "00 02 00 01 00 05 03 b4"},
+    {"vmrg %v1, %v2, %v3, %vm4",    "00 03 02 01 00 00 04 d6"},
+    {"brgt.l %s1, %s2, 16",         "10 00 00 00 82 81 01 18"},
+    {"br.l -8",                     "f8 ff ff ff 00 00 0f 18"},
+};
+static string bytestr(uint64_t const w){
+    ostringstream oss;
+    unsigned char b[8];
+    memcpy(b, &w, 8);
+    for(int i=0; i<8; ++i) oss<<(i?" ":"")<<hex<<setfill('0')<<setw(2)<<(unsigned)b[i];
+    return oss.str();
+}
+/** decode just the scalar load ops that \c ve_load64 emits, to check that
+ * VeAsm words reproduce the constant. */
+static uint64_t eval_loads(vector<uint64_t> const& code, unsigned const reg){
+    uint64_t s[64] = {0};
+    for(uint64_t const w: code){
+        unsigned const op = w>>56, cx = (w>>55)&1, sx = (w>>48)&0x7f;
+        unsigned const y = (w>>40)&0xff, z = (w>>32)&0xff;
+        uint64_t const sy = (y&0x80? s[y&0x7f]: (uint64_t)((int64_t)((uint64_t)y<<57)>>57));
+        uint64_t const mz = ((z&0x40)? ~uint64_t{0} >> (z&0x3f)
+                : (z&0x3f)? ~uint64_t{0} << (64-(z&0x3f)): 0);
+        uint64_t const sz = (z&0x80? s[z&0x7f]: mz);
+        int64_t const d = (int32_t)(uint32_t)w;
+        switch(op){
+          case 0x06: s[sx] = (cx? (uint64_t)d<<32: (uint64_t)d) + sy + (z&0x80? sz: 0); break;
+          case 0x44: s[sx] = sy & sz; break;
+          case 0x45: s[sx] = sy | sz; break;
+          case 0x46: s[sx] = sy ^ sz; break;
+          case 0x48: s[sx] = sy + sz; break;
+          case 0x58: s[sx] = sy - sz; break;
+          case 0x65: s[sx] = sz << (sy&63); break;
+          default: THROW("eval_loads: op "<<hex<<op);
+        }
+    }
+    return s[reg];
+}
+int main(int argc, char** argv){
+    int const v = (argc>1? atoi(argv[1]): 0);
+    int nerr = 0;
+    for(auto const& r: refs){
+        string const got = bytestr(ve_assemble(r.ins).at(0));
+        if(v>0 || got != r.bytes)
+            cout<<setw(32)<<left<<r.ins<<right<<" "<<got<<(got==r.bytes? "": "  EXPECTED ")
+                <<(got==r.bytes? "": r.bytes)<<endl;
+        nerr += (got != r.bytes);
+    }
+    // AsmFmtVe + ve_load64 output, with #defines, comments and labels
+    {
+        AsmFmtVe a;
+        AsmScope block = {{"OUT","%s3"}};
+        a.scope(block,"veasm demo");
+        a.lab("entry");
+        a.ins(ve_load64("OUT", 0x123456789abcdef0ULL), "OUT = big constant");
+        a.set_vector_length("%s4");
+        a.set_vector_length(77);
+        a.ins("b.l (,%s10)","return");
+        a.pop_scopes();
+        string const code = a.flush();
+        VeAsm va(v);
+        va(code);
+        if(v>0) cout<<code<<endl;
+        if(va.words().size() != 5 || va.labels().at("entry") != 0){
+            cout<<" AsmFmtVe demo: "<<va.words().size()<<" words"<<endl;
+            ++nerr;
+        }
+        JitPage page;
+        if(va.jitpage(&page) == nullptr || memcmp(page.mem, va.words().data(), va.bytes())){
+            cout<<" VeAsm::jitpage failed"<<endl; ++nerr;
+        }
+        jitpage_free(&page);
+    }
+    // labels: backward and forward (back-patched) branches
+    {
+        VeAsm va;
+        va("top: nop\n brlt.l %s0, %s1, top; br.l done\n nop\ndone:\n b.l (,%s10)");
+        vector<uint64_t> const& w = va.words();
+        if(w.size() != 5 || (int32_t)w[1] != -8 || (int32_t)w[2] != 16
+                || VeAsm::mnemonic(w[1]) != "brlt.l" || VeAsm::mnemonic(w[2]) != "br.l"){
+            cout<<" label fixups failed"<<endl; ++nerr;
+        }
+    }
+    // every OpLoadregStrings choice must load its constant
+    {
+        mt19937_64 rng(1234);
+        vector<uint64_t> vals = {0, 1, ~0ULL, 63, 64, 0x7fffffffULL, 0x80000000ULL,
+            0xffffffff80000000ULL, 0x123400000000ULL, 1ULL<<63, ~0ULL<<13, 0x3f3f};
+        for(int i=0; i<2000; ++i) vals.push_back(rng() >> (rng()%64));
+        int nbad = 0;
+        for(uint64_t const c: vals){
+            OpLoadregStrings const ops = opLoadregStrings(c);
+            for(string const* s: {&ops.lea, &ops.log, &ops.shl, &ops.ari, &ops.lea2}){
+                if(s->empty()) continue;
+                uint64_t const got = eval_loads(ve_assemble(multiReplace("OUT","%s3",*s)), 3);
+                if(got != c){
+                    if(++nbad < 10) cout<<" load "<<jithex(c)<<" via "<<*s<<" --> "<<jithex(got)<<endl;
+                }
+            }
+        }
+        nerr += nbad;
+    }
+    // unsupported input throws (callers fall back to asm2bin)
+    for(char const* bad: {"frobnicate %s1", "lea %s1, foo", "or %s1, 99, (0)1",
+            "#define L(X) X##_\n nop", "x: nop\nx: nop"}){
+        bool threw = false;
+        try{ ve_assemble(bad); }catch(std::exception const&){ threw = true; }
+        if(!threw){ cout<<" did not throw: "<<bad<<endl; ++nerr; }
+    }
+    cout<<"\nVeAsm tests "<<(nerr? "FAILED": "OK")<<" ("<<nerr<<" errors)"<<endl;
+    return nerr? 1: 0;
+}
+#endif // VEASM_MAIN
+// vim: ts=4 sw=4 et cindent cino=^=l0,\:.5s,=-.5s,N-s,g.5s,b1 cinkeys=0{,0},0),\:,0#,!^F,o,O,e,0=break
@@ -0,0 +1,88 @@
+#ifndef VEASM_HPP
+#define VEASM_HPP
+/* Copyright (c) 2019 by NEC Corporation
+ * This file is part of ve-jit */
+/** \file
+ * In-process VE assembler for the instruction subset emitted by
+ * \ref asmfmt_fwd.hpp helpers (\c AsmFmtVe, \c ve_load64, \c OpLoadregStrings).
+ *
+ * \c asm2bin (and \c JITpipe) go through cpp, nas and nobjcopy via \c bin.mk,
+ * several processes per asm JIT.  For the simple kernels that \c AsmFmtCols
+ * produces we can instead encode VE machine words directly and copy them
+ * into a \c JitPage.
+ *
+ * Anything outside the subset \b throws, so a caller can fall back to
+ * \c asm2bin.
+ */
+#include "jitpage.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <map>
+
+/** Assemble \c AsmFmtCols output into VE instruction words.
+ *
+ * - Input handling:
+ *   - object-like <tt>\#define SYM subst</tt> and <tt>\#undef SYM</tt>
+ *     (whole-word substitution, like cpp; function-like macros throw),
+ *   - <tt>// ...</tt>, <tt>/</tt><tt>* ... *</tt><tt>/</tt> and <tt>\# ...</tt> comments,
+ *   - ';' or newline separated statements,
+ *   - <tt>label:</tt> definitions (byte offsets, see \c labels()),
+ *   - <tt>.text .globl .type .size .section</tt> are ignored.
+ * - Instructions (VE ISA formats RM, RR, RV):
+ *   - \c lea, \c lea.sl, \c ld*, \c st*, \c b.l D(,%sz)
+ *   - \c or \c xor \c and \c eqv \c nnd, \c addu \c adds \c subu \c subs
+ *     \c mulu \c muls \c cmpu \c cmps (.l/.w variants)
+ *   - \c sll \c srl \c sla \c sra, \c lvl, \c nop
+ *   - IC-relative branches \c br.l \c label, \c br<cc>.{l|w} \c sy,sz,label
+ *     with cc in gt lt ne eq ge le (Sy cc Sz), labels may be forward refs
+ *   - vector \c vld* \c vst* \c vbrd \c vseq \c vmv \c lsv \c lvs,
+ *     \c vaddu \c vadds \c vsubu \c vsubs \c vmulu \c vmuls
+ *     \c vand \c vor \c vxor \c veqv \c vsll \c vsrl \c vsla \c vsra
+ *     \c vcmpu, \c vfmk.l.<cc> \c %vmx,%vz (cc as above, vz cc 0)
+ *     (optional trailing \c %vmN mask), \c vmrg \c vx,vy,vz,%vmN
+ *   - mask \c andm \c orm \c xorm \c eqvm \c nndm \c negm \c pcvm \c lvm \c svm
+ * - Operands: \c %sN (and %sl %fp %lr %sp %tp %got %plt), \c %vN, \c %vmN,
+ *   integers (I field: -64..63), \c (m)0 / \c (m)1 (M field), \c D(%sy,%sz).
+ */
+class VeAsm {
+  public:
+    VeAsm(int const verbose=0) : verbose(verbose), code(), macros(), labs(), fixups() {}
+    /** append assembled \c asmcode (any \#defines persist across calls).
+     * \throw std::runtime_error on unsupported input. */
+    VeAsm& operator()(std::string const& asmcode);
+    /** encode one instruction, \c op with comma-separated \c args
+     * (no macros or comments). \throw on unsupported input. */
+    static uint64_t encode(std::string const& op, std::string const& args);
+    /** instruction name of an encoded word (empty if not in our subset) */
+    static std::string mnemonic(uint64_t const word);
+
+    std::vector<uint64_t> const& words() const {return code;}
+    std::size_t bytes() const {return code.size() * sizeof(uint64_t);}
+    /** label --> byte offset into \c words().
+     * \note branches to labels not yet defined are back-patched when the
+     * label appears; \c jitpage() throws if any remain undefined. */
+    std::map<std::string,std::size_t> const& labels() const {return labs;}
+
+    /** copy \c words() into an executable (PROT_READ|PROT_EXEC) code page.
+     * With \c pool, this is a \c jitpool_alloc sub-allocation (the pool
+     * gets a \c jitpool_exec, sealing that chunk, so the next call starts a
+     * new one: batch many kernels with \c jitpool_alloc and one
+     * \c jitpool_exec instead); o/w a fresh mmap.  Either way
+     * \c jitpage_free releases it.  \return code address (or NULL). */
+    char* jitpage(JitPage* page, JitPagePool* pool=nullptr) const;
+
+    int verbose;
+  private:
+    std::string expand(std::string line) const;     ///< apply \c macros
+    std::vector<uint64_t> code;
+    std::map<std::string,std::string> macros;
+    std::map<std::string,std::size_t> labs;
+    std::vector<std::pair<std::size_t,std::string>> fixups; ///< {word index, label}
+};
+
+/** one-shot \c VeAsm()(asmcode).words() */
+std::vector<uint64_t> ve_assemble(std::string const& asmcode);
+
+// vim: ts=4 sw=4 et cindent cino=^=l0,\:.5s,=-.5s,N-s,g.5s,b1 cinkeys=0{,0},0),\:,0#,!^F,o,O,e,0=break
+#endif // VEASM_HPP
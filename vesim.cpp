@@ -0,0 +1,468 @@
+/* Copyright (c) 2019 by NEC Corporation
+ * This file is part of ve-jit */
+/** \file
+ * VE interpreter, see \ref vesim.hpp.
+ * Field layout is that of \ref veasm.cpp (RM, RR, RV formats).
+ */
+#include "vesim.hpp"
+#include "throw.hpp"
+#include "stringutil.hpp"
+#include <cstring>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+
+using namespace std;
+
+char const* name(VeUnit const u){
+    static char const* const names[VE_NUNITS] = {"s.alu","s.mul","s.ldst","branch",
+        "v.alu","v.mul","v.ldst","v.mask"};
+    return (unsigned)u < VE_NUNITS? names[u]: "?";
+}
+
+uint64_t constexpr VeSim::RETURN;
+
+VeSim::VeSim(int const verbose) : vl(0), ic(0), stats(), cost(), verbose(verbose) {
+    memset(s, 0, sizeof(s));
+    memset(v, 0, sizeof(v));
+    memset(vm, 0, sizeof(vm));
+    memset(vm[0], 0xff, sizeof(vm[0]));
+}
+uint64_t& VeSim::sreg(RegId const r){
+    if(!isScalar(r)) THROW("VeSim::sreg("<<r<<") not a scalar register");
+    return s[r - IDscalar];
+}
+uint64_t* VeSim::vreg(RegId const r){
+    if(!isVector(r)) THROW("VeSim::vreg("<<r<<") not a vector register");
+    return v[r - IDvector];
+}
+uint64_t* VeSim::vmreg(RegId const r){
+    if(!isMask(r)) THROW("VeSim::vmreg("<<r<<") not a mask register");
+    return vm[r - IDvmask];
+}
+/** VE mask bits are MSB-first within each 64-bit word */
+bool VeSim::mbit(unsigned const m, unsigned const i) const {
+    return (vm[m][i/64] >> (63 - i%64)) & 1;
+}
+
+void VeSim::vcount(VeUnit const u, uint64_t const n){
+    uint64_t const c = cost.unit[u] + (n + cost.lanes-1) / cost.lanes;
+    ++stats.unit[u];
+    stats.ucycles[u] += c;
+    stats.cycles += c;
+    stats.velems += n;
+}
+
+namespace {
+inline int64_t sext7(unsigned const f){ return (int64_t)((uint64_t)f << 57) >> 57; }
+/** RR M-field value (cz=0) */
+inline uint64_t mval(unsigned const f){
+    unsigned const m = f & 0x3f;
+    return (f & 0x40)? ~uint64_t{0} >> m                   // (m)0
+        :  m? ~uint64_t{0} << (64-m): 0;                    // (m)1
+}
+inline uint64_t sx32(uint64_t const x){ return (uint64_t)(int64_t)(int32_t)x; }
+inline uint64_t zx32(uint64_t const x){ return (uint32_t)x; }
+inline int64_t cmp3(bool const gt, bool const lt){ return gt? 1: lt? -1: 0; }
+/** 64-bit integer ops shared by scalar RR and vector RV formats.
+ * \return false if \c op is not one of them. */
+bool intop(unsigned const op, bool const cx, uint64_t const y, uint64_t const z, uint64_t& x){
+    switch(op){
+      case 0x44: x = y & z; break;                                          // and
+      case 0x45: x = y | z; break;                                          // or
+      case 0x46: x = y ^ z; break;                                          // xor
+      case 0x47: x = ~(y ^ z); break;                                       // eqv
+      case 0x54: x = ~y & z; break;                                         // nnd
+      case 0x48: x = cx? zx32(y + z): y + z; break;                         // addu
+      case 0x4a: x = cx? zx32(y + z): sx32(y + z); break;                   // adds.w
+      case 0x59: x = y + z; break;                                          // adds.l
+      case 0x58: x = cx? zx32(y - z): y - z; break;                         // subu
+      case 0x5a: x = cx? zx32(y - z): sx32(y - z); break;                   // subs.w
+      case 0x5b: x = y - z; break;                                          // subs.l
+      case 0x49: x = cx? zx32((uint32_t)y * (uint32_t)z): y * z; break;     // mulu
+      // muls: low product bits are the unsigned ones (no signed overflow UB)
+      case 0x4b: x = cx? zx32((uint32_t)y * (uint32_t)z): sx32((uint32_t)y * (uint32_t)z); break;
+      case 0x6e: x = y * z; break;                                          // muls.l
+      case 0x55: x = cx? cmp3((uint32_t)y > (uint32_t)z, (uint32_t)y < (uint32_t)z)
+                 : cmp3(y > z, y < z); break;                               // cmpu
+      case 0x7a: x = cmp3((int32_t)y > (int32_t)z, (int32_t)y < (int32_t)z); break;
+      case 0x6a: x = cmp3((int64_t)y > (int64_t)z, (int64_t)y < (int64_t)z); break;
+      default: return false;
+    }
+    return true;
+}
+/** shifts: value \c z, count \c y */
+bool shiftop(unsigned const op, bool const cx, uint64_t const y, uint64_t const z, uint64_t& x){
+    switch(op){
+      case 0x65: x = z << (y & 63); break;                                          // sll
+      case 0x75: x = z >> (y & 63); break;                                          // srl
+      case 0x66: x = cx? zx32((uint32_t)z << (y & 31)): sx32((uint32_t)z << (y & 31)); break;
+      case 0x57: x = z << (y & 63); break;                                          // sla.l, as sll
+      case 0x76: x = cx? zx32((int32_t)z >> (y & 31)): sx32((int32_t)z >> (y & 31)); break;
+      case 0x77: x = (uint64_t)((int64_t)z >> (y & 63)); break;                     // sra.l
+      default: return false;
+    }
+    return true;
+}
+bool brcond(unsigned const cf, int64_t const y, int64_t const z){
+    switch(cf){
+      case 0: return false;     case 1: return y >  z;  case 2: return y <  z;
+      case 3: return y != z;    case 4: return y == z;  case 5: return y >= z;
+      case 6: return y <= z;    case 15: return true;
+    }
+    THROW("VeSim: unsupported branch condition "<<cf);
+}
+/** VE vector opcode --> shared scalar opcode for \c intop/shiftop */
+unsigned scalarOf(unsigned const vop){
+    switch(vop){
+      case 0xc8: return 0x48; case 0xca: return 0x4a; case 0x8b: return 0x59;
+      case 0xd8: return 0x58; case 0xda: return 0x5a; case 0x9b: return 0x5b;
+      case 0xc9: return 0x49; case 0xcb: return 0x4b; case 0xdb: return 0x6e;
+      case 0xc4: return 0x44; case 0xc5: return 0x45; case 0xc6: return 0x46;
+      case 0xc7: return 0x47; case 0xb9: return 0x55;
+      case 0xe5: return 0x65; case 0xf5: return 0x75;
+      case 0xd4: return 0x57; case 0xd5: return 0x77;
+    }
+    return 0;
+}
+}//anon::
+
+void VeSim::step(uint64_t const w){
+    unsigned const op = w >> 56;
+    bool const cx = (w >> 55) & 1;
+    unsigned const x = (w >> 48) & 0x7f;
+    unsigned const yf = (w >> 40) & 0xff, zf = (w >> 32) & 0xff;
+    uint32_t const lo = (uint32_t)w;
+    int64_t const d = (int32_t)lo;
+    uint64_t const y = (yf & 0x80)? s[yf & 0x7f]: (uint64_t)sext7(yf);
+    uint64_t const zrr = (zf & 0x80)? s[zf & 0x7f]: mval(zf);   // RR formats
+    uint64_t const zrm = (zf & 0x80)? s[zf & 0x7f]: 0;          // RM formats
+    unsigned const m = x & 0xf;                                 // RV mask reg
+    bool const cs = (x >> 5) & 1;                               // RV: sy replaces vy
+    unsigned const vx = (lo >> 24) & 0xff, vy = (lo >> 16) & 0xff, vz = (lo >> 8) & 0xff;
+    uint64_t const next = ic + 8;
+    ++stats.insns;
+    ++stats.op[op][cx];
+    if(verbose>1) cout<<" VeSim "<<hex<<setw(12)<<ic<<": "<<setfill('0')<<setw(16)<<w
+        <<setfill(' ')<<dec<<" "<<VeAsm::mnemonic(w)<<endl;
+    auto const scalar = [this](VeUnit const u){
+        ++stats.unit[u]; stats.ucycles[u] += cost.unit[u]; stats.cycles += cost.unit[u];
+    };
+    if(op>=0x80 && vx>=NREG_v && op!=0x84 && op!=0x85 && op!=0x86 && op!=0x87
+            && op!=0x94 && op!=0x95 && op!=0xb7)
+        THROW("VeSim: bad vector register "<<vx);
+    uint64_t res = 0;
+    // scalar RR
+    if(intop(op, cx, y, zrr, res) || shiftop(op, cx, y, zrr, res)){
+        s[x] = res;
+        scalar((op==0x49 || op==0x4b || op==0x6e)? VE_SMUL: VE_SALU);
+        ic = next;
+        return;
+    }
+    unsigned const vop = scalarOf(op);
+    if(vop){                                                    // vector RV
+        uint64_t* const dst = v[vx];
+        uint64_t const* const vsrcy = v[vy & 0x3f];
+        uint64_t const* const vsrcz = v[vz & 0x3f];
+        bool const sh = (vop==0x65 || vop==0x75 || vop==0x57 || vop==0x77);
+        for(unsigned i=0; i<vl; ++i){
+            if(!mbit(m,i)) continue;
+            uint64_t const a = (cs? y: vsrcy[i]);
+            if(sh) shiftop(vop, cx, a, vsrcz[i], dst[i]);
+            else   intop  (vop, cx, a, vsrcz[i], dst[i]);
+        }
+        vcount((vop==0x49 || vop==0x4b || vop==0x6e)? VE_VMUL: VE_VALU, vl);
+        ic = next;
+        return;
+    }
+    switch(op){
+      case 0x06:                                                // lea, lea.sl
+          s[x] = (cx? (uint64_t)d << 32: (uint64_t)d) + ((yf & 0x80)? y: (uint64_t)sext7(yf)) + zrm;
+          scalar(VE_SALU);
+          break;
+      case 0x01: case 0x02: case 0x03: case 0x04: case 0x05:    // loads
+      case 0x11: case 0x12: case 0x13: case 0x14: case 0x15: {  // stores
+          char* const p = (char*)(uintptr_t)((uint64_t)d + y + zrm);
+          uint64_t u64; uint32_t u32; uint16_t u16; uint8_t u8;
+          switch(op){
+            case 0x01: memcpy(&u64,p,8); s[x] = u64; break;
+            case 0x02: memcpy(&u32,p,4); s[x] = (uint64_t)u32 << 32; break;
+            case 0x03: memcpy(&u32,p,4); s[x] = cx? zx32(u32): sx32(u32); break;
+            case 0x04: memcpy(&u16,p,2); s[x] = cx? (uint64_t)u16: (uint64_t)(int64_t)(int16_t)u16; break;
+            case 0x05: memcpy(&u8, p,1); s[x] = cx? (uint64_t)u8:  (uint64_t)(int64_t)(int8_t)u8; break;
+            case 0x11: memcpy(p,&s[x],8); break;
+            case 0x12: u32 = s[x] >> 32; memcpy(p,&u32,4); break;
+            case 0x13: u32 = (uint32_t)s[x]; memcpy(p,&u32,4); break;
+            case 0x14: u16 = (uint16_t)s[x]; memcpy(p,&u16,2); break;
+            case 0x15: u8  = (uint8_t)s[x];  memcpy(p,&u8, 1); break;
+          }
+          scalar(VE_SLS);
+          break;
+      }
+      case 0x19:                                                // b.l D(,sz)
+          if(x != 0x0f) THROW("VeSim: only unconditional b.l supported");
+          scalar(VE_BR);
+          ++stats.taken; stats.cycles += cost.taken;
+          ic = (uint64_t)d + zrm;
+          return;
+      case 0x18: {                                              // br<cc>.{l,w} relative
+          int64_t const a = cx? (int32_t)y: (int64_t)y;
+          int64_t const b = cx? (int32_t)zrm: (int64_t)zrm;
+          scalar(VE_BR);
+          if(brcond(x & 0xf, a, b)){
+              ++stats.taken; stats.cycles += cost.taken;
+              ic += d;
+              return;
+          }
+          break;
+      }
+      case 0xbf:                                                // lvl
+          vl = (yf & 0x80)? y: (yf & 0x7f);                    // immediate is 0..127
+          if(vl > MVL) THROW("VeSim: lvl "<<vl<<" > MVL");
+          scalar(VE_SALU);
+          break;
+      case 0x79:                                                // nop
+          scalar(VE_SALU);
+          break;
+      case 0x81: case 0x82: case 0x83:                          // vld vldu vldl
+      case 0x91: case 0x92: case 0x93: {                        // vst vstu vstl
+          uint64_t const base = zrr;
+          for(unsigned i=0; i<vl; ++i){
+              if(!mbit(m,i)) continue;
+              char* const p = (char*)(uintptr_t)(base + i*y);
+              uint64_t& e = v[vx][i];
+              uint32_t u32;
+              switch(op){
+                case 0x81: memcpy(&e,p,8); break;
+                case 0x82: memcpy(&u32,p,4); e = (uint64_t)u32 << 32; break;
+                case 0x83: memcpy(&u32,p,4); e = cx? zx32(u32): sx32(u32); break;
+                case 0x91: memcpy(p,&e,8); break;
+                case 0x92: u32 = e >> 32; memcpy(p,&u32,4); break;
+                case 0x93: u32 = (uint32_t)e; memcpy(p,&u32,4); break;
+              }
+          }
+          vcount(VE_VLS, vl);
+          break;
+      }
+      case 0x8c:                                                // vbrd
+          for(unsigned i=0; i<vl; ++i) if(mbit(m,i)) v[vx][i] = y;
+          vcount(VE_VALU, vl);
+          break;
+      case 0x99:                                                // vseq
+          for(unsigned i=0; i<vl; ++i) if(mbit(m,i)) v[vx][i] = i;
+          vcount(VE_VALU, vl);
+          break;
+      case 0x9c: {                                              // vmv
+          uint64_t tmp[MVL];
+          memcpy(tmp, v[vz & 0x3f], sizeof(tmp));
+          for(unsigned i=0; i<vl; ++i) if(mbit(m,i)) v[vx][i] = tmp[(i + y) % MVL];
+          vcount(VE_VALU, vl);
+          break;
+      }
+      case 0x8e:                                                // lsv
+          v[vx][y % MVL] = zrr;
+          scalar(VE_VALU);
+          break;
+      case 0x9e:                                                // lvs
+          s[x] = v[vx][y % MVL];
+          scalar(VE_VALU);
+          break;
+      case 0x84: case 0x85: case 0x86: case 0x87: case 0x94: case 0x95: {
+          unsigned const mx = vx & 0xf, my = vy & 0xf, mz = vz & 0xf;
+          for(unsigned k=0; k<MVL/64 && mx!=0; ++k){            // %vm0 stays all-ones
+              uint64_t const a = vm[my][k], b = vm[mz][k];
+              vm[mx][k] = op==0x84? a & b: op==0x85? a | b: op==0x86? a ^ b
+                  : op==0x87? ~(a ^ b): op==0x94? ~a & b: ~a;
+          }
+          vcount(VE_VMASK, 0);
+          break;
+      }
+      case 0xd6:                                                // vmrg: vm? vz: vy
+          for(unsigned i=0; i<vl; ++i)
+              v[vx][i] = mbit(m,i)? v[vz & 0x3f][i]: (cs? y: v[vy & 0x3f][i]);
+          vcount(VE_VALU, vl);
+          break;
+      case 0xb4: {                                              // vfmk.l.<cc> vmx, vz
+          unsigned const mx = vx & 0xf;
+          for(unsigned i=0; i<vl && mx!=0; ++i){                // %vm0 stays all-ones
+              uint64_t const bit = uint64_t{1} << (63 - i%64);
+              if(mbit(m,i) && brcond(yf & 0xf, (int64_t)v[vz & 0x3f][i], 0))
+                  vm[mx][i/64] |= bit;
+              else
+                  vm[mx][i/64] &= ~bit;
+          }
+          vcount(VE_VMASK, vl);
+          break;
+      }
+      case 0xa4: {                                              // pcvm
+          uint64_t n = 0;
+          for(unsigned i=0; i<vl; ++i) n += mbit(vy & 0xf, i);
+          s[x] = n;
+          vcount(VE_VMASK, vl);
+          break;
+      }
+      case 0xb7:                                                // lvm
+          if((vx & 0xf) != 0) vm[vx & 0xf][y & 3] = zrr;
+          vcount(VE_VMASK, 0);
+          break;
+      case 0xa7:                                                // svm
+          s[x] = vm[vz & 0xf][y & 3];
+          vcount(VE_VMASK, 0);
+          break;
+      default:
+          THROW("VeSim: unsupported instruction "<<hex<<w<<dec<<" "<<VeAsm::mnemonic(w));
+    }
+    ic = next;
+}
+
+uint64_t VeSim::run(uint64_t const* code, size_t const nwords, size_t const entry,
+        uint64_t const maxInsns){
+    uint64_t const base = (uintptr_t)code;
+    uint64_t const end = base + 8*nwords;
+    uint64_t const insns0 = stats.insns;
+    s[10] = RETURN;
+    ic = base + entry;
+    for(uint64_t n=0; ic != RETURN && ic != end; ++n){
+        if(n >= maxInsns) THROW("VeSim: no return after "<<maxInsns<<" instructions");
+        if(ic < base || ic > end || (ic-base)%8) THROW("VeSim: ic "<<hex<<ic<<dec<<" outside code");
+        step(code[(ic - base)/8]);
+    }
+    if(verbose>0) print_stats(cout);
+    return stats.insns - insns0;
+}
+uint64_t VeSim::run(VeAsm const& a, std::string const& label){
+    size_t const entry = (label.empty()? 0: a.labels().at(label));
+    return run(a.words().data(), a.words().size(), entry);
+}
+
+void VeSim::print_stats(std::ostream& os) const {
+    os<<" VeSim: "<<stats.insns<<" instructions, ~"<<stats.cycles<<" cycles, "
+        <<stats.velems<<" vector elements, "<<stats.taken<<" taken branches\n";
+    for(int u=0; u<VE_NUNITS; ++u){
+        if(stats.unit[u]) os<<"   "<<left<<setw(8)<<name(VeUnit(u))<<right
+            <<setw(10)<<stats.unit[u]<<" insns "<<setw(10)<<stats.ucycles[u]<<" cycles\n";
+    }
+    vector<pair<uint64_t,uint64_t>> ops;    // {count, word-with-op}
+    for(unsigned op=0; op<256; ++op) for(unsigned cx=0; cx<2; ++cx)
+        if(stats.op[op][cx]) ops.emplace_back(stats.op[op][cx],
+                (uint64_t)op<<56 | (uint64_t)cx<<55 | (op==0x18? uint64_t{1}<<48: 0));
+    sort(ops.rbegin(), ops.rend());
+    for(size_t i=0; i<ops.size() && i<8; ++i){
+        string nm = VeAsm::mnemonic(ops[i].second);
+        if((ops[i].second>>56) == 0x18) nm = "br*";
+        os<<"   "<<left<<setw(10)<<(nm.empty()? jithex(ops[i].second>>56): nm)<<right
+            <<setw(10)<<ops[i].first<<"\n";
+    }
+    os.flush();
+}
+
+#ifdef VESIM_MAIN
+#include "asmfmt.hpp"
+#include <random>
+int main(int argc, char** argv){
+    int const v = (argc>1? atoi(argv[1]): 0);
+    int nerr = 0;
+    // 1. ve_load64 for random constants, now executed
+    {
+        mt19937_64 rng(77);
+        for(int i=0; i<1000; ++i){
+            uint64_t const c = rng() >> (rng()%64);
+            VeSim sim;
+            sim.run(VeAsm()(ve_load64("%s3", c)));
+            if(sim.s[3] != c){ if(++nerr<10) cout<<" ve_load64("<<jithex(c)<<") --> "<<jithex(sim.s[3])<<endl; }
+        }
+    }
+    // 2. vector kernel: out[i] = 3*a[i] + i, with a loop over vl-sized strips
+    {
+        int64_t const n = 1000;
+        vector<uint64_t> a(n), out(n, 0);
+        for(int64_t i=0; i<n; ++i) a[i] = 7*i + 1;
+        AsmFmtVe k;
+        AsmScope block = {{"A","%s0"},{"OUT","%s1"},{"N","%s2"},{"VL","%s3"},
+            {"I","%s4"},{"MVLR","%s5"},{"va","%v0"},{"vi","%v1"}};
+        k.scope(block,"strip-mined 3*a[i]+i");
+        k.ins(ve_load64("MVLR", MVL));
+        k.ins("or I, 0, (0)1", "I = 0");
+        k.lab("loop");
+        k.ins("subu.l VL, N, I");
+        k.ins("brle.l VL, MVLR, short");
+        k.ins("or VL, 0, MVLR");
+        k.lab("short");
+        k.set_vector_length("%s3");          // VL
+        k.ins("vld va, 8, A");
+        k.ins("vmulu.l va, 3, va");
+        k.ins("vseq vi");
+        k.ins("vaddu.l vi, I, vi");
+        k.ins("vaddu.l va, va, vi");
+        k.ins("vst va, 8, OUT");
+        k.ins("addu.l I, I, VL");
+        k.ins("sll %s6, VL, 3");
+        k.ins("addu.l A, A, %s6; addu.l OUT, OUT, %s6");
+        k.ins("brlt.l I, N, loop");
+        k.ins("b.l (,%lr)", "return");
+        k.pop_scopes();
+        string const code = k.flush();
+        if(v>0) cout<<code<<endl;
+        VeAsm va;
+        va(code);
+        VeSim sim(v);
+        sim.s[0] = (uintptr_t)a.data();
+        sim.s[1] = (uintptr_t)out.data();
+        sim.s[2] = n;
+        sim.run(va);
+        for(int64_t i=0; i<n; ++i){
+            if(out[i] != 3*a[i] + i){ if(++nerr<10) cout<<" out["<<i<<"]="<<out[i]<<endl; }
+        }
+        if(sim.stats.unit[VE_VLS] != 2*4 || sim.stats.velems == 0 || sim.stats.taken < 4){
+            cout<<" unexpected counters"<<endl; sim.print_stats(cout); ++nerr;
+        }
+    }
+    // 3. masks: odd elements only
+    {
+        VeAsm va;
+        va("lea %s0, 16; lvl %s0\n vbrd %v0, 0\n"
+                "lea %s1, 0x55550000; lea.sl %s1, 0x55555555(,%s1)\n lvm %vm1, 0, %s1\n"
+                "vbrd %v0, 9, %vm1\n pcvm %s2, %vm1\n svm %s3, %vm1, 0\n"
+                "negm %vm2, %vm1; andm %vm3, %vm1, %vm2; pcvm %s4, %vm3");
+        VeSim sim;
+        sim.run(va);
+        for(int i=0; i<16; ++i) if(sim.v[0][i] != (i%2? 9u: 0u)){ ++nerr; cout<<" mask elt "<<i<<endl; }
+        if(sim.s[2] != 8 || sim.s[3] != 0x5555555555550000ULL || sim.s[4] != 0){
+            ++nerr; cout<<" pcvm/svm "<<sim.s[2]<<" "<<jithex(sim.s[3])<<" "<<sim.s[4]<<endl;
+        }
+    }
+    // 4. signed multiply/shift that overflow: two's complement wraparound
+    {
+        VeSim sim;
+        sim.s[0] = (uint64_t)-3;
+        sim.s[1] = 0x4000000000000001ULL;
+        sim.s[4] = 0x7fffffffU;
+        sim.run(VeAsm()("muls.l %s2, %s0, %s1\n muls.w.sx %s3, %s0, %s4\n"
+                    " muls.w.zx %s6, %s0, %s4\n sla.l %s5, %s1, 2"));
+        uint32_t const w = (uint32_t)sim.s[0] * (uint32_t)sim.s[4];
+        if(sim.s[2] != sim.s[0] * sim.s[1] || sim.s[3] != (uint64_t)(int64_t)(int32_t)w
+                || sim.s[6] != w || sim.s[5] != 0x0000000000000004ULL){
+            ++nerr; cout<<" muls/sla "<<jithex(sim.s[2])<<" "<<jithex(sim.s[3])
+                <<" "<<jithex(sim.s[6])<<" "<<jithex(sim.s[5])<<endl;
+        }
+    }
+    // 5. compare, form mask, merge: x[i] = a[i] < b[i]? a[i]: b[i] (unsigned)
+    {
+        VeSim sim;
+        for(int i=0; i<20; ++i){ sim.v[1][i] = (i*7)%11; sim.v[2][i] = 5; }
+        sim.v[1][3] = ~uint64_t{0};                 // huge unsigned, not -1
+        sim.run(VeAsm()("lea %s0, 20; lvl %s0\n vcmpu.l %v3, %v1, %v2\n"
+                    " vfmk.l.lt %vm1, %v3\n vmrg %v4, %v2, %v1, %vm1\n pcvm %s1, %vm1"));
+        uint64_t nlt = 0;
+        for(int i=0; i<20; ++i){
+            bool const lt = sim.v[1][i] < sim.v[2][i];
+            nlt += lt;
+            if(sim.v[4][i] != (lt? sim.v[1][i]: sim.v[2][i])){ ++nerr; cout<<" vmrg elt "<<i<<endl; }
+        }
+        if(sim.s[1] != nlt){ ++nerr; cout<<" vfmk count "<<sim.s[1]<<" != "<<nlt<<endl; }
+    }
+    cout<<"\nVeSim tests "<<(nerr? "FAILED": "OK")<<" ("<<nerr<<" errors)"<<endl;
+    return nerr? 1: 0;
+}
+#endif // VESIM_MAIN
+// vim: ts=4 sw=4 et cindent cino=^=l0,\:.5s,=-.5s,N-s,g.5s,b1 cinkeys=0{,0},0),\:,0#,!^F,o,O,e,0=break
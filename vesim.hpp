@@ -0,0 +1,89 @@
+#ifndef VESIM_HPP
+#define VESIM_HPP
+/* Copyright (c) 2019 by NEC Corporation
+ * This file is part of ve-jit */
+/** \file
+ * Functional VE interpreter for the instruction subset of \ref veasm.hpp,
+ * so generated asm kernels can be run (and roughly profiled) on x86.
+ *
+ * - Register file follows \c ChipRegistersAurora (\ref regs/reg-aurora.hpp):
+ *   \c NREG_s scalars, \c NREG_v vectors of \c MVL elements, \c NREG_vm masks
+ *   of \c MVL bits, addressed by \c RegId (IDscalar, IDvector, IDvmask).
+ * - Loads and stores use host addresses, so pass real pointers in scalar regs.
+ * - A call returns when it branches to \c VeSim::RETURN (preset in %s10 = %lr)
+ *   or falls off the end of the code.
+ * - Counters: per instruction, per execution unit, vector elements, and a
+ *   cycle \e estimate from the table-driven \c VeSimCost model (not a
+ *   pipeline simulation; use it to compare kernel variants).
+ */
+#include "veasm.hpp"
+#include "regs/reg-aurora.hpp"
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+/** VE execution units, as counted by \c VeSim */
+enum VeUnit { VE_SALU, VE_SMUL, VE_SLS, VE_BR, VE_VALU, VE_VMUL, VE_VLS, VE_VMASK, VE_NUNITS };
+char const* name(VeUnit const u);
+
+/** Rough per-unit cycle costs.  Vector ops cost \c startup plus
+ * \c ceil(vl/lanes) cycles. */
+struct VeSimCost {
+    unsigned unit[VE_NUNITS] = {1, 4, 4, 1, 1, 1, 8, 1};    ///< scalar cost or vector startup
+    unsigned taken = 2;         ///< extra cycles for a taken branch
+    unsigned lanes = 32;        ///< vector elements per cycle
+};
+
+struct VeSimStats {
+    uint64_t insns = 0;                 ///< instructions executed
+    uint64_t cycles = 0;                ///< \c VeSimCost estimate
+    uint64_t velems = 0;                ///< vector elements processed
+    uint64_t taken = 0;                 ///< taken branches
+    uint64_t unit[VE_NUNITS] = {0};     ///< instructions per execution unit
+    uint64_t ucycles[VE_NUNITS] = {0};  ///< estimated cycles per execution unit
+    uint64_t op[256][2] = {{0}};        ///< per [opcode][cx]
+    void clear() { *this = VeSimStats(); }
+};
+
+class VeSim {
+  public:
+    static uint64_t constexpr RETURN = ~uint64_t{7}; ///< return address preset in %lr
+
+    VeSim(int const verbose=0);
+    /** \group register file (modeled after ChipRegistersAurora) */
+    //@{
+    uint64_t  s [NREG_s];               ///< scalar registers %s0..%s63
+    uint64_t  v [NREG_v][MVL];          ///< vector registers %v0..%v63
+    uint64_t  vm[NREG_vm][MVL/64];      ///< vector masks %vm0..%vm15 (%vm0 all ones)
+    uint64_t  vl;                       ///< vector length register
+    uint64_t  ic;                       ///< instruction counter (host address)
+    uint64_t& sreg(RegId const r);      ///< r in [IDscalar,IDscalar_last]
+    uint64_t* vreg(RegId const r);      ///< r in [IDvector,IDvector_last]
+    uint64_t* vmreg(RegId const r);     ///< r in [IDvmask,IDvmask_last]
+    bool mbit(unsigned const m, unsigned const i) const; ///< mask \c m, element \c i
+    //@}
+
+    /** run \c nwords of code starting at byte offset \c entry, until return,
+     * or throw after \c maxInsns.  Registers are not reset between runs,
+     * except that %lr is set to \c RETURN.
+     * \return instructions executed by this call. */
+    uint64_t run(uint64_t const* code, std::size_t const nwords,
+            std::size_t const entry=0, uint64_t const maxInsns=100000000);
+    /** run assembled code, from \c label (or the beginning). */
+    uint64_t run(VeAsm const& a, std::string const& label="");
+    /** execute one instruction word at \c ic (updating \c ic). */
+    void step(uint64_t const w);
+
+    /** per-unit and most-frequent-instruction summary */
+    void print_stats(std::ostream& os) const;
+
+    VeSimStats stats;
+    VeSimCost cost;
+    int verbose;
+  private:
+    void vcount(VeUnit const u, uint64_t const n);
+};
+
+// vim: ts=4 sw=4 et cindent cino=^=l0,\:.5s,=-.5s,N-s,g.5s,b1 cinkeys=0{,0},0),\:,0#,!^F,o,O,e,0=break
+#endif // VESIM_HPP